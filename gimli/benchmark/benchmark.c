@@ -0,0 +1,749 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gimli/gimli_directory.h"
+#include "gimli/image_store.h"
+#include "gimli/layer_store.h"
+#include "gimli/metadata_index.h"
+#include "gimli/metadata_index_builder.h"
+#include "gimli/netns.h"
+#include "gimli/overlay.h"
+#include "gimli/spawn.h"
+#include "stb_ds/stb_ds.h"
+
+// The gimli executable that is launched by default, as configured by the
+// build.
+#ifndef GIMLI_BENCHMARK_DEFAULT_BINARY
+#define GIMLI_BENCHMARK_DEFAULT_BINARY "gimli"
+#endif
+
+// Rebuilding the index reads the whole store, so it is measured fewer times
+// than the other operations.
+#define INDEX_BUILD_ITERATIONS 5
+
+// The size of the heap-allocated stack that processes were cloned onto before
+// gimli spawned them through `clone3`.
+#define CLONE_STACK_SIZE (1024 * 1024)
+
+typedef enum StoreBackend {
+  STORE_BACKEND_EAGER = 0,
+  STORE_BACKEND_LAZY,
+  STORE_BACKEND_INDEXED,
+
+  STORE_BACKEND_COUNT,
+} StoreBackend;
+
+static const char *const STORE_BACKEND_NAMES[STORE_BACKEND_COUNT] = {
+    [STORE_BACKEND_EAGER] = "eager",
+    [STORE_BACKEND_LAZY] = "lazy",
+    [STORE_BACKEND_INDEXED] = "indexed",
+};
+
+typedef struct BenchmarkOptions {
+  const char *root;
+  size_t iterations;
+  size_t launch_iterations;
+  const char *gimli;
+  const char *command;
+} BenchmarkOptions;
+
+typedef struct Stores {
+  MetadataIndex metadata_index;
+  ImageStore image_store;
+  LayerStore layer_store;
+  StoreBackend backend;
+} Stores;
+
+static void print_usage(const char *program) {
+  printf("USAGE: %s --root <directory> [options]\n", program);
+  printf("\n");
+  printf("Measures gimli's store backends and container launch latency "
+         "against a\nstore (such as one made by gimli_store_generator).\n");
+  printf("\n");
+  printf("  --root <directory>        the store root\n");
+  printf("  --iterations <count>      the number of samples per measurement "
+         "(100)\n");
+  printf("  --launch-iterations <count>\n");
+  printf("                            the number of container launches, 0 to "
+         "skip (20)\n");
+  printf("  --gimli <file>            the gimli executable to launch\n");
+  printf("  --command <file>          the command to run in the containers "
+         "(/bin/payload)\n");
+}
+
+static int parse_count(const char *argument, size_t *out_count) {
+  char *end;
+  errno = 0;
+  unsigned long long count = strtoull(argument, &end, 10);
+  if ((0 != errno) || (end == argument) || ('\0' != (*end))) {
+    return 1;
+  }
+
+  *out_count = (size_t)count;
+
+  return 0;
+}
+
+static int parse_options(BenchmarkOptions *self, int argc, char *argv[]) {
+  enum Option {
+    OPTION_ROOT = 0,
+    OPTION_ITERATIONS,
+    OPTION_LAUNCH_ITERATIONS,
+    OPTION_GIMLI,
+    OPTION_COMMAND,
+  };
+
+  static const struct option OPTIONS[] = {
+      {"root", required_argument, NULL, OPTION_ROOT},
+      {"iterations", required_argument, NULL, OPTION_ITERATIONS},
+      {"launch-iterations", required_argument, NULL, OPTION_LAUNCH_ITERATIONS},
+      {"gimli", required_argument, NULL, OPTION_GIMLI},
+      {"command", required_argument, NULL, OPTION_COMMAND},
+      {NULL, 0, NULL, 0},
+  };
+
+  self->root = NULL;
+  self->iterations = 100;
+  self->launch_iterations = 20;
+  self->gimli = GIMLI_BENCHMARK_DEFAULT_BINARY;
+  self->command = "/bin/payload";
+
+  for (;;) {
+    int option = getopt_long(argc, argv, "", OPTIONS, NULL);
+    if (-1 == option) {
+      break;
+    }
+
+    int result = 0;
+
+    switch (option) {
+      case OPTION_ROOT:
+        self->root = optarg;
+        break;
+
+      case OPTION_ITERATIONS:
+        result = parse_count(optarg, &self->iterations);
+        break;
+
+      case OPTION_LAUNCH_ITERATIONS:
+        result = parse_count(optarg, &self->launch_iterations);
+        break;
+
+      case OPTION_GIMLI:
+        self->gimli = optarg;
+        break;
+
+      case OPTION_COMMAND:
+        self->command = optarg;
+        break;
+
+      default:
+        return 1;
+    }
+
+    if (0 != result) {
+      return 1;
+    }
+  }
+
+  if ((NULL == self->root) || (optind != argc) || (0 == self->iterations)) {
+    return 1;
+  }
+
+  return 0;
+}
+
+static double get_time_milliseconds(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+
+  return ((double)time.tv_sec * 1000.0) + ((double)time.tv_nsec / 1000000.0);
+}
+
+static int compare_samples(const void *first, const void *second) {
+  double first_sample = *(const double *)first;
+  double second_sample = *(const double *)second;
+
+  return (first_sample > second_sample) - (first_sample < second_sample);
+}
+
+static double get_percentile(const double *sorted_samples, size_t size,
+                             size_t percentile) {
+  // Nearest rank percentile.
+  size_t rank = ((percentile * size) + 99) / 100;
+
+  return sorted_samples[(0 == rank) ? 0 : (rank - 1)];
+}
+
+static void print_report_header(void) {
+  printf("%-28s %8s %10s %10s %10s %10s %10s\n", "measurement (ms)", "samples",
+         "min", "p50", "p90", "p99", "max");
+}
+
+static void report(const char *name, double *samples, size_t size) {
+  if (0 == size) {
+    printf("%-28s %8s\n", name, "-");
+    return;
+  }
+
+  qsort(samples, size, sizeof(*samples), compare_samples);
+
+  printf("%-28s %8zu %10.3f %10.3f %10.3f %10.3f %10.3f\n", name, size,
+         samples[0], get_percentile(samples, size, 50),
+         get_percentile(samples, size, 90), get_percentile(samples, size, 99),
+         samples[size - 1]);
+}
+
+static int open_stores(Stores *self, StoreBackend backend) {
+  self->backend = backend;
+
+  switch (backend) {
+    case STORE_BACKEND_EAGER:
+      if (0 != image_store_init(&self->image_store, IMAGE_STORE_MODE_EAGER)) {
+        return 1;
+      }
+
+      if (0 != layer_store_init(&self->layer_store, LAYER_STORE_MODE_EAGER)) {
+        image_store_destroy(&self->image_store);
+        return 1;
+      }
+
+      return 0;
+
+    case STORE_BACKEND_LAZY:
+      if (0 != image_store_init(&self->image_store, IMAGE_STORE_MODE_LAZY)) {
+        return 1;
+      }
+
+      if (0 != layer_store_init(&self->layer_store, LAYER_STORE_MODE_LAZY)) {
+        image_store_destroy(&self->image_store);
+        return 1;
+      }
+
+      return 0;
+
+    case STORE_BACKEND_INDEXED:
+      if (0 != metadata_index_open(&self->metadata_index)) {
+        return 1;
+      }
+
+      image_store_init_from_index(&self->image_store, &self->metadata_index);
+      layer_store_init_from_index(&self->layer_store, &self->metadata_index);
+
+      return 0;
+
+    case STORE_BACKEND_COUNT:
+      break;
+  }
+
+  return 1;
+}
+
+static void close_stores(Stores *self) {
+  layer_store_destroy(&self->layer_store);
+  image_store_destroy(&self->image_store);
+
+  if (STORE_BACKEND_INDEXED == self->backend) {
+    metadata_index_close(&self->metadata_index);
+  }
+}
+
+static int load_image(Stores *self, const char *repository, Image **out_image) {
+  *out_image =
+      image_store_get_image_by_repository(&self->image_store, repository);
+  if (NULL == (*out_image)) {
+    return 1;
+  }
+
+  return layer_store_load_image_layers(&self->layer_store, *out_image);
+}
+
+static int list_repositories(char ***out_repositories,
+                             size_t *out_repositories_size) {
+  // A lazy store reads only the repositories file.
+  ImageStore image_store;
+  if (0 != image_store_init(&image_store, IMAGE_STORE_MODE_LAZY)) {
+    return 1;
+  }
+
+  size_t repositories_size = (size_t)shlen(image_store.repository_to_id);
+  char **repositories = malloc(repositories_size * sizeof(*repositories));
+  if ((0 < repositories_size) && (NULL == repositories)) {
+    image_store_destroy(&image_store);
+    return 1;
+  }
+
+  for (size_t repository_index = 0; repository_index < repositories_size;
+       ++repository_index) {
+    repositories[repository_index] =
+        strdup(image_store.repository_to_id[repository_index].key);
+  }
+
+  image_store_destroy(&image_store);
+
+  *out_repositories = repositories;
+  *out_repositories_size = repositories_size;
+
+  return 0;
+}
+
+static int measure_index_build(double *samples, size_t *out_size) {
+  char path[PATH_MAX];
+  metadata_index_format_path(path, sizeof(path));
+
+  *out_size = 0;
+
+  for (size_t iteration = 0; iteration < INDEX_BUILD_ITERATIONS; ++iteration) {
+    unlink(path);
+
+    double start = get_time_milliseconds();
+    if (0 != metadata_index_rebuild()) {
+      return 1;
+    }
+
+    samples[(*out_size)++] = get_time_milliseconds() - start;
+  }
+
+  return 0;
+}
+
+static int measure_load(const BenchmarkOptions *options, StoreBackend backend,
+                        double *samples) {
+  for (size_t iteration = 0; iteration < options->iterations; ++iteration) {
+    Stores stores;
+
+    double start = get_time_milliseconds();
+    if (0 != open_stores(&stores, backend)) {
+      return 1;
+    }
+
+    samples[iteration] = get_time_milliseconds() - start;
+
+    close_stores(&stores);
+  }
+
+  return 0;
+}
+
+static int measure_lookup(const BenchmarkOptions *options,
+                          StoreBackend backend, char **repositories,
+                          size_t repositories_size, double *samples) {
+  // The stores are opened once, so that each lookup of a repository that has
+  // not been looked up before is a cold lookup.
+  Stores stores;
+  if (0 != open_stores(&stores, backend)) {
+    return 1;
+  }
+
+  for (size_t iteration = 0; iteration < options->iterations; ++iteration) {
+    const char *repository = repositories[iteration % repositories_size];
+
+    double start = get_time_milliseconds();
+
+    Image *image;
+    if (0 != load_image(&stores, repository, &image)) {
+      close_stores(&stores);
+      return 1;
+    }
+
+    samples[iteration] = get_time_milliseconds() - start;
+  }
+
+  close_stores(&stores);
+
+  return 0;
+}
+
+static int measure_mount_data(const BenchmarkOptions *options,
+                              char **repositories, size_t repositories_size,
+                              double *samples) {
+  Stores stores;
+  if (0 != open_stores(&stores, STORE_BACKEND_LAZY)) {
+    return 1;
+  }
+
+  // Format the upperdir and workdir as a container would.
+  char upperdir[PATH_MAX];
+  snprintf(upperdir, sizeof(upperdir), "%s/container/benchmark/diff",
+           gimli_directory_get());
+
+  char workdir[PATH_MAX];
+  snprintf(workdir, sizeof(workdir), "%s/container/benchmark/work",
+           gimli_directory_get());
+
+  for (size_t iteration = 0; iteration < options->iterations; ++iteration) {
+    Image *image;
+    if (0 != load_image(&stores, repositories[iteration % repositories_size],
+                        &image)) {
+      close_stores(&stores);
+      return 1;
+    }
+
+    double start = get_time_milliseconds();
+
+    char *mount_data;
+    if (0 != overlay_format_mount_data(image, &stores.layer_store, upperdir,
+                                       workdir, &mount_data)) {
+      close_stores(&stores);
+      return 1;
+    }
+
+    samples[iteration] = get_time_milliseconds() - start;
+
+    free(mount_data);
+  }
+
+  close_stores(&stores);
+
+  return 0;
+}
+
+static int spawned_process(void *argument) {
+  (void)argument;
+
+  return 0;
+}
+
+static int measure_spawn_clone(const BenchmarkOptions *options,
+                               double *samples) {
+  // Spawn processes the way that gimli used to, through `clone` on a heap
+  // stack and `waitpid`.
+  for (size_t iteration = 0; iteration < options->iterations; ++iteration) {
+    double start = get_time_milliseconds();
+
+    uint8_t *stack = malloc(CLONE_STACK_SIZE);
+    if (NULL == stack) {
+      return 1;
+    }
+
+    pid_t pid =
+        clone(spawned_process, stack + CLONE_STACK_SIZE, SIGCHLD, NULL);
+    free(stack);
+    if (-1 == pid) {
+      return 1;
+    }
+
+    int status;
+    if (-1 == waitpid(pid, &status, 0)) {
+      return 1;
+    }
+
+    samples[iteration] = get_time_milliseconds() - start;
+  }
+
+  return 0;
+}
+
+static int measure_spawn_clone3(const BenchmarkOptions *options,
+                                double *samples) {
+  for (size_t iteration = 0; iteration < options->iterations; ++iteration) {
+    double start = get_time_milliseconds();
+
+    int pidfd = -1;
+    pid_t pid = spawn_process(spawned_process, NULL, 0, -1, &pidfd);
+    if (-1 == pid) {
+      return 1;
+    }
+
+    int status;
+    int is_timed_out;
+    int wait_result =
+        spawn_wait(pid, pidfd, 0, NULL, &status, NULL, &is_timed_out);
+    if (-1 != pidfd) {
+      close(pidfd);
+    }
+
+    if (0 != wait_result) {
+      return 1;
+    }
+
+    samples[iteration] = get_time_milliseconds() - start;
+  }
+
+  return 0;
+}
+
+static int network_process(void *argument) {
+  // Join the pooled namespace, or else set up the one the process was cloned
+  // in, as a container does.
+  int network_namespace_fd = *(const int *)argument;
+  if (-1 != network_namespace_fd) {
+    return (0 == setns(network_namespace_fd, CLONE_NEWNET)) ? 0 : 1;
+  }
+
+  return netns_set_loopback_up();
+}
+
+static int measure_netns(const BenchmarkOptions *options, int is_pooled,
+                         double *samples) {
+  // Fill the pool up front, so that every iteration takes a namespace from it
+  // without waiting for the background refill.
+  size_t created_size;
+  if (is_pooled && (0 != netns_fill(options->iterations, &created_size))) {
+    return 1;
+  }
+
+  for (size_t iteration = 0; iteration < options->iterations; ++iteration) {
+    double start = get_time_milliseconds();
+
+    int is_low;
+    int network_namespace_fd = is_pooled ? netns_take(&is_low) : -1;
+    if (is_pooled && (-1 == network_namespace_fd)) {
+      return 1;
+    }
+
+    pid_t pid = spawn_process(network_process, &network_namespace_fd,
+                              is_pooled ? 0 : CLONE_NEWNET, -1, NULL);
+    if (-1 != network_namespace_fd) {
+      close(network_namespace_fd);
+    }
+
+    if (-1 == pid) {
+      return 1;
+    }
+
+    int status;
+    if (-1 == waitpid(pid, &status, 0)) {
+      return 1;
+    }
+
+    if ((!WIFEXITED(status)) || (0 != WEXITSTATUS(status))) {
+      errno = ECHILD;
+      return 1;
+    }
+
+    samples[iteration] = get_time_milliseconds() - start;
+  }
+
+  return 0;
+}
+
+static int launch_container(const BenchmarkOptions *options,
+                            const char *repository) {
+  pid_t pid = fork();
+  if (-1 == pid) {
+    return 1;
+  }
+
+  if (0 == pid) {
+    // Silence the launch's progress output.
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (-1 != null_fd) {
+      dup2(null_fd, STDOUT_FILENO);
+      dup2(null_fd, STDERR_FILENO);
+    }
+
+    execl(options->gimli, options->gimli, "run", repository, options->command,
+          (char *)NULL);
+    _exit(127);
+  }
+
+  int status;
+  if (-1 == waitpid(pid, &status, 0)) {
+    return 1;
+  }
+
+  if ((!WIFEXITED(status)) || (0 != WEXITSTATUS(status))) {
+    errno = ECHILD;
+    return 1;
+  }
+
+  return 0;
+}
+
+static int measure_launch(const BenchmarkOptions *options,
+                          char **repositories, size_t repositories_size,
+                          double *samples) {
+  for (size_t iteration = 0; iteration < options->launch_iterations;
+       ++iteration) {
+    double start = get_time_milliseconds();
+
+    if (0 != launch_container(options,
+                              repositories[iteration % repositories_size])) {
+      return 1;
+    }
+
+    samples[iteration] = get_time_milliseconds() - start;
+  }
+
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  int ret = 1;
+
+  BenchmarkOptions options;
+  if (0 != parse_options(&options, argc, argv)) {
+    print_usage(argv[0]);
+    goto out;
+  }
+
+  // The overlay mount data refers to the layers by absolute paths.
+  char root[PATH_MAX];
+  if (NULL == realpath(options.root, root)) {
+    printf("failed resolving the store root, error(%d): [%s]\n", errno,
+           strerror(errno));
+    goto out;
+  }
+
+  // Point both this process and the launched containers at the store.
+  gimli_directory_set(root);
+  setenv("GIMLI_ROOT", root, 1);
+
+  char **repositories;
+  size_t repositories_size;
+  if ((0 != list_repositories(&repositories, &repositories_size)) ||
+      (0 == repositories_size)) {
+    printf("failed listing the store's repositories, error(%d): [%s]\n", errno,
+           strerror(errno));
+    goto out;
+  }
+
+  size_t samples_size = (options.iterations > options.launch_iterations)
+                            ? options.iterations
+                            : options.launch_iterations;
+  if (INDEX_BUILD_ITERATIONS > samples_size) {
+    samples_size = INDEX_BUILD_ITERATIONS;
+  }
+
+  double *samples = malloc(samples_size * sizeof(*samples));
+  if (NULL == samples) {
+    goto out_free_repositories;
+  }
+
+  print_report_header();
+
+  // Measure building the index, which also leaves an up to date index for the
+  // indexed backend.
+  size_t index_build_samples_size;
+  if (0 != measure_index_build(samples, &index_build_samples_size)) {
+    printf("failed building the index, error(%d): [%s]\n", errno,
+           strerror(errno));
+    goto out_free_samples;
+  }
+
+  report("index build", samples, index_build_samples_size);
+
+  // Measure each backend.
+  for (size_t backend = 0; backend < STORE_BACKEND_COUNT; ++backend) {
+    char name[64];
+
+    if (0 != measure_load(&options, (StoreBackend)backend, samples)) {
+      printf("failed loading the %s stores, error(%d): [%s]\n",
+             STORE_BACKEND_NAMES[backend], errno, strerror(errno));
+      goto out_free_samples;
+    }
+
+    snprintf(name, sizeof(name), "load/%s", STORE_BACKEND_NAMES[backend]);
+    report(name, samples, options.iterations);
+
+    if (0 != measure_lookup(&options, (StoreBackend)backend, repositories,
+                            repositories_size, samples)) {
+      printf("failed looking up images in the %s stores, error(%d): [%s]\n",
+             STORE_BACKEND_NAMES[backend], errno, strerror(errno));
+      goto out_free_samples;
+    }
+
+    snprintf(name, sizeof(name), "lookup/%s", STORE_BACKEND_NAMES[backend]);
+    report(name, samples, options.iterations);
+  }
+
+  // Measure formatting the overlay mount data.
+  if (0 != measure_mount_data(&options, repositories, repositories_size,
+                              samples)) {
+    printf("failed formatting mount data, error(%d): [%s]\n", errno,
+           strerror(errno));
+    goto out_free_samples;
+  }
+
+  report("mount data", samples, options.iterations);
+
+  // Measure spawning a process, without the namespaces of a container, so
+  // that only the spawn path itself is measured.
+  if (0 != measure_spawn_clone(&options, samples)) {
+    printf("failed spawning through clone, error(%d): [%s]\n", errno,
+           strerror(errno));
+    goto out_free_samples;
+  }
+
+  report("spawn/clone", samples, options.iterations);
+
+  if (0 != measure_spawn_clone3(&options, samples)) {
+    printf("failed spawning through clone3, error(%d): [%s]\n", errno,
+           strerror(errno));
+    goto out_free_samples;
+  }
+
+  report("spawn/clone3", samples, options.iterations);
+
+  // Measure setting up the network namespace of a container, either a new
+  // one or one from the pool, which requires root privileges.
+  if (0 != geteuid()) {
+    printf("%-28s %8s (requires root)\n", "netns/new", "-");
+    printf("%-28s %8s (requires root)\n", "netns/pooled", "-");
+  } else {
+    if (0 != measure_netns(&options, 0, samples)) {
+      printf("failed spawning in a new network namespace, error(%d): [%s]\n",
+             errno, strerror(errno));
+      goto out_free_samples;
+    }
+
+    report("netns/new", samples, options.iterations);
+
+    if (0 != measure_netns(&options, 1, samples)) {
+      printf("failed spawning in a pooled network namespace, error(%d): "
+             "[%s]\n",
+             errno, strerror(errno));
+      goto out_free_samples;
+    }
+
+    report("netns/pooled", samples, options.iterations);
+  }
+
+  // Measure launching containers, which requires root privileges.
+  if (0 == options.launch_iterations) {
+    report("launch", samples, 0);
+  } else if (0 != geteuid()) {
+    printf("%-28s %8s (requires root)\n", "launch", "-");
+  } else {
+    if (0 != measure_launch(&options, repositories, repositories_size,
+                            samples)) {
+      printf("failed launching a container, error(%d): [%s]\n", errno,
+             strerror(errno));
+      goto out_free_samples;
+    }
+
+    report("launch", samples, options.launch_iterations);
+  }
+
+  ret = 0;
+
+out_free_samples:
+  free(samples);
+
+out_free_repositories:
+  for (size_t repository_index = 0; repository_index < repositories_size;
+       ++repository_index) {
+    free(repositories[repository_index]);
+  }
+
+  free(repositories);
+
+out:
+  return ret;
+}
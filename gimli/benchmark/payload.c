@@ -0,0 +1,3 @@
+// The command that benchmark containers run, which exits immediately so that
+// the launch latency is dominated by gimli itself.
+int main(void) { return 0; }
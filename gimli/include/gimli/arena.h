@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct Arena {
+  ArenaBlock *blocks;
+  char *cursor;
+  char *end;
+} Arena;
+
+void arena_init(Arena *self);
+
+void arena_destroy(Arena *self);
+
+void *arena_allocate(Arena *self, size_t size);
+
+char *arena_duplicate_string(Arena *self, const char *string);
+
+char *arena_format_string(Arena *self, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+void arena_adopt(Arena *self, Arena *other);
+
+void arena_begin_json(Arena *self);
+
+void arena_end_json(void);
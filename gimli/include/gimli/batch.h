@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "gimli/cgroup.h"
+#include "gimli/image_store.h"
+#include "gimli/layer_store.h"
+#include "gimli/log.h"
+
+typedef struct BatchConfiguration {
+  // The number of jobs that run at once.
+  size_t concurrency;
+
+  // The number of seconds after which a job is killed, or 0 to let it run
+  // until it exits.
+  size_t timeout;
+
+  // Whether the jobs share their images' read-only roots.
+  int is_read_only;
+
+  // The size limit of the jobs' in-memory directories, or NULL to keep their
+  // files on disk.
+  const char *ephemeral_size;
+
+  // The limits of the jobs' cgroups, which are only created when a limit is
+  // set.
+  const CgroupLimits *cgroup_limits;
+
+  // Where the jobs' output is logged, or NULL to let the jobs write to
+  // gimli's output.
+  const LogConfiguration *log_configuration;
+
+  // The file that a record of each job's resource usage is written to, or
+  // NULL to record none.
+  FILE *stats_file;
+} BatchConfiguration;
+
+int batch_run(ImageStore *image_store, LayerStore *layer_store, int input_fd,
+              const BatchConfiguration *configuration,
+              size_t *out_failed_size);
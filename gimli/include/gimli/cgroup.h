@@ -0,0 +1,28 @@
+#pragma once
+
+#include <limits.h>
+
+// The limits of a container's cgroup, which are written as they are to the
+// cgroup's interface files, or NULL to leave a limit unset.
+typedef struct CgroupLimits {
+  char *cpu_max;
+  char *cpu_weight;
+  char *cpuset_cpus;
+  char *cpuset_mems;
+  char *memory_max;
+  char *memory_high;
+  char *io_max;
+} CgroupLimits;
+
+typedef struct Cgroup {
+  char directory[PATH_MAX];
+
+  // The cgroup's directory, which containers are cloned into.
+  int fd;
+} Cgroup;
+
+int cgroup_limits_is_set(const CgroupLimits *limits);
+
+int cgroup_create(Cgroup *self, const char *name, const CgroupLimits *limits);
+
+int cgroup_remove(Cgroup *self);
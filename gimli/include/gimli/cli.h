@@ -2,10 +2,95 @@
 
 #include <stddef.h>
 
+#include "gimli/cgroup.h"
+#include "gimli/log.h"
+
+typedef enum CliSubcommand {
+  // Run a command in a container.
+  CLI_SUBCOMMAND_RUN = 0,
+
+  // Keep containers ready to run commands in, and serve them over a socket.
+  CLI_SUBCOMMAND_POOL,
+
+  // Flatten the layers of images into snapshots.
+  CLI_SUBCOMMAND_SNAPSHOT,
+
+  // Run the container commands of a job file with bounded concurrency.
+  CLI_SUBCOMMAND_BATCH,
+
+  // Fill the pool of network namespaces that containers join.
+  CLI_SUBCOMMAND_NETNS,
+
+  // Load the images of a docker save archive into the store.
+  CLI_SUBCOMMAND_LOAD,
+
+  // Share the contents of identical files across the layers.
+  CLI_SUBCOMMAND_DEDUPE,
+} CliSubcommand;
+
 typedef struct Cli {
+  CliSubcommand subcommand;
+
+  // The image and command to run.
   char *image;
   char **command;
   size_t command_size;
+
+  // The number of seconds after which a container is killed, or 0 to let it
+  // run until it exits.
+  size_t timeout;
+
+  // Whether containers share their image's read-only root instead of each
+  // mounting a writable overlay.
+  int is_read_only;
+
+  // The size limit of an ephemeral container's in-memory directory, which is
+  // NULL unless the container is ephemeral.
+  char *ephemeral_size;
+
+  // The limits of the containers' cgroups, which are only created when a
+  // limit is set.
+  CgroupLimits cgroup_limits;
+
+  // Where the containers' output is logged, which is only logged when a
+  // directory is given.
+  LogConfiguration log_configuration;
+
+  // The images that a pool keeps containers ready for, or that are flattened.
+  char **images;
+  size_t images_size;
+
+  // The trace options, which are NULL unless they are given.
+  char *trace_path;
+  char *trace_format;
+
+  // The file that a JSON record of each container's resource usage is
+  // appended to ("-" for the standard error), which is NULL unless it is
+  // given.
+  char *stats_path;
+
+  // The socket of the pool that the command runs in, or that the pool listens
+  // on, which is NULL unless it is given.
+  char *pool_socket_path;
+  size_t pool_size;
+
+  // The job file of a batch, which is NULL for the standard input, and the
+  // number of its jobs that run at once (0 for the number of processors).
+  char *batch_path;
+  size_t batch_jobs_size;
+
+  // The number of network namespaces that the pool is filled to.
+  size_t netns_size;
+
+  // The archive that images are loaded from, which is NULL for the standard
+  // input, and the number of layers that are extracted at once (0 for the
+  // number of processors).
+  char *load_path;
+  size_t load_jobs_size;
+
+  // The number of layers (or files) that are walked (or hashed) at once by a
+  // deduplication pass (0 for the number of processors).
+  size_t dedupe_jobs_size;
 } Cli;
 
 int cli_init(Cli *self, int argc, const char *const argv[]);
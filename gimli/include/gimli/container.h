@@ -0,0 +1,57 @@
+#pragma once
+
+#include <limits.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "gimli/image.h"
+#include "gimli/layer_store.h"
+
+// The standard streams that are passed to a parked container along with its
+// command.
+#define CONTAINER_STREAMS_SIZE 3
+
+typedef struct ContainerConfiguration {
+  const Image *image;
+  const char *directory;
+  const char *root_fs_directory;
+  const char *hostname;
+  char **command;
+  LayerStore *layer_store;
+
+  // The image's shared read-only root that the container is pivoted to, or
+  // NULL to mount a writable overlay in the container directory.
+  const char *shared_root_directory;
+
+  // The size limit of the in-memory file system that an ephemeral container's
+  // directory is mounted on (in the units of tmpfs, such as 512m), or NULL to
+  // keep the container's files on disk.
+  const char *ephemeral_size;
+
+  // The cgroup that the container is cloned into, or -1 to leave it in
+  // gimli's cgroup.
+  int cgroup_fd;
+
+  // The pipe that the container's standard output and error are written to,
+  // or -1 to write them to gimli's.
+  int log_fd;
+
+  // The socket that a parked container receives its command and standard
+  // streams over, or -1 to execute the command right away.
+  int control_fd;
+} ContainerConfiguration;
+
+void container_format_directories(const char *hostname,
+                                  char directory[PATH_MAX],
+                                  char root_fs_directory[PATH_MAX]);
+
+pid_t container_clone(const ContainerConfiguration *configuration,
+                      int *out_pidfd);
+
+int container_send_command(int control_fd, const char *const *command,
+                           size_t command_size,
+                           const int streams[CONTAINER_STREAMS_SIZE]);
+
+void container_remove_directory(const char *directory,
+                                const char *root_fs_directory,
+                                const char *hostname);
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gimli/sha256.h"
+
+#define DEDUPE_INDEX_MAGIC "GIMLIDDP"
+#define DEDUPE_INDEX_VERSION 1
+
+// The index records the files of every layer that has been deduplicated, so
+// that later passes only walk and hash the layers that are new.
+// It is laid out as a header followed by its sections, and all strings are
+// null terminated offsets into the strings section.
+typedef struct DedupeIndexHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t file_size;
+
+  uint32_t layers_offset;
+  uint32_t layers_size;
+  uint32_t files_offset;
+  uint32_t files_size;
+  uint32_t strings_offset;
+  uint32_t strings_size;
+} DedupeIndexHeader;
+
+// The files of a layer are consecutive in the files section.
+typedef struct DedupeIndexLayer {
+  uint32_t cache_id;
+  uint32_t first_file_index;
+  uint32_t files_size;
+} DedupeIndexLayer;
+
+enum DedupeFileFlag {
+  // The digest of the file's contents is known.
+  DEDUPE_FILE_FLAG_HASHED = 1 << 0,
+
+  // The file's extents are shared with the other files of the same contents.
+  DEDUPE_FILE_FLAG_CLONED = 1 << 1,
+};
+
+// A regular file of a layer, whose path is relative to its diff directory.
+typedef struct DedupeIndexFile {
+  uint8_t digest[SHA256_DIGEST_SIZE];
+  uint64_t size;
+  uint64_t inode;
+  int64_t modification_seconds;
+  int64_t modification_nanoseconds;
+  uint32_t mode;
+  uint32_t uid;
+  uint32_t gid;
+  uint32_t flags;
+  uint32_t path;
+} DedupeIndexFile;
+
+typedef struct DedupeSummary {
+  // The layers in the store, and the ones that were walked as they were not
+  // in the index.
+  size_t layers_size;
+  size_t scanned_layers_size;
+
+  // The files of the layers, and the ones whose contents were hashed.
+  size_t files_size;
+  size_t hashed_files_size;
+
+  // The duplicates that now share their contents, either as reflinks or as
+  // hard links, and the ones that could not be replaced.
+  size_t cloned_files_size;
+  size_t linked_files_size;
+  size_t failed_files_size;
+
+  // The bytes that the duplicates no longer take up.
+  uint64_t saved_size;
+} DedupeSummary;
+
+void dedupe_format_index_path(char *path, size_t size);
+
+int dedupe_run(size_t threads_size, DedupeSummary *out_summary);
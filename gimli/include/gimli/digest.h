@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gimli/sha256.h"
+
+// A digest is formatted as follows:
+// sha256:<hex-digest>
+// The size includes the null terminator.
+#define DIGEST_STRING_SIZE (sizeof(SHA256_DIGEST_PREFIX) + SHA256_HEX_DIGEST_SIZE)
+
+// The number of bits in a digest.
+#define DIGEST_BITS_SIZE (SHA256_DIGEST_SIZE * 8)
+
+typedef struct Digest {
+  uint8_t bytes[SHA256_DIGEST_SIZE];
+} Digest;
+
+int digest_parse(Digest *self, const char *string);
+
+int digest_parse_hex(Digest *self, const char *hex);
+
+int digest_parse_prefix(Digest *self, const char *string,
+                        size_t *out_bits_size);
+
+void digest_format(const Digest *self, char out_string[DIGEST_STRING_SIZE]);
+
+uint64_t digest_hash(const Digest *self);
+
+int digest_equals(const Digest *self, const Digest *other);
+
+unsigned int digest_get_bit(const Digest *self, size_t bit_index);
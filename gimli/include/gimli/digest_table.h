@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "gimli/digest.h"
+
+// A slot is empty when its value is NULL.
+typedef struct DigestTableSlot {
+  Digest key;
+  void *value;
+} DigestTableSlot;
+
+typedef struct DigestTable {
+  DigestTableSlot *slots;
+  size_t capacity;
+  size_t size;
+} DigestTable;
+
+void digest_table_init(DigestTable *self);
+
+void digest_table_destroy(DigestTable *self);
+
+int digest_table_put(DigestTable *self, const Digest *key, void *value);
+
+void *digest_table_get(const DigestTable *self, const Digest *key);
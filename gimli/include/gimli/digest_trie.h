@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "gimli/arena.h"
+#include "gimli/digest.h"
+
+// The trie is a crit-bit tree: every internal node branches on the first bit
+// in which the digests below it differ, so a trie of n digests has exactly
+// n - 1 internal nodes.
+typedef struct DigestTrie {
+  const void *root;
+  int is_root_leaf;
+} DigestTrie;
+
+void digest_trie_init(DigestTrie *self);
+
+int digest_trie_insert(DigestTrie *self, const Digest *digest, Arena *arena);
+
+int digest_trie_find_prefix(const DigestTrie *self, const char *prefix,
+                            Digest *out_digest);
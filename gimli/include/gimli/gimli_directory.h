@@ -3,3 +3,7 @@
 #include <stddef.h>
 
 const char *gimli_directory_get(void);
+
+void gimli_directory_set(const char *path);
+
+int gimli_directory_open(const char *relative_path);
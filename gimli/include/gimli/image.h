@@ -2,12 +2,22 @@
 
 #include <stddef.h>
 
+#include "gimli/arena.h"
+#include "gimli/digest.h"
+
+#define IMAGE_ID_PREFIX "sha256:"
+
 typedef struct Image {
   char *id;
   char **layers;
   size_t layers_size;
 } Image;
 
-int image_init(Image *self, const char *id, const char *image_store_directory);
+int image_init(Image *self, const char *id, int image_store_directory_fd,
+               Arena *arena);
+
+int image_init_from_metadata(Image *self, const char *id, const char *metadata,
+                             size_t metadata_size, Arena *arena);
 
-void image_destroy(Image *self);
+void image_compute_chain_id(const Image *self,
+                            char out_chain_id[DIGEST_STRING_SIZE]);
@@ -1,25 +1,57 @@
 #pragma once
 
+#include "gimli/arena.h"
+#include "gimli/digest_table.h"
+#include "gimli/digest_trie.h"
 #include "gimli/image.h"
-
-typedef struct IdToImagePair {
-  char *key;
-  Image value;
-} IdToImagePair;
+#include "gimli/metadata_index.h"
 
 typedef struct RepositoryToIdPair {
   char *key;
   char *value;
 } RepositoryToIdPair;
 
+typedef enum ImageStoreMode {
+  // Read every image in the image store during initialization.
+  IMAGE_STORE_MODE_EAGER = 0,
+
+  // Read only the repositories file during initialization, and read each image
+  // the first time it is looked up.
+  IMAGE_STORE_MODE_LAZY,
+
+  // Resolve repositories and images from a metadata index on demand.
+  IMAGE_STORE_MODE_INDEXED,
+} ImageStoreMode;
+
 typedef struct ImageStore {
-  IdToImagePair *id_to_image;
+  ImageStoreMode mode;
+  // Maps image IDs to the images, which are allocated from the arena.
+  DigestTable id_to_image;
   RepositoryToIdPair *repository_to_id;
+
+  // The IDs of all of the images in the store, which is built the first time
+  // an image is looked up by a short ID.
+  DigestTrie id_trie;
+  int has_id_trie;
+
+  const MetadataIndex *metadata_index;
+  Arena arena;
+
+  // The directory that images are read from (-1 in indexed mode).
+  int image_store_directory_fd;
 } ImageStore;
 
-int image_store_init(ImageStore *self);
+int image_store_init(ImageStore *self, ImageStoreMode mode);
+
+int image_store_init_from_index(ImageStore *self,
+                                const MetadataIndex *metadata_index);
 
 void image_store_destroy(ImageStore *self);
 
 Image *image_store_get_image_by_repository(ImageStore *self,
                                            const char *repository);
+
+Image *image_store_get_image_by_id_prefix(ImageStore *self,
+                                          const char *id_prefix);
+
+Image *image_store_get_image_by_name(ImageStore *self, const char *name);
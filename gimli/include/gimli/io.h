@@ -1,5 +1,39 @@
 #pragma once
 
+#include <dirent.h>
+#include <stddef.h>
+
+#include "gimli/arena.h"
+
 int io_file_to_string(const char *path, char **out_data);
 
+int io_file_to_buffer(const char *path, char *buffer, size_t size);
+
+int io_read_files_at(int directory_fd, const char *const *paths,
+                     size_t paths_size, Arena *arena, char **out_contents,
+                     size_t *out_sizes);
+
+int io_map_file(const char *path, void **out_data, size_t *out_size);
+
+int io_map_file_at(int directory_fd, const char *path, void **out_data,
+                   size_t *out_size);
+
+void io_unmap_file(void *data, size_t size);
+
+int io_write_all(int fd, const void *buffer, size_t size);
+
+int io_write_file_atomically(const char *path, const void *data, size_t size);
+
+int io_read_directory_names(DIR *directory, unsigned char type,
+                            char ***out_names, size_t *out_size);
+
+void io_free_directory_names(char **names, size_t size);
+
+int io_remove_tree_at(int directory_fd, const char *name);
+
+int io_link_tree_at(int source_directory_fd, const char *source_name,
+                    int target_directory_fd, const char *target_name);
+
 void io_remove_directory_recursive(const char *path);
+
+void io_close_range(unsigned int first_fd, unsigned int last_fd);
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct IoRing {
+  int fd;
+
+  // The submission and completion queue rings share a single mapping.
+  void *rings;
+  size_t rings_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+
+  uint32_t *sq_head;
+  uint32_t *sq_tail;
+  uint32_t *sq_array;
+  uint32_t sq_mask;
+  uint32_t sq_entries;
+
+  uint32_t *cq_head;
+  uint32_t *cq_tail;
+  struct io_uring_cqe *cqes;
+  uint32_t cq_mask;
+
+  // The number of entries that have been queued but not yet submitted.
+  uint32_t sq_pending;
+} IoRing;
+
+int io_ring_init(IoRing *self, uint32_t entries, uint32_t files_size);
+
+void io_ring_destroy(IoRing *self);
+
+struct io_uring_sqe *io_ring_get_sqe(IoRing *self);
+
+int io_ring_submit_and_wait(IoRing *self, uint32_t completions_size);
+
+int io_ring_next_cqe(IoRing *self, struct io_uring_cqe *out_cqe);
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The deepest the scanner can enter objects and arrays, which is independent
+// of how deep the values it skips may be nested.
+#define JSON_SCANNER_MAX_ENTERED_DEPTH 64
+
+typedef struct JsonScanner {
+  const char *cursor;
+  const char *end;
+
+  // The objects and arrays that have been entered, as a stack of bits which
+  // are set for objects, so that the rest of the document can be checked once
+  // the values have been extracted.
+  uint64_t entered_objects;
+  size_t entered_depth;
+
+  // Whether a member or element has already been read from the innermost
+  // container, so that the next one must be preceded by a comma.
+  int expects_separator;
+} JsonScanner;
+
+// A string as it appears in the scanned buffer, without its quotes.
+// The string is not null terminated, and still contains its escape sequences
+// (if any).
+typedef struct JsonScannerString {
+  const char *data;
+  size_t size;
+  int has_escapes;
+} JsonScannerString;
+
+void json_scanner_init(JsonScanner *self, const char *data, size_t size);
+
+int json_scanner_enter_object(JsonScanner *self);
+
+int json_scanner_next_member(JsonScanner *self, JsonScannerString *out_key,
+                             int *out_has_member);
+
+int json_scanner_find_member(JsonScanner *self, const char *key);
+
+int json_scanner_enter_array(JsonScanner *self);
+
+int json_scanner_next_element(JsonScanner *self, int *out_has_element);
+
+int json_scanner_read_string(JsonScanner *self, JsonScannerString *out_string);
+
+int json_scanner_skip_value(JsonScanner *self);
+
+int json_scanner_finish(JsonScanner *self);
+
+int json_scanner_string_equals(const JsonScannerString *string,
+                               const char *value);
+
+int json_scanner_string_copy(const JsonScannerString *string, char *out);
+
+char *json_scanner_string_duplicate(const JsonScannerString *string);
@@ -1,5 +1,10 @@
 #pragma once
 
+#include <stddef.h>
+
+#include "gimli/arena.h"
+#include "gimli/digest.h"
+
 typedef struct Layer {
   char *chain_id;
   char *diff_id;
@@ -7,7 +12,9 @@ typedef struct Layer {
   char *link_path;
 } Layer;
 
-int layer_init(Layer *self, const char *chain_id,
-               char const *layer_store_directory);
+int layer_init_all(Layer *layers, char *const *chain_ids, size_t layers_size,
+                   int layer_store_directory_fd, int overlay_directory_fd,
+                   Arena *arena);
 
-void layer_destroy(Layer *self);
+void layer_compute_chain_id(const char *parent_chain_id, const char *diff_id,
+                            char out_chain_id[DIGEST_STRING_SIZE]);
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gimli/digest.h"
+
+int layer_archive_extract(const void *data, size_t size, int directory_fd,
+                          Digest *out_diff_id, uint64_t *out_size);
@@ -1,18 +1,42 @@
 #pragma once
 
+#include "gimli/arena.h"
+#include "gimli/digest_table.h"
+#include "gimli/image.h"
 #include "gimli/layer.h"
+#include "gimli/metadata_index.h"
 
-typedef struct DiffIdToLayerPair {
-  char *key;
-  Layer value;
-} DiffIdToLayerPair;
+typedef enum LayerStoreMode {
+  // Read every layer in the layer store during initialization.
+  LAYER_STORE_MODE_EAGER = 0,
+
+  // Read only the layers of the images that are loaded into the store.
+  LAYER_STORE_MODE_LAZY,
+
+  // Read the layers of the images that are loaded into the store from a
+  // metadata index.
+  LAYER_STORE_MODE_INDEXED,
+} LayerStoreMode;
 
 typedef struct LayerStore {
-  DiffIdToLayerPair *diff_id_to_layer;
+  LayerStoreMode mode;
+  // Maps diff IDs to the layers, which are allocated from the arena.
+  DigestTable diff_id_to_layer;
+  const MetadataIndex *metadata_index;
+  Arena arena;
+
+  // The directories that layers are read from (-1 in indexed mode).
+  int layer_store_directory_fd;
+  int overlay_directory_fd;
 } LayerStore;
 
-int layer_store_init(LayerStore *self);
+int layer_store_init(LayerStore *self, LayerStoreMode mode);
+
+int layer_store_init_from_index(LayerStore *self,
+                                const MetadataIndex *metadata_index);
 
 void layer_store_destroy(LayerStore *self);
 
+int layer_store_load_image_layers(LayerStore *self, const Image *image);
+
 Layer *layer_store_get_layer_by_diff_id(LayerStore *self, const char *diff_id);
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct LoadSummary {
+  // The images of the archive, and the tags that were pointed at them.
+  size_t images_size;
+  size_t tags_size;
+
+  // The layers that were extracted, and the layers whose contents were
+  // already in the store.
+  size_t extracted_layers_size;
+  size_t skipped_layers_size;
+
+  // The uncompressed size of the extracted layers, in bytes.
+  uint64_t extracted_size;
+} LoadSummary;
+
+int load_images(int input_fd, size_t threads_size, LoadSummary *out_summary);
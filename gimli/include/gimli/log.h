@@ -0,0 +1,52 @@
+#pragma once
+
+#include <limits.h>
+#include <stddef.h>
+
+typedef struct LogConfiguration {
+  // The directory that the containers' logs are written to, or NULL to let
+  // the containers write to gimli's standard streams.
+  char *directory;
+
+  // The size that a log is rotated at, in bytes.
+  size_t size;
+
+  // Whether each batch of output is framed with the time it was logged at.
+  int is_timestamped;
+
+  // Whether output is dropped instead of making the container wait once the
+  // log falls behind.
+  int is_non_blocking;
+} LogConfiguration;
+
+typedef struct Log {
+  const LogConfiguration *configuration;
+  char path[PATH_MAX];
+
+  // The pipe that the container's output is read from, and the file that it
+  // is moved to.
+  int pipe_fd;
+  size_t pipe_size;
+  int file_fd;
+  size_t file_size;
+
+  // Where dropped output is moved to, which is only opened once output is
+  // dropped.
+  int null_fd;
+  size_t dropped_size;
+
+  // The error of the first write that failed, after which the output is
+  // dropped, or 0.
+  int error;
+
+  int is_closed;
+} Log;
+
+int log_open(Log *self, const LogConfiguration *configuration,
+             const char *name, int *out_write_fd);
+
+void log_pump(Log *self);
+
+void log_drain(Log *self);
+
+void log_close(Log *self);
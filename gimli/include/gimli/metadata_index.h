@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gimli/arena.h"
+#include "gimli/image.h"
+#include "gimli/layer.h"
+
+#define METADATA_INDEX_MAGIC "GIMLIIDX"
+#define METADATA_INDEX_VERSION 1
+
+// The metadata sources of the index.
+// A change to any of them invalidates the index.
+enum MetadataIndexSource {
+  METADATA_INDEX_SOURCE_REPOSITORIES = 0,
+  METADATA_INDEX_SOURCE_IMAGE_STORE,
+  METADATA_INDEX_SOURCE_LAYER_STORE,
+
+  METADATA_INDEX_SOURCE_COUNT,
+};
+
+typedef struct MetadataIndexSourceStamp {
+  int64_t modification_seconds;
+  int64_t modification_nanoseconds;
+  uint64_t inode;
+  uint64_t size;
+} MetadataIndexSourceStamp;
+
+// The index file is laid out as a header followed by its sections.
+// All references between sections are offsets or indices, and all strings are
+// null terminated offsets into the strings section, so the file can be used
+// directly from a read-only mapping.
+// The key of every hashed entry is its first field, and the buckets of each
+// hash table hold entry indices incremented by 1, with 0 marking an empty
+// bucket.
+typedef struct MetadataIndexHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t file_size;
+  MetadataIndexSourceStamp sources[METADATA_INDEX_SOURCE_COUNT];
+
+  // Repository entries and their hash table buckets.
+  uint32_t repositories_offset;
+  uint32_t repositories_size;
+  uint32_t repository_buckets_offset;
+  uint32_t repository_buckets_size;
+
+  // Image entries and their hash table buckets.
+  uint32_t images_offset;
+  uint32_t images_size;
+  uint32_t image_buckets_offset;
+  uint32_t image_buckets_size;
+
+  // The diff ID string offsets of all images, in image layer order.
+  uint32_t image_layers_offset;
+  uint32_t image_layers_size;
+
+  // Layer entries and their hash table buckets.
+  uint32_t layers_offset;
+  uint32_t layers_size;
+  uint32_t layer_buckets_offset;
+  uint32_t layer_buckets_size;
+
+  uint32_t strings_offset;
+  uint32_t strings_size;
+} MetadataIndexHeader;
+
+typedef struct MetadataIndexRepository {
+  uint32_t name;
+  uint32_t image_id;
+} MetadataIndexRepository;
+
+typedef struct MetadataIndexImage {
+  uint32_t id;
+  uint32_t first_layer_index;
+  uint32_t layers_size;
+} MetadataIndexImage;
+
+typedef struct MetadataIndexLayer {
+  uint32_t diff_id;
+  uint32_t chain_id;
+  uint32_t cache_id;
+  uint32_t link_path;
+} MetadataIndexLayer;
+
+typedef struct MetadataIndex {
+  void *data;
+  size_t size;
+} MetadataIndex;
+
+uint32_t metadata_index_hash(const char *key);
+
+void metadata_index_format_path(char *path, size_t size);
+
+int metadata_index_stamp_sources(
+    MetadataIndexSourceStamp out_stamps[METADATA_INDEX_SOURCE_COUNT]);
+
+int metadata_index_open(MetadataIndex *self);
+
+void metadata_index_close(MetadataIndex *self);
+
+const char *metadata_index_get_image_id(const MetadataIndex *self,
+                                        const char *repository);
+
+size_t metadata_index_get_images_size(const MetadataIndex *self);
+
+const char *metadata_index_get_image_id_at(const MetadataIndex *self,
+                                           size_t image_index);
+
+int metadata_index_get_image(const MetadataIndex *self, const char *id,
+                             Arena *arena, Image *out_image);
+
+int metadata_index_get_layer(const MetadataIndex *self, const char *diff_id,
+                             Layer *out_layer);
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "gimli/image_store.h"
+#include "gimli/layer_store.h"
+#include "gimli/metadata_index.h"
+
+int metadata_index_build(
+    const ImageStore *image_store, const LayerStore *layer_store,
+    const MetadataIndexSourceStamp stamps[METADATA_INDEX_SOURCE_COUNT]);
+
+int metadata_index_rebuild(void);
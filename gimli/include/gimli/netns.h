@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stddef.h>
+
+int netns_set_loopback_up(void);
+
+int netns_fill(size_t size, size_t *out_created_size);
+
+int netns_take(int *out_is_low);
+
+int netns_spawn_refiller(void);
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "gimli/image.h"
+#include "gimli/layer_store.h"
+
+int overlay_format_mount_data(const Image *image, LayerStore *layer_store,
+                              const char *upperdir, const char *workdir,
+                              char **out_mount_data);
+
+void overlay_detect_fs_context_support(void);
+
+int overlay_mount_image(const Image *image, const char *directory,
+                        const char *merged_directory, LayerStore *layer_store);
+
+int overlay_mount_image_read_only(const Image *image,
+                                  const char *merged_directory,
+                                  LayerStore *layer_store);
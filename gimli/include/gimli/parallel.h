@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stddef.h>
+
+// Tasks are given the index of the worker thread running them (which is less
+// than the threads size passed to `parallel_run`), so that they can use
+// per-thread state without locking.
+typedef int (*ParallelTask)(void *context, size_t worker_index,
+                            size_t task_index);
+
+size_t parallel_get_threads_size(void);
+
+int parallel_run(size_t tasks_size, size_t threads_size, ParallelTask task,
+                 void *context);
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "gimli/image_store.h"
+#include "gimli/layer_store.h"
+
+void pool_format_default_socket_path(char *path, size_t size);
+
+int pool_serve(ImageStore *image_store, LayerStore *layer_store,
+               const char *const *images, size_t images_size, size_t size,
+               const char *socket_path);
+
+int pool_run(const char *socket_path, const char *image,
+             const char *const *command, size_t command_size,
+             int *out_exit_code, int *out_is_dispatched);
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_PREFIX "sha256:"
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_HEX_DIGEST_SIZE (SHA256_DIGEST_SIZE * 2)
+#define SHA256_BLOCK_SIZE 64
+
+typedef struct Sha256 {
+  uint32_t state[8];
+  uint64_t size;
+  uint8_t block[SHA256_BLOCK_SIZE];
+  size_t block_size;
+} Sha256;
+
+void sha256_init(Sha256 *self);
+
+void sha256_update(Sha256 *self, const void *data, size_t size);
+
+void sha256_final(Sha256 *self, uint8_t out_digest[SHA256_DIGEST_SIZE]);
+
+void sha256_to_hex(const uint8_t digest[SHA256_DIGEST_SIZE],
+                   char out_hex[SHA256_HEX_DIGEST_SIZE + 1]);
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <limits.h>
+
+#include "gimli/image.h"
+#include "gimli/layer_store.h"
+
+typedef struct SharedRoot {
+  // The directory that the image's read-only root is mounted on.
+  char directory[PATH_MAX];
+
+  // The lock that every user of the root holds shared, so that it is
+  // unmounted only once it has no users.
+  int users_lock_fd;
+} SharedRoot;
+
+int shared_root_acquire(SharedRoot *self, const Image *image,
+                        LayerStore *layer_store);
+
+void shared_root_release(SharedRoot *self);
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <limits.h>
+
+#include "gimli/image.h"
+#include "gimli/layer_store.h"
+
+int snapshot_find(const Image *image, char out_path[PATH_MAX]);
+
+int snapshot_create(const Image *image, LayerStore *layer_store,
+                    int *out_is_created);
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+
+// The maximal size of a message, including the strings packed in it.
+#define SOCKET_MESSAGE_MAX_SIZE 65536
+
+int socket_message_send(int fd, const void *data, size_t size, const int *fds,
+                        size_t fds_size);
+
+int socket_message_receive(int fd, void *data, size_t size, size_t *out_size,
+                           int *out_fds, size_t fds_size);
+
+int socket_message_pack_strings(const char *const *strings,
+                                size_t strings_size, char *buffer, size_t size,
+                                size_t *out_size);
+
+int socket_message_unpack_strings(char *data, size_t size, char ***out_strings,
+                                  size_t *out_strings_size);
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stddef.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+#include "gimli/log.h"
+
+pid_t spawn_process(int (*function)(void *), void *argument, int flags,
+                    int cgroup_fd, int *out_pidfd);
+
+int spawn_signal(int pidfd, int signal);
+
+int spawn_wait(pid_t pid, int pidfd, size_t timeout, Log *log,
+               int *out_status, struct rusage *out_rusage,
+               int *out_is_timed_out);
+
+int spawn_detached(int (*function)(void));
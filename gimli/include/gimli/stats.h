@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/resource.h>
+
+typedef struct StatsRecord {
+  const char *container;
+  const char *image;
+
+  // The wait status of the container's init, and whether it was killed for
+  // running past its timeout.
+  int status;
+  int is_timed_out;
+
+  // The container's wall-clock lifetime, in nanoseconds.
+  uint64_t duration;
+
+  // The resource usage of the container's init, along with the processes it
+  // has waited for.
+  struct rusage rusage;
+
+  // The usage of the container's cgroup as a JSON object, or NULL if the
+  // container has no cgroup.
+  char *cgroup_usage;
+} StatsRecord;
+
+FILE *stats_open(const char *path);
+
+void stats_close(FILE *file);
+
+int stats_read_cgroup_usage(int cgroup_fd, char **out_usage);
+
+int stats_write_record(FILE *file, const StatsRecord *record,
+                       int is_with_phases);
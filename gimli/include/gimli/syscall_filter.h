@@ -0,0 +1,3 @@
+#pragma once
+
+int syscall_filter_install(void);
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#define TAR_BLOCK_SIZE 512
+
+typedef enum TarEntryType {
+  TAR_ENTRY_TYPE_REGULAR = 0,
+  TAR_ENTRY_TYPE_HARD_LINK,
+  TAR_ENTRY_TYPE_SYMBOLIC_LINK,
+  TAR_ENTRY_TYPE_CHARACTER_DEVICE,
+  TAR_ENTRY_TYPE_BLOCK_DEVICE,
+  TAR_ENTRY_TYPE_DIRECTORY,
+  TAR_ENTRY_TYPE_FIFO,
+} TarEntryType;
+
+typedef struct TarXattr {
+  const char *name;
+  const char *value;
+  size_t value_size;
+} TarXattr;
+
+typedef struct TarEntry {
+  TarEntryType type;
+  const char *path;
+
+  // The target of a hard link or a symbolic link, which is empty for the
+  // other entry types.
+  const char *link_path;
+
+  // The permission bits of the entry, without its file type.
+  mode_t mode;
+  uid_t uid;
+  gid_t gid;
+
+  // The size of the entry's data, which follows its header.
+  uint64_t size;
+
+  struct timespec modification_time;
+  unsigned int device_major;
+  unsigned int device_minor;
+
+  // The extended attributes of the entry, which are given by PAX headers.
+  TarXattr *xattrs;
+  size_t xattrs_size;
+} TarEntry;
+
+// Reads exactly `size` bytes of the archive.
+typedef int (*TarRead)(void *context, void *buffer, size_t size);
+
+typedef struct TarReader {
+  TarRead read;
+  void *context;
+  TarEntry entry;
+
+  // The name and link fields of the current header, with room for the ustar
+  // prefix and the null terminators.
+  char path[256 + 1];
+  char link_path[100 + 1];
+
+  // The extended headers that apply to the next entry, which are released
+  // once the entry after it is read.
+  char *extended_header;
+  size_t extended_header_size;
+  char *long_path;
+  char *long_link_path;
+} TarReader;
+
+void tar_reader_init(TarReader *self, TarRead read, void *context);
+
+void tar_reader_destroy(TarReader *self);
+
+int tar_reader_next(TarReader *self, TarEntry **out_entry);
+
+uint64_t tar_get_padded_size(uint64_t size);
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+typedef enum TraceFormat {
+  // A Chrome trace-event JSON file, which can be loaded in chrome://tracing
+  // or Perfetto.
+  TRACE_FORMAT_CHROME = 0,
+
+  // A span per line, as "<pid> <start us> <duration us> <name>".
+  TRACE_FORMAT_LINES,
+} TraceFormat;
+
+int trace_init(const char *path, const char *format, int is_recording);
+
+uint64_t trace_begin(void);
+
+void trace_end(const char *name, uint64_t start);
+
+int trace_open_child_pipe(void);
+
+void trace_enter_child(void);
+
+void trace_collect_child(pid_t child_pid);
+
+void trace_write_phases(FILE *file);
+
+int trace_write(void);
@@ -0,0 +1,7 @@
+#pragma once
+
+int trash_move(const char *path, const char *name);
+
+int trash_reap(void);
+
+int trash_spawn_reaper(void);
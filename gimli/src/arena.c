@@ -0,0 +1,183 @@
+#include "gimli/arena.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jansson.h"
+
+// Allocations are aligned for any of the types stored in the arena.
+#define ARENA_ALIGNMENT 16
+
+// The size of a regular arena block.
+// Allocations that do not fit in a regular block are given a block of their
+// own.
+static const size_t ARENA_BLOCK_SIZE = 64 * 1024;
+
+struct ArenaBlock {
+  ArenaBlock *next;
+
+  // Pads the block header so that the block data is aligned.
+  char padding[ARENA_ALIGNMENT - sizeof(ArenaBlock *)];
+};
+
+// The arena that Jansson allocates from on the current thread (if any).
+static __thread Arena *json_arena = NULL;
+
+static pthread_once_t json_alloc_funcs_once = PTHREAD_ONCE_INIT;
+
+static size_t align_size(size_t size) {
+  return (size + (ARENA_ALIGNMENT - 1)) & ~((size_t)ARENA_ALIGNMENT - 1);
+}
+
+static ArenaBlock *allocate_block(Arena *self, size_t data_size) {
+  ArenaBlock *block = malloc(sizeof(*block) + data_size);
+  if (NULL == block) {
+    return NULL;
+  }
+
+  block->next = self->blocks;
+  self->blocks = block;
+
+  return block;
+}
+
+static void *json_allocate(size_t size) {
+  // Allocations made outside of an arena scope are regular heap allocations.
+  if (NULL == json_arena) {
+    return malloc(size);
+  }
+
+  return arena_allocate(json_arena, size);
+}
+
+static void json_free(void *pointer) {
+  // Memory allocated from an arena is released along with the arena.
+  if (NULL == json_arena) {
+    free(pointer);
+  }
+}
+
+static void set_json_alloc_funcs(void) {
+  json_set_alloc_funcs(json_allocate, json_free);
+}
+
+void arena_init(Arena *self) {
+  self->blocks = NULL;
+  self->cursor = NULL;
+  self->end = NULL;
+}
+
+void arena_destroy(Arena *self) {
+  ArenaBlock *block = self->blocks;
+  while (NULL != block) {
+    ArenaBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+
+  arena_init(self);
+}
+
+void *arena_allocate(Arena *self, size_t size) {
+  // Empty allocations are given a byte, so that they still return a unique
+  // pointer.
+  size_t aligned_size = align_size((0 == size) ? 1 : size);
+
+  // Allocate from the current block if it has enough room.
+  if (aligned_size <= (size_t)(self->end - self->cursor)) {
+    void *allocation = self->cursor;
+    self->cursor += aligned_size;
+    return allocation;
+  }
+
+  // Give large allocations a block of their own, so that the rest of the
+  // current block is not wasted.
+  if (aligned_size > (ARENA_BLOCK_SIZE / 4)) {
+    ArenaBlock *block = allocate_block(self, aligned_size);
+    if (NULL == block) {
+      return NULL;
+    }
+
+    return block + 1;
+  }
+
+  // Start a new regular block.
+  ArenaBlock *block = allocate_block(self, ARENA_BLOCK_SIZE);
+  if (NULL == block) {
+    return NULL;
+  }
+
+  self->cursor = (char *)(block + 1);
+  self->end = self->cursor + ARENA_BLOCK_SIZE;
+
+  void *allocation = self->cursor;
+  self->cursor += aligned_size;
+
+  return allocation;
+}
+
+char *arena_duplicate_string(Arena *self, const char *string) {
+  size_t string_size = strlen(string) + 1;
+
+  char *duplicate = arena_allocate(self, string_size);
+  if (NULL == duplicate) {
+    return NULL;
+  }
+
+  memcpy(duplicate, string, string_size);
+
+  return duplicate;
+}
+
+char *arena_format_string(Arena *self, const char *format, ...) {
+  // Calculate the formatted string's size.
+  // 1 is added for the null terminator which is appended by vsnprintf but is
+  // not included in its return value.
+  va_list arguments;
+  va_start(arguments, format);
+  int string_size = vsnprintf(NULL, 0, format, arguments);
+  va_end(arguments);
+
+  if (0 > string_size) {
+    return NULL;
+  }
+
+  char *string = arena_allocate(self, (size_t)string_size + 1);
+  if (NULL == string) {
+    return NULL;
+  }
+
+  // Format the string.
+  va_start(arguments, format);
+  vsnprintf(string, (size_t)string_size + 1, format, arguments);
+  va_end(arguments);
+
+  return string;
+}
+
+void arena_adopt(Arena *self, Arena *other) {
+  // Find the last block of the other arena.
+  ArenaBlock **last_next = &other->blocks;
+  while (NULL != (*last_next)) {
+    last_next = &((*last_next)->next);
+  }
+
+  // Move the other arena's blocks in front of this arena's blocks.
+  // Allocation continues from this arena's current block.
+  *last_next = self->blocks;
+  self->blocks = other->blocks;
+
+  arena_init(other);
+}
+
+void arena_begin_json(Arena *self) {
+  pthread_once(&json_alloc_funcs_once, set_json_alloc_funcs);
+
+  json_arena = self;
+}
+
+void arena_end_json(void) { json_arena = NULL; }
@@ -0,0 +1,661 @@
+#define _GNU_SOURCE
+
+#include "gimli/batch.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gimli/cgroup.h"
+#include "gimli/container.h"
+#include "gimli/log.h"
+#include "gimli/shared_root.h"
+#include "gimli/spawn.h"
+#include "gimli/stats.h"
+#include "gimli/uuid.h"
+#include "stb_ds/stb_ds.h"
+
+// The longest job line, including its newline.
+#define BATCH_LINE_MAX_SIZE (64 * 1024)
+
+// The characters that separate the image and the command parts of a job.
+#define BATCH_JOB_SEPARATORS " \t\r"
+
+// Lines that start with this character are comments.
+#define BATCH_COMMENT_PREFIX '#'
+
+static const uint64_t NANOSECONDS_PER_SECOND = 1000 * 1000 * 1000;
+static const uint64_t NANOSECONDS_PER_MILLISECOND = 1000 * 1000;
+
+typedef struct BatchJob {
+  // The number of the job's line in the input, starting from 1.
+  size_t line_number;
+  char *image_name;
+
+  pid_t pid;
+  int pidfd;
+
+  uint64_t start;
+
+  // The time at which the job is killed, or 0 if it is not limited.
+  uint64_t deadline;
+  int is_timed_out;
+
+  char *hostname;
+  char directory[PATH_MAX];
+  char root_fs_directory[PATH_MAX];
+
+  // The image's read-only root, which the job shares in read-only batches.
+  SharedRoot shared_root;
+
+  // The job's cgroup, if the batch sets limits.
+  Cgroup cgroup;
+
+  // The job's log, if the batch logs its jobs' output.
+  Log log;
+} BatchJob;
+
+typedef struct Batch {
+  ImageStore *image_store;
+  LayerStore *layer_store;
+  const BatchConfiguration *configuration;
+
+  // The jobs that are running.
+  BatchJob **jobs;
+
+  // The input that has been read but not yet started.
+  int input_fd;
+  int is_input_done;
+  int is_discarding_line;
+  char *input;
+  size_t input_size;
+  size_t line_number;
+
+  int signal_fd;
+  int is_stopping;
+
+  size_t started_size;
+  size_t failed_size;
+} Batch;
+
+static uint64_t get_monotonic_time(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+
+  return ((uint64_t)time.tv_sec * NANOSECONDS_PER_SECOND) +
+         (uint64_t)time.tv_nsec;
+}
+
+static void report_failure(Batch *self, size_t line_number,
+                           const char *image_name, const char *reason) {
+  printf("=> job (%zu) [%s] failed, %s\n", line_number, image_name, reason);
+  fflush(stdout);
+
+  ++self->failed_size;
+}
+
+static void remove_job_cgroup(BatchJob *job) {
+  if (0 != cgroup_remove(&job->cgroup)) {
+    printf("=> job (%zu) [%s] failed removing cgroup [%s], error(%d): [%s]\n",
+           job->line_number, job->image_name, job->cgroup.directory, errno,
+           strerror(errno));
+  }
+}
+
+static void remove_job_root(Batch *self, BatchJob *job) {
+  if (self->configuration->is_read_only) {
+    shared_root_release(&job->shared_root);
+  } else {
+    container_remove_directory(job->directory, job->root_fs_directory,
+                               job->hostname);
+  }
+}
+
+static void start_job(Batch *self, char *line) {
+  ++self->line_number;
+
+  // Skip blank lines and comments.
+  char *save_pointer;
+  char *image_name = strtok_r(line, BATCH_JOB_SEPARATORS, &save_pointer);
+  if ((NULL == image_name) || (BATCH_COMMENT_PREFIX == image_name[0])) {
+    return;
+  }
+
+  ++self->started_size;
+
+  // Split the command, which points into the line until the job is cloned.
+  char **command = NULL;
+  for (char *part = strtok_r(NULL, BATCH_JOB_SEPARATORS, &save_pointer);
+       NULL != part;
+       part = strtok_r(NULL, BATCH_JOB_SEPARATORS, &save_pointer)) {
+    arrput(command, part);
+  }
+
+  if (0 == arrlen(command)) {
+    report_failure(self, self->line_number, image_name, "no command");
+    goto out_free_command;
+  }
+
+  arrput(command, NULL);
+
+  // Jobs that cannot be started fail on their own, without stopping the
+  // batch, and are reported as soon as they fail, before their error is lost
+  // to the cleanup.
+  Image *image = image_store_get_image_by_name(self->image_store, image_name);
+  if (NULL == image) {
+    report_failure(self, self->line_number, image_name, "no such image");
+    goto out_free_command;
+  }
+
+  if (0 != layer_store_load_image_layers(self->layer_store, image)) {
+    report_failure(self, self->line_number, image_name, strerror(errno));
+    goto out_free_command;
+  }
+
+  BatchJob *job = malloc(sizeof(*job));
+  if (NULL == job) {
+    report_failure(self, self->line_number, image_name, strerror(errno));
+    goto out_free_command;
+  }
+
+  job->line_number = self->line_number;
+  job->is_timed_out = 0;
+
+  job->image_name = strdup(image_name);
+  if (NULL == job->image_name) {
+    report_failure(self, self->line_number, image_name, strerror(errno));
+    goto out_free_job;
+  }
+
+  if (0 != uuid_generate(&job->hostname)) {
+    report_failure(self, self->line_number, image_name, strerror(errno));
+    goto out_free_image_name;
+  }
+
+  container_format_directories(job->hostname, job->directory,
+                               job->root_fs_directory);
+
+  // Mount the image's shared read-only root, or else create the container
+  // directory.
+  if (self->configuration->is_read_only) {
+    if (0 != shared_root_acquire(&job->shared_root, image,
+                                 self->layer_store)) {
+      report_failure(self, self->line_number, image_name, strerror(errno));
+      goto out_free_hostname;
+    }
+  } else if (0 != mkdir(job->directory, 0755)) {
+    report_failure(self, self->line_number, image_name, strerror(errno));
+    goto out_free_hostname;
+  }
+
+  // Create the job's cgroup, which it is cloned into.
+  int is_limited = cgroup_limits_is_set(self->configuration->cgroup_limits);
+  if (is_limited && (0 != cgroup_create(&job->cgroup, job->hostname,
+                                        self->configuration->cgroup_limits))) {
+    report_failure(self, self->line_number, image_name, strerror(errno));
+    goto out_remove_directory;
+  }
+
+  // Open the job's log, which its output is moved to.
+  const LogConfiguration *log_configuration =
+      self->configuration->log_configuration;
+  int log_write_fd = -1;
+  if ((NULL != log_configuration) &&
+      (0 != log_open(&job->log, log_configuration, job->hostname,
+                     &log_write_fd))) {
+    report_failure(self, self->line_number, image_name, strerror(errno));
+    goto out_remove_cgroup;
+  }
+
+  // Clone the container.
+  ContainerConfiguration container_configuration = {
+      .image = image,
+      .directory = job->directory,
+      .root_fs_directory = job->root_fs_directory,
+      .hostname = job->hostname,
+      .command = command,
+      .layer_store = self->layer_store,
+      .shared_root_directory = self->configuration->is_read_only
+                                   ? job->shared_root.directory
+                                   : NULL,
+      .ephemeral_size = self->configuration->ephemeral_size,
+      .cgroup_fd = is_limited ? job->cgroup.fd : -1,
+      .log_fd = log_write_fd,
+      .control_fd = -1,
+  };
+
+  size_t timeout = self->configuration->timeout;
+
+  job->start = get_monotonic_time();
+  job->deadline =
+      (0 == timeout)
+          ? 0
+          : job->start + ((uint64_t)timeout * NANOSECONDS_PER_SECOND);
+
+  job->pidfd = -1;
+  job->pid = container_clone(&container_configuration, &job->pidfd);
+  int clone_errno = errno;
+
+  // The job holds the log's pipe from now on, so that the log ends once the
+  // job has exited.
+  if (-1 != log_write_fd) {
+    close(log_write_fd);
+  }
+
+  if (-1 == job->pid) {
+    report_failure(self, self->line_number, image_name, strerror(clone_errno));
+    goto out_close_log;
+  }
+
+  arrput(self->jobs, job);
+  goto out_free_command;
+
+out_close_log:
+  if (NULL != log_configuration) {
+    log_close(&job->log);
+  }
+
+out_remove_cgroup:
+  if (is_limited) {
+    remove_job_cgroup(job);
+  }
+
+out_remove_directory:
+  remove_job_root(self, job);
+
+out_free_hostname:
+  free(job->hostname);
+
+out_free_image_name:
+  free(job->image_name);
+
+out_free_job:
+  free(job);
+
+out_free_command:
+  arrfree(command);
+}
+
+static void finish_job(Batch *self, size_t job_index) {
+  BatchJob *job = self->jobs[job_index];
+
+  int is_limited = cgroup_limits_is_set(self->configuration->cgroup_limits);
+  int is_logged = NULL != self->configuration->log_configuration;
+  FILE *stats_file = self->configuration->stats_file;
+
+  // The job has exited, so it is reaped right away.
+  int status;
+  struct rusage rusage;
+  int wait_result = wait4(job->pid, &status, 0, &rusage);
+  int wait_errno = errno;
+
+  // Move the rest of the job's output to its log, which has ended along with
+  // the job.
+  if (is_logged) {
+    log_drain(&job->log);
+
+    if (0 != job->log.error) {
+      report_failure(self, job->line_number, job->image_name,
+                     strerror(job->log.error));
+    }
+
+    if (0 != job->log.dropped_size) {
+      printf("=> job (%zu) [%s] dropped (%zu) bytes of output\n",
+             job->line_number, job->image_name, job->log.dropped_size);
+    }
+  }
+
+  if (-1 == wait_result) {
+    report_failure(self, job->line_number, job->image_name,
+                   strerror(wait_errno));
+  } else {
+    uint64_t duration_nanoseconds = get_monotonic_time() - job->start;
+    double duration =
+        (double)duration_nanoseconds / (double)NANOSECONDS_PER_MILLISECOND;
+    int exit_code = WIFEXITED(status) ? WEXITSTATUS(status)
+                                      : (128 + WTERMSIG(status));
+
+    printf("=> job (%zu) [%s] %s with code (%d) in (%.3f) ms\n",
+           job->line_number, job->image_name,
+           job->is_timed_out ? "timed out" : "exited", exit_code, duration);
+
+    if ((0 != exit_code) || job->is_timed_out) {
+      ++self->failed_size;
+    }
+
+    // Record the job's usage, which its cgroup only holds until it is
+    // removed.
+    if (NULL != stats_file) {
+      StatsRecord record = {
+          .container = job->hostname,
+          .image = job->image_name,
+          .status = status,
+          .is_timed_out = job->is_timed_out,
+          .duration = duration_nanoseconds,
+          .rusage = rusage,
+          .cgroup_usage = NULL,
+      };
+
+      if (is_limited) {
+        stats_read_cgroup_usage(job->cgroup.fd, &record.cgroup_usage);
+      }
+
+      stats_write_record(stats_file, &record, 0);
+      free(record.cgroup_usage);
+    }
+  }
+
+  // Stream the results, even when the output is not a terminal.
+  fflush(stdout);
+
+  close(job->pidfd);
+
+  if (is_logged) {
+    log_close(&job->log);
+  }
+
+  if (is_limited) {
+    remove_job_cgroup(job);
+  }
+
+  remove_job_root(self, job);
+
+  free(job->hostname);
+  free(job->image_name);
+  free(job);
+
+  arrdelswap(self->jobs, job_index);
+}
+
+static void start_buffered_jobs(Batch *self) {
+  while ((!self->is_stopping) &&
+         ((size_t)arrlen(self->jobs) < self->configuration->concurrency)) {
+    char *newline = memchr(self->input, '\n', self->input_size);
+
+    // Take the rest of the input as the last line once it has ended.
+    if ((NULL == newline) &&
+        ((!self->is_input_done) || (0 == self->input_size))) {
+      return;
+    }
+
+    size_t line_size = (NULL == newline)
+                           ? self->input_size
+                           : (size_t)(newline - self->input) + 1;
+
+    // Terminate the line in place of its newline, or after the last line,
+    // which is never at the end of the buffer once the input has ended.
+    self->input[(NULL == newline) ? line_size : (line_size - 1)] = '\0';
+
+    if (!self->is_discarding_line) {
+      start_job(self, self->input);
+    }
+
+    self->is_discarding_line = 0;
+
+    memmove(self->input, self->input + line_size,
+            self->input_size - line_size);
+    self->input_size -= line_size;
+  }
+}
+
+static int read_input(Batch *self) {
+  // A line that does not fit in the buffer fails, and the rest of it is
+  // discarded.
+  if (BATCH_LINE_MAX_SIZE == self->input_size) {
+    if (!self->is_discarding_line) {
+      ++self->line_number;
+      ++self->started_size;
+      report_failure(self, self->line_number, "", "line too long");
+    }
+
+    self->is_discarding_line = 1;
+    self->input_size = 0;
+  }
+
+  ssize_t bytes_read = read(self->input_fd, self->input + self->input_size,
+                            BATCH_LINE_MAX_SIZE - self->input_size);
+  if (-1 == bytes_read) {
+    return ((EAGAIN == errno) || (EINTR == errno)) ? 0 : 1;
+  }
+
+  if (0 == bytes_read) {
+    self->is_input_done = 1;
+  }
+
+  self->input_size += (size_t)bytes_read;
+
+  return 0;
+}
+
+static int handle_signals(Batch *self) {
+  for (;;) {
+    struct signalfd_siginfo signal_information;
+    ssize_t bytes_read = read(self->signal_fd, &signal_information,
+                              sizeof(signal_information));
+    if (-1 == bytes_read) {
+      return ((EAGAIN == errno) || (EINTR == errno)) ? 0 : 1;
+    }
+
+    // Stop starting jobs, and pass the signal on to the running ones.
+    self->is_stopping = 1;
+
+    for (ptrdiff_t job_index = 0; job_index < arrlen(self->jobs);
+         ++job_index) {
+      spawn_signal(self->jobs[job_index]->pidfd,
+                   (int)signal_information.ssi_signo);
+    }
+  }
+}
+
+static int enforce_deadlines(Batch *self) {
+  uint64_t now = get_monotonic_time();
+  uint64_t deadline = 0;
+
+  for (ptrdiff_t job_index = 0; job_index < arrlen(self->jobs); ++job_index) {
+    BatchJob *job = self->jobs[job_index];
+    if (0 == job->deadline) {
+      continue;
+    }
+
+    // Kill the job once it has run out of time, and keep waiting for it to
+    // exit.
+    if (now >= job->deadline) {
+      spawn_signal(job->pidfd, SIGKILL);
+      job->is_timed_out = 1;
+      job->deadline = 0;
+      continue;
+    }
+
+    if ((0 == deadline) || (job->deadline < deadline)) {
+      deadline = job->deadline;
+    }
+  }
+
+  // Wait until the nearest deadline.
+  if (0 == deadline) {
+    return -1;
+  }
+
+  // Round up, so that the deadline has passed when the poll times out.
+  uint64_t timeout = (deadline - now + NANOSECONDS_PER_MILLISECOND - 1) /
+                     NANOSECONDS_PER_MILLISECOND;
+
+  return (INT_MAX < timeout) ? INT_MAX : (int)timeout;
+}
+
+static int supervise(Batch *self, struct pollfd *poll_fds) {
+  for (;;) {
+    start_buffered_jobs(self);
+
+    int is_accepting_jobs =
+        (!self->is_stopping) && (!self->is_input_done) &&
+        ((size_t)arrlen(self->jobs) < self->configuration->concurrency);
+    if ((0 == arrlen(self->jobs)) && (!is_accepting_jobs)) {
+      return 0;
+    }
+
+    // Wait for the signals, for the running jobs, and for more input while
+    // there is room for more jobs.
+    size_t poll_fds_size = 0;
+    poll_fds[poll_fds_size++] =
+        (struct pollfd){.fd = self->signal_fd, .events = POLLIN, .revents = 0};
+    poll_fds[poll_fds_size++] = (struct pollfd){
+        .fd = is_accepting_jobs ? self->input_fd : -1,
+        .events = POLLIN,
+        .revents = 0,
+    };
+
+    // Each job is polled for its exit, and for its output while it is
+    // logged.
+    int is_logged = NULL != self->configuration->log_configuration;
+    for (ptrdiff_t job_index = 0; job_index < arrlen(self->jobs);
+         ++job_index) {
+      BatchJob *job = self->jobs[job_index];
+      poll_fds[poll_fds_size++] =
+          (struct pollfd){.fd = job->pidfd, .events = POLLIN, .revents = 0};
+      poll_fds[poll_fds_size++] = (struct pollfd){
+          .fd = (is_logged && (!job->log.is_closed)) ? job->log.pipe_fd : -1,
+          .events = POLLIN,
+          .revents = 0,
+      };
+    }
+
+    int ready =
+        poll(poll_fds, (nfds_t)poll_fds_size, enforce_deadlines(self));
+    if (-1 == ready) {
+      if (EINTR == errno) {
+        continue;
+      }
+
+      return 1;
+    }
+
+    if (0 != (poll_fds[0].revents & POLLIN)) {
+      if (0 != handle_signals(self)) {
+        return 1;
+      }
+    }
+
+    // Log the jobs' output, and finish the exited jobs, from the last one, as
+    // finishing a job moves the last job into its place.
+    // The jobs are polled after the signals and the input.
+    for (size_t job_index = (poll_fds_size - 2) / 2; job_index > 0;
+         --job_index) {
+      const struct pollfd *job_poll_fds = &poll_fds[2 + (2 * (job_index - 1))];
+      if (0 != job_poll_fds[1].revents) {
+        log_pump(&self->jobs[job_index - 1]->log);
+      }
+
+      if (0 != job_poll_fds[0].revents) {
+        finish_job(self, job_index - 1);
+      }
+    }
+
+    if (0 != (poll_fds[1].revents & (POLLIN | POLLHUP))) {
+      if (0 != read_input(self)) {
+        return 1;
+      }
+    }
+  }
+}
+
+int batch_run(ImageStore *image_store, LayerStore *layer_store, int input_fd,
+              const BatchConfiguration *configuration,
+              size_t *out_failed_size) {
+  int ret = 1;
+
+  Batch batch = {
+      .image_store = image_store,
+      .layer_store = layer_store,
+      .configuration = configuration,
+      .jobs = NULL,
+      .input_fd = input_fd,
+      .is_input_done = 0,
+      .is_discarding_line = 0,
+      .input = NULL,
+      .input_size = 0,
+      .line_number = 0,
+      .signal_fd = -1,
+      .is_stopping = 0,
+      .started_size = 0,
+      .failed_size = 0,
+  };
+
+  // Keep an extra byte to terminate the last line, which may not end with a
+  // newline.
+  batch.input = malloc(BATCH_LINE_MAX_SIZE + 1);
+  if (NULL == batch.input) {
+    goto out;
+  }
+
+  // Poll the signals, the input, and every running job along with its log.
+  struct pollfd *poll_fds =
+      malloc(((2 * configuration->concurrency) + 2) * sizeof(*poll_fds));
+  if (NULL == poll_fds) {
+    goto out_free_input;
+  }
+
+  // Handle stop requests through a file descriptor, so that they are handled
+  // along with the jobs.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+
+  sigset_t previous_signals;
+  if (0 != sigprocmask(SIG_BLOCK, &signals, &previous_signals)) {
+    goto out_free_poll_fds;
+  }
+
+  batch.signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (-1 == batch.signal_fd) {
+    goto out_restore_signals;
+  }
+
+  ret = supervise(&batch, poll_fds);
+
+  // Preserve the error of the supervising loop while the running jobs are
+  // waited for.
+  int supervise_errno = errno;
+
+  while (0 < arrlen(batch.jobs)) {
+    BatchJob *job = batch.jobs[arrlen(batch.jobs) - 1];
+    spawn_signal(job->pidfd, SIGKILL);
+    finish_job(&batch, (size_t)(arrlen(batch.jobs) - 1));
+  }
+
+  printf("=> batch finished, (%zu) jobs, (%zu) failed\n", batch.started_size,
+         batch.failed_size);
+
+  *out_failed_size = batch.failed_size;
+
+  errno = supervise_errno;
+
+  close(batch.signal_fd);
+
+out_restore_signals:
+  sigprocmask(SIG_SETMASK, &previous_signals, NULL);
+
+out_free_poll_fds:
+  free(poll_fds);
+
+out_free_input:
+  free(batch.input);
+
+out:
+  arrfree(batch.jobs);
+
+  return ret;
+}
@@ -0,0 +1,291 @@
+#define _GNU_SOURCE
+
+#include "gimli/cgroup.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/magic.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// The places that the cgroup v2 hierarchy is mounted at, either on its own or
+// next to the v1 hierarchies.
+static const char *const CGROUP_MOUNT_DIRECTORIES[] = {
+    "/sys/fs/cgroup",
+    "/sys/fs/cgroup/unified",
+};
+
+// The cgroup that the containers' cgroups are created in, relative to the
+// root of the hierarchy.
+// It never holds processes of its own, so that it can pass controllers on to
+// the containers' cgroups.
+#define CGROUP_DIRECTORY "gimli"
+
+#define CGROUP_SUBTREE_CONTROL_FILE "cgroup.subtree_control"
+#define CGROUP_EVENTS_FILE "cgroup.events"
+#define CGROUP_KILL_FILE "cgroup.kill"
+
+// How long (in milliseconds) a cgroup that still has processes is waited for
+// to become empty once they have been killed.
+#define CGROUP_EMPTY_TIMEOUT 1000
+
+// A limit, along with the interface file that it is written to and the
+// controller that the file belongs to.
+typedef struct CgroupSetting {
+  const char *file;
+  const char *controller;
+  const char *value;
+} CgroupSetting;
+
+// The cgroup v2 hierarchy's mount, once it has been found.
+static const char *cgroup_mount_directory = NULL;
+
+int cgroup_limits_is_set(const CgroupLimits *limits) {
+  return (NULL != limits->cpu_max) || (NULL != limits->cpu_weight) ||
+         (NULL != limits->cpuset_cpus) || (NULL != limits->cpuset_mems) ||
+         (NULL != limits->memory_max) || (NULL != limits->memory_high) ||
+         (NULL != limits->io_max);
+}
+
+static const char *find_mount_directory(void) {
+  if (NULL != cgroup_mount_directory) {
+    return cgroup_mount_directory;
+  }
+
+  for (size_t directory_index = 0;
+       directory_index < (sizeof(CGROUP_MOUNT_DIRECTORIES) /
+                          sizeof(*CGROUP_MOUNT_DIRECTORIES));
+       ++directory_index) {
+    struct statfs statfs_buffer;
+    if ((0 == statfs(CGROUP_MOUNT_DIRECTORIES[directory_index],
+                     &statfs_buffer)) &&
+        (CGROUP2_SUPER_MAGIC == statfs_buffer.f_type)) {
+      cgroup_mount_directory = CGROUP_MOUNT_DIRECTORIES[directory_index];
+      return cgroup_mount_directory;
+    }
+  }
+
+  errno = ENOENT;
+  return NULL;
+}
+
+static int write_file(int directory_fd, const char *file, const char *value) {
+  int fd = openat(directory_fd, file, O_WRONLY | O_CLOEXEC);
+  if (-1 == fd) {
+    return 1;
+  }
+
+  size_t value_size = strlen(value);
+  int ret = ((ssize_t)value_size == write(fd, value, value_size)) ? 0 : 1;
+
+  close(fd);
+
+  return ret;
+}
+
+static int enable_controllers(const char *directory,
+                              const CgroupSetting *settings,
+                              size_t settings_size) {
+  int fd = open(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (-1 == fd) {
+    return 1;
+  }
+
+  // Enabling a controller that is already enabled has no effect, so each
+  // setting enables its own.
+  int ret = 0;
+  for (size_t setting_index = 0; setting_index < settings_size;
+       ++setting_index) {
+    char control[32];
+    snprintf(control, sizeof(control), "+%s",
+             settings[setting_index].controller);
+
+    if (0 != write_file(fd, CGROUP_SUBTREE_CONTROL_FILE, control)) {
+      ret = 1;
+      break;
+    }
+  }
+
+  close(fd);
+
+  return ret;
+}
+
+int cgroup_create(Cgroup *self, const char *name, const CgroupLimits *limits) {
+  int ret = 1;
+
+  // The CPUs and memory nodes are set first, as the other limits do not
+  // depend on them.
+  const CgroupSetting all_settings[] = {
+      {.file = "cpuset.cpus", .controller = "cpuset",
+       .value = limits->cpuset_cpus},
+      {.file = "cpuset.mems", .controller = "cpuset",
+       .value = limits->cpuset_mems},
+      {.file = "cpu.max", .controller = "cpu", .value = limits->cpu_max},
+      {.file = "cpu.weight", .controller = "cpu", .value = limits->cpu_weight},
+      {.file = "memory.max", .controller = "memory",
+       .value = limits->memory_max},
+      {.file = "memory.high", .controller = "memory",
+       .value = limits->memory_high},
+      {.file = "io.max", .controller = "io", .value = limits->io_max},
+  };
+
+  // Keep only the limits that are set.
+  CgroupSetting settings[sizeof(all_settings) / sizeof(*all_settings)];
+  size_t settings_size = 0;
+  for (size_t setting_index = 0;
+       setting_index < (sizeof(all_settings) / sizeof(*all_settings));
+       ++setting_index) {
+    if (NULL != all_settings[setting_index].value) {
+      settings[settings_size++] = all_settings[setting_index];
+    }
+  }
+
+  const char *mount_directory = find_mount_directory();
+  if (NULL == mount_directory) {
+    goto out;
+  }
+
+  // Create the cgroup that the containers' cgroups are created in, and pass
+  // the controllers of the limits down to them.
+  char parent_directory[PATH_MAX];
+  int parent_directory_size =
+      snprintf(parent_directory, sizeof(parent_directory),
+               "%s/" CGROUP_DIRECTORY, mount_directory);
+  if ((0 > parent_directory_size) ||
+      (sizeof(parent_directory) <= (size_t)parent_directory_size)) {
+    errno = ENAMETOOLONG;
+    goto out;
+  }
+
+  if ((0 != mkdir(parent_directory, 0755)) && (EEXIST != errno)) {
+    goto out;
+  }
+
+  if ((0 != enable_controllers(mount_directory, settings, settings_size)) ||
+      (0 != enable_controllers(parent_directory, settings, settings_size))) {
+    goto out;
+  }
+
+  // Create the container's cgroup and set its limits.
+  int directory_size = snprintf(self->directory, sizeof(self->directory),
+                                "%s/%s", parent_directory, name);
+  if ((0 > directory_size) ||
+      (sizeof(self->directory) <= (size_t)directory_size)) {
+    errno = ENAMETOOLONG;
+    goto out;
+  }
+
+  if (0 != mkdir(self->directory, 0755)) {
+    goto out;
+  }
+
+  self->fd = open(self->directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (-1 == self->fd) {
+    goto out_remove_directory;
+  }
+
+  for (size_t setting_index = 0; setting_index < settings_size;
+       ++setting_index) {
+    if (0 != write_file(self->fd, settings[setting_index].file,
+                        settings[setting_index].value)) {
+      goto out_close_fd;
+    }
+  }
+
+  ret = 0;
+  goto out;
+
+out_close_fd:
+  close(self->fd);
+
+out_remove_directory:
+  // Preserve the error while the cgroup is removed.
+  {
+    int create_errno = errno;
+    rmdir(self->directory);
+    errno = create_errno;
+  }
+
+out:
+  return ret;
+}
+
+static int is_populated(int events_fd) {
+  char events[256];
+  ssize_t events_size = pread(events_fd, events, sizeof(events) - 1, 0);
+  if (0 >= events_size) {
+    return 1;
+  }
+
+  events[events_size] = '\0';
+
+  return NULL == strstr(events, "populated 0");
+}
+
+static int wait_for_empty(int fd) {
+  int events_fd = openat(fd, CGROUP_EVENTS_FILE, O_RDONLY | O_CLOEXEC);
+  if (-1 == events_fd) {
+    return 1;
+  }
+
+  // The events file is modified once the last process is gone.
+  int ret = 0;
+  while (is_populated(events_fd)) {
+    struct pollfd poll_fd = {.fd = events_fd, .events = POLLPRI, .revents = 0};
+    int ready = poll(&poll_fd, 1, CGROUP_EMPTY_TIMEOUT);
+    if ((-1 == ready) && (EINTR == errno)) {
+      continue;
+    }
+
+    if (0 >= ready) {
+      if (0 == ready) {
+        errno = EBUSY;
+      }
+
+      ret = 1;
+      break;
+    }
+  }
+
+  close(events_fd);
+
+  return ret;
+}
+
+int cgroup_remove(Cgroup *self) {
+  int ret = 1;
+
+  // The cgroup is normally empty once its container has been waited for, as a
+  // pid namespace's processes are all gone once its init has exited, but they
+  // may still be exiting (or may have been moved out of the namespace's
+  // reach), so whatever is left is killed (since Linux 5.14).
+  if (0 != rmdir(self->directory)) {
+    if (EBUSY != errno) {
+      goto out_close_fd;
+    }
+
+    if ((0 != write_file(self->fd, CGROUP_KILL_FILE, "1")) ||
+        (0 != wait_for_empty(self->fd)) || (0 != rmdir(self->directory))) {
+      goto out_close_fd;
+    }
+  }
+
+  ret = 0;
+
+out_close_fd:
+  // Preserve the error while the cgroup is closed.
+  {
+    int remove_errno = errno;
+    close(self->fd);
+    errno = remove_errno;
+  }
+
+  return ret;
+}
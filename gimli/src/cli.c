@@ -1,9 +1,100 @@
 #include "gimli/cli.h"
 
+#include <errno.h>
+#include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "gimli/cgroup.h"
+
+// The subcommand that runs a container.
+// It may be omitted, in which case the image is the first argument.
+#define CLI_RUN_COMMAND "run"
+
+// The subcommand that keeps a pool of containers ready to run commands.
+#define CLI_POOL_COMMAND "pool"
+
+// The subcommand that flattens the layers of images into snapshots.
+#define CLI_SNAPSHOT_COMMAND "snapshot"
+
+// The subcommand that runs the container commands of a job file.
+#define CLI_BATCH_COMMAND "batch"
+
+// The subcommand that fills the pool of network namespaces.
+#define CLI_NETNS_COMMAND "netns"
+
+// The subcommand that loads the images of a docker save archive.
+#define CLI_LOAD_COMMAND "load"
+
+// The subcommand that shares the contents of identical layer files.
+#define CLI_DEDUPE_COMMAND "dedupe"
+
+// The job file (or archive) argument that stands for the standard input.
+#define CLI_STANDARD_INPUT_PATH "-"
+
+// The longest size limit of an ephemeral container, which leaves room for
+// the rest of its mount data.
+#define CLI_EPHEMERAL_SIZE_MAX_LENGTH 32
+
+// The number of containers that a pool keeps ready for each image by default.
+#define CLI_DEFAULT_POOL_SIZE 4
+
+// The number of network namespaces that are kept ready by default.
+#define CLI_DEFAULT_NETNS_SIZE 16
+
+// The size that the containers' logs are rotated at by default.
+#define CLI_DEFAULT_LOG_SIZE (64 * 1024 * 1024)
+
+enum Option {
+  OPTION_TRACE = 0,
+  OPTION_TRACE_FORMAT,
+  OPTION_POOL,
+  OPTION_SOCKET,
+  OPTION_SIZE,
+  OPTION_TIMEOUT,
+  OPTION_JOBS,
+  OPTION_READ_ONLY,
+  OPTION_EPHEMERAL,
+  OPTION_CPU_MAX,
+  OPTION_CPU_WEIGHT,
+  OPTION_CPUSET_CPUS,
+  OPTION_CPUSET_MEMS,
+  OPTION_MEMORY_MAX,
+  OPTION_MEMORY_HIGH,
+  OPTION_IO_MAX,
+  OPTION_STATS,
+  OPTION_LOG,
+  OPTION_LOG_SIZE,
+  OPTION_LOG_TIMESTAMPS,
+  OPTION_LOG_NON_BLOCKING,
+};
+
+static const struct option OPTIONS[] = {
+    {"trace", required_argument, NULL, OPTION_TRACE},
+    {"trace-format", required_argument, NULL, OPTION_TRACE_FORMAT},
+    {"pool", required_argument, NULL, OPTION_POOL},
+    {"socket", required_argument, NULL, OPTION_SOCKET},
+    {"size", required_argument, NULL, OPTION_SIZE},
+    {"timeout", required_argument, NULL, OPTION_TIMEOUT},
+    {"jobs", required_argument, NULL, OPTION_JOBS},
+    {"read-only", no_argument, NULL, OPTION_READ_ONLY},
+    {"ephemeral", required_argument, NULL, OPTION_EPHEMERAL},
+    {"cpu-max", required_argument, NULL, OPTION_CPU_MAX},
+    {"cpu-weight", required_argument, NULL, OPTION_CPU_WEIGHT},
+    {"cpuset-cpus", required_argument, NULL, OPTION_CPUSET_CPUS},
+    {"cpuset-mems", required_argument, NULL, OPTION_CPUSET_MEMS},
+    {"memory-max", required_argument, NULL, OPTION_MEMORY_MAX},
+    {"memory-high", required_argument, NULL, OPTION_MEMORY_HIGH},
+    {"io-max", required_argument, NULL, OPTION_IO_MAX},
+    {"stats", required_argument, NULL, OPTION_STATS},
+    {"log", required_argument, NULL, OPTION_LOG},
+    {"log-size", required_argument, NULL, OPTION_LOG_SIZE},
+    {"log-timestamps", no_argument, NULL, OPTION_LOG_TIMESTAMPS},
+    {"log-non-blocking", no_argument, NULL, OPTION_LOG_NON_BLOCKING},
+    {NULL, 0, NULL, 0},
+};
+
 enum Argument {
   ARGUMENT_PROGRAM = 0,
   ARGUMENT_IMAGE,
@@ -12,6 +103,20 @@ enum Argument {
   ARGUMENT_MINIMUM_COUNT,
 };
 
+enum BatchArgument {
+  BATCH_ARGUMENT_PROGRAM = 0,
+  BATCH_ARGUMENT_PATH,
+
+  BATCH_ARGUMENT_MAXIMUM_COUNT,
+};
+
+enum PoolArgument {
+  POOL_ARGUMENT_PROGRAM = 0,
+  POOL_ARGUMENT_FIRST_IMAGE,
+
+  POOL_ARGUMENT_MINIMUM_COUNT,
+};
+
 static int parse_string_argument(const char *argument, char **out) {
   size_t argument_size = strlen(argument) + 1;
 
@@ -25,6 +130,89 @@ static int parse_string_argument(const char *argument, char **out) {
   return 0;
 }
 
+static int parse_size_argument(const char *argument, size_t *out) {
+  char *end;
+  errno = 0;
+  unsigned long long value = strtoull(argument, &end, 10);
+  if ((0 != errno) || (end == argument) || ('\0' != (*end)) || (0 == value)) {
+    return 1;
+  }
+
+  *out = (size_t)value;
+
+  return 0;
+}
+
+static int parse_ephemeral_size_argument(const char *argument, char **out) {
+  // The size is a number of bytes, optionally followed by a unit (k, m or g),
+  // or a percentage of the memory.
+  size_t digits_size = strspn(argument, "0123456789");
+  const char *unit = argument + digits_size;
+  if ((0 == digits_size) ||
+      (CLI_EPHEMERAL_SIZE_MAX_LENGTH < strlen(argument)) ||
+      (('\0' != unit[0]) &&
+       ((NULL == strchr("kKmMgG%", unit[0])) || ('\0' != unit[1])))) {
+    return 1;
+  }
+
+  return parse_string_argument(argument, out);
+}
+
+static char **get_cgroup_limit(CgroupLimits *limits, int option) {
+  switch (option) {
+    case OPTION_CPU_MAX:
+      return &limits->cpu_max;
+
+    case OPTION_CPU_WEIGHT:
+      return &limits->cpu_weight;
+
+    case OPTION_CPUSET_CPUS:
+      return &limits->cpuset_cpus;
+
+    case OPTION_CPUSET_MEMS:
+      return &limits->cpuset_mems;
+
+    case OPTION_MEMORY_MAX:
+      return &limits->memory_max;
+
+    case OPTION_MEMORY_HIGH:
+      return &limits->memory_high;
+
+    default:
+      return &limits->io_max;
+  }
+}
+
+static size_t *get_jobs_size(Cli *self) {
+  switch (self->subcommand) {
+    case CLI_SUBCOMMAND_BATCH:
+      return &self->batch_jobs_size;
+
+    case CLI_SUBCOMMAND_LOAD:
+      return &self->load_jobs_size;
+
+    case CLI_SUBCOMMAND_DEDUPE:
+      return &self->dedupe_jobs_size;
+
+    case CLI_SUBCOMMAND_RUN:
+    case CLI_SUBCOMMAND_POOL:
+    case CLI_SUBCOMMAND_SNAPSHOT:
+    case CLI_SUBCOMMAND_NETNS:
+    default:
+      return NULL;
+  }
+}
+
+static void free_cgroup_limits(CgroupLimits *limits) {
+  free(limits->cpu_max);
+  free(limits->cpu_weight);
+  free(limits->cpuset_cpus);
+  free(limits->cpuset_mems);
+  free(limits->memory_max);
+  free(limits->memory_high);
+  free(limits->io_max);
+}
+
 static int parse_string_array_argument(const char *const *argument, size_t size,
                                        char ***out_array, size_t *out_size) {
   int ret = 1;
@@ -76,14 +264,325 @@ out:
 int cli_init(Cli *self, int argc, const char *const argv[]) {
   int ret = 1;
 
+  self->subcommand = CLI_SUBCOMMAND_RUN;
+  self->image = NULL;
+  self->command = NULL;
+  self->command_size = 0;
+  self->timeout = 0;
+  self->is_read_only = 0;
+  self->ephemeral_size = NULL;
+  memset(&self->cgroup_limits, 0, sizeof(self->cgroup_limits));
+  self->log_configuration = (LogConfiguration){
+      .directory = NULL,
+      .size = CLI_DEFAULT_LOG_SIZE,
+      .is_timestamped = 0,
+      .is_non_blocking = 0,
+  };
+  self->images = NULL;
+  self->images_size = 0;
+  self->trace_path = NULL;
+  self->trace_format = NULL;
+  self->stats_path = NULL;
+  self->pool_socket_path = NULL;
+  self->pool_size = CLI_DEFAULT_POOL_SIZE;
+  self->batch_path = NULL;
+  self->batch_jobs_size = 0;
+  self->netns_size = CLI_DEFAULT_NETNS_SIZE;
+  self->load_path = NULL;
+  self->load_jobs_size = 0;
+  self->dedupe_jobs_size = 0;
+
+  // Skip the subcommand, so that the rest of the arguments are parsed in the
+  // same way as without it.
+  if ((1 < argc) && (0 == strcmp(argv[1], CLI_RUN_COMMAND))) {
+    --argc;
+    ++argv;
+  } else if ((1 < argc) && (0 == strcmp(argv[1], CLI_POOL_COMMAND))) {
+    self->subcommand = CLI_SUBCOMMAND_POOL;
+    --argc;
+    ++argv;
+  } else if ((1 < argc) && (0 == strcmp(argv[1], CLI_SNAPSHOT_COMMAND))) {
+    self->subcommand = CLI_SUBCOMMAND_SNAPSHOT;
+    --argc;
+    ++argv;
+  } else if ((1 < argc) && (0 == strcmp(argv[1], CLI_BATCH_COMMAND))) {
+    self->subcommand = CLI_SUBCOMMAND_BATCH;
+    --argc;
+    ++argv;
+  } else if ((1 < argc) && (0 == strcmp(argv[1], CLI_NETNS_COMMAND))) {
+    self->subcommand = CLI_SUBCOMMAND_NETNS;
+    --argc;
+    ++argv;
+  } else if ((1 < argc) && (0 == strcmp(argv[1], CLI_LOAD_COMMAND))) {
+    self->subcommand = CLI_SUBCOMMAND_LOAD;
+    --argc;
+    ++argv;
+  } else if ((1 < argc) && (0 == strcmp(argv[1], CLI_DEDUPE_COMMAND))) {
+    self->subcommand = CLI_SUBCOMMAND_DEDUPE;
+    --argc;
+    ++argv;
+  }
+
+  // Parse the options, which precede the image.
+  // Parsing stops at the first non-option argument, so that the options of
+  // the user command are left as they are.
+  opterr = 0;
+  optind = 1;
+
+  for (;;) {
+    int option = getopt_long(argc, (char *const *)argv, "+", OPTIONS, NULL);
+    if (-1 == option) {
+      break;
+    }
+
+    switch (option) {
+      case OPTION_TRACE:
+        free(self->trace_path);
+        if (0 != parse_string_argument(optarg, &self->trace_path)) {
+          goto out_free_options;
+        }
+
+        break;
+
+      case OPTION_TRACE_FORMAT:
+        free(self->trace_format);
+        if (0 != parse_string_argument(optarg, &self->trace_format)) {
+          goto out_free_options;
+        }
+
+        break;
+
+      // The pool that a command runs in, or that a pool listens on.
+      case OPTION_POOL:
+      case OPTION_SOCKET:
+        if ((CLI_SUBCOMMAND_SNAPSHOT == self->subcommand) ||
+            (CLI_SUBCOMMAND_BATCH == self->subcommand) ||
+            (CLI_SUBCOMMAND_NETNS == self->subcommand) ||
+            (CLI_SUBCOMMAND_LOAD == self->subcommand) ||
+            (CLI_SUBCOMMAND_DEDUPE == self->subcommand) ||
+            ((OPTION_POOL == option) !=
+             (CLI_SUBCOMMAND_RUN == self->subcommand))) {
+          goto out_free_options;
+        }
+
+        free(self->pool_socket_path);
+        if (0 != parse_string_argument(optarg, &self->pool_socket_path)) {
+          goto out_free_options;
+        }
+
+        break;
+
+      // The number of containers that a pool keeps ready for each image, or of
+      // network namespaces to keep ready.
+      case OPTION_SIZE:
+        if (((CLI_SUBCOMMAND_POOL != self->subcommand) &&
+             (CLI_SUBCOMMAND_NETNS != self->subcommand)) ||
+            (0 != parse_size_argument(optarg,
+                                      (CLI_SUBCOMMAND_POOL == self->subcommand)
+                                          ? &self->pool_size
+                                          : &self->netns_size))) {
+          goto out_free_options;
+        }
+
+        break;
+
+      case OPTION_TIMEOUT:
+        if (((CLI_SUBCOMMAND_RUN != self->subcommand) &&
+             (CLI_SUBCOMMAND_BATCH != self->subcommand)) ||
+            (0 != parse_size_argument(optarg, &self->timeout))) {
+          goto out_free_options;
+        }
+
+        break;
+
+      case OPTION_READ_ONLY:
+        if ((CLI_SUBCOMMAND_RUN != self->subcommand) &&
+            (CLI_SUBCOMMAND_BATCH != self->subcommand)) {
+          goto out_free_options;
+        }
+
+        self->is_read_only = 1;
+        break;
+
+      case OPTION_EPHEMERAL:
+        if ((CLI_SUBCOMMAND_RUN != self->subcommand) &&
+            (CLI_SUBCOMMAND_BATCH != self->subcommand)) {
+          goto out_free_options;
+        }
+
+        free(self->ephemeral_size);
+        if (0 != parse_ephemeral_size_argument(optarg, &self->ephemeral_size)) {
+          goto out_free_options;
+        }
+
+        break;
+
+      // The limits are written to the container's cgroup as they are, so they
+      // are validated by the kernel.
+      case OPTION_CPU_MAX:
+      case OPTION_CPU_WEIGHT:
+      case OPTION_CPUSET_CPUS:
+      case OPTION_CPUSET_MEMS:
+      case OPTION_MEMORY_MAX:
+      case OPTION_MEMORY_HIGH:
+      case OPTION_IO_MAX: {
+        if ((CLI_SUBCOMMAND_RUN != self->subcommand) &&
+            (CLI_SUBCOMMAND_BATCH != self->subcommand)) {
+          goto out_free_options;
+        }
+
+        char **limit = get_cgroup_limit(&self->cgroup_limits, option);
+        free(*limit);
+        if (0 != parse_string_argument(optarg, limit)) {
+          goto out_free_options;
+        }
+
+        break;
+      }
+
+      case OPTION_STATS:
+        if ((CLI_SUBCOMMAND_RUN != self->subcommand) &&
+            (CLI_SUBCOMMAND_BATCH != self->subcommand)) {
+          goto out_free_options;
+        }
+
+        free(self->stats_path);
+        if (0 != parse_string_argument(optarg, &self->stats_path)) {
+          goto out_free_options;
+        }
+
+        break;
+
+      case OPTION_LOG:
+      case OPTION_LOG_SIZE:
+      case OPTION_LOG_TIMESTAMPS:
+      case OPTION_LOG_NON_BLOCKING: {
+        if ((CLI_SUBCOMMAND_RUN != self->subcommand) &&
+            (CLI_SUBCOMMAND_BATCH != self->subcommand)) {
+          goto out_free_options;
+        }
+
+        LogConfiguration *log_configuration = &self->log_configuration;
+        if (OPTION_LOG == option) {
+          free(log_configuration->directory);
+          if (0 != parse_string_argument(optarg,
+                                         &log_configuration->directory)) {
+            goto out_free_options;
+          }
+        } else if (OPTION_LOG_SIZE == option) {
+          if (0 != parse_size_argument(optarg, &log_configuration->size)) {
+            goto out_free_options;
+          }
+        } else if (OPTION_LOG_TIMESTAMPS == option) {
+          log_configuration->is_timestamped = 1;
+        } else {
+          log_configuration->is_non_blocking = 1;
+        }
+
+        break;
+      }
+
+      // The number of jobs of a batch, of layers of a load, or of files of a
+      // deduplication pass, that run at once.
+      case OPTION_JOBS: {
+        size_t *jobs_size = get_jobs_size(self);
+        if ((NULL == jobs_size) ||
+            (0 != parse_size_argument(optarg, jobs_size))) {
+          goto out_free_options;
+        }
+
+        break;
+      }
+
+      default:
+        goto out_free_options;
+    }
+  }
+
+  // A read-only container has no files of its own to keep in memory.
+  if (self->is_read_only && (NULL != self->ephemeral_size)) {
+    goto out_free_options;
+  }
+
+  // A pool's containers are already running, so they cannot be limited, and
+  // their usage is not theirs alone.
+  // Their output is written to the streams of the command's client.
+  // Their roots were set up when they were parked, and the pool does not time
+  // their commands out.
+  if ((NULL != self->pool_socket_path) &&
+      (cgroup_limits_is_set(&self->cgroup_limits) ||
+       (NULL != self->stats_path) ||
+       (NULL != self->log_configuration.directory) || (0 != self->timeout) ||
+       self->is_read_only || (NULL != self->ephemeral_size))) {
+    goto out_free_options;
+  }
+
+  // Skip the options, so that the rest of the arguments are parsed in the
+  // same way as without them.
+  argc -= optind - 1;
+  argv += optind - 1;
+
+  // The network namespace pool and deduplication take no arguments besides
+  // their options.
+  if ((CLI_SUBCOMMAND_NETNS == self->subcommand) ||
+      (CLI_SUBCOMMAND_DEDUPE == self->subcommand)) {
+    if (1 != argc) {
+      goto out_free_options;
+    }
+
+    ret = 0;
+    goto out;
+  }
+
+  // Parse the job file of a batch, or the archive of a load, which default
+  // to the standard input.
+  // Both take the same arguments.
+  if ((CLI_SUBCOMMAND_BATCH == self->subcommand) ||
+      (CLI_SUBCOMMAND_LOAD == self->subcommand)) {
+    if (BATCH_ARGUMENT_MAXIMUM_COUNT < argc) {
+      goto out_free_options;
+    }
+
+    if ((BATCH_ARGUMENT_PATH < argc) &&
+        (0 != strcmp(argv[BATCH_ARGUMENT_PATH], CLI_STANDARD_INPUT_PATH)) &&
+        (0 != parse_string_argument(argv[BATCH_ARGUMENT_PATH],
+                                    (CLI_SUBCOMMAND_BATCH == self->subcommand)
+                                        ? &self->batch_path
+                                        : &self->load_path))) {
+      goto out_free_options;
+    }
+
+    ret = 0;
+    goto out;
+  }
+
+  // Parse the images of a pool, or the images to flatten.
+  // Both take the same arguments.
+  if ((CLI_SUBCOMMAND_POOL == self->subcommand) ||
+      (CLI_SUBCOMMAND_SNAPSHOT == self->subcommand)) {
+    if (POOL_ARGUMENT_MINIMUM_COUNT > argc) {
+      goto out_free_options;
+    }
+
+    if (0 != parse_string_array_argument(
+                 argv + POOL_ARGUMENT_FIRST_IMAGE,
+                 (size_t)(argc - POOL_ARGUMENT_FIRST_IMAGE), &self->images,
+                 &self->images_size)) {
+      goto out_free_options;
+    }
+
+    ret = 0;
+    goto out;
+  }
+
   // Ensure that the correct number of arguments has been passed in.
   if (ARGUMENT_MINIMUM_COUNT > argc) {
-    goto out;
+    goto out_free_options;
   }
 
   // Parse the image argument.
   if (0 != parse_string_argument(argv[ARGUMENT_IMAGE], &self->image)) {
-    goto out;
+    goto out_free_options;
   }
 
   // Parse the command argument.
@@ -100,6 +599,17 @@ int cli_init(Cli *self, int argc, const char *const argv[]) {
 out_free_image:
   free(self->image);
 
+out_free_options:
+  free(self->log_configuration.directory);
+  free_cgroup_limits(&self->cgroup_limits);
+  free(self->ephemeral_size);
+  free(self->load_path);
+  free(self->batch_path);
+  free(self->pool_socket_path);
+  free(self->stats_path);
+  free(self->trace_format);
+  free(self->trace_path);
+
 out:
   return ret;
 }
@@ -114,8 +624,145 @@ void cli_destroy(Cli *self) {
 
   // Free the image.
   free(self->image);
+
+  // Free the images.
+  for (size_t item_index = 0; item_index < self->images_size; ++item_index) {
+    free(self->images[item_index]);
+  }
+
+  free(self->images);
+
+  // Free the options.
+  free(self->log_configuration.directory);
+  free_cgroup_limits(&self->cgroup_limits);
+  free(self->ephemeral_size);
+  free(self->load_path);
+  free(self->batch_path);
+  free(self->pool_socket_path);
+  free(self->stats_path);
+  free(self->trace_format);
+  free(self->trace_path);
 }
 
 void cli_print_usage(const char *program) {
-  printf("USAGE: %s <image> <command>...\n", program);
+  printf("USAGE: %s [" CLI_RUN_COMMAND "] [options] <image> <command>...\n",
+         program);
+  printf("       %s " CLI_POOL_COMMAND " [options] <image>...\n", program);
+  printf("       %s " CLI_SNAPSHOT_COMMAND " [options] <image>...\n",
+         program);
+  printf("       %s " CLI_BATCH_COMMAND " [options] [<file>]\n", program);
+  printf("       %s " CLI_NETNS_COMMAND " [options]\n", program);
+  printf("       %s " CLI_LOAD_COMMAND " [options] [<file>]\n", program);
+  printf("       %s " CLI_DEDUPE_COMMAND " [options]\n", program);
+  printf("\n");
+  printf("The image is either a repository (such as ubuntu:latest) or an image "
+         "ID,\nwhich may be shortened to any unique prefix.\n");
+  printf("\n");
+  printf("The " CLI_SNAPSHOT_COMMAND
+         " subcommand flattens the layers of images into snapshots,\nwhich "
+         "their containers are mounted from instead of the layers.\n");
+  printf("\n");
+  printf("The " CLI_BATCH_COMMAND
+         " subcommand runs the jobs of a file (or of the standard input),\n"
+         "one \"<image> <command>...\" job per line.\n");
+  printf("\n");
+  printf("The " CLI_NETNS_COMMAND
+         " subcommand fills the pool of network namespaces that\n"
+         "containers join instead of creating their own, which is refilled "
+         "as they\nare taken.\n");
+  printf("\n");
+  printf("The " CLI_LOAD_COMMAND
+         " subcommand loads the images of a docker save archive (or of\n"
+         "the standard input) into the store, extracting the layers that it "
+         "does not\nhave yet.\n");
+  printf("\n");
+  printf("The " CLI_DEDUPE_COMMAND
+         " subcommand shares the contents of identical files across the\n"
+         "layers, hard linking the ones with the same metadata and "
+         "reflinking the rest\n(where the file system supports it). Layers "
+         "that an earlier pass has indexed\nare not scanned again.\n");
+  printf("\n");
+  printf("OPTIONS:\n");
+  printf("  --trace <file>           write a trace of the launch phases to the "
+         "file\n");
+  printf("                           (- for the standard error, defaults to "
+         "$GIMLI_TRACE)\n");
+  printf("  --trace-format <format>  the trace format, chrome or lines\n");
+  printf("                           (defaults to $GIMLI_TRACE_FORMAT, or "
+         "chrome)\n");
+  printf("\n");
+  printf("RUN OPTIONS:\n");
+  printf("  --pool <socket>          run the command in a container from a "
+         "pool, if it\n");
+  printf("                           has one ready for the image\n");
+  printf("  --timeout <seconds>      kill the container if it runs for longer "
+         "than the\n");
+  printf("                           timeout (also a batch option)\n");
+  printf("  --read-only              share the image's read-only root, with "
+         "writable\n");
+  printf("                           /tmp and /run (also a batch option)\n");
+  printf("  --ephemeral <size>       keep the container's files in memory, up "
+         "to the size\n");
+  printf("                           (such as 512m, also a batch option)\n");
+  printf("  --stats <file>           append a JSON line of each container's "
+         "resource usage\n");
+  printf("                           to the file (- for the standard error, "
+         "also a batch\n");
+  printf("                           option)\n");
+  printf("\n");
+  printf("CGROUP OPTIONS (run and batch):\n");
+  printf("  --cpu-max <max period>   the CPU bandwidth, such as "
+         "\"50000 100000\" for half\n");
+  printf("                           of a CPU\n");
+  printf("  --cpu-weight <weight>    the CPU weight, from 1 to 10000 (100 by "
+         "default)\n");
+  printf("  --cpuset-cpus <cpus>     the CPUs to run on, such as 0-3,6\n");
+  printf("  --cpuset-mems <nodes>    the memory nodes to allocate from\n");
+  printf("  --memory-max <bytes>     the memory limit, such as 512M\n");
+  printf("  --memory-high <bytes>    the memory that is throttled above\n");
+  printf("  --io-max <limit>         the I/O limit of a device, such as\n");
+  printf("                           \"8:0 rbps=1048576 wiops=100\"\n");
+  printf("\n");
+  printf("LOG OPTIONS (run and batch):\n");
+  printf("  --log <directory>        move each container's output to "
+         "<hostname>.log in the\n");
+  printf("                           directory, instead of gimli's output\n");
+  printf("  --log-size <bytes>       the size that logs are rotated to "
+         "<hostname>.log.1 at\n");
+  printf("                           (%d)\n", CLI_DEFAULT_LOG_SIZE);
+  printf("  --log-timestamps         frame each batch of output with a "
+         "\"<seconds>.<nanoseconds>\n");
+  printf("                           <size>\" header line\n");
+  printf("  --log-non-blocking       drop output instead of making the "
+         "container wait for\n");
+  printf("                           the log to catch up\n");
+  printf("\n");
+  printf("POOL OPTIONS:\n");
+  printf("  --socket <socket>        the socket to listen on (defaults to "
+         "pool.sock in\n");
+  printf("                           the gimli directory)\n");
+  printf("  --size <count>           the number of containers to keep ready "
+         "for each\n");
+  printf("                           image (%d)\n", CLI_DEFAULT_POOL_SIZE);
+  printf("\n");
+  printf("BATCH OPTIONS:\n");
+  printf("  --jobs <count>           the number of jobs to run at once "
+         "(defaults to the\n");
+  printf("                           number of processors)\n");
+  printf("\n");
+  printf("NETNS OPTIONS:\n");
+  printf("  --size <count>           the number of network namespaces to keep "
+         "ready (%d)\n",
+         CLI_DEFAULT_NETNS_SIZE);
+  printf("\n");
+  printf("LOAD OPTIONS:\n");
+  printf("  --jobs <count>           the number of layers to extract at once "
+         "(defaults to\n");
+  printf("                           the number of processors)\n");
+  printf("\n");
+  printf("DEDUPE OPTIONS:\n");
+  printf("  --jobs <count>           the number of layers to scan (and files "
+         "to hash) at\n");
+  printf("                           once (defaults to the number of "
+         "processors)\n");
 }
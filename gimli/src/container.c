@@ -0,0 +1,479 @@
+#define _GNU_SOURCE
+
+#include "gimli/container.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "gimli/gimli_directory.h"
+#include "gimli/io.h"
+#include "gimli/netns.h"
+#include "gimli/overlay.h"
+#include "gimli/socket_message.h"
+#include "gimli/spawn.h"
+#include "gimli/syscall_filter.h"
+#include "gimli/trace.h"
+#include "gimli/trash.h"
+
+// The writable file systems that are mounted in a container with a shared
+// read-only root.
+typedef struct ScratchMount {
+  const char *path;
+  const char *data;
+} ScratchMount;
+
+static const ScratchMount SCRATCH_MOUNTS[] = {
+    {.path = "/tmp", .data = "mode=1777,size=64m"},
+    {.path = "/run", .data = "mode=755,size=16m"},
+};
+
+// The arguments of a cloned container, along with the network namespace that
+// it joins, or -1 if it is cloned in a new one.
+typedef struct ContainerClone {
+  const ContainerConfiguration *configuration;
+  int network_namespace_fd;
+} ContainerClone;
+
+static int mount_container_image(
+    const ContainerConfiguration *container_configuration) {
+  const Image *image = container_configuration->image;
+  const char *directory = container_configuration->directory;
+  const char *root_fs_directory = container_configuration->root_fs_directory;
+  LayerStore *layer_store = container_configuration->layer_store;
+
+  // Remount everything as private.
+  uint64_t trace_start = trace_begin();
+  if (0 != mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL)) {
+    return 1;
+  }
+
+  trace_end("remount private", trace_start);
+
+  // Keep an ephemeral container's directory in memory.
+  // The file system is only mounted in the container's mount namespace, so it
+  // is freed along with the namespace once the container exits, and the
+  // container directory is left empty.
+  if (NULL != container_configuration->ephemeral_size) {
+    trace_start = trace_begin();
+
+    char mount_data[64];
+    snprintf(mount_data, sizeof(mount_data), "mode=755,size=%s",
+             container_configuration->ephemeral_size);
+
+    if (0 != mount("tmpfs", directory, "tmpfs", MS_NOSUID | MS_NODEV,
+                   mount_data)) {
+      return 1;
+    }
+
+    trace_end("mount ephemeral directory", trace_start);
+  }
+
+  // Create the merged directory.
+  trace_start = trace_begin();
+  if (0 != mkdir(root_fs_directory, 0755)) {
+    return 1;
+  }
+
+  trace_end("create merged directory", trace_start);
+
+  // Setup the image overlayfs.
+  trace_start = trace_begin();
+  if (0 !=
+      overlay_mount_image(image, directory, root_fs_directory, layer_store)) {
+    return 1;
+  }
+
+  trace_end("mount overlay", trace_start);
+
+  // Create a temporary directory to move the old root directory to.
+  char old_root_fs_directory[PATH_MAX];
+  snprintf(old_root_fs_directory, sizeof(old_root_fs_directory), "%s/old_root",
+           root_fs_directory);
+
+  if (0 != mkdir(old_root_fs_directory, 0755)) {
+    return 1;
+  }
+
+  // Pivot to the merged directory.
+  trace_start = trace_begin();
+  if (0 != syscall(SYS_pivot_root, root_fs_directory, old_root_fs_directory)) {
+    return 1;
+  }
+
+  // Change directory to the newly pivoted root directory,
+  if (0 != chdir("/")) {
+    return 1;
+  }
+
+  // Unmount the old root directory.
+  // The basename of the old root directory is retrieved here, as the root
+  // directory has been pivoted.
+  char *old_root_fs_directory_name = basename(old_root_fs_directory);
+  if (0 != umount2(old_root_fs_directory_name, MNT_DETACH)) {
+    return 1;
+  }
+
+  // Remove the old root directory.
+  if (0 != rmdir(old_root_fs_directory_name)) {
+    return 1;
+  }
+
+  trace_end("pivot root", trace_start);
+
+  // Mount `/proc`.
+  trace_start = trace_begin();
+  if (0 != mount("proc", "/proc", "proc", 0, NULL)) {
+    return 1;
+  }
+
+  trace_end("mount proc", trace_start);
+
+  return 0;
+}
+
+static int mount_shared_root(const char *shared_root_directory) {
+  // Remount everything as private.
+  uint64_t trace_start = trace_begin();
+  if (0 != mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL)) {
+    return 1;
+  }
+
+  trace_end("remount private", trace_start);
+
+  // Pivot to the shared root, which is already mounted.
+  // The read-only root has no directory to move the old root directory to, so
+  // the old root is stacked on top of the shared root, and then unmounted.
+  trace_start = trace_begin();
+  if (0 != chdir(shared_root_directory)) {
+    return 1;
+  }
+
+  if (0 != syscall(SYS_pivot_root, ".", ".")) {
+    return 1;
+  }
+
+  if (0 != umount2(".", MNT_DETACH)) {
+    return 1;
+  }
+
+  if (0 != chdir("/")) {
+    return 1;
+  }
+
+  trace_end("pivot root", trace_start);
+
+  // Mount `/proc`.
+  trace_start = trace_begin();
+  if (0 != mount("proc", "/proc", "proc", 0, NULL)) {
+    return 1;
+  }
+
+  trace_end("mount proc", trace_start);
+
+  // Mount small writable file systems for the scratch directories, which are
+  // skipped when the image does not have them.
+  trace_start = trace_begin();
+  for (size_t scratch_index = 0;
+       scratch_index < (sizeof(SCRATCH_MOUNTS) / sizeof(*SCRATCH_MOUNTS));
+       ++scratch_index) {
+    const ScratchMount *scratch_mount = &SCRATCH_MOUNTS[scratch_index];
+    if ((0 != mount("tmpfs", scratch_mount->path, "tmpfs",
+                    MS_NOSUID | MS_NODEV, scratch_mount->data)) &&
+        (ENOENT != errno)) {
+      return 1;
+    }
+  }
+
+  trace_end("mount scratch", trace_start);
+
+  return 0;
+}
+
+static int receive_command(int control_fd, char ***out_command) {
+  int ret = 1;
+
+  // The command is received into the heap, as it is used until the command is
+  // executed.
+  char *data = malloc(SOCKET_MESSAGE_MAX_SIZE);
+  if (NULL == data) {
+    goto out;
+  }
+
+  size_t data_size;
+  int streams[CONTAINER_STREAMS_SIZE];
+  if (0 != socket_message_receive(control_fd, data, SOCKET_MESSAGE_MAX_SIZE,
+                                  &data_size, streams,
+                                  CONTAINER_STREAMS_SIZE)) {
+    goto out_free_data;
+  }
+
+  size_t command_size;
+  if ((0 != socket_message_unpack_strings(data, data_size, out_command,
+                                          &command_size)) ||
+      (0 == command_size)) {
+    errno = EPROTO;
+    goto out_close_streams;
+  }
+
+  // Flush the container's setup output, before the standard streams are
+  // replaced with those of the command.
+  fflush(stdout);
+
+  for (int stream = 0; stream < CONTAINER_STREAMS_SIZE; ++stream) {
+    if (-1 == dup2(streams[stream], stream)) {
+      free(*out_command);
+      goto out_close_streams;
+    }
+  }
+
+  // The command points into the data, so it is not freed.
+  data = NULL;
+  ret = 0;
+
+out_close_streams:
+  for (int stream = 0; stream < CONTAINER_STREAMS_SIZE; ++stream) {
+    if (CONTAINER_STREAMS_SIZE <= streams[stream]) {
+      close(streams[stream]);
+    }
+  }
+
+out_free_data:
+  free(data);
+
+out:
+  return ret;
+}
+
+static int child(void *argument) {
+  const ContainerClone *container_clone = argument;
+  const ContainerConfiguration *container_configuration =
+      container_clone->configuration;
+
+  // Pass the child's trace spans back to the parent.
+  trace_enter_child();
+  uint64_t child_trace_start = trace_begin();
+
+  // Join the network namespace that was taken from the pool, or else bring
+  // up the loopback interface of the one that the child was cloned in, so
+  // that both have the same network.
+  printf("=> setting up container network... ");
+
+  uint64_t trace_start = trace_begin();
+
+  if (-1 != container_clone->network_namespace_fd) {
+    if (0 != setns(container_clone->network_namespace_fd, CLONE_NEWNET)) {
+      printf("failed, error(%d): [%s]\n", errno, strerror(errno));
+      return 1;
+    }
+
+    close(container_clone->network_namespace_fd);
+    trace_end("join network namespace", trace_start);
+  } else {
+    if (0 != netns_set_loopback_up()) {
+      printf("failed, error(%d): [%s]\n", errno, strerror(errno));
+      return 1;
+    }
+
+    trace_end("set loopback up", trace_start);
+  }
+
+  printf("done\n");
+
+  // Set the container hostname.
+  printf("=> setting container hostname... ");
+
+  trace_start = trace_begin();
+
+  if (-1 == sethostname(container_configuration->hostname,
+                        strlen(container_configuration->hostname))) {
+    printf("failed, error(%d): [%s]\n", errno, strerror(errno));
+    return 1;
+  }
+
+  trace_end("set hostname", trace_start);
+
+  printf("done\n");
+
+  // Mount the image.
+  printf("=> mounting container image... ");
+
+  int mount_result =
+      (NULL == container_configuration->shared_root_directory)
+          ? mount_container_image(container_configuration)
+          : mount_shared_root(container_configuration->shared_root_directory);
+  if (0 != mount_result) {
+    printf("failed, error(%d): [%s]\n", errno, strerror(errno));
+    return 1;
+  }
+
+  printf("done\n");
+
+  // Filter the syscalls that the container can make.
+  printf("=> filtering syscalls... ");
+
+  trace_start = trace_begin();
+
+  if (0 != syscall_filter_install()) {
+    printf("failed, error(%d): [%s]\n", errno, strerror(errno));
+    return 1;
+  }
+
+  trace_end("filter syscalls", trace_start);
+
+  printf("done\n");
+
+  trace_end("child setup", child_trace_start);
+
+  // Write the command's output to the container's log.
+  // The container's setup output is flushed first, so that it stays out of
+  // the log.
+  if (-1 != container_configuration->log_fd) {
+    fflush(stdout);
+
+    if ((-1 == dup2(container_configuration->log_fd, STDOUT_FILENO)) ||
+        (-1 == dup2(container_configuration->log_fd, STDERR_FILENO))) {
+      printf("failed redirecting output, error(%d): [%s]\n", errno,
+             strerror(errno));
+      return 1;
+    }
+
+    close(container_configuration->log_fd);
+  }
+
+  // A parked container waits for its command and standard streams.
+  char **command = container_configuration->command;
+  if (-1 != container_configuration->control_fd) {
+    // Close every other descriptor inherited from the pool (such as the
+    // sockets of the other parked containers), so that closing a socket
+    // releases exactly the container it belongs to.
+    unsigned int control_fd = (unsigned int)container_configuration->control_fd;
+    io_close_range(CONTAINER_STREAMS_SIZE, control_fd - 1);
+    io_close_range(control_fd + 1, ~0U);
+
+    if (0 != receive_command(container_configuration->control_fd, &command)) {
+      // The socket is closed to release a parked container that is no longer
+      // needed.
+      return (ECONNRESET == errno) ? 0 : 1;
+    }
+  }
+
+  // Unblock the signals that the parent handles through a file descriptor, as
+  // the signal mask is inherited by the user command.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigprocmask(SIG_SETMASK, &signals, NULL);
+
+  // Execute the user command.
+  execve(command[0], command, NULL);
+
+  // If this line is reached, it means that `execve` failed.
+  // Exit with failure.
+  printf("failed executing user command, error(%d): [%s]\n", errno,
+         strerror(errno));
+
+  // The child exits without flushing its output, which is buffered when it is
+  // written to a log.
+  fflush(stdout);
+
+  return 1;
+}
+
+void container_format_directories(const char *hostname,
+                                  char directory[PATH_MAX],
+                                  char root_fs_directory[PATH_MAX]) {
+  snprintf(directory, PATH_MAX, "%s/container/%s", gimli_directory_get(),
+           hostname);
+  snprintf(root_fs_directory, PATH_MAX, "%s/merged", directory);
+}
+
+pid_t container_clone(const ContainerConfiguration *configuration,
+                      int *out_pidfd) {
+  // Flush any buffered output, so that the child does not write it again.
+  fflush(stdout);
+
+  // Take a network namespace from the pool, so that the child joins it
+  // instead of creating (and later destroying) a namespace of its own.
+  int is_netns_pool_low;
+  ContainerClone container_clone = {
+      .configuration = configuration,
+      .network_namespace_fd = netns_take(&is_netns_pool_low),
+  };
+
+  // Detect how the child mounts its overlay before it is cloned, so that it is
+  // only detected once rather than by every child.
+  overlay_detect_fs_context_support();
+
+  // Clone a child process in new namespaces.
+  int clone_flags = CLONE_NEWNS | CLONE_NEWPID | CLONE_NEWIPC | CLONE_NEWUTS;
+  if (-1 == container_clone.network_namespace_fd) {
+    clone_flags |= CLONE_NEWNET;
+  }
+
+  pid_t pid = spawn_process(child, &container_clone, clone_flags,
+                            configuration->cgroup_fd, out_pidfd);
+
+  // The child holds the namespace from now on.
+  if (-1 != container_clone.network_namespace_fd) {
+    close(container_clone.network_namespace_fd);
+  }
+
+  // Refill the pool in the background once it runs low.
+  if (is_netns_pool_low) {
+    netns_spawn_refiller();
+  }
+
+  return pid;
+}
+
+int container_send_command(int control_fd, const char *const *command,
+                           size_t command_size,
+                           const int streams[CONTAINER_STREAMS_SIZE]) {
+  char *data = malloc(SOCKET_MESSAGE_MAX_SIZE);
+  if (NULL == data) {
+    return 1;
+  }
+
+  size_t data_size;
+  int ret = ((0 == socket_message_pack_strings(command, command_size, data,
+                                               SOCKET_MESSAGE_MAX_SIZE,
+                                               &data_size)) &&
+             (0 == socket_message_send(control_fd, data, data_size, streams,
+                                       CONTAINER_STREAMS_SIZE)))
+                ? 0
+                : 1;
+
+  free(data);
+
+  return ret;
+}
+
+void container_remove_directory(const char *directory,
+                                const char *root_fs_directory,
+                                const char *hostname) {
+  // Try detaching the root directory of the container's file system, without
+  // waiting for it to be unused.
+  umount2(root_fs_directory, MNT_DETACH);
+
+  // Move the container directory to the trash, and leave removing it to a
+  // background reaper, so that the exit code is returned without waiting for
+  // the container's files to be removed.
+  // The directory is removed in place if it cannot be moved, and the trash is
+  // reaped in the foreground if the reaper cannot be started.
+  if (0 != trash_move(directory, hostname)) {
+    io_remove_directory_recursive(directory);
+  } else if (0 != trash_spawn_reaper()) {
+    trash_reap();
+  }
+}
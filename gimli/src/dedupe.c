@@ -0,0 +1,1222 @@
+#define _GNU_SOURCE
+
+#include "gimli/dedupe.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/fs.h>
+#include <linux/openat2.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include "gimli/digest.h"
+#include "gimli/gimli_directory.h"
+#include "gimli/io.h"
+#include "gimli/parallel.h"
+#include "stb_ds/stb_ds.h"
+
+// The directory that the layers are in, relative to the gimli directory.
+#define DEDUPE_OVERLAY_DIRECTORY "overlay2"
+
+// Duplicates are linked to a temporary name next to them, which then replaces
+// them.
+#define DEDUPE_TEMPORARY_PREFIX ".gimli-dedupe-"
+
+// The size of the buffers that extended attributes are compared in, which is
+// the most that Linux allows for a file's attribute names and for a value.
+#define DEDUPE_XATTR_BUFFER_SIZE (64 * 1024)
+
+typedef struct DedupeFile DedupeFile;
+
+typedef struct DedupeLayer {
+  char *cache_id;
+  DedupeFile *files;
+
+  // Whether the layer's files were read from the index instead of walked.
+  int is_indexed;
+
+  // Whether any of the layer's files changed since it was walked, in which
+  // case it is left out of the index, so that it is walked again.
+  int is_stale;
+} DedupeLayer;
+
+struct DedupeFile {
+  DedupeLayer *layer;
+  char *path;
+  uint64_t size;
+  uint64_t inode;
+  struct timespec modification_time;
+  uint32_t mode;
+  uint32_t uid;
+  uint32_t gid;
+  uint32_t flags;
+  Digest digest;
+};
+
+typedef struct CacheIdToIndexLayerPair {
+  char *key;
+  const DedupeIndexLayer *value;
+} CacheIdToIndexLayerPair;
+
+typedef struct Deduper {
+  int overlay_directory_fd;
+  DedupeLayer *layers;
+
+  // The layers that are walked, and the files that are hashed, by the
+  // workers.
+  DedupeLayer **scanned_layers;
+  DedupeFile **hashed_files;
+
+  // Whether the layers' file system may support reflinks, which is assumed
+  // until a clone fails as unsupported.
+  int is_cloning;
+
+  size_t temporary_names_size;
+  char *xattr_names[2];
+  char *xattr_values[2];
+
+  DedupeSummary *summary;
+} Deduper;
+
+void dedupe_format_index_path(char *path, size_t size) {
+  snprintf(path, size, "%s/dedupe.index", gimli_directory_get());
+}
+
+static int is_cache_id(const char *name) {
+  // Docker names the directories of image layers after random hex digests.
+  if (SHA256_HEX_DIGEST_SIZE != strlen(name)) {
+    return 0;
+  }
+
+  return SHA256_HEX_DIGEST_SIZE == strspn(name, "0123456789abcdef");
+}
+
+static void mark_layer_stale(DedupeLayer *layer) {
+  __atomic_store_n(&layer->is_stale, 1, __ATOMIC_RELAXED);
+}
+
+static int format_file_path(const DedupeFile *file, char path[PATH_MAX]) {
+  int size =
+      snprintf(path, PATH_MAX, "%s/diff/%s", file->layer->cache_id, file->path);
+  if (PATH_MAX <= size) {
+    errno = ENAMETOOLONG;
+    return 1;
+  }
+
+  return 0;
+}
+
+static int open_beneath(int root_fd, const char *path, int flags) {
+  // Layers are only read through their own directories, so that a symbolic
+  // link never leads out of them.
+  struct open_how how = {
+      .flags = (unsigned int)(flags | O_NOFOLLOW | O_CLOEXEC),
+      .mode = 0,
+      .resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS,
+  };
+
+  return (int)syscall(__NR_openat2, root_fd, path, &how, sizeof(how));
+}
+
+static int open_file(const Deduper *self, const DedupeFile *file, int flags) {
+  char path[PATH_MAX];
+  if (0 != format_file_path(file, path)) {
+    return -1;
+  }
+
+  int fd = open_beneath(self->overlay_directory_fd, path, flags);
+  if (-1 == fd) {
+    return -1;
+  }
+
+  // The file must still be the one that was walked (or indexed).
+  struct stat stat_buffer;
+  if (0 != fstat(fd, &stat_buffer)) {
+    close(fd);
+    return -1;
+  }
+
+  if (!S_ISREG(stat_buffer.st_mode) || (file->inode != stat_buffer.st_ino) ||
+      (file->size != (uint64_t)stat_buffer.st_size) ||
+      (file->modification_time.tv_sec != stat_buffer.st_mtim.tv_sec) ||
+      (file->modification_time.tv_nsec != stat_buffer.st_mtim.tv_nsec)) {
+    mark_layer_stale(file->layer);
+    close(fd);
+    errno = ESTALE;
+    return -1;
+  }
+
+  return fd;
+}
+
+static int open_parent(const Deduper *self, const DedupeFile *file,
+                       const char **out_name) {
+  char path[PATH_MAX];
+  if (0 != format_file_path(file, path)) {
+    return -1;
+  }
+
+  // The path always has a directory, as it is under the layer's diff
+  // directory.
+  char *separator = strrchr(path, '/');
+  *separator = '\0';
+
+  const char *name = strrchr(file->path, '/');
+  *out_name = (NULL == name) ? file->path : (name + 1);
+
+  return open_beneath(self->overlay_directory_fd, path, O_RDONLY | O_DIRECTORY);
+}
+
+static int add_file(DedupeLayer *layer, const char *path,
+                    const struct stat *stat_buffer) {
+  DedupeFile file = {
+      .layer = layer,
+      .path = strdup(path),
+      .size = (uint64_t)stat_buffer->st_size,
+      .inode = stat_buffer->st_ino,
+      .modification_time = stat_buffer->st_mtim,
+      .mode = stat_buffer->st_mode,
+      .uid = stat_buffer->st_uid,
+      .gid = stat_buffer->st_gid,
+      .flags = 0,
+  };
+  if (NULL == file.path) {
+    return 1;
+  }
+
+  arrput(layer->files, file);
+
+  return 0;
+}
+
+static int walk_directory(DedupeLayer *layer, int directory_fd, char *path,
+                          size_t path_size) {
+  int ret = 1;
+
+  DIR *directory = fdopendir(directory_fd);
+  if (NULL == directory) {
+    close(directory_fd);
+    goto out;
+  }
+
+  for (;;) {
+    // Set `errno` to 0 before reading the next directory entry.
+    errno = 0;
+
+    struct dirent *entry = readdir(directory);
+    if (NULL == entry) {
+      if (0 != errno) {
+        goto out_close_directory;
+      }
+
+      break;
+    }
+
+    // Skip the "." and ".." directories.
+    if ((0 == strcmp(entry->d_name, ".")) ||
+        (0 == strcmp(entry->d_name, ".."))) {
+      continue;
+    }
+
+    // Only files have contents to share, and whiteouts, links and device
+    // nodes are skipped.
+    if ((DT_REG != entry->d_type) && (DT_DIR != entry->d_type) &&
+        (DT_UNKNOWN != entry->d_type)) {
+      continue;
+    }
+
+    struct stat stat_buffer;
+    if (0 != fstatat(dirfd(directory), entry->d_name, &stat_buffer,
+                     AT_SYMLINK_NOFOLLOW)) {
+      goto out_close_directory;
+    }
+
+    // Append the entry's name to the path.
+    size_t name_size = strlen(entry->d_name);
+    size_t entry_path_size = path_size + ((0 == path_size) ? 0 : 1) + name_size;
+    if (PATH_MAX <= entry_path_size) {
+      errno = ENAMETOOLONG;
+      goto out_close_directory;
+    }
+
+    if (0 != path_size) {
+      path[path_size] = '/';
+    }
+
+    memcpy(path + entry_path_size - name_size, entry->d_name, name_size + 1);
+
+    if (S_ISDIR(stat_buffer.st_mode)) {
+      int fd = openat(dirfd(directory), entry->d_name,
+                      O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+      if ((-1 == fd) ||
+          (0 != walk_directory(layer, fd, path, entry_path_size))) {
+        goto out_close_directory;
+      }
+    } else if (S_ISREG(stat_buffer.st_mode) && (0 < stat_buffer.st_size)) {
+      // Empty files have no contents to share.
+      if (0 != add_file(layer, path, &stat_buffer)) {
+        goto out_close_directory;
+      }
+    }
+
+    path[path_size] = '\0';
+  }
+
+  ret = 0;
+
+out_close_directory:
+  closedir(directory);
+
+out:
+  return ret;
+}
+
+static void free_layer_files(DedupeLayer *layer) {
+  for (size_t file_index = 0; file_index < arrlenu(layer->files);
+       ++file_index) {
+    free(layer->files[file_index].path);
+  }
+
+  arrfree(layer->files);
+}
+
+static int run_scan_task(void *context, size_t worker_index,
+                         size_t task_index) {
+  (void)worker_index;
+
+  Deduper *self = context;
+  DedupeLayer *layer = self->scanned_layers[task_index];
+
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/diff", layer->cache_id);
+
+  // A layer that cannot be walked (for example, as it has just been removed)
+  // is left out of the pass.
+  int fd = openat(self->overlay_directory_fd, path,
+                  O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+
+  path[0] = '\0';
+  if ((-1 == fd) || (0 != walk_directory(layer, fd, path, 0))) {
+    free_layer_files(layer);
+    mark_layer_stale(layer);
+  }
+
+  return 0;
+}
+
+static int run_hash_task(void *context, size_t worker_index,
+                         size_t task_index) {
+  (void)worker_index;
+
+  Deduper *self = context;
+  DedupeFile *file = self->hashed_files[task_index];
+
+  // A file that cannot be hashed is left out of the pass.
+  int fd = open_file(self, file, O_RDONLY);
+  if (-1 == fd) {
+    return 0;
+  }
+
+  void *data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (MAP_FAILED == data) {
+    return 0;
+  }
+
+  madvise(data, file->size, MADV_SEQUENTIAL);
+
+  Sha256 sha256;
+  sha256_init(&sha256);
+  sha256_update(&sha256, data, file->size);
+  sha256_final(&sha256, file->digest.bytes);
+
+  munmap(data, file->size);
+
+  file->flags |= DEDUPE_FILE_FLAG_HASHED;
+
+  return 0;
+}
+
+static int compare_sizes(const void *first, const void *second) {
+  const DedupeFile *first_file = *(DedupeFile *const *)first;
+  const DedupeFile *second_file = *(DedupeFile *const *)second;
+
+  if (first_file->size != second_file->size) {
+    return (first_file->size < second_file->size) ? -1 : 1;
+  }
+
+  if (first_file->inode != second_file->inode) {
+    return (first_file->inode < second_file->inode) ? -1 : 1;
+  }
+
+  return 0;
+}
+
+static int compare_metadata(const DedupeFile *first, const DedupeFile *second) {
+  if (first->mode != second->mode) {
+    return (first->mode < second->mode) ? -1 : 1;
+  }
+
+  if (first->uid != second->uid) {
+    return (first->uid < second->uid) ? -1 : 1;
+  }
+
+  if (first->gid != second->gid) {
+    return (first->gid < second->gid) ? -1 : 1;
+  }
+
+  if (first->modification_time.tv_sec != second->modification_time.tv_sec) {
+    return (first->modification_time.tv_sec <
+            second->modification_time.tv_sec)
+               ? -1
+               : 1;
+  }
+
+  if (first->modification_time.tv_nsec != second->modification_time.tv_nsec) {
+    return (first->modification_time.tv_nsec <
+            second->modification_time.tv_nsec)
+               ? -1
+               : 1;
+  }
+
+  return 0;
+}
+
+static int compare_contents(const DedupeFile *first, const DedupeFile *second) {
+  if (first->size != second->size) {
+    return (first->size < second->size) ? -1 : 1;
+  }
+
+  return memcmp(first->digest.bytes, second->digest.bytes,
+                sizeof(first->digest.bytes));
+}
+
+static int compare_files(const void *first, const void *second) {
+  const DedupeFile *first_file = *(DedupeFile *const *)first;
+  const DedupeFile *second_file = *(DedupeFile *const *)second;
+
+  // Files are ordered by their contents, then by their metadata, and then by
+  // their inodes, so that the links of each inode are adjacent.
+  int result = compare_contents(first_file, second_file);
+  if (0 == result) {
+    result = compare_metadata(first_file, second_file);
+  }
+
+  if ((0 == result) && (first_file->inode != second_file->inode)) {
+    result = (first_file->inode < second_file->inode) ? -1 : 1;
+  }
+
+  return result;
+}
+
+static int read_xattrs(int fd, char *names, ssize_t *out_names_size) {
+  *out_names_size = flistxattr(fd, names, DEDUPE_XATTR_BUFFER_SIZE);
+
+  return (-1 == *out_names_size) ? 1 : 0;
+}
+
+static int is_xattrs_equal(Deduper *self, int first_fd, int second_fd) {
+  char *first_names = self->xattr_names[0];
+  char *second_names = self->xattr_names[1];
+  char *first_value = self->xattr_values[0];
+  char *second_value = self->xattr_values[1];
+
+  // Files that are linked share their extended attributes (such as file
+  // capabilities), so they must have the same ones.
+  ssize_t first_names_size;
+  ssize_t second_names_size;
+  if ((0 != read_xattrs(first_fd, first_names, &first_names_size)) ||
+      (0 != read_xattrs(second_fd, second_names, &second_names_size)) ||
+      (first_names_size != second_names_size)) {
+    return 0;
+  }
+
+  for (const char *name = first_names; name < (first_names + first_names_size);
+       name += strlen(name) + 1) {
+    ssize_t first_value_size =
+        fgetxattr(first_fd, name, first_value, DEDUPE_XATTR_BUFFER_SIZE);
+    ssize_t second_value_size =
+        fgetxattr(second_fd, name, second_value, DEDUPE_XATTR_BUFFER_SIZE);
+    if ((-1 == first_value_size) || (first_value_size != second_value_size) ||
+        (0 != memcmp(first_value, second_value, (size_t)first_value_size))) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static int replace_with_link(Deduper *self, const DedupeFile *canonical,
+                             int canonical_fd, DedupeFile *file) {
+  int ret = 1;
+
+  int fd = open_file(self, file, O_RDONLY);
+  if (-1 == fd) {
+    goto out;
+  }
+
+  struct stat stat_buffer;
+  if (0 != fstat(fd, &stat_buffer)) {
+    goto out_close_fd;
+  }
+
+  // Files whose extended attributes differ are left as they are.
+  if (!is_xattrs_equal(self, canonical_fd, fd)) {
+    ret = 0;
+    goto out_close_fd;
+  }
+
+  const char *canonical_name;
+  int canonical_parent_fd = open_parent(self, canonical, &canonical_name);
+  if (-1 == canonical_parent_fd) {
+    goto out_close_fd;
+  }
+
+  const char *name;
+  int parent_fd = open_parent(self, file, &name);
+  if (-1 == parent_fd) {
+    goto out_close_canonical_parent_fd;
+  }
+
+  // Replacing an entry changes its directory's times, which containers see.
+  struct stat parent_stat;
+  if (0 != fstat(parent_fd, &parent_stat)) {
+    goto out_close_parent_fd;
+  }
+
+  // Link the canonical file next to the duplicate, and atomically replace the
+  // duplicate with it.
+  char temporary_name[NAME_MAX];
+  snprintf(temporary_name, sizeof(temporary_name),
+           DEDUPE_TEMPORARY_PREFIX "%d-%zu", (int)getpid(),
+           self->temporary_names_size++);
+
+  if (0 != linkat(canonical_parent_fd, canonical_name, parent_fd,
+                  temporary_name, 0)) {
+    goto out_close_parent_fd;
+  }
+
+  if (0 != renameat(parent_fd, temporary_name, parent_fd, name)) {
+    unlinkat(parent_fd, temporary_name, 0);
+    goto out_close_parent_fd;
+  }
+
+  const struct timespec times[2] = {{.tv_sec = 0, .tv_nsec = UTIME_OMIT},
+                                    parent_stat.st_mtim};
+  if (0 != futimens(parent_fd, times)) {
+    goto out_close_parent_fd;
+  }
+
+  // The duplicate's contents are freed with its last link, which other links
+  // (such as snapshots) may still hold.
+  if (1 == stat_buffer.st_nlink) {
+    self->summary->saved_size += file->size;
+  }
+
+  file->inode = canonical->inode;
+  file->flags = canonical->flags;
+  ++self->summary->linked_files_size;
+
+  ret = 0;
+
+out_close_parent_fd:
+  close(parent_fd);
+
+out_close_canonical_parent_fd:
+  close(canonical_parent_fd);
+
+out_close_fd:
+  close(fd);
+
+out:
+  return ret;
+}
+
+static DedupeFile *find_canonical(DedupeFile **files, size_t files_size) {
+  // Keep the inode that most of the files are already linked to, so that the
+  // fewest files are replaced (the links of each inode are adjacent).
+  size_t canonical_index = 0;
+  size_t canonical_links_size = 0;
+  for (size_t start = 0; start < files_size;) {
+    size_t end = start + 1;
+    while ((end < files_size) && (files[start]->inode == files[end]->inode)) {
+      ++end;
+    }
+
+    if ((end - start) > canonical_links_size) {
+      canonical_index = start;
+      canonical_links_size = end - start;
+    }
+
+    start = end;
+  }
+
+  return files[canonical_index];
+}
+
+static void link_files(Deduper *self, DedupeFile **files, size_t files_size) {
+  DedupeFile *canonical = find_canonical(files, files_size);
+  int canonical_fd = open_file(self, canonical, O_RDONLY);
+  if (-1 == canonical_fd) {
+    return;
+  }
+
+  for (size_t file_index = 0; file_index < files_size; ++file_index) {
+    DedupeFile *file = files[file_index];
+    if (file->inode == canonical->inode) {
+      continue;
+    }
+
+    if (0 != replace_with_link(self, canonical, canonical_fd, file)) {
+      // The rest of the files are linked to this one once the canonical file
+      // has too many links.
+      if (EMLINK == errno) {
+        close(canonical_fd);
+
+        canonical = file;
+        canonical_fd = open_file(self, canonical, O_RDONLY);
+        if (-1 == canonical_fd) {
+          return;
+        }
+
+        continue;
+      }
+
+      ++self->summary->failed_files_size;
+    }
+  }
+
+  close(canonical_fd);
+}
+
+static int is_clone_unsupported(int error) {
+  return (EOPNOTSUPP == error) || (ENOTTY == error) || (EXDEV == error) ||
+         (EINVAL == error) || (ENOSYS == error);
+}
+
+static int clone_file(Deduper *self, int source_fd, DedupeFile *file) {
+  int ret = 1;
+
+  int fd = open_file(self, file, O_WRONLY);
+  if (-1 == fd) {
+    goto out;
+  }
+
+  if (0 != ioctl(fd, FICLONE, source_fd)) {
+    goto out_close_fd;
+  }
+
+  // Cloning changes the file's modification time, which containers see.
+  const struct timespec times[2] = {{.tv_sec = 0, .tv_nsec = UTIME_OMIT},
+                                    file->modification_time};
+  if (0 != futimens(fd, times)) {
+    goto out_close_fd;
+  }
+
+  ret = 0;
+
+out_close_fd:
+  close(fd);
+
+out:
+  return ret;
+}
+
+static void clone_files(Deduper *self, DedupeFile **files, size_t files_size) {
+  DedupeFile *source = files[0];
+  int source_fd = open_file(self, source, O_RDONLY);
+  if (-1 == source_fd) {
+    return;
+  }
+
+  uint64_t cloned_inode = source->inode;
+  for (size_t file_index = 1; file_index < files_size; ++file_index) {
+    DedupeFile *file = files[file_index];
+
+    // Each inode is cloned once, and files that were cloned by an earlier
+    // pass already share their extents.
+    if ((file->inode == source->inode) || (file->inode == cloned_inode) ||
+        ((DEDUPE_FILE_FLAG_CLONED & file->flags) &&
+         (DEDUPE_FILE_FLAG_CLONED & source->flags))) {
+      continue;
+    }
+
+    if (0 != clone_file(self, source_fd, file)) {
+      // Stop cloning for the rest of the pass once the file system turns out
+      // not to support it.
+      if ((0 == self->summary->cloned_files_size) &&
+          is_clone_unsupported(errno)) {
+        self->is_cloning = 0;
+        break;
+      }
+
+      ++self->summary->failed_files_size;
+      continue;
+    }
+
+    cloned_inode = file->inode;
+    source->flags |= DEDUPE_FILE_FLAG_CLONED;
+    file->flags |= DEDUPE_FILE_FLAG_CLONED;
+    self->summary->saved_size += file->size;
+    ++self->summary->cloned_files_size;
+  }
+
+  // The other links of the cloned inodes share their extents as well.
+  for (size_t file_index = 1; file_index < files_size; ++file_index) {
+    if (files[file_index]->inode == files[file_index - 1]->inode) {
+      files[file_index]->flags |=
+          DEDUPE_FILE_FLAG_CLONED & files[file_index - 1]->flags;
+    }
+  }
+
+  close(source_fd);
+}
+
+static void dedupe_contents(Deduper *self, DedupeFile **files,
+                            size_t files_size) {
+  // Files with the same metadata are linked, so that they share their inode
+  // (and so their page cache).
+  for (size_t start = 0; start < files_size;) {
+    size_t end = start + 1;
+    while ((end < files_size) &&
+           (0 == compare_metadata(files[start], files[end]))) {
+      ++end;
+    }
+
+    link_files(self, files + start, end - start);
+    start = end;
+  }
+
+  // The rest are cloned, which keeps their own metadata, if the file system
+  // supports reflinks.
+  if (self->is_cloning) {
+    clone_files(self, files, files_size);
+  }
+}
+
+static DedupeFile **collect_files(const Deduper *self) {
+  DedupeFile **files = NULL;
+
+  for (size_t layer_index = 0; layer_index < arrlenu(self->layers);
+       ++layer_index) {
+    DedupeLayer *layer = &(self->layers[layer_index]);
+    if (layer->is_stale) {
+      continue;
+    }
+
+    for (size_t file_index = 0; file_index < arrlenu(layer->files);
+         ++file_index) {
+      arrput(files, &(layer->files[file_index]));
+    }
+  }
+
+  return files;
+}
+
+static int hash_files(Deduper *self, DedupeFile **files, size_t threads_size,
+                      DedupeFile ***out_candidates) {
+  DedupeFile **candidates = NULL;
+  size_t files_size = arrlenu(files);
+
+  // Only files whose size is shared with another inode may be duplicates, so
+  // only they are hashed.
+  if (0 < files_size) {
+    qsort(files, files_size, sizeof(*files), compare_sizes);
+  }
+
+  for (size_t start = 0; start < files_size;) {
+    size_t end = start + 1;
+    int is_shared = 0;
+    while ((end < files_size) && (files[start]->size == files[end]->size)) {
+      is_shared |= files[start]->inode != files[end]->inode;
+      ++end;
+    }
+
+    for (size_t file_index = start; is_shared && (file_index < end);
+         ++file_index) {
+      arrput(candidates, files[file_index]);
+
+      // Each inode is hashed once, unless its digest is already known.
+      if ((file_index == start) ||
+          (files[file_index]->inode != files[file_index - 1]->inode)) {
+        if (!(DEDUPE_FILE_FLAG_HASHED & files[file_index]->flags)) {
+          arrput(self->hashed_files, files[file_index]);
+        }
+      }
+    }
+
+    start = end;
+  }
+
+  if (0 != parallel_run(arrlenu(self->hashed_files), threads_size,
+                        run_hash_task, self)) {
+    arrfree(candidates);
+    return 1;
+  }
+
+  for (size_t file_index = 0; file_index < arrlenu(self->hashed_files);
+       ++file_index) {
+    if (DEDUPE_FILE_FLAG_HASHED & self->hashed_files[file_index]->flags) {
+      ++self->summary->hashed_files_size;
+    }
+  }
+
+  // Share the digests with the other links of each inode.
+  for (size_t file_index = 1; file_index < arrlenu(candidates); ++file_index) {
+    DedupeFile *previous = candidates[file_index - 1];
+    DedupeFile *file = candidates[file_index];
+    if ((file->inode == previous->inode) &&
+        (DEDUPE_FILE_FLAG_HASHED & previous->flags)) {
+      file->digest = previous->digest;
+      file->flags |= DEDUPE_FILE_FLAG_HASHED;
+    }
+  }
+
+  // Leave out the files that could not be hashed.
+  size_t hashed_size = 0;
+  for (size_t file_index = 0; file_index < arrlenu(candidates); ++file_index) {
+    if (DEDUPE_FILE_FLAG_HASHED & candidates[file_index]->flags) {
+      candidates[hashed_size++] = candidates[file_index];
+    }
+  }
+
+  arrsetlen(candidates, hashed_size);
+  *out_candidates = candidates;
+
+  return 0;
+}
+
+static const DedupeIndexHeader *map_index(void **out_data,
+                                          size_t *out_size) {
+  char path[PATH_MAX];
+  dedupe_format_index_path(path, sizeof(path));
+
+  // The index is rebuilt from scratch when it is missing or invalid.
+  if (0 != io_map_file(path, out_data, out_size)) {
+    return NULL;
+  }
+
+  const DedupeIndexHeader *header = *out_data;
+  size_t size = *out_size;
+  if ((sizeof(*header) > size) ||
+      (0 != memcmp(header->magic, DEDUPE_INDEX_MAGIC, sizeof(header->magic))) ||
+      (DEDUPE_INDEX_VERSION != header->version) ||
+      (header->file_size != size) || (header->layers_offset > size) ||
+      (((size_t)header->layers_size * sizeof(DedupeIndexLayer)) >
+       (size - header->layers_offset)) ||
+      (header->files_offset > size) ||
+      (((size_t)header->files_size * sizeof(DedupeIndexFile)) >
+       (size - header->files_offset)) ||
+      (header->strings_offset > size) ||
+      (header->strings_size > (size - header->strings_offset)) ||
+      (0 == header->strings_size) ||
+      ('\0' != *((const char *)*out_data + header->strings_offset +
+                 header->strings_size - 1))) {
+    io_unmap_file(*out_data, size);
+    return NULL;
+  }
+
+  return header;
+}
+
+static int read_indexed_layer(DedupeLayer *layer,
+                              const DedupeIndexHeader *header,
+                              const DedupeIndexLayer *index_layer) {
+  const uint8_t *data = (const uint8_t *)header;
+  const DedupeIndexFile *files =
+      (const DedupeIndexFile *)(data + header->files_offset);
+  const char *strings = (const char *)(data + header->strings_offset);
+
+  if ((index_layer->first_file_index > header->files_size) ||
+      (index_layer->files_size >
+       (header->files_size - index_layer->first_file_index))) {
+    return 1;
+  }
+
+  for (uint32_t file_index = 0; file_index < index_layer->files_size;
+       ++file_index) {
+    const DedupeIndexFile *index_file =
+        &(files[index_layer->first_file_index + file_index]);
+    if (index_file->path >= header->strings_size) {
+      return 1;
+    }
+
+    DedupeFile file = {
+        .layer = layer,
+        .path = strdup(strings + index_file->path),
+        .size = index_file->size,
+        .inode = index_file->inode,
+        .modification_time =
+            {
+                .tv_sec = (time_t)index_file->modification_seconds,
+                .tv_nsec = (long)index_file->modification_nanoseconds,
+            },
+        .mode = index_file->mode,
+        .uid = index_file->uid,
+        .gid = index_file->gid,
+        .flags = index_file->flags,
+    };
+    if (NULL == file.path) {
+      return 1;
+    }
+
+    memcpy(file.digest.bytes, index_file->digest, sizeof(file.digest.bytes));
+    arrput(layer->files, file);
+  }
+
+  return 0;
+}
+
+static int read_layers(Deduper *self) {
+  int ret = 1;
+
+  // The directory stream takes ownership of its descriptor, so the overlay
+  // directory is listed through a copy of it.
+  int directory_fd = dup(self->overlay_directory_fd);
+  if (-1 == directory_fd) {
+    goto out;
+  }
+
+  DIR *directory = fdopendir(directory_fd);
+  if (NULL == directory) {
+    close(directory_fd);
+    goto out;
+  }
+
+  char **names;
+  size_t names_size;
+  if (0 != io_read_directory_names(directory, DT_DIR, &names, &names_size)) {
+    goto out_close_directory;
+  }
+
+  // Only the directories of image layers are deduplicated, which skips the
+  // links directory, and the layers that are still being loaded.
+  for (size_t name_index = 0; name_index < names_size; ++name_index) {
+    if (!is_cache_id(names[name_index])) {
+      continue;
+    }
+
+    DedupeLayer layer = {
+        .cache_id = strdup(names[name_index]),
+        .files = NULL,
+        .is_indexed = 0,
+        .is_stale = 0,
+    };
+    if (NULL == layer.cache_id) {
+      goto out_free_names;
+    }
+
+    arrput(self->layers, layer);
+  }
+
+  // Read the files of the layers that are in the index, which are immutable,
+  // so only the new layers are walked.
+  void *index_data;
+  size_t index_size;
+  const DedupeIndexHeader *header = map_index(&index_data, &index_size);
+  if (NULL != header) {
+    const DedupeIndexLayer *index_layers =
+        (const DedupeIndexLayer *)((const uint8_t *)index_data +
+                                   header->layers_offset);
+    const char *strings =
+        (const char *)index_data + header->strings_offset;
+
+    CacheIdToIndexLayerPair *cache_id_to_index_layer = NULL;
+    for (uint32_t layer_index = 0; layer_index < header->layers_size;
+         ++layer_index) {
+      const DedupeIndexLayer *index_layer = &(index_layers[layer_index]);
+      if (index_layer->cache_id < header->strings_size) {
+        shput(cache_id_to_index_layer,
+              (char *)(strings + index_layer->cache_id), index_layer);
+      }
+    }
+
+    for (size_t layer_index = 0; layer_index < arrlenu(self->layers);
+         ++layer_index) {
+      DedupeLayer *layer = &(self->layers[layer_index]);
+      const DedupeIndexLayer *index_layer =
+          shget(cache_id_to_index_layer, layer->cache_id);
+      if (NULL == index_layer) {
+        continue;
+      }
+
+      layer->is_indexed = 0 == read_indexed_layer(layer, header, index_layer);
+      if (!layer->is_indexed) {
+        free_layer_files(layer);
+      }
+    }
+
+    shfree(cache_id_to_index_layer);
+    io_unmap_file(index_data, index_size);
+  }
+
+  ret = 0;
+
+out_free_names:
+  io_free_directory_names(names, names_size);
+
+out_close_directory:
+  closedir(directory);
+
+out:
+  return ret;
+}
+
+static uint32_t intern_string(char **strings, const char *string) {
+  uint32_t offset = (uint32_t)arrlenu(*strings);
+
+  size_t size = strlen(string) + 1;
+  memcpy(arraddnptr(*strings, size), string, size);
+
+  return offset;
+}
+
+static size_t place_section(size_t *cursor, size_t size) {
+  // Sections are aligned for their widest fields.
+  size_t offset = (*cursor + 7) & ~(size_t)7;
+  *cursor = offset + size;
+
+  return offset;
+}
+
+static int write_index(const Deduper *self) {
+  int ret = 1;
+
+  DedupeIndexLayer *layers = NULL;
+  DedupeIndexFile *files = NULL;
+  char *strings = NULL;
+
+  // Record the layers whose files are all unchanged.
+  for (size_t layer_index = 0; layer_index < arrlenu(self->layers);
+       ++layer_index) {
+    const DedupeLayer *layer = &(self->layers[layer_index]);
+    if (layer->is_stale) {
+      continue;
+    }
+
+    DedupeIndexLayer index_layer = {
+        .cache_id = intern_string(&strings, layer->cache_id),
+        .first_file_index = (uint32_t)arrlenu(files),
+        .files_size = (uint32_t)arrlenu(layer->files),
+    };
+
+    arrput(layers, index_layer);
+
+    for (size_t file_index = 0; file_index < arrlenu(layer->files);
+         ++file_index) {
+      const DedupeFile *file = &(layer->files[file_index]);
+
+      DedupeIndexFile index_file = {
+          .size = file->size,
+          .inode = file->inode,
+          .modification_seconds = (int64_t)file->modification_time.tv_sec,
+          .modification_nanoseconds = (int64_t)file->modification_time.tv_nsec,
+          .mode = file->mode,
+          .uid = file->uid,
+          .gid = file->gid,
+          .flags = file->flags,
+          .path = intern_string(&strings, file->path),
+      };
+
+      memcpy(index_file.digest, file->digest.bytes, sizeof(index_file.digest));
+      arrput(files, index_file);
+    }
+  }
+
+  // The strings section is never empty, so that it is always terminated.
+  if (0 == arrlenu(strings)) {
+    arrput(strings, '\0');
+  }
+
+  DedupeIndexHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, DEDUPE_INDEX_MAGIC, sizeof(header.magic));
+  header.version = DEDUPE_INDEX_VERSION;
+  header.layers_size = (uint32_t)arrlenu(layers);
+  header.files_size = (uint32_t)arrlenu(files);
+  header.strings_size = (uint32_t)arrlenu(strings);
+
+  // Lay out the sections after the header.
+  size_t cursor = sizeof(header);
+  size_t layers_offset =
+      place_section(&cursor, header.layers_size * sizeof(*layers));
+  size_t files_offset =
+      place_section(&cursor, header.files_size * sizeof(*files));
+  size_t strings_offset = place_section(&cursor, header.strings_size);
+  size_t file_size = cursor;
+
+  // All offsets are stored as 32 bit integers.
+  if (UINT32_MAX < file_size) {
+    errno = EFBIG;
+    goto out_free_sections;
+  }
+
+  header.layers_offset = (uint32_t)layers_offset;
+  header.files_offset = (uint32_t)files_offset;
+  header.strings_offset = (uint32_t)strings_offset;
+  header.file_size = (uint32_t)file_size;
+
+  // Assemble the index file.
+  uint8_t *data = calloc(1, file_size);
+  if (NULL == data) {
+    goto out_free_sections;
+  }
+
+  memcpy(data, &header, sizeof(header));
+  memcpy(data + layers_offset, layers, header.layers_size * sizeof(*layers));
+  memcpy(data + files_offset, files, header.files_size * sizeof(*files));
+  memcpy(data + strings_offset, strings, header.strings_size);
+
+  char path[PATH_MAX];
+  dedupe_format_index_path(path, sizeof(path));
+
+  if (0 != io_write_file_atomically(path, data, file_size)) {
+    goto out_free_data;
+  }
+
+  ret = 0;
+
+out_free_data:
+  free(data);
+
+out_free_sections:
+  arrfree(strings);
+  arrfree(files);
+  arrfree(layers);
+
+  return ret;
+}
+
+static void free_layers(Deduper *self) {
+  for (size_t layer_index = 0; layer_index < arrlenu(self->layers);
+       ++layer_index) {
+    free_layer_files(&(self->layers[layer_index]));
+    free(self->layers[layer_index].cache_id);
+  }
+
+  arrfree(self->layers);
+}
+
+int dedupe_run(size_t threads_size, DedupeSummary *out_summary) {
+  int ret = 1;
+
+  memset(out_summary, 0, sizeof(*out_summary));
+
+  Deduper self = {
+      .overlay_directory_fd = -1,
+      .layers = NULL,
+      .scanned_layers = NULL,
+      .hashed_files = NULL,
+      .is_cloning = 1,
+      .temporary_names_size = 0,
+      .xattr_names = {NULL, NULL},
+      .xattr_values = {NULL, NULL},
+      .summary = out_summary,
+  };
+
+  for (size_t buffer_index = 0; buffer_index < 2; ++buffer_index) {
+    self.xattr_names[buffer_index] = malloc(DEDUPE_XATTR_BUFFER_SIZE);
+    self.xattr_values[buffer_index] = malloc(DEDUPE_XATTR_BUFFER_SIZE);
+    if ((NULL == self.xattr_names[buffer_index]) ||
+        (NULL == self.xattr_values[buffer_index])) {
+      goto out_free_buffers;
+    }
+  }
+
+  self.overlay_directory_fd = gimli_directory_open(DEDUPE_OVERLAY_DIRECTORY);
+  if (-1 == self.overlay_directory_fd) {
+    goto out_free_buffers;
+  }
+
+  if (0 != read_layers(&self)) {
+    goto out_free_layers;
+  }
+
+  // Walk the layers that are not in the index.
+  for (size_t layer_index = 0; layer_index < arrlenu(self.layers);
+       ++layer_index) {
+    if (!self.layers[layer_index].is_indexed) {
+      arrput(self.scanned_layers, &(self.layers[layer_index]));
+    }
+  }
+
+  if (0 != parallel_run(arrlenu(self.scanned_layers), threads_size,
+                        run_scan_task, &self)) {
+    goto out_free_layers;
+  }
+
+  DedupeFile **files = collect_files(&self);
+
+  // Hash the files that may be duplicates, and share the contents of each
+  // group of duplicates.
+  DedupeFile **candidates;
+  if (0 != hash_files(&self, files, threads_size, &candidates)) {
+    goto out_free_files;
+  }
+
+  if (0 < arrlenu(candidates)) {
+    qsort(candidates, arrlenu(candidates), sizeof(*candidates),
+          compare_files);
+  }
+
+  for (size_t start = 0; start < arrlenu(candidates);) {
+    size_t end = start + 1;
+    while ((end < arrlenu(candidates)) &&
+           (0 == compare_contents(candidates[start], candidates[end]))) {
+      ++end;
+    }
+
+    if (candidates[start]->inode != candidates[end - 1]->inode) {
+      dedupe_contents(&self, candidates + start, end - start);
+    }
+
+    start = end;
+  }
+
+  for (size_t layer_index = 0; layer_index < arrlenu(self.layers);
+       ++layer_index) {
+    if (!self.layers[layer_index].is_stale) {
+      ++out_summary->layers_size;
+      out_summary->scanned_layers_size +=
+          self.layers[layer_index].is_indexed ? 0 : 1;
+    }
+  }
+
+  out_summary->files_size = arrlenu(files);
+
+  if (0 != write_index(&self)) {
+    goto out_free_candidates;
+  }
+
+  ret = 0;
+
+out_free_candidates:
+  arrfree(candidates);
+
+out_free_files:
+  arrfree(files);
+
+out_free_layers:
+  arrfree(self.hashed_files);
+  arrfree(self.scanned_layers);
+  free_layers(&self);
+  close(self.overlay_directory_fd);
+
+out_free_buffers:
+  for (size_t buffer_index = 0; buffer_index < 2; ++buffer_index) {
+    free(self.xattr_values[buffer_index]);
+    free(self.xattr_names[buffer_index]);
+  }
+
+  return ret;
+}
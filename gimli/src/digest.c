@@ -0,0 +1,115 @@
+#include "gimli/digest.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+static int parse_hex_digit(char digit) {
+  // Digests are always formatted with lowercase hex digits.
+  if (('0' <= digit) && ('9' >= digit)) {
+    return digit - '0';
+  }
+
+  if (('a' <= digit) && ('f' >= digit)) {
+    return (digit - 'a') + 10;
+  }
+
+  return -1;
+}
+
+static const char *skip_prefix(const char *string) {
+  size_t prefix_size = strlen(SHA256_DIGEST_PREFIX);
+  if (0 == strncmp(string, SHA256_DIGEST_PREFIX, prefix_size)) {
+    return string + prefix_size;
+  }
+
+  return string;
+}
+
+int digest_parse(Digest *self, const char *string) {
+  size_t prefix_size = strlen(SHA256_DIGEST_PREFIX);
+  if (0 != strncmp(string, SHA256_DIGEST_PREFIX, prefix_size)) {
+    errno = EINVAL;
+    return 1;
+  }
+
+  return digest_parse_hex(self, string + prefix_size);
+}
+
+int digest_parse_hex(Digest *self, const char *hex) {
+  size_t bits_size;
+  if (0 != digest_parse_prefix(self, hex, &bits_size)) {
+    return 1;
+  }
+
+  // A full digest must specify every bit.
+  if (DIGEST_BITS_SIZE != bits_size) {
+    errno = EINVAL;
+    return 1;
+  }
+
+  return 0;
+}
+
+int digest_parse_prefix(Digest *self, const char *string,
+                        size_t *out_bits_size) {
+  const char *hex = skip_prefix(string);
+
+  // Zero the digest, so that the bits that are not specified by the prefix
+  // compare equal between prefixes.
+  memset(self->bytes, 0, sizeof(self->bytes));
+
+  size_t digit_index = 0;
+  for (; '\0' != hex[digit_index]; ++digit_index) {
+    if (SHA256_HEX_DIGEST_SIZE <= digit_index) {
+      errno = EINVAL;
+      return 1;
+    }
+
+    int value = parse_hex_digit(hex[digit_index]);
+    if (-1 == value) {
+      errno = EINVAL;
+      return 1;
+    }
+
+    // Even digits are the high nibble of their byte.
+    unsigned int shift = (0 == (digit_index % 2)) ? 4 : 0;
+    self->bytes[digit_index / 2] |= (uint8_t)((unsigned int)value << shift);
+  }
+
+  // An empty prefix matches every digest, which is never useful.
+  if (0 == digit_index) {
+    errno = EINVAL;
+    return 1;
+  }
+
+  *out_bits_size = digit_index * 4;
+
+  return 0;
+}
+
+void digest_format(const Digest *self, char out_string[DIGEST_STRING_SIZE]) {
+  char hex[SHA256_HEX_DIGEST_SIZE + 1];
+  sha256_to_hex(self->bytes, hex);
+
+  snprintf(out_string, DIGEST_STRING_SIZE, "%s%s", SHA256_DIGEST_PREFIX, hex);
+}
+
+uint64_t digest_hash(const Digest *self) {
+  // The bytes of a digest are already uniformly distributed, so any of them
+  // can be used as the hash directly.
+  uint64_t hash;
+  memcpy(&hash, self->bytes, sizeof(hash));
+
+  return hash;
+}
+
+int digest_equals(const Digest *self, const Digest *other) {
+  return 0 == memcmp(self->bytes, other->bytes, sizeof(self->bytes));
+}
+
+unsigned int digest_get_bit(const Digest *self, size_t bit_index) {
+  // Bits are numbered from the most significant bit of the first byte, so
+  // that a hex prefix covers the lowest numbered bits.
+  return (self->bytes[bit_index / 8] >> (7 - (bit_index % 8))) & 1;
+}
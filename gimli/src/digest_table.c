@@ -0,0 +1,84 @@
+#include "gimli/digest_table.h"
+
+#include <stdlib.h>
+
+// The capacity of a table the first time an entry is added to it.
+#define DIGEST_TABLE_MINIMUM_CAPACITY 16
+
+// Tables are kept at most half full, so that probe sequences stay short.
+static int is_full(const DigestTable *self) {
+  return (self->size + 1) * 2 > self->capacity;
+}
+
+static DigestTableSlot *find_slot(const DigestTableSlot *slots, size_t capacity,
+                                  const Digest *key) {
+  // The capacity is a power of 2, so the hash is reduced with a mask.
+  size_t mask = capacity - 1;
+
+  // Probe linearly until the key or an empty slot is found.
+  for (size_t slot_index = (size_t)digest_hash(key) & mask;;
+       slot_index = (slot_index + 1) & mask) {
+    const DigestTableSlot *slot = &(slots[slot_index]);
+    if ((NULL == slot->value) || (digest_equals(&(slot->key), key))) {
+      return (DigestTableSlot *)slot;
+    }
+  }
+}
+
+static int grow(DigestTable *self) {
+  size_t capacity = (0 == self->capacity) ? DIGEST_TABLE_MINIMUM_CAPACITY
+                                          : self->capacity * 2;
+
+  DigestTableSlot *slots = calloc(capacity, sizeof(*slots));
+  if (NULL == slots) {
+    return 1;
+  }
+
+  // Move all of the entries to the new slots.
+  for (size_t slot_index = 0; slot_index < self->capacity; ++slot_index) {
+    const DigestTableSlot *slot = &(self->slots[slot_index]);
+    if (NULL != slot->value) {
+      *find_slot(slots, capacity, &(slot->key)) = *slot;
+    }
+  }
+
+  free(self->slots);
+
+  self->slots = slots;
+  self->capacity = capacity;
+
+  return 0;
+}
+
+void digest_table_init(DigestTable *self) {
+  self->slots = NULL;
+  self->capacity = 0;
+  self->size = 0;
+}
+
+void digest_table_destroy(DigestTable *self) { free(self->slots); }
+
+int digest_table_put(DigestTable *self, const Digest *key, void *value) {
+  // Grow the table before adding an entry to it, as the entry may be new.
+  if ((is_full(self)) && (0 != grow(self))) {
+    return 1;
+  }
+
+  DigestTableSlot *slot = find_slot(self->slots, self->capacity, key);
+  if (NULL == slot->value) {
+    slot->key = *key;
+    ++self->size;
+  }
+
+  slot->value = value;
+
+  return 0;
+}
+
+void *digest_table_get(const DigestTable *self, const Digest *key) {
+  if (0 == self->size) {
+    return NULL;
+  }
+
+  return find_slot(self->slots, self->capacity, key)->value;
+}
@@ -0,0 +1,182 @@
+#include "gimli/digest_trie.h"
+
+#include <errno.h>
+#include <stdint.h>
+
+typedef struct DigestTrieNode {
+  // Each child is either another node or a leaf digest, as marked by the
+  // corresponding bit of leaf_children.
+  const void *children[2];
+  uint16_t bit_index;
+  uint8_t leaf_children;
+} DigestTrieNode;
+
+typedef struct DigestTrieCursor {
+  const void *node;
+  int is_leaf;
+} DigestTrieCursor;
+
+static DigestTrieCursor get_child(const DigestTrieNode *node,
+                                  unsigned int direction) {
+  DigestTrieCursor child = {
+      .node = node->children[direction],
+      .is_leaf = (int)((node->leaf_children >> direction) & 1),
+  };
+
+  return child;
+}
+
+static void set_child(DigestTrieNode *node, unsigned int direction,
+                      DigestTrieCursor child) {
+  node->children[direction] = child.node;
+
+  if (child.is_leaf) {
+    node->leaf_children |= (uint8_t)(1 << direction);
+  } else {
+    node->leaf_children &= (uint8_t)(~(1 << direction));
+  }
+}
+
+static const Digest *find_leaf(DigestTrieCursor cursor, const Digest *digest) {
+  // Follow the digest's bits until a leaf is reached.
+  // Bits beyond the node's bit are irrelevant, so any leaf below a node works
+  // when no digest is given.
+  while (!cursor.is_leaf) {
+    const DigestTrieNode *node = cursor.node;
+    unsigned int direction =
+        (NULL == digest) ? 0 : digest_get_bit(digest, node->bit_index);
+    cursor = get_child(node, direction);
+  }
+
+  return cursor.node;
+}
+
+void digest_trie_init(DigestTrie *self) {
+  self->root = NULL;
+  self->is_root_leaf = 0;
+}
+
+int digest_trie_insert(DigestTrie *self, const Digest *digest, Arena *arena) {
+  // Copy the digest into the arena, as the trie's leaves point to it.
+  Digest *leaf = arena_allocate(arena, sizeof(*leaf));
+  if (NULL == leaf) {
+    return 1;
+  }
+
+  *leaf = *digest;
+
+  // The first digest becomes the root.
+  if (NULL == self->root) {
+    self->root = leaf;
+    self->is_root_leaf = 1;
+    return 0;
+  }
+
+  // Find the closest digest that is already in the trie, and the first bit in
+  // which it differs from the new digest.
+  DigestTrieCursor root = {.node = self->root, .is_leaf = self->is_root_leaf};
+  const Digest *closest = find_leaf(root, digest);
+
+  size_t bit_index = 0;
+  while ((DIGEST_BITS_SIZE > bit_index) &&
+         (digest_get_bit(closest, bit_index) ==
+          digest_get_bit(digest, bit_index))) {
+    ++bit_index;
+  }
+
+  // The digest is already in the trie.
+  if (DIGEST_BITS_SIZE == bit_index) {
+    return 0;
+  }
+
+  DigestTrieNode *node = arena_allocate(arena, sizeof(*node));
+  if (NULL == node) {
+    return 1;
+  }
+
+  node->bit_index = (uint16_t)bit_index;
+  node->leaf_children = 0;
+
+  // Find the position of the new node, which is above the first node that
+  // branches on a later bit.
+  DigestTrieNode *parent = NULL;
+  unsigned int parent_direction = 0;
+  DigestTrieCursor cursor = root;
+
+  while (!cursor.is_leaf) {
+    DigestTrieNode *current = (DigestTrieNode *)cursor.node;
+    if (current->bit_index > bit_index) {
+      break;
+    }
+
+    parent = current;
+    parent_direction = digest_get_bit(digest, current->bit_index);
+    cursor = get_child(current, parent_direction);
+  }
+
+  // The new digest goes on the side of its differing bit, and the existing
+  // subtree goes on the other side.
+  unsigned int direction = digest_get_bit(digest, bit_index);
+  DigestTrieCursor new_leaf = {.node = leaf, .is_leaf = 1};
+  set_child(node, direction, new_leaf);
+  set_child(node, 1 - direction, cursor);
+
+  DigestTrieCursor new_node = {.node = node, .is_leaf = 0};
+  if (NULL == parent) {
+    self->root = node;
+    self->is_root_leaf = 0;
+  } else {
+    set_child(parent, parent_direction, new_node);
+  }
+
+  return 0;
+}
+
+int digest_trie_find_prefix(const DigestTrie *self, const char *prefix,
+                            Digest *out_digest) {
+  Digest prefix_digest;
+  size_t prefix_bits_size;
+  if (0 != digest_parse_prefix(&prefix_digest, prefix, &prefix_bits_size)) {
+    return 1;
+  }
+
+  if (NULL == self->root) {
+    errno = ENOENT;
+    return 1;
+  }
+
+  // Follow the prefix's bits down to the top-most subtree whose digests all
+  // share the prefix's bits.
+  DigestTrieCursor cursor = {.node = self->root, .is_leaf = self->is_root_leaf};
+
+  while (!cursor.is_leaf) {
+    const DigestTrieNode *node = cursor.node;
+    if (node->bit_index >= prefix_bits_size) {
+      break;
+    }
+
+    cursor = get_child(node, digest_get_bit(&prefix_digest, node->bit_index));
+  }
+
+  // Every digest in the subtree shares the same first bits, so checking a
+  // single one of them tells whether the prefix matches any digest at all.
+  const Digest *candidate = find_leaf(cursor, NULL);
+
+  for (size_t bit_index = 0; bit_index < prefix_bits_size; ++bit_index) {
+    if (digest_get_bit(candidate, bit_index) !=
+        digest_get_bit(&prefix_digest, bit_index)) {
+      errno = ENOENT;
+      return 1;
+    }
+  }
+
+  // A prefix that matches more than a single digest is ambiguous.
+  if (!cursor.is_leaf) {
+    errno = EEXIST;
+    return 1;
+  }
+
+  *out_digest = *candidate;
+
+  return 0;
+}
@@ -1,8 +1,40 @@
 #include "gimli/gimli_directory.h"
 
+#include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 static const char *const GIMLI_DIRECTORY = "/var/lib/gimli";
 /* static const char *const GIMLI_DIRECTORY = "/Library/gimli"; */
 
-const char *gimli_directory_get(void) { return GIMLI_DIRECTORY; }
+// The environment variable that overrides the gimli directory.
+static const char *const GIMLI_DIRECTORY_ENVIRONMENT_VARIABLE = "GIMLI_ROOT";
+
+// The gimli directory, once it has been resolved or set explicitly.
+static const char *gimli_directory = NULL;
+
+const char *gimli_directory_get(void) {
+  if (NULL == gimli_directory) {
+    const char *environment_directory =
+        getenv(GIMLI_DIRECTORY_ENVIRONMENT_VARIABLE);
+
+    gimli_directory = ((NULL != environment_directory) &&
+                       ('\0' != environment_directory[0]))
+                          ? environment_directory
+                          : GIMLI_DIRECTORY;
+  }
+
+  return gimli_directory;
+}
+
+void gimli_directory_set(const char *path) { gimli_directory = path; }
+
+int gimli_directory_open(const char *relative_path) {
+  // Format the directory's path.
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s", gimli_directory_get(), relative_path);
+
+  // Open the directory, so that the files in it can be opened relative to it.
+  return open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
@@ -1,33 +1,92 @@
 #include "gimli/image.h"
 
-#include <limits.h>
 #include <stdio.h>
 #include <string.h>
 
 #include "gimli/io.h"
+#include "gimli/json_scanner.h"
+#include "gimli/layer.h"
 #include "jansson.h"
 
-#define IMAGE_ID_PREFIX "sha256:"
+static int scan_image_layers(Image *self, const char *metadata,
+                             size_t metadata_size, Arena *arena) {
+  // Only the RootFS layers diff IDs array is extracted from the metadata, and
+  // everything around it is skipped without being parsed.
+  JsonScanner scanner;
+  json_scanner_init(&scanner, metadata, metadata_size);
+
+  if ((0 != json_scanner_enter_object(&scanner)) ||
+      (0 != json_scanner_find_member(&scanner, "rootfs")) ||
+      (0 != json_scanner_enter_object(&scanner)) ||
+      (0 != json_scanner_find_member(&scanner, "diff_ids")) ||
+      (0 != json_scanner_enter_array(&scanner))) {
+    return 1;
+  }
 
-static int init_image_layers(Image *self, const char *id,
-                             const char *image_store_directory) {
-  int ret = 1;
+  // Count the diff IDs on a copy of the scanner, so that the layers array can
+  // be allocated from the arena at its final size.
+  JsonScanner counting_scanner = scanner;
+  size_t layers_size = 0;
 
-  // Format the metadata file path.
-  char metadata_file_path[PATH_MAX];
-  snprintf(metadata_file_path, sizeof(metadata_file_path), "%s/%s",
-           image_store_directory, id);
+  for (;;) {
+    int has_element;
+    if (0 != json_scanner_next_element(&counting_scanner, &has_element)) {
+      return 1;
+    }
 
-  // Read the metadata file.
-  char *metadata_file;
-  if (0 != io_file_to_string(metadata_file_path, &metadata_file)) {
-    goto out;
+    if (!has_element) {
+      break;
+    }
+
+    JsonScannerString diff_id;
+    if (0 != json_scanner_read_string(&counting_scanner, &diff_id)) {
+      return 1;
+    }
+
+    ++layers_size;
+  }
+
+  // Check the rest of the metadata, so that anything Jansson would reject
+  // falls back to it.
+  if (0 != json_scanner_finish(&counting_scanner)) {
+    return 1;
+  }
+
+  // Initialize the image layers.
+  self->layers = arena_allocate(arena, layers_size * sizeof(*self->layers));
+  if (NULL == self->layers) {
+    return 1;
   }
 
+  for (size_t layer_index = 0; layer_index < layers_size; ++layer_index) {
+    int has_element;
+    JsonScannerString diff_id;
+    if ((0 != json_scanner_next_element(&scanner, &has_element)) ||
+        (0 != json_scanner_read_string(&scanner, &diff_id))) {
+      return 1;
+    }
+
+    // Extract the layer's diff ID.
+    self->layers[layer_index] = arena_allocate(arena, diff_id.size + 1);
+    if ((NULL == self->layers[layer_index]) ||
+        (0 != json_scanner_string_copy(&diff_id, self->layers[layer_index]))) {
+      return 1;
+    }
+  }
+
+  self->layers_size = layers_size;
+
+  return 0;
+}
+
+static int parse_image_layers(Image *self, const char *metadata_file,
+                              size_t metadata_file_size, Arena *arena) {
+  int ret = 1;
+
   // Parse the metadata.
-  json_t *metadata = json_loads(metadata_file, 0, NULL);
+  json_t *metadata = json_loadb(metadata_file, metadata_file_size, 0, NULL);
   if (NULL == metadata) {
-    goto out_free_metadata_file;
+    goto out;
   }
 
   if (!json_is_object(metadata)) {
@@ -47,60 +106,60 @@ static int init_image_layers(Image *self, const char *id,
   }
 
   // Initialize the image layers.
-  self->layers = malloc(json_array_size(layers) * sizeof(*self->layers));
+  self->layers =
+      arena_allocate(arena, json_array_size(layers) * sizeof(*self->layers));
   if (NULL == self->layers) {
     goto out_decref_metadata;
   }
 
-  // The layers array size will be incremented each time we successfully
-  // parse a single item.
-  self->layers_size = 0;
-
   for (size_t layer_index = 0; layer_index < json_array_size(layers);
        ++layer_index) {
     // Retrieve the layer JSON from the array.
     json_t *layer_json = json_array_get(layers, layer_index);
     if (!json_is_string(layer_json)) {
-      goto out_free_layers;
+      goto out_decref_metadata;
     }
 
     // Initialize the layer.
-    self->layers[layer_index] = strdup(json_string_value(layer_json));
+    self->layers[layer_index] =
+        arena_duplicate_string(arena, json_string_value(layer_json));
     if (NULL == self->layers[layer_index]) {
-      goto out_free_layers;
+      goto out_decref_metadata;
     }
-
-    // Increment the size of the layers array after successfully parsing an
-    // item.
-    ++self->layers_size;
   }
 
-  ret = 0;
-  goto out_decref_metadata;
+  self->layers_size = json_array_size(layers);
 
-out_free_layers:
-  for (size_t layer_index = 0; layer_index < self->layers_size; ++layer_index) {
-    free(self->layers[layer_index]);
-  }
-
-  free(self->layers);
+  ret = 0;
 
 out_decref_metadata:
   json_decref(metadata);
 
-out_free_metadata_file:
-  free(metadata_file);
-
 out:
   return ret;
 }
 
-static int init_image_id(Image *self, const char *id) {
+static int init_image_layers(Image *self, const char *metadata,
+                             size_t metadata_size, Arena *arena) {
+  // Extract the layers with the scanner, and fall back to fully parsing (and
+  // validating) the metadata if the scanner fails.
+  // Jansson allocates the parsed metadata from the arena as well.
+  int ret = scan_image_layers(self, metadata, metadata_size, arena);
+  if (0 != ret) {
+    arena_begin_json(arena);
+    ret = parse_image_layers(self, metadata, metadata_size, arena);
+    arena_end_json();
+  }
+
+  return ret;
+}
+
+static int init_image_id(Image *self, const char *id, Arena *arena) {
   // `sizeof(IMAGE_ID_PREFIX)` includes the null terminator, so no need to add 1
   // to the size.
   size_t id_size = sizeof(IMAGE_ID_PREFIX) + strlen(id);
 
-  self->id = malloc(id_size);
+  self->id = arena_allocate(arena, id_size);
   if (NULL == self->id) {
     return 1;
   }
@@ -110,29 +169,45 @@ static int init_image_id(Image *self, const char *id) {
   return 0;
 }
 
-int image_init(Image *self, const char *id, const char *image_store_directory) {
+int image_init(Image *self, const char *id, int image_store_directory_fd,
+               Arena *arena) {
+  // Map the metadata file, which is named after the ID.
+  void *metadata_file;
+  size_t metadata_file_size;
+  if (0 != io_map_file_at(image_store_directory_fd, id, &metadata_file,
+                          &metadata_file_size)) {
+    return 1;
+  }
+
+  int ret = image_init_from_metadata(self, id, metadata_file,
+                                     metadata_file_size, arena);
+
+  io_unmap_file(metadata_file, metadata_file_size);
+
+  return ret;
+}
+
+int image_init_from_metadata(Image *self, const char *id, const char *metadata,
+                             size_t metadata_size, Arena *arena) {
   // Initialize the ID.
-  if (0 != init_image_id(self, id)) {
+  if (0 != init_image_id(self, id, arena)) {
     return 1;
   }
 
   // Initialize the RootFS layers.
-  if (0 != init_image_layers(self, id, image_store_directory)) {
-    free(self->id);
+  if (0 != init_image_layers(self, metadata, metadata_size, arena)) {
     return 1;
   }
 
   return 0;
 }
 
-void image_destroy(Image *self) {
-  // Free the layers array.
-  for (size_t layer_index = 0; layer_index < self->layers_size; ++layer_index) {
-    free(self->layers[layer_index]);
+void image_compute_chain_id(const Image *self,
+                            char out_chain_id[DIGEST_STRING_SIZE]) {
+  // The chain ID of the top-most layer identifies the whole layer stack.
+  for (size_t layer_index = 0; layer_index < self->layers_size;
+       ++layer_index) {
+    layer_compute_chain_id((0 == layer_index) ? NULL : out_chain_id,
+                           self->layers[layer_index], out_chain_id);
   }
-
-  free(self->layers);
-
-  // Free the ID.
-  free(self->id);
 }
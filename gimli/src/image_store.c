@@ -1,15 +1,111 @@
 #include "gimli/image_store.h"
 
 #include <dirent.h>
-#include <errno.h>
 #include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
+#include "gimli/digest.h"
 #include "gimli/gimli_directory.h"
 #include "gimli/io.h"
+#include "gimli/json_scanner.h"
+#include "gimli/parallel.h"
 #include "jansson.h"
 #include "stb_ds/stb_ds.h"
 
+// The image store directory, relative to the gimli directory.
+#define IMAGE_STORE_DIRECTORY "image/overlay2/imagedb/content/sha256"
+
+static int scan_repository(ImageStore *self, JsonScanner *scanner) {
+  if (0 != json_scanner_enter_object(scanner)) {
+    return 1;
+  }
+
+  for (;;) {
+    JsonScannerString repository_name;
+    int has_member;
+    if (0 != json_scanner_next_member(scanner, &repository_name, &has_member)) {
+      return 1;
+    }
+
+    if (!has_member) {
+      return 0;
+    }
+
+    JsonScannerString image_id;
+    if (0 != json_scanner_read_string(scanner, &image_id)) {
+      return 1;
+    }
+
+    char *store_repository_name =
+        arena_allocate(&self->arena, repository_name.size + 1);
+    if ((NULL == store_repository_name) ||
+        (0 != json_scanner_string_copy(&repository_name,
+                                       store_repository_name))) {
+      return 1;
+    }
+
+    char *store_image_id = arena_allocate(&self->arena, image_id.size + 1);
+    if ((NULL == store_image_id) ||
+        (0 != json_scanner_string_copy(&image_id, store_image_id))) {
+      return 1;
+    }
+
+    shput(self->repository_to_id, store_repository_name, store_image_id);
+  }
+}
+
+static int scan_repositories(ImageStore *self, const char *repositories_file,
+                             size_t repositories_file_size) {
+  // Reset the repository to ID map (required to be initialized to NULL by
+  // stb_ds).
+  self->repository_to_id = NULL;
+
+  // Only the repositories object is extracted from the file, and everything
+  // around it is skipped without being parsed.
+  JsonScanner scanner;
+  json_scanner_init(&scanner, repositories_file, repositories_file_size);
+
+  if ((0 != json_scanner_enter_object(&scanner)) ||
+      (0 != json_scanner_find_member(&scanner, "Repositories")) ||
+      (0 != json_scanner_enter_object(&scanner))) {
+    return 1;
+  }
+
+  // Scan each repository.
+  for (;;) {
+    JsonScannerString repository_kind;
+    int has_member;
+    if (0 != json_scanner_next_member(&scanner, &repository_kind, &has_member)) {
+      goto out_free_repository_to_id;
+    }
+
+    if (!has_member) {
+      break;
+    }
+
+    if (0 != scan_repository(self, &scanner)) {
+      goto out_free_repository_to_id;
+    }
+  }
+
+  // Check the rest of the file, so that anything Jansson would reject falls
+  // back to it.
+  if (0 != json_scanner_finish(&scanner)) {
+    goto out_free_repository_to_id;
+  }
+
+  return 0;
+
+out_free_repository_to_id:
+  shfree(self->repository_to_id);
+
+  return 1;
+}
+
 static int parse_repository(ImageStore *self, json_t *repository) {
   const char *repository_name;
   json_t *image_id_json;
@@ -18,14 +114,15 @@ static int parse_repository(ImageStore *self, json_t *repository) {
       return 1;
     }
 
-    char *store_repository_name = strdup(repository_name);
+    char *store_repository_name =
+        arena_duplicate_string(&self->arena, repository_name);
     if (NULL == store_repository_name) {
       return 1;
     }
 
-    char *store_image_id = strdup(json_string_value(image_id_json));
+    char *store_image_id =
+        arena_duplicate_string(&self->arena, json_string_value(image_id_json));
     if (NULL == store_image_id) {
-      free(store_repository_name);
       return 1;
     }
 
@@ -35,11 +132,13 @@ static int parse_repository(ImageStore *self, json_t *repository) {
   return 0;
 }
 
-static int parse_repositories(ImageStore *self, const char *repositories_file) {
+static int parse_repositories(ImageStore *self, const char *repositories_file,
+                              size_t repositories_file_size) {
   int ret = 1;
 
   // Parse the repositories root JSON.
-  json_t *repositories_root = json_loads(repositories_file, 0, NULL);
+  json_t *repositories_root =
+      json_loadb(repositories_file, repositories_file_size, 0, NULL);
   if (NULL == repositories_root) {
     goto out;
   }
@@ -75,12 +174,6 @@ static int parse_repositories(ImageStore *self, const char *repositories_file) {
   goto out_decref_repositories_root;
 
 out_free_repository_to_id:
-  for (ptrdiff_t pair_index = 0; pair_index < shlen(self->repository_to_id);
-       ++pair_index) {
-    free(self->repository_to_id[pair_index].key);
-    free(self->repository_to_id[pair_index].value);
-  }
-
   shfree(self->repository_to_id);
 
 out_decref_repositories_root:
@@ -90,59 +183,143 @@ out:
   return ret;
 }
 
-static int read_image_store(ImageStore *self, const char *path,
-                            DIR *directory) {
+static int add_image(ImageStore *self, Image *image) {
+  Digest id;
+  if (0 != digest_parse(&id, image->id)) {
+    return 1;
+  }
+
+  return digest_table_put(&self->id_to_image, &id, image);
+}
+
+typedef struct ReadImageStoreContext {
+  char **ids;
+  char **metadata;
+  size_t *metadata_sizes;
+  Image *images;
+  Arena *worker_arenas;
+} ReadImageStoreContext;
+
+static int read_image(void *argument, size_t worker_index,
+                      size_t image_index) {
+  ReadImageStoreContext *context = argument;
+
+  // Read the image information into its own slot, and allocate it from the
+  // worker's own arena, so that images can be read concurrently.
+  return image_init_from_metadata(
+      &(context->images[image_index]), context->ids[image_index],
+      context->metadata[image_index], context->metadata_sizes[image_index],
+      &(context->worker_arenas[worker_index]));
+}
+
+static int read_image_store(ImageStore *self, DIR *directory) {
   int ret = 1;
 
-  // Reset the ID to image map (required to be initialized to NULL by stb_ds).
-  self->id_to_image = NULL;
+  // List the image metadata files, which are named after the images' IDs.
+  char **ids;
+  size_t ids_size;
+  if (0 != io_read_directory_names(directory, DT_REG, &ids, &ids_size)) {
+    goto out;
+  }
 
-  for (;;) {
-    // Set `errno` to 0 before reading the next directory entry.
-    errno = 0;
-
-    // Read the next directory entry.
-    struct dirent *entry = readdir(directory);
-    if (NULL == entry) {
-      // Check if an error occurred while reading the directory entry.
-      if (0 != errno) {
-        goto out_free_id_to_image;
-      }
-
-      // Completed reading all directory entries.
-      break;
-    }
+  // Read all of the metadata files at once.
+  // The metadata is only needed until the images are read from it.
+  Arena metadata_arena;
+  arena_init(&metadata_arena);
 
-    // Skip non regular file entries.
-    if (DT_REG != entry->d_type) {
-      continue;
-    }
+  char **metadata = arena_allocate(&metadata_arena, ids_size * sizeof(*metadata));
+  size_t *metadata_sizes =
+      arena_allocate(&metadata_arena, ids_size * sizeof(*metadata_sizes));
+  if ((NULL == metadata) || (NULL == metadata_sizes)) {
+    goto out_destroy_metadata_arena;
+  }
 
-    // Read the image information.
-    Image image;
-    if (0 != image_init(&image, entry->d_name, path)) {
-      goto out_free_id_to_image;
-    }
+  if (0 != io_read_files_at(self->image_store_directory_fd,
+                            (const char *const *)ids, ids_size,
+                            &metadata_arena, metadata, metadata_sizes)) {
+    goto out_destroy_metadata_arena;
+  }
+
+  // Allocate a slot for each image, and an arena for each worker thread.
+  size_t threads_size = parallel_get_threads_size();
+
+  Image *images = arena_allocate(&self->arena, ids_size * sizeof(*images));
+  if (NULL == images) {
+    goto out_destroy_metadata_arena;
+  }
+
+  Arena *worker_arenas = malloc(threads_size * sizeof(*worker_arenas));
+  if (NULL == worker_arenas) {
+    goto out_destroy_metadata_arena;
+  }
+
+  for (size_t worker_index = 0; worker_index < threads_size; ++worker_index) {
+    arena_init(&(worker_arenas[worker_index]));
+  }
+
+  // Extract the images from their metadata on a pool of worker threads.
+  ReadImageStoreContext context = {
+      .ids = ids,
+      .metadata = metadata,
+      .metadata_sizes = metadata_sizes,
+      .images = images,
+      .worker_arenas = worker_arenas,
+  };
+
+  if (0 != parallel_run(ids_size, threads_size, read_image, &context)) {
+    goto out_destroy_worker_arenas;
+  }
 
-    // Add the image to the ID to image map.
-    shput(self->id_to_image, image.id, image);
+  // Merge the worker arenas into the store's arena.
+  for (size_t worker_index = 0; worker_index < threads_size; ++worker_index) {
+    arena_adopt(&self->arena, &(worker_arenas[worker_index]));
+  }
+
+  // Add the images to the ID to image map.
+  // The images are added in ID order, so the map does not depend on the order
+  // in which the worker threads finished.
+  for (size_t image_index = 0; image_index < ids_size; ++image_index) {
+    if (0 != add_image(self, &(images[image_index]))) {
+      goto out_free_worker_arenas;
+    }
   }
 
   ret = 0;
-  goto out;
+  goto out_free_worker_arenas;
 
-out_free_id_to_image:
-  for (ptrdiff_t pair_index = 0; pair_index < shlen(self->id_to_image);
-       ++pair_index) {
-    image_destroy(&(self->id_to_image[pair_index].value));
+out_destroy_worker_arenas:
+  for (size_t worker_index = 0; worker_index < threads_size; ++worker_index) {
+    arena_destroy(&(worker_arenas[worker_index]));
   }
 
-  shfree(self->id_to_image);
+out_free_worker_arenas:
+  free(worker_arenas);
+
+out_destroy_metadata_arena:
+  arena_destroy(&metadata_arena);
+
+  io_free_directory_names(ids, ids_size);
 
 out:
   return ret;
 }
 
+static DIR *open_image_store_directory(const ImageStore *self) {
+  // The directory stream takes ownership of its descriptor, so it is given a
+  // descriptor of its own.
+  int fd = dup(self->image_store_directory_fd);
+  if (-1 == fd) {
+    return NULL;
+  }
+
+  DIR *directory = fdopendir(fd);
+  if (NULL == directory) {
+    close(fd);
+  }
+
+  return directory;
+}
+
 static int init_repository_to_id(ImageStore *self) {
   int ret = 1;
 
@@ -151,21 +328,32 @@ static int init_repository_to_id(ImageStore *self) {
   snprintf(repositories_file_path, sizeof(repositories_file_path),
            "%s/image/overlay2/repositories.json", gimli_directory_get());
 
-  // Read the repositories file.
-  char *repositories_file;
-  if (0 != io_file_to_string(repositories_file_path, &repositories_file)) {
+  // Map the repositories file.
+  void *repositories_file;
+  size_t repositories_file_size;
+  if (0 != io_map_file(repositories_file_path, &repositories_file,
+                       &repositories_file_size)) {
     goto out;
   }
 
-  // Parse the repositories file.
-  if (0 != parse_repositories(self, repositories_file)) {
-    goto out_free_repositories_file;
+  // Extract the repositories with the scanner, and fall back to fully parsing
+  // (and validating) the file if the scanner fails.
+  // Jansson allocates the parsed file from the store's arena as well.
+  if (0 != scan_repositories(self, repositories_file, repositories_file_size)) {
+    arena_begin_json(&self->arena);
+    int parse_result =
+        parse_repositories(self, repositories_file, repositories_file_size);
+    arena_end_json();
+
+    if (0 != parse_result) {
+      goto out_unmap_repositories_file;
+    }
   }
 
   ret = 0;
 
-out_free_repositories_file:
-  free(repositories_file);
+out_unmap_repositories_file:
+  io_unmap_file(repositories_file, repositories_file_size);
 
 out:
   return ret;
@@ -174,20 +362,21 @@ out:
 static int init_id_to_image(ImageStore *self) {
   int ret = 1;
 
-  // Format the image store directory path.
-  char image_store_directory_path[PATH_MAX];
-  snprintf(image_store_directory_path, sizeof(image_store_directory_path),
-           "%s/image/overlay2/imagedb/content/sha256", gimli_directory_get());
+  // Images are read on demand in lazy mode, so the image store directory is
+  // not read during initialization.
+  if (IMAGE_STORE_MODE_LAZY == self->mode) {
+    ret = 0;
+    goto out;
+  }
 
   // Open the image store directory.
-  DIR *image_store_directory = opendir(image_store_directory_path);
+  DIR *image_store_directory = open_image_store_directory(self);
   if (NULL == image_store_directory) {
     goto out;
   }
 
   // Read the image store.
-  if (0 != read_image_store(self, image_store_directory_path,
-                            image_store_directory)) {
+  if (0 != read_image_store(self, image_store_directory)) {
     goto out_close_image_store_directory;
   }
 
@@ -200,62 +389,284 @@ out:
   return ret;
 }
 
-int image_store_init(ImageStore *self) {
-  // Initialize the ID to image map.
-  if (0 != init_id_to_image(self)) {
+int image_store_init(ImageStore *self, ImageStoreMode mode) {
+  self->mode = mode;
+  self->metadata_index = NULL;
+  self->repository_to_id = NULL;
+  self->image_store_directory_fd = -1;
+  digest_table_init(&self->id_to_image);
+  digest_trie_init(&self->id_trie);
+  self->has_id_trie = 0;
+  arena_init(&self->arena);
+
+  // Open the image store directory, and initialize the ID to image map and
+  // the repository to ID map.
+  self->image_store_directory_fd = gimli_directory_open(IMAGE_STORE_DIRECTORY);
+  if ((-1 == self->image_store_directory_fd) ||
+      (0 != init_id_to_image(self)) || (0 != init_repository_to_id(self))) {
+    // Release whatever was read before the failure.
+    image_store_destroy(self);
+
     return 1;
   }
 
-  // Initialize the repository to ID map.
-  if (0 != init_repository_to_id(self)) {
-    // Free the ID to image map.
-    for (ptrdiff_t pair_index = 0; pair_index < shlen(self->id_to_image);
-         ++pair_index) {
-      image_destroy(&(self->id_to_image[pair_index].value));
-    }
-
-    shfree(self->id_to_image);
+  return 0;
+}
 
-    return 1;
-  }
+int image_store_init_from_index(ImageStore *self,
+                                const MetadataIndex *metadata_index) {
+  self->mode = IMAGE_STORE_MODE_INDEXED;
+  self->metadata_index = metadata_index;
+  self->image_store_directory_fd = -1;
+  digest_trie_init(&self->id_trie);
+  self->has_id_trie = 0;
+  arena_init(&self->arena);
+
+  // Both maps are filled on demand from the index (and the repository to ID
+  // map is required to be initialized to NULL by stb_ds).
+  digest_table_init(&self->id_to_image);
+  self->repository_to_id = NULL;
 
   return 0;
 }
 
 void image_store_destroy(ImageStore *self) {
-  // Free the repository to ID map.
-  for (ptrdiff_t pair_index = 0; pair_index < shlen(self->repository_to_id);
-       ++pair_index) {
-    free(self->repository_to_id[pair_index].key);
-    free(self->repository_to_id[pair_index].value);
+  shfree(self->repository_to_id);
+  digest_table_destroy(&self->id_to_image);
+
+  // Release all of the images and repositories at once.
+  arena_destroy(&self->arena);
+
+  if (-1 != self->image_store_directory_fd) {
+    close(self->image_store_directory_fd);
   }
+}
 
-  shfree(self->repository_to_id);
+static const char *find_image_id(ImageStore *self, const char *repository) {
+  // Indexed stores look up the repository in the index directly.
+  if (IMAGE_STORE_MODE_INDEXED == self->mode) {
+    return metadata_index_get_image_id(self->metadata_index, repository);
+  }
 
-  // Free the ID to image map.
-  for (ptrdiff_t pair_index = 0; pair_index < shlen(self->id_to_image);
-       ++pair_index) {
-    image_destroy(&(self->id_to_image[pair_index].value));
+  ptrdiff_t repository_pair_index = shgeti(self->repository_to_id, repository);
+  if (-1 == repository_pair_index) {
+    return NULL;
+  }
+
+  return self->repository_to_id[repository_pair_index].value;
+}
+
+static Image *resolve_indexed_image(ImageStore *self, const char *id) {
+  // Read the image information from the index.
+  Image *image = arena_allocate(&self->arena, sizeof(*image));
+  if ((NULL == image) ||
+      (0 != metadata_index_get_image(self->metadata_index, id, &self->arena,
+                                     image))) {
+    return NULL;
+  }
+
+  // Cache the image in the ID to image map, so that subsequent lookups of the
+  // same image do not allocate its layers array again.
+  if (0 != add_image(self, image)) {
+    return NULL;
+  }
+
+  return image;
+}
+
+static Image *resolve_image(ImageStore *self, const char *id) {
+  // The image metadata file is named after the ID without its digest
+  // algorithm prefix.
+  size_t id_prefix_size = strlen(IMAGE_ID_PREFIX);
+  if (0 != strncmp(id, IMAGE_ID_PREFIX, id_prefix_size)) {
+    return NULL;
+  }
+
+  // Read the image information.
+  Image *image = arena_allocate(&self->arena, sizeof(*image));
+  if ((NULL == image) ||
+      (0 != image_init(image, id + id_prefix_size,
+                       self->image_store_directory_fd, &self->arena))) {
+    return NULL;
+  }
+
+  // Cache the image in the ID to image map, so that subsequent lookups of the
+  // same image do not read it again.
+  if (0 != add_image(self, image)) {
+    return NULL;
   }
 
-  shfree(self->id_to_image);
+  return image;
+}
+
+static Image *find_image(ImageStore *self, const char *id) {
+  // Find the image by the ID.
+  Digest id_digest;
+  if (0 != digest_parse(&id_digest, id)) {
+    return NULL;
+  }
+
+  Image *image = digest_table_get(&self->id_to_image, &id_digest);
+  if (NULL != image) {
+    return image;
+  }
+
+  if (IMAGE_STORE_MODE_LAZY == self->mode) {
+    return resolve_image(self, id);
+  }
+
+  if (IMAGE_STORE_MODE_INDEXED == self->mode) {
+    return resolve_indexed_image(self, id);
+  }
+
+  // In eager mode all images have already been read, so the image does not
+  // exist.
+  return NULL;
 }
 
 Image *image_store_get_image_by_repository(ImageStore *self,
                                            const char *repository) {
   // Find the image ID by the repository.
-  ptrdiff_t repository_pair_index = shgeti(self->repository_to_id, repository);
-  if (-1 == repository_pair_index) {
+  const char *id = find_image_id(self, repository);
+  if (NULL == id) {
     return NULL;
   }
 
-  const char *id = self->repository_to_id[repository_pair_index].value;
+  return find_image(self, id);
+}
 
-  // Find the image by the ID.
-  ptrdiff_t id_pair_index = shgeti(self->id_to_image, id);
-  if (-1 == id_pair_index) {
+static int add_image_ids_from_table(ImageStore *self) {
+  for (size_t slot_index = 0; slot_index < self->id_to_image.capacity;
+       ++slot_index) {
+    const DigestTableSlot *slot = &(self->id_to_image.slots[slot_index]);
+    if (NULL == slot->value) {
+      continue;
+    }
+
+    if (0 != digest_trie_insert(&self->id_trie, &(slot->key), &self->arena)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int add_image_ids_from_index(ImageStore *self) {
+  size_t images_size = metadata_index_get_images_size(self->metadata_index);
+
+  for (size_t image_index = 0; image_index < images_size; ++image_index) {
+    const char *id =
+        metadata_index_get_image_id_at(self->metadata_index, image_index);
+
+    Digest id_digest;
+    if ((NULL == id) || (0 != digest_parse(&id_digest, id))) {
+      return 1;
+    }
+
+    if (0 != digest_trie_insert(&self->id_trie, &id_digest, &self->arena)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int add_image_ids_from_directory(ImageStore *self) {
+  int ret = 1;
+
+  // Open the image store directory.
+  DIR *image_store_directory = open_image_store_directory(self);
+  if (NULL == image_store_directory) {
+    goto out;
+  }
+
+  // List the image metadata files, which are named after the images' IDs.
+  char **ids;
+  size_t ids_size;
+  if (0 !=
+      io_read_directory_names(image_store_directory, DT_REG, &ids, &ids_size)) {
+    goto out_close_image_store_directory;
+  }
+
+  for (size_t id_index = 0; id_index < ids_size; ++id_index) {
+    // Skip files that are not named after an image ID.
+    Digest id_digest;
+    if (0 != digest_parse_hex(&id_digest, ids[id_index])) {
+      continue;
+    }
+
+    if (0 != digest_trie_insert(&self->id_trie, &id_digest, &self->arena)) {
+      goto out_free_ids;
+    }
+  }
+
+  ret = 0;
+
+out_free_ids:
+  io_free_directory_names(ids, ids_size);
+
+out_close_image_store_directory:
+  closedir(image_store_directory);
+
+out:
+  return ret;
+}
+
+static int init_id_trie(ImageStore *self) {
+  if (self->has_id_trie) {
+    return 0;
+  }
+
+  // Collect the IDs of all of the images in the store, and not only of the
+  // images that have been resolved so far.
+  int result = 0;
+  switch (self->mode) {
+    case IMAGE_STORE_MODE_EAGER:
+      result = add_image_ids_from_table(self);
+      break;
+
+    case IMAGE_STORE_MODE_LAZY:
+      result = add_image_ids_from_directory(self);
+      break;
+
+    case IMAGE_STORE_MODE_INDEXED:
+      result = add_image_ids_from_index(self);
+      break;
+  }
+
+  if (0 != result) {
+    return 1;
+  }
+
+  self->has_id_trie = 1;
+
+  return 0;
+}
+
+Image *image_store_get_image_by_id_prefix(ImageStore *self,
+                                          const char *id_prefix) {
+  // Find the single image ID that starts with the prefix.
+  if (0 != init_id_trie(self)) {
     return NULL;
   }
 
-  return &(self->id_to_image[id_pair_index].value);
+  Digest id_digest;
+  if (0 != digest_trie_find_prefix(&self->id_trie, id_prefix, &id_digest)) {
+    return NULL;
+  }
+
+  char id[DIGEST_STRING_SIZE];
+  digest_format(&id_digest, id);
+
+  return find_image(self, id);
+}
+
+Image *image_store_get_image_by_name(ImageStore *self, const char *name) {
+  // Look the image up by its repository, or else by its (possibly short) ID.
+  Image *image = image_store_get_image_by_repository(self, name);
+  if (NULL == image) {
+    image = image_store_get_image_by_id_prefix(self, name);
+  }
+
+  return image;
 }
@@ -1,18 +1,52 @@
-#include "gimli/io.h"
-
+#define _DEFAULT_SOURCE
 #define _XOPEN_SOURCE 500
 
+#include "gimli/io.h"
+
 #include <errno.h>
 #include <fcntl.h>
 #include <ftw.h>
+#include <limits.h>
+#include <linux/stat.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/xattr.h>
 #include <unistd.h>
 
+#include "gimli/io_ring.h"
+
+// The number of files that are read with a single pass over the ring.
+// Each file takes a single entry to stat it, and then three linked entries to
+// open, read and close it.
+#define IO_RING_FILES_SIZE 64
+#define IO_RING_ENTRIES_SIZE (IO_RING_FILES_SIZE * 4)
+
+// Smaller batches are read directly, as setting up a ring costs more than
+// the system calls that it saves.
+#define IO_RING_MINIMUM_FILES_SIZE 4
+
+// The ceiling on the number of open files (`fs.nr_open`) that the kernel
+// defaults to.
+#define IO_DEFAULT_OPEN_MAX (1024 * 1024)
+
+// The operation that a completion belongs to is kept in the low bits of its
+// user data, and the file's index within the pass in the rest of them.
+enum IoRingOperation {
+  IO_RING_OPERATION_STAT = 0,
+  IO_RING_OPERATION_OPEN,
+  IO_RING_OPERATION_READ,
+  IO_RING_OPERATION_CLOSE,
+};
+
+#define IO_RING_OPERATION_BITS 2
+
 static int nftw_remove(const char *path,
                        const struct stat *stat_buffer __attribute__((unused)),
                        int type __attribute__((unused)),
@@ -38,6 +72,12 @@ static int read_all(int fd, void *buffer, size_t size) {
       return 1;
     }
 
+    // The file is shorter than expected.
+    if (0 == result) {
+      errno = EIO;
+      return 1;
+    }
+
     cursor += result;
     bytes_remaining -= (size_t)result;
   }
@@ -85,6 +125,749 @@ out:
   return ret;
 }
 
+int io_file_to_buffer(const char *path, char *buffer, size_t size) {
+  int ret = 1;
+
+  // Open the file.
+  int fd = open(path, O_RDONLY);
+  if (-1 == fd) {
+    goto out;
+  }
+
+  // Read the file, leaving room for a null terminator.
+  // A read of the whole buffer means that the file may not fit in it.
+  size_t data_size = 0;
+  while (data_size < size) {
+    ssize_t result = read(fd, buffer + data_size, size - data_size);
+    if (-1 == result) {
+      if (EINTR == errno) {
+        // Interrupted while reading, try reading again.
+        continue;
+      }
+
+      // An error occurred while reading.
+      goto out_close_fd;
+    }
+
+    if (0 == result) {
+      break;
+    }
+
+    data_size += (size_t)result;
+  }
+
+  if (data_size == size) {
+    errno = EFBIG;
+    goto out_close_fd;
+  }
+
+  buffer[data_size] = '\0';
+
+  ret = 0;
+
+out_close_fd:
+  close(fd);
+
+out:
+  return ret;
+}
+
+static int read_file_at(int directory_fd, const char *path, Arena *arena,
+                        char **out_data, size_t *out_size) {
+  int ret = 1;
+
+  // Open the file.
+  int fd = openat(directory_fd, path, O_RDONLY | O_CLOEXEC);
+  if (-1 == fd) {
+    goto out;
+  }
+
+  // Retrieve the file's size.
+  struct stat stat_buffer;
+  if (0 != fstat(fd, &stat_buffer)) {
+    goto out_close_fd;
+  }
+
+  // Allocate a buffer to store the entire file data.
+  size_t size = (size_t)stat_buffer.st_size;
+  *out_data = arena_allocate(arena, size + 1);
+  if (NULL == (*out_data)) {
+    goto out_close_fd;
+  }
+
+  // Read the entire file.
+  if (0 != read_all(fd, *out_data, size)) {
+    goto out_close_fd;
+  }
+
+  (*out_data)[size] = '\0';
+  *out_size = size;
+
+  ret = 0;
+
+out_close_fd:
+  close(fd);
+
+out:
+  return ret;
+}
+
+static void prepare_sqe(struct io_uring_sqe *sqe, uint8_t opcode, int fd,
+                        const void *address, uint32_t size, uint64_t offset,
+                        uint64_t user_data) {
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)address;
+  sqe->len = size;
+  sqe->off = offset;
+  sqe->user_data = user_data;
+}
+
+static uint64_t get_user_data(size_t file_index,
+                              enum IoRingOperation operation) {
+  return ((uint64_t)file_index << IO_RING_OPERATION_BITS) | operation;
+}
+
+static int reap_completions(IoRing *ring, size_t completions_size,
+                            int (*handle)(void *context, size_t file_index,
+                                          enum IoRingOperation operation,
+                                          int32_t result),
+                            void *context) {
+  int ret = 0;
+
+  // Every completion is reaped, even after a failure, so that the ring is
+  // empty for the next pass.
+  for (size_t completion_index = 0; completion_index < completions_size;
+       ++completion_index) {
+    struct io_uring_cqe cqe;
+    if (0 != io_ring_next_cqe(ring, &cqe)) {
+      errno = EIO;
+      return 1;
+    }
+
+    size_t file_index = (size_t)(cqe.user_data >> IO_RING_OPERATION_BITS);
+    enum IoRingOperation operation =
+        (enum IoRingOperation)(cqe.user_data &
+                               ((1 << IO_RING_OPERATION_BITS) - 1));
+
+    if ((0 == ret) && (0 != handle(context, file_index, operation, cqe.res))) {
+      ret = 1;
+    }
+  }
+
+  return ret;
+}
+
+typedef struct ReadFilesPass {
+  char **contents;
+  size_t *sizes;
+  struct statx stat_buffers[IO_RING_FILES_SIZE];
+} ReadFilesPass;
+
+static int handle_completion(void *context, size_t file_index,
+                             enum IoRingOperation operation, int32_t result) {
+  ReadFilesPass *pass = context;
+
+  // The result of a failed operation is its negated error number.
+  if (0 > result) {
+    errno = -result;
+    return 1;
+  }
+
+  switch (operation) {
+    case IO_RING_OPERATION_READ:
+      // The read may be short if the file was truncated after it was stat'd.
+      pass->sizes[file_index] = (size_t)result;
+      pass->contents[file_index][result] = '\0';
+      break;
+
+    case IO_RING_OPERATION_STAT:
+    case IO_RING_OPERATION_OPEN:
+    case IO_RING_OPERATION_CLOSE:
+      break;
+  }
+
+  return 0;
+}
+
+static int read_files_pass(IoRing *ring, int directory_fd,
+                           const char *const *paths, size_t paths_size,
+                           Arena *arena, char **out_contents,
+                           size_t *out_sizes) {
+  ReadFilesPass pass = {
+      .contents = out_contents,
+      .sizes = out_sizes,
+  };
+
+  // Retrieve the files' sizes.
+  for (size_t file_index = 0; file_index < paths_size; ++file_index) {
+    struct io_uring_sqe *sqe = io_ring_get_sqe(ring);
+    prepare_sqe(sqe, IORING_OP_STATX, directory_fd, paths[file_index],
+                STATX_SIZE, (uint64_t)(uintptr_t)&(pass.stat_buffers[file_index]),
+                get_user_data(file_index, IO_RING_OPERATION_STAT));
+  }
+
+  if ((0 != io_ring_submit_and_wait(ring, (uint32_t)paths_size)) ||
+      (0 != reap_completions(ring, paths_size, handle_completion, &pass))) {
+    return 1;
+  }
+
+  // Allocate a buffer for each file, with room for a null terminator.
+  for (size_t file_index = 0; file_index < paths_size; ++file_index) {
+    out_contents[file_index] =
+        arena_allocate(arena, pass.stat_buffers[file_index].stx_size + 1);
+    if (NULL == out_contents[file_index]) {
+      return 1;
+    }
+  }
+
+  // Open, read and close each file with linked entries.
+  // The file is opened into the ring's file table, so that the read can refer
+  // to it before its descriptor is known.
+  for (size_t file_index = 0; file_index < paths_size; ++file_index) {
+    struct io_uring_sqe *open_sqe = io_ring_get_sqe(ring);
+    prepare_sqe(open_sqe, IORING_OP_OPENAT, directory_fd, paths[file_index], 0,
+                0, get_user_data(file_index, IO_RING_OPERATION_OPEN));
+    open_sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    // The file table slot shares its field with `splice_fd_in`, which older
+    // headers only know it as.
+    open_sqe->splice_fd_in = (int32_t)file_index + 1;
+    open_sqe->flags = IOSQE_IO_LINK;
+
+    struct io_uring_sqe *read_sqe = io_ring_get_sqe(ring);
+    prepare_sqe(read_sqe, IORING_OP_READ, (int)file_index,
+                out_contents[file_index],
+                (uint32_t)pass.stat_buffers[file_index].stx_size, 0,
+                get_user_data(file_index, IO_RING_OPERATION_READ));
+    read_sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+
+    struct io_uring_sqe *close_sqe = io_ring_get_sqe(ring);
+    prepare_sqe(close_sqe, IORING_OP_CLOSE, 0, NULL, 0, 0,
+                get_user_data(file_index, IO_RING_OPERATION_CLOSE));
+    close_sqe->splice_fd_in = (int32_t)file_index + 1;
+  }
+
+  size_t completions_size = paths_size * 3;
+  if ((0 != io_ring_submit_and_wait(ring, (uint32_t)completions_size)) ||
+      (0 != reap_completions(ring, completions_size, handle_completion,
+                             &pass))) {
+    return 1;
+  }
+
+  return 0;
+}
+
+static int read_files_with_ring(int directory_fd, const char *const *paths,
+                                size_t paths_size, Arena *arena,
+                                char **out_contents, size_t *out_sizes) {
+  int ret = 1;
+
+  IoRing ring;
+  if (0 != io_ring_init(&ring, IO_RING_ENTRIES_SIZE, IO_RING_FILES_SIZE)) {
+    goto out;
+  }
+
+  // Read the files in passes that fit in the ring.
+  for (size_t first_index = 0; first_index < paths_size;
+       first_index += IO_RING_FILES_SIZE) {
+    size_t pass_size = paths_size - first_index;
+    if (IO_RING_FILES_SIZE < pass_size) {
+      pass_size = IO_RING_FILES_SIZE;
+    }
+
+    if (0 != read_files_pass(&ring, directory_fd, paths + first_index,
+                             pass_size, arena, out_contents + first_index,
+                             out_sizes + first_index)) {
+      goto out_destroy_ring;
+    }
+  }
+
+  ret = 0;
+
+out_destroy_ring:
+  io_ring_destroy(&ring);
+
+out:
+  return ret;
+}
+
+static int is_io_ring_enabled(void) {
+  // io_uring may be disabled explicitly, which is mostly useful to compare the
+  // two implementations.
+  const char *value = getenv("GIMLI_IO_URING");
+  return (NULL == value) || (0 != strcmp(value, "0"));
+}
+
+int io_read_files_at(int directory_fd, const char *const *paths,
+                     size_t paths_size, Arena *arena, char **out_contents,
+                     size_t *out_sizes) {
+  // Read the files with a ring, and fall back to reading them one at a time
+  // if the kernel does not support it (or forbids it).
+  if ((IO_RING_MINIMUM_FILES_SIZE <= paths_size) && (is_io_ring_enabled())) {
+    if (0 == read_files_with_ring(directory_fd, paths, paths_size, arena,
+                                  out_contents, out_sizes)) {
+      return 0;
+    }
+
+    // Errors that belong to the files themselves are not retried.
+    if ((ENOSYS != errno) && (EPERM != errno) && (EINVAL != errno) &&
+        (EOPNOTSUPP != errno)) {
+      return 1;
+    }
+  }
+
+  for (size_t file_index = 0; file_index < paths_size; ++file_index) {
+    if (0 != read_file_at(directory_fd, paths[file_index], arena,
+                          &(out_contents[file_index]),
+                          &(out_sizes[file_index]))) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+int io_write_all(int fd, const void *buffer, size_t size) {
+  const uint8_t *cursor = buffer;
+  size_t bytes_remaining = size;
+
+  while (0 < bytes_remaining) {
+    ssize_t result = write(fd, cursor, bytes_remaining);
+    if (-1 == result) {
+      if (EINTR == errno) {
+        // Interrupted while writing, try writing again.
+        continue;
+      }
+
+      // An error occurred while writing.
+      return 1;
+    }
+
+    cursor += result;
+    bytes_remaining -= (size_t)result;
+  }
+
+  return 0;
+}
+
+int io_map_file(const char *path, void **out_data, size_t *out_size) {
+  return io_map_file_at(AT_FDCWD, path, out_data, out_size);
+}
+
+int io_map_file_at(int directory_fd, const char *path, void **out_data,
+                   size_t *out_size) {
+  int ret = 1;
+
+  // Open the file.
+  int fd = openat(directory_fd, path, O_RDONLY | O_CLOEXEC);
+  if (-1 == fd) {
+    goto out;
+  }
+
+  // Retrieve the file's size.
+  struct stat stat_buffer;
+  if (0 != fstat(fd, &stat_buffer)) {
+    goto out_close_fd;
+  }
+
+  // Empty files cannot be mapped.
+  if (0 == stat_buffer.st_size) {
+    errno = EINVAL;
+    goto out_close_fd;
+  }
+
+  // Map the entire file.
+  // The mapping remains valid after the file descriptor is closed.
+  *out_data = mmap(NULL, (size_t)stat_buffer.st_size, PROT_READ, MAP_PRIVATE,
+                   fd, 0);
+  if (MAP_FAILED == (*out_data)) {
+    goto out_close_fd;
+  }
+
+  *out_size = (size_t)stat_buffer.st_size;
+
+  ret = 0;
+
+out_close_fd:
+  close(fd);
+
+out:
+  return ret;
+}
+
+void io_unmap_file(void *data, size_t size) { munmap(data, size); }
+
+int io_write_file_atomically(const char *path, const void *data, size_t size) {
+  int ret = 1;
+
+  // Format a temporary file path next to the destination, so that the
+  // temporary file can be renamed over the destination.
+  // The process ID is included so that concurrent writers do not clobber each
+  // other's temporary files.
+  char temporary_path[PATH_MAX];
+  snprintf(temporary_path, sizeof(temporary_path), "%s.tmp.%d", path,
+           (int)getpid());
+
+  // Create the temporary file.
+  int fd = open(temporary_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (-1 == fd) {
+    goto out;
+  }
+
+  // Write the data to the temporary file.
+  if (0 != io_write_all(fd, data, size)) {
+    goto out_close_fd;
+  }
+
+  // Replace the destination with the temporary file.
+  if (0 != rename(temporary_path, path)) {
+    goto out_close_fd;
+  }
+
+  ret = 0;
+
+out_close_fd:
+  close(fd);
+
+  if (0 != ret) {
+    unlink(temporary_path);
+  }
+
+out:
+  return ret;
+}
+
+static int compare_names(const void *first, const void *second) {
+  return strcmp(*(char *const *)first, *(char *const *)second);
+}
+
+int io_read_directory_names(DIR *directory, unsigned char type,
+                            char ***out_names, size_t *out_size) {
+  int ret = 1;
+
+  char **names = NULL;
+  size_t names_size = 0;
+  size_t names_capacity = 0;
+
+  for (;;) {
+    // Set `errno` to 0 before reading the next directory entry.
+    errno = 0;
+
+    // Read the next directory entry.
+    struct dirent *entry = readdir(directory);
+    if (NULL == entry) {
+      // Check if an error occurred while reading the directory entry.
+      if (0 != errno) {
+        goto out_free_names;
+      }
+
+      // Completed reading all directory entries.
+      break;
+    }
+
+    // Skip entries of other types.
+    if (type != entry->d_type) {
+      continue;
+    }
+
+    // Skip the "." and ".." directories.
+    if ((0 == strcmp(entry->d_name, ".")) ||
+        (0 == strcmp(entry->d_name, ".."))) {
+      continue;
+    }
+
+    // Grow the names array if it is full.
+    if (names_size == names_capacity) {
+      size_t new_capacity = (0 == names_capacity) ? 64 : (names_capacity * 2);
+      char **new_names = realloc(names, new_capacity * sizeof(*names));
+      if (NULL == new_names) {
+        goto out_free_names;
+      }
+
+      names = new_names;
+      names_capacity = new_capacity;
+    }
+
+    names[names_size] = strdup(entry->d_name);
+    if (NULL == names[names_size]) {
+      goto out_free_names;
+    }
+
+    ++names_size;
+  }
+
+  // Sort the names, so that the result does not depend on the order in which
+  // the file system returns the entries.
+  if (0 < names_size) {
+    qsort(names, names_size, sizeof(*names), compare_names);
+  }
+
+  *out_names = names;
+  *out_size = names_size;
+
+  ret = 0;
+  goto out;
+
+out_free_names:
+  io_free_directory_names(names, names_size);
+
+out:
+  return ret;
+}
+
+void io_free_directory_names(char **names, size_t size) {
+  for (size_t name_index = 0; name_index < size; ++name_index) {
+    free(names[name_index]);
+  }
+
+  free(names);
+}
+
+static int remove_tree_at(int directory_fd, const char *name,
+                          unsigned char type) {
+  // Most entries are files, so unless the entry is known to be a directory,
+  // try unlinking it as a file first.
+  if (DT_DIR != type) {
+    if (0 == unlinkat(directory_fd, name, 0)) {
+      return 0;
+    }
+
+    if (EISDIR != errno) {
+      return 1;
+    }
+  }
+
+  // Open the directory, so that its entries are removed relative to it
+  // instead of by their full paths.
+  int fd =
+      openat(directory_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (-1 == fd) {
+    return 1;
+  }
+
+  DIR *directory = fdopendir(fd);
+  if (NULL == directory) {
+    close(fd);
+    return 1;
+  }
+
+  int ret = 0;
+
+  for (;;) {
+    // Set `errno` to 0 before reading the next directory entry.
+    errno = 0;
+
+    struct dirent *entry = readdir(directory);
+    if (NULL == entry) {
+      if (0 != errno) {
+        ret = 1;
+      }
+
+      break;
+    }
+
+    // Skip the "." and ".." directories.
+    if ((0 == strcmp(entry->d_name, ".")) ||
+        (0 == strcmp(entry->d_name, ".."))) {
+      continue;
+    }
+
+    // Keep removing the rest of the entries if one of them fails, so that as
+    // much of the tree as possible is removed.
+    if (0 != remove_tree_at(fd, entry->d_name, entry->d_type)) {
+      ret = 1;
+    }
+  }
+
+  closedir(directory);
+
+  // Remove the (now empty) directory itself.
+  if (0 != unlinkat(directory_fd, name, AT_REMOVEDIR)) {
+    ret = 1;
+  }
+
+  return ret;
+}
+
+int io_remove_tree_at(int directory_fd, const char *name) {
+  return remove_tree_at(directory_fd, name, DT_UNKNOWN);
+}
+
+static int copy_xattrs(int source_fd, int target_fd) {
+  int ret = 1;
+
+  ssize_t names_size = flistxattr(source_fd, NULL, 0);
+  if (0 >= names_size) {
+    return (0 == names_size) ? 0 : 1;
+  }
+
+  char *names = malloc((size_t)names_size);
+  char *value = malloc(XATTR_SIZE_MAX);
+  if ((NULL == names) || (NULL == value)) {
+    goto out_free;
+  }
+
+  names_size = flistxattr(source_fd, names, (size_t)names_size);
+  if (-1 == names_size) {
+    goto out_free;
+  }
+
+  // The names are null terminated, one after the other.
+  for (const char *name = names; name < names + names_size;
+       name += strlen(name) + 1) {
+    ssize_t value_size = fgetxattr(source_fd, name, value, XATTR_SIZE_MAX);
+    if ((-1 == value_size) ||
+        (0 != fsetxattr(target_fd, name, value, (size_t)value_size, 0))) {
+      goto out_free;
+    }
+  }
+
+  ret = 0;
+
+out_free:
+  free(value);
+  free(names);
+
+  return ret;
+}
+
+static int link_tree_at(int source_directory_fd, const char *source_name,
+                        int target_directory_fd, const char *target_name,
+                        unsigned char type) {
+  // Only directories are copied, and everything else is linked.
+  if (DT_UNKNOWN == type) {
+    struct stat stat_buffer;
+    if (0 != fstatat(source_directory_fd, source_name, &stat_buffer,
+                     AT_SYMLINK_NOFOLLOW)) {
+      return 1;
+    }
+
+    type = S_ISDIR(stat_buffer.st_mode) ? DT_DIR : DT_REG;
+  }
+
+  if (DT_DIR != type) {
+    return (0 == linkat(source_directory_fd, source_name, target_directory_fd,
+                        target_name, 0))
+               ? 0
+               : 1;
+  }
+
+  int ret = 1;
+
+  int source_fd = openat(source_directory_fd, source_name,
+                         O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (-1 == source_fd) {
+    goto out;
+  }
+
+  struct stat stat_buffer;
+  if (0 != fstat(source_fd, &stat_buffer)) {
+    goto out_close_source_fd;
+  }
+
+  // The directory is only made accessible to others once it is complete.
+  if (0 != mkdirat(target_directory_fd, target_name, 0700)) {
+    goto out_close_source_fd;
+  }
+
+  int target_fd = openat(target_directory_fd, target_name,
+                         O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (-1 == target_fd) {
+    goto out_close_source_fd;
+  }
+
+  // The directory stream takes ownership of its own descriptor, so that the
+  // source's is left for its metadata.
+  int directory_fd = dup(source_fd);
+  if (-1 == directory_fd) {
+    goto out_close_target_fd;
+  }
+
+  DIR *directory = fdopendir(directory_fd);
+  if (NULL == directory) {
+    close(directory_fd);
+    goto out_close_target_fd;
+  }
+
+  for (;;) {
+    // Set `errno` to 0 before reading the next directory entry.
+    errno = 0;
+
+    struct dirent *entry = readdir(directory);
+    if (NULL == entry) {
+      if (0 != errno) {
+        goto out_close_directory;
+      }
+
+      break;
+    }
+
+    // Skip the "." and ".." directories.
+    if ((0 == strcmp(entry->d_name, ".")) ||
+        (0 == strcmp(entry->d_name, ".."))) {
+      continue;
+    }
+
+    if (0 != link_tree_at(source_fd, entry->d_name, target_fd, entry->d_name,
+                          entry->d_type)) {
+      goto out_close_directory;
+    }
+  }
+
+  // The ownership is changed before the mode, which would otherwise lose its
+  // set-group-ID bit, and the times last, as the entries change them.
+  struct timespec times[2] = {stat_buffer.st_atim, stat_buffer.st_mtim};
+  if ((0 != copy_xattrs(source_fd, target_fd)) ||
+      (0 != fchown(target_fd, stat_buffer.st_uid, stat_buffer.st_gid)) ||
+      (0 != fchmod(target_fd, stat_buffer.st_mode & 07777)) ||
+      (0 != futimens(target_fd, times))) {
+    goto out_close_directory;
+  }
+
+  ret = 0;
+
+out_close_directory:
+  closedir(directory);
+
+out_close_target_fd:
+  close(target_fd);
+
+out_close_source_fd:
+  close(source_fd);
+
+out:
+  return ret;
+}
+
+int io_link_tree_at(int source_directory_fd, const char *source_name,
+                    int target_directory_fd, const char *target_name) {
+  return link_tree_at(source_directory_fd, source_name, target_directory_fd,
+                      target_name, DT_UNKNOWN);
+}
+
 void io_remove_directory_recursive(const char *path) {
   nftw(path, nftw_remove, 64, FTW_DEPTH | FTW_PHYS);
 }
+
+void io_close_range(unsigned int first_fd, unsigned int last_fd) {
+  if (first_fd > last_fd) {
+    return;
+  }
+
+  // The C library only wraps the system call since glibc 2.34, and the kernel
+  // only has it since Linux 5.9 (or a seccomp filter may deny it), in which
+  // case the descriptors are closed one at a time.
+  if (0 == syscall(__NR_close_range, first_fd, last_fd, 0)) {
+    return;
+  }
+
+  // Without a limit on open files, the kernel's default ceiling on it is
+  // assumed.
+  long open_max = sysconf(_SC_OPEN_MAX);
+  unsigned int fds_size = ((0 < open_max) && (open_max <= INT_MAX))
+                              ? (unsigned int)open_max
+                              : IO_DEFAULT_OPEN_MAX;
+  for (unsigned int fd = first_fd; (fd <= last_fd) && (fd < fds_size); ++fd) {
+    close((int)fd);
+  }
+}
@@ -0,0 +1,208 @@
+#include "gimli/io_ring.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Registering a sparse file table needs Linux 5.19, which is detected when the
+// ring is created, so it is defined here when the headers predate it.
+#ifndef IORING_REGISTER_FILES2
+#define IORING_REGISTER_FILES2 13
+#endif
+
+#ifndef IORING_RSRC_REGISTER_SPARSE
+#define IORING_RSRC_REGISTER_SPARSE (1U << 0)
+#endif
+
+// The layout of `struct io_uring_rsrc_register`.
+typedef struct IoRingFilesRegister {
+  uint32_t nr;
+  uint32_t flags;
+  uint64_t resv2;
+  uint64_t data;
+  uint64_t tags;
+} IoRingFilesRegister;
+
+// The ring is accessed through the raw system calls, so that no library is
+// required.
+static int io_uring_setup(uint32_t entries, struct io_uring_params *params) {
+  return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, uint32_t to_submit, uint32_t min_complete,
+                          uint32_t flags) {
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                      NULL, 0);
+}
+
+static int io_uring_register(int fd, uint32_t opcode, const void *argument,
+                             uint32_t arguments_size) {
+  return (int)syscall(__NR_io_uring_register, fd, opcode, argument,
+                      arguments_size);
+}
+
+static void *get_ring_field(const IoRing *self, uint32_t offset) {
+  return (char *)self->rings + offset;
+}
+
+static int register_sparse_files(IoRing *self, uint32_t files_size) {
+  // Register an empty file table, which direct descriptors are opened into.
+  IoRingFilesRegister files_register;
+  memset(&files_register, 0, sizeof(files_register));
+  files_register.nr = files_size;
+  files_register.flags = IORING_RSRC_REGISTER_SPARSE;
+
+  if (0 > io_uring_register(self->fd, IORING_REGISTER_FILES2, &files_register,
+                            sizeof(files_register))) {
+    return 1;
+  }
+
+  return 0;
+}
+
+int io_ring_init(IoRing *self, uint32_t entries, uint32_t files_size) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+
+  // Create the ring.
+  self->fd = io_uring_setup(entries, &params);
+  if (0 > self->fd) {
+    goto out;
+  }
+
+  // Older kernels map the two queues separately, which is not supported.
+  if (0 == (params.features & IORING_FEAT_SINGLE_MMAP)) {
+    errno = ENOSYS;
+    goto out_close_fd;
+  }
+
+  // Map the queue rings.
+  size_t sq_ring_size =
+      params.sq_off.array + (params.sq_entries * sizeof(uint32_t));
+  size_t cq_ring_size = params.cq_off.cqes +
+                        (params.cq_entries * sizeof(struct io_uring_cqe));
+  self->rings_size = (sq_ring_size > cq_ring_size) ? sq_ring_size
+                                                   : cq_ring_size;
+
+  self->rings = mmap(NULL, self->rings_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, self->fd, IORING_OFF_SQ_RING);
+  if (MAP_FAILED == self->rings) {
+    goto out_close_fd;
+  }
+
+  // Map the submission queue entries.
+  self->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  self->sqes = mmap(NULL, self->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, self->fd, IORING_OFF_SQES);
+  if (MAP_FAILED == self->sqes) {
+    goto out_unmap_rings;
+  }
+
+  self->sq_head = get_ring_field(self, params.sq_off.head);
+  self->sq_tail = get_ring_field(self, params.sq_off.tail);
+  self->sq_array = get_ring_field(self, params.sq_off.array);
+  self->sq_mask = *(uint32_t *)get_ring_field(self, params.sq_off.ring_mask);
+  self->sq_entries = params.sq_entries;
+
+  self->cq_head = get_ring_field(self, params.cq_off.head);
+  self->cq_tail = get_ring_field(self, params.cq_off.tail);
+  self->cqes = get_ring_field(self, params.cq_off.cqes);
+  self->cq_mask = *(uint32_t *)get_ring_field(self, params.cq_off.ring_mask);
+
+  self->sq_pending = 0;
+
+  // Register the file table.
+  if ((0 < files_size) && (0 != register_sparse_files(self, files_size))) {
+    goto out_unmap_sqes;
+  }
+
+  return 0;
+
+out_unmap_sqes:
+  munmap(self->sqes, self->sqes_size);
+
+out_unmap_rings:
+  munmap(self->rings, self->rings_size);
+
+out_close_fd:
+  close(self->fd);
+
+out:
+  return 1;
+}
+
+void io_ring_destroy(IoRing *self) {
+  munmap(self->sqes, self->sqes_size);
+  munmap(self->rings, self->rings_size);
+  close(self->fd);
+}
+
+struct io_uring_sqe *io_ring_get_sqe(IoRing *self) {
+  // Only the kernel advances the head, so it is read with acquire semantics.
+  uint32_t head = __atomic_load_n(self->sq_head, __ATOMIC_ACQUIRE);
+  uint32_t tail = (*self->sq_tail) + self->sq_pending;
+  if ((tail - head) >= self->sq_entries) {
+    return NULL;
+  }
+
+  uint32_t index = tail & self->sq_mask;
+  self->sq_array[index] = index;
+  ++self->sq_pending;
+
+  struct io_uring_sqe *sqe = &(self->sqes[index]);
+  memset(sqe, 0, sizeof(*sqe));
+
+  return sqe;
+}
+
+int io_ring_submit_and_wait(IoRing *self, uint32_t completions_size) {
+  // Publish the queued entries to the kernel.
+  __atomic_store_n(self->sq_tail, (*self->sq_tail) + self->sq_pending,
+                   __ATOMIC_RELEASE);
+
+  uint32_t to_submit = self->sq_pending;
+  self->sq_pending = 0;
+
+  // Submit the entries and wait for their completions.
+  // Waiting is done on every call, as the kernel may submit fewer entries than
+  // requested.
+  while ((0 < to_submit) || (0 < completions_size)) {
+    int result = io_uring_enter(self->fd, to_submit, completions_size,
+                                IORING_ENTER_GETEVENTS);
+    if (0 > result) {
+      if (EINTR == errno) {
+        // Interrupted while waiting, try waiting again.
+        continue;
+      }
+
+      return 1;
+    }
+
+    to_submit -= (uint32_t)result;
+
+    // Stop waiting once enough completions are available.
+    uint32_t completed = __atomic_load_n(self->cq_tail, __ATOMIC_ACQUIRE) -
+                         (*self->cq_head);
+    if (completed >= completions_size) {
+      completions_size = 0;
+    }
+  }
+
+  return 0;
+}
+
+int io_ring_next_cqe(IoRing *self, struct io_uring_cqe *out_cqe) {
+  uint32_t head = *self->cq_head;
+  if (head == __atomic_load_n(self->cq_tail, __ATOMIC_ACQUIRE)) {
+    return 1;
+  }
+
+  *out_cqe = self->cqes[head & self->cq_mask];
+
+  // Release the entry back to the kernel.
+  __atomic_store_n(self->cq_head, head + 1, __ATOMIC_RELEASE);
+
+  return 0;
+}
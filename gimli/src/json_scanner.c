@@ -0,0 +1,755 @@
+#include "gimli/json_scanner.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(GIMLI_JSON_SCANNER_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#define USE_SIMD
+#endif
+
+#ifdef USE_SIMD
+static const size_t SIMD_CHUNK_SIZE = sizeof(__m128i);
+#endif
+
+// Skipped values may be nested as deeply as Jansson allows.
+#define MAX_SKIPPED_DEPTH 2048
+
+// The longest number that is checked for overflows.
+#define MAX_NUMBER_SIZE 63
+
+static int is_whitespace(char character) {
+  return (' ' == character) || ('\t' == character) || ('\n' == character) ||
+         ('\r' == character);
+}
+
+static int is_digit(char character) {
+  return ('0' <= character) && ('9' >= character);
+}
+
+static void skip_whitespace(JsonScanner *self) {
+  while ((self->cursor < self->end) && is_whitespace(*self->cursor)) {
+    ++self->cursor;
+  }
+}
+
+static int consume(JsonScanner *self, char character) {
+  skip_whitespace(self);
+
+  if ((self->cursor >= self->end) || (character != (*self->cursor))) {
+    return 1;
+  }
+
+  ++self->cursor;
+
+  return 0;
+}
+
+// Finds the first quote, backslash, control character or non-ASCII byte,
+// which are the only characters that end a run of plain string characters.
+static const char *find_string_special(const char *cursor, const char *end) {
+#ifdef USE_SIMD
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i last_control = _mm_set1_epi8(0x1F);
+
+  while ((size_t)(end - cursor) >= SIMD_CHUNK_SIZE) {
+    __m128i chunk = _mm_loadu_si128((const void *)cursor);
+
+    // A byte is a control character if it is its own unsigned minimum with
+    // the last control character, and non-ASCII bytes have their top bit set,
+    // which is what the mask is made of.
+    __m128i matches = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                     _mm_cmpeq_epi8(chunk, backslash)),
+        _mm_cmpeq_epi8(_mm_min_epu8(chunk, last_control), chunk));
+    int mask = _mm_movemask_epi8(_mm_or_si128(matches, chunk));
+    if (0 != mask) {
+      return cursor + __builtin_ctz((unsigned int)mask);
+    }
+
+    cursor += SIMD_CHUNK_SIZE;
+  }
+#endif
+
+  for (; cursor < end; ++cursor) {
+    unsigned char character = (unsigned char)(*cursor);
+    if (('"' == character) || ('\\' == character) || (0x20 > character) ||
+        (0x80 <= character)) {
+      break;
+    }
+  }
+
+  return cursor;
+}
+
+static int parse_hex_digit(char character, uint32_t *out_value) {
+  if (('0' <= character) && ('9' >= character)) {
+    *out_value = (uint32_t)(character - '0');
+  } else if (('a' <= character) && ('f' >= character)) {
+    *out_value = (uint32_t)(character - 'a' + 10);
+  } else if (('A' <= character) && ('F' >= character)) {
+    *out_value = (uint32_t)(character - 'A' + 10);
+  } else {
+    return 1;
+  }
+
+  return 0;
+}
+
+static int parse_code_unit(const char *cursor, const char *end,
+                           uint32_t *out_code_unit) {
+  // A code unit is formatted as 4 hex digits.
+  if (4 > (end - cursor)) {
+    return 1;
+  }
+
+  *out_code_unit = 0;
+  for (size_t digit_index = 0; digit_index < 4; ++digit_index) {
+    uint32_t digit;
+    if (0 != parse_hex_digit(cursor[digit_index], &digit)) {
+      return 1;
+    }
+
+    *out_code_unit = ((*out_code_unit) << 4) | digit;
+  }
+
+  return 0;
+}
+
+// Parses a "\u" escape sequence, whose cursor is right after the "\u", and
+// returns the cursor after it (or NULL if it is invalid).
+static const char *parse_unicode_escape(const char *cursor, const char *end,
+                                        uint32_t *out_code_point) {
+  uint32_t code_point;
+  if (0 != parse_code_unit(cursor, end, &code_point)) {
+    return NULL;
+  }
+  cursor += 4;
+
+  // A low surrogate is only valid after a high surrogate.
+  if ((0xDC00 <= code_point) && (0xDFFF >= code_point)) {
+    return NULL;
+  }
+
+  // Combine a surrogate pair into a single code point.
+  if ((0xD800 <= code_point) && (0xDBFF >= code_point)) {
+    uint32_t low_surrogate;
+    if ((2 > (end - cursor)) || ('\\' != cursor[0]) || ('u' != cursor[1]) ||
+        (0 != parse_code_unit(cursor + 2, end, &low_surrogate)) ||
+        (0xDC00 > low_surrogate) || (0xDFFF < low_surrogate)) {
+      return NULL;
+    }
+    cursor += 6;
+
+    code_point =
+        0x10000 + ((code_point - 0xD800) << 10) + (low_surrogate - 0xDC00);
+  }
+
+  // Null characters are rejected, as Jansson does by default.
+  if (0 == code_point) {
+    return NULL;
+  }
+
+  *out_code_point = code_point;
+
+  return cursor;
+}
+
+// Skips a UTF-8 encoded character, and returns the cursor after it (or NULL
+// if it is not encoded in the shortest form, or is not a Unicode scalar
+// value).
+static const char *skip_utf8_character(const char *cursor, const char *end) {
+  unsigned char first_byte = (unsigned char)(*cursor);
+  size_t character_size;
+  uint32_t code_point;
+
+  if ((0xC2 <= first_byte) && (0xDF >= first_byte)) {
+    character_size = 2;
+    code_point = first_byte & 0x1F;
+  } else if ((0xE0 <= first_byte) && (0xEF >= first_byte)) {
+    character_size = 3;
+    code_point = first_byte & 0x0F;
+  } else if ((0xF0 <= first_byte) && (0xF4 >= first_byte)) {
+    character_size = 4;
+    code_point = first_byte & 0x07;
+  } else {
+    return NULL;
+  }
+
+  if ((size_t)(end - cursor) < character_size) {
+    return NULL;
+  }
+
+  for (size_t byte_index = 1; byte_index < character_size; ++byte_index) {
+    unsigned char byte = (unsigned char)cursor[byte_index];
+    if (0x80 != (byte & 0xC0)) {
+      return NULL;
+    }
+
+    code_point = (code_point << 6) | (byte & 0x3F);
+  }
+
+  if (((3 == character_size) && (0x800 > code_point)) ||
+      ((4 == character_size) && (0x10000 > code_point)) ||
+      ((0xD800 <= code_point) && (0xDFFF >= code_point)) ||
+      (0x10FFFF < code_point)) {
+    return NULL;
+  }
+
+  return cursor + character_size;
+}
+
+static int scan_string(JsonScanner *self, JsonScannerString *out_string) {
+  // The cursor is expected to be right after the opening quote.
+  const char *start = self->cursor;
+  const char *cursor = start;
+  int has_escapes = 0;
+
+  for (;;) {
+    cursor = find_string_special(cursor, self->end);
+    if (cursor >= self->end) {
+      return 1;
+    }
+
+    if ('"' == (*cursor)) {
+      break;
+    }
+
+    if ('\\' == (*cursor)) {
+      has_escapes = 1;
+      if (2 > (self->end - cursor)) {
+        return 1;
+      }
+
+      switch (cursor[1]) {
+        case '"':
+        case '\\':
+        case '/':
+        case 'b':
+        case 'f':
+        case 'n':
+        case 'r':
+        case 't':
+          cursor += 2;
+          break;
+        case 'u': {
+          uint32_t code_point;
+          cursor = parse_unicode_escape(cursor + 2, self->end, &code_point);
+          if (NULL == cursor) {
+            return 1;
+          }
+          break;
+        }
+        default:
+          return 1;
+      }
+
+      continue;
+    }
+
+    // Control characters must be escaped, and anything else must be valid
+    // UTF-8.
+    if (0x20 > (unsigned char)(*cursor)) {
+      return 1;
+    }
+
+    cursor = skip_utf8_character(cursor, self->end);
+    if (NULL == cursor) {
+      return 1;
+    }
+  }
+
+  out_string->data = start;
+  out_string->size = (size_t)(cursor - start);
+  out_string->has_escapes = has_escapes;
+
+  // Skip the closing quote.
+  self->cursor = cursor + 1;
+
+  return 0;
+}
+
+static int skip_literal(JsonScanner *self, const char *literal) {
+  size_t literal_size = strlen(literal);
+  if (((size_t)(self->end - self->cursor) < literal_size) ||
+      (0 != memcmp(self->cursor, literal, literal_size))) {
+    return 1;
+  }
+
+  self->cursor += literal_size;
+
+  return 0;
+}
+
+static int skip_digits(JsonScanner *self) {
+  const char *start = self->cursor;
+
+  while ((self->cursor < self->end) && is_digit(*self->cursor)) {
+    ++self->cursor;
+  }
+
+  return (start == self->cursor) ? 1 : 0;
+}
+
+static int skip_number(JsonScanner *self) {
+  const char *start = self->cursor;
+  int is_real = 0;
+
+  if ((self->cursor < self->end) && ('-' == (*self->cursor))) {
+    ++self->cursor;
+  }
+
+  // The integer part has no leading zeros.
+  if ((self->cursor < self->end) && ('0' == (*self->cursor))) {
+    ++self->cursor;
+  } else if (0 != skip_digits(self)) {
+    return 1;
+  }
+
+  if ((self->cursor < self->end) && ('.' == (*self->cursor))) {
+    is_real = 1;
+    ++self->cursor;
+    if (0 != skip_digits(self)) {
+      return 1;
+    }
+  }
+
+  if ((self->cursor < self->end) &&
+      (('e' == (*self->cursor)) || ('E' == (*self->cursor)))) {
+    is_real = 1;
+    ++self->cursor;
+    if ((self->cursor < self->end) &&
+        (('+' == (*self->cursor)) || ('-' == (*self->cursor)))) {
+      ++self->cursor;
+    }
+
+    if (0 != skip_digits(self)) {
+      return 1;
+    }
+  }
+
+  // Jansson rejects numbers that overflow, which are checked on a null
+  // terminated copy (and long numbers are left for it to check).
+  char number[MAX_NUMBER_SIZE + 1];
+  size_t number_size = (size_t)(self->cursor - start);
+  if (MAX_NUMBER_SIZE < number_size) {
+    return 1;
+  }
+
+  memcpy(number, start, number_size);
+  number[number_size] = '\0';
+
+  errno = 0;
+  if (is_real) {
+    double value = strtod(number, NULL);
+    if ((ERANGE == errno) && ((HUGE_VAL == value) || (-HUGE_VAL == value))) {
+      return 1;
+    }
+  } else {
+    strtoll(number, NULL, 10);
+    if (ERANGE == errno) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int skip_scalar(JsonScanner *self) {
+  // Whatever follows the scalar is checked by the caller, which expects a
+  // separator or the end of the container.
+  switch (*self->cursor) {
+    case '"': {
+      JsonScannerString string;
+      return json_scanner_read_string(self, &string);
+    }
+    case 't':
+      return skip_literal(self, "true");
+    case 'f':
+      return skip_literal(self, "false");
+    case 'n':
+      return skip_literal(self, "null");
+    default:
+      return skip_number(self);
+  }
+}
+
+static int skip_member_key(JsonScanner *self) {
+  JsonScannerString key;
+  if (0 != json_scanner_read_string(self, &key)) {
+    return 1;
+  }
+
+  return consume(self, ':');
+}
+
+static int skip_container(JsonScanner *self) {
+  // The containers that are being skipped, as a stack of bits which are set
+  // for objects.
+  uint8_t objects[MAX_SKIPPED_DEPTH / 8];
+  size_t depth = 0;
+
+  for (;;) {
+    // The cursor is expected to be on a value.
+    skip_whitespace(self);
+    if (self->cursor >= self->end) {
+      return 1;
+    }
+
+    char opening_bracket = *self->cursor;
+    if (('{' == opening_bracket) || ('[' == opening_bracket)) {
+      if (MAX_SKIPPED_DEPTH == depth) {
+        return 1;
+      }
+
+      uint8_t depth_bit = (uint8_t)(1 << (depth % 8));
+      if ('{' == opening_bracket) {
+        objects[depth / 8] |= depth_bit;
+      } else {
+        objects[depth / 8] &= (uint8_t)~depth_bit;
+      }
+
+      ++depth;
+      ++self->cursor;
+
+      // An empty container is a value of its own, and anything else starts
+      // with its first member or element.
+      skip_whitespace(self);
+      char closing_bracket = ('{' == opening_bracket) ? '}' : ']';
+      if ((self->cursor < self->end) && (closing_bracket == (*self->cursor))) {
+        ++self->cursor;
+        --depth;
+      } else {
+        if (('{' == opening_bracket) && (0 != skip_member_key(self))) {
+          return 1;
+        }
+
+        continue;
+      }
+    } else if (0 != skip_scalar(self)) {
+      return 1;
+    }
+
+    // The value is followed either by a comma and the next member or
+    // element, or by the end of its container.
+    for (;;) {
+      if (0 == depth) {
+        return 0;
+      }
+
+      int is_object = (objects[(depth - 1) / 8] >> ((depth - 1) % 8)) & 1;
+
+      skip_whitespace(self);
+      if (self->cursor >= self->end) {
+        return 1;
+      }
+
+      if (',' == (*self->cursor)) {
+        ++self->cursor;
+        if (is_object && (0 != skip_member_key(self))) {
+          return 1;
+        }
+
+        break;
+      }
+
+      if ((is_object ? '}' : ']') != (*self->cursor)) {
+        return 1;
+      }
+
+      ++self->cursor;
+      --depth;
+    }
+  }
+}
+
+static int enter_container(JsonScanner *self, char opening_bracket) {
+  if ((JSON_SCANNER_MAX_ENTERED_DEPTH == self->entered_depth) ||
+      (0 != consume(self, opening_bracket))) {
+    return 1;
+  }
+
+  uint64_t depth_bit = (uint64_t)1 << self->entered_depth;
+  if ('{' == opening_bracket) {
+    self->entered_objects |= depth_bit;
+  } else {
+    self->entered_objects &= ~depth_bit;
+  }
+
+  ++self->entered_depth;
+  self->expects_separator = 0;
+
+  return 0;
+}
+
+static int next_item(JsonScanner *self, char closing_bracket,
+                     int *out_has_item) {
+  skip_whitespace(self);
+
+  if ((0 == self->entered_depth) || (self->cursor >= self->end)) {
+    return 1;
+  }
+
+  // Check if the end of the container has been reached, which makes it a
+  // value of the container around it.
+  if (closing_bracket == (*self->cursor)) {
+    ++self->cursor;
+    --self->entered_depth;
+    self->expects_separator = 1;
+    *out_has_item = 0;
+    return 0;
+  }
+
+  // Members and elements are separated by commas, which may not be trailing.
+  if (self->expects_separator) {
+    if (0 != consume(self, ',')) {
+      return 1;
+    }
+
+    skip_whitespace(self);
+    if ((self->cursor >= self->end) || (closing_bracket == (*self->cursor))) {
+      return 1;
+    }
+  }
+
+  self->expects_separator = 1;
+  *out_has_item = 1;
+
+  return 0;
+}
+
+static char *encode_utf8(char *out, uint32_t code_point) {
+  if (0x80 > code_point) {
+    *(out++) = (char)code_point;
+  } else if (0x800 > code_point) {
+    *(out++) = (char)(0xC0 | (code_point >> 6));
+    *(out++) = (char)(0x80 | (code_point & 0x3F));
+  } else if (0x10000 > code_point) {
+    *(out++) = (char)(0xE0 | (code_point >> 12));
+    *(out++) = (char)(0x80 | ((code_point >> 6) & 0x3F));
+    *(out++) = (char)(0x80 | (code_point & 0x3F));
+  } else {
+    *(out++) = (char)(0xF0 | (code_point >> 18));
+    *(out++) = (char)(0x80 | ((code_point >> 12) & 0x3F));
+    *(out++) = (char)(0x80 | ((code_point >> 6) & 0x3F));
+    *(out++) = (char)(0x80 | (code_point & 0x3F));
+  }
+
+  return out;
+}
+
+static int unescape(const JsonScannerString *string, char *out) {
+  const char *cursor = string->data;
+  const char *end = string->data + string->size;
+
+  while (cursor < end) {
+    if ('\\' != (*cursor)) {
+      *(out++) = *(cursor++);
+      continue;
+    }
+
+    // Skip the backslash.
+    ++cursor;
+
+    char escaped = *(cursor++);
+    switch (escaped) {
+      case '"':
+      case '\\':
+      case '/':
+        *(out++) = escaped;
+        break;
+      case 'b':
+        *(out++) = '\b';
+        break;
+      case 'f':
+        *(out++) = '\f';
+        break;
+      case 'n':
+        *(out++) = '\n';
+        break;
+      case 'r':
+        *(out++) = '\r';
+        break;
+      case 't':
+        *(out++) = '\t';
+        break;
+      case 'u': {
+        uint32_t code_point;
+        cursor = parse_unicode_escape(cursor, end, &code_point);
+        if (NULL == cursor) {
+          return 1;
+        }
+
+        out = encode_utf8(out, code_point);
+        break;
+      }
+      default:
+        return 1;
+    }
+  }
+
+  *out = '\0';
+
+  return 0;
+}
+
+void json_scanner_init(JsonScanner *self, const char *data, size_t size) {
+  self->cursor = data;
+  self->end = data + size;
+  self->entered_objects = 0;
+  self->entered_depth = 0;
+  self->expects_separator = 0;
+}
+
+int json_scanner_enter_object(JsonScanner *self) {
+  return enter_container(self, '{');
+}
+
+int json_scanner_next_member(JsonScanner *self, JsonScannerString *out_key,
+                             int *out_has_member) {
+  if (0 != next_item(self, '}', out_has_member)) {
+    return 1;
+  }
+
+  if (!(*out_has_member)) {
+    return 0;
+  }
+
+  // Read the member's key, and leave the cursor on the member's value.
+  if ((0 != json_scanner_read_string(self, out_key)) ||
+      (0 != consume(self, ':'))) {
+    return 1;
+  }
+
+  return 0;
+}
+
+int json_scanner_find_member(JsonScanner *self, const char *key) {
+  for (;;) {
+    JsonScannerString member_key;
+    int has_member;
+    if (0 != json_scanner_next_member(self, &member_key, &has_member)) {
+      return 1;
+    }
+
+    // The object has no such member.
+    if (!has_member) {
+      return 1;
+    }
+
+    if (json_scanner_string_equals(&member_key, key)) {
+      return 0;
+    }
+
+    if (0 != json_scanner_skip_value(self)) {
+      return 1;
+    }
+  }
+}
+
+int json_scanner_enter_array(JsonScanner *self) {
+  return enter_container(self, '[');
+}
+
+int json_scanner_next_element(JsonScanner *self, int *out_has_element) {
+  return next_item(self, ']', out_has_element);
+}
+
+int json_scanner_read_string(JsonScanner *self, JsonScannerString *out_string) {
+  if (0 != consume(self, '"')) {
+    return 1;
+  }
+
+  return scan_string(self, out_string);
+}
+
+int json_scanner_skip_value(JsonScanner *self) {
+  skip_whitespace(self);
+
+  if (self->cursor >= self->end) {
+    return 1;
+  }
+
+  if (('{' == (*self->cursor)) || ('[' == (*self->cursor))) {
+    return skip_container(self);
+  }
+
+  return skip_scalar(self);
+}
+
+int json_scanner_finish(JsonScanner *self) {
+  // Check the rest of the containers that were entered, from the innermost
+  // one outwards.
+  while (0 < self->entered_depth) {
+    int is_object =
+        (int)((self->entered_objects >> (self->entered_depth - 1)) & 1);
+
+    int has_item;
+    if (0 != next_item(self, is_object ? '}' : ']', &has_item)) {
+      return 1;
+    }
+
+    if (!has_item) {
+      continue;
+    }
+
+    if ((is_object && (0 != skip_member_key(self))) ||
+        (0 != json_scanner_skip_value(self))) {
+      return 1;
+    }
+  }
+
+  // Nothing but whitespace may follow the document.
+  skip_whitespace(self);
+
+  return (self->cursor == self->end) ? 0 : 1;
+}
+
+int json_scanner_string_equals(const JsonScannerString *string,
+                               const char *value) {
+  // Strings with escape sequences are compared after they are unescaped.
+  if (string->has_escapes) {
+    char *unescaped = json_scanner_string_duplicate(string);
+    if (NULL == unescaped) {
+      return 0;
+    }
+
+    int equals = 0 == strcmp(unescaped, value);
+    free(unescaped);
+
+    return equals;
+  }
+
+  return (strlen(value) == string->size) &&
+         (0 == memcmp(string->data, value, string->size));
+}
+
+int json_scanner_string_copy(const JsonScannerString *string, char *out) {
+  // `out` is expected to hold at least `string->size + 1` bytes, which is
+  // always enough as unescaping never makes a string longer.
+  if (!string->has_escapes) {
+    memcpy(out, string->data, string->size);
+    out[string->size] = '\0';
+    return 0;
+  }
+
+  return unescape(string, out);
+}
+
+char *json_scanner_string_duplicate(const JsonScannerString *string) {
+  char *duplicate = malloc(string->size + 1);
+  if (NULL == duplicate) {
+    return NULL;
+  }
+
+  if (0 != json_scanner_string_copy(string, duplicate)) {
+    free(duplicate);
+    return NULL;
+  }
+
+  return duplicate;
+}
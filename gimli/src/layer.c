@@ -1,116 +1,181 @@
 #include "gimli/layer.h"
 
-#include <limits.h>
 #include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
 
 #include "gimli/gimli_directory.h"
 #include "gimli/io.h"
+#include "gimli/sha256.h"
+
+// The properties that are read from each layer's layer store directory.
+enum LayerProperty {
+  LAYER_PROPERTY_DIFF_ID = 0,
+  LAYER_PROPERTY_CACHE_ID,
+
+  LAYER_PROPERTY_COUNT,
+};
+
+static const char *const LAYER_PROPERTY_FILE_NAMES[LAYER_PROPERTY_COUNT] = {
+    [LAYER_PROPERTY_DIFF_ID] = "diff",
+    [LAYER_PROPERTY_CACHE_ID] = "cache-id",
+};
+
+typedef struct LayerFiles {
+  const char **paths;
+  char **contents;
+  size_t *sizes;
+} LayerFiles;
+
+static int allocate_layer_files(LayerFiles *self, size_t files_size,
+                                Arena *arena) {
+  self->paths = arena_allocate(arena, files_size * sizeof(*self->paths));
+  self->contents = arena_allocate(arena, files_size * sizeof(*self->contents));
+  self->sizes = arena_allocate(arena, files_size * sizeof(*self->sizes));
+
+  if ((NULL == self->paths) || (NULL == self->contents) ||
+      (NULL == self->sizes)) {
+    return 1;
+  }
 
-static int init_link_path(Layer *self) {
-  int ret = 1;
+  return 0;
+}
 
-  // Read the link file.
-  char link_file_path[PATH_MAX];
-  snprintf(link_file_path, sizeof(link_file_path), "%s/overlay2/%s/link",
-           gimli_directory_get(), self->cache_id);
+static int read_layer_properties(Layer *layers, char *const *chain_ids,
+                                 size_t layers_size,
+                                 int layer_store_directory_fd, Arena *arena,
+                                 Arena *scratch_arena) {
+  // Format the paths of all of the layers' property files, relative to the
+  // layer store directory.
+  LayerFiles files;
+  size_t files_size = layers_size * LAYER_PROPERTY_COUNT;
+  if (0 != allocate_layer_files(&files, files_size, scratch_arena)) {
+    return 1;
+  }
 
-  // Read the link name.
-  char *link_name;
-  if (0 != io_file_to_string(link_file_path, &link_name)) {
-    goto out;
+  for (size_t layer_index = 0; layer_index < layers_size; ++layer_index) {
+    for (size_t property = 0; property < LAYER_PROPERTY_COUNT; ++property) {
+      const char **path =
+          &(files.paths[(layer_index * LAYER_PROPERTY_COUNT) + property]);
+
+      *path = arena_format_string(scratch_arena, "%s/%s",
+                                  chain_ids[layer_index],
+                                  LAYER_PROPERTY_FILE_NAMES[property]);
+      if (NULL == (*path)) {
+        return 1;
+      }
+    }
   }
 
-  // Calculate the link path size.
-  // 1 is added for the null terminator which is appended by sprintf but
-  // is not included in its return value.
-  size_t link_path_size = (size_t)snprintf(NULL, 0, "%s/overlay2/l/%s",
-                                           gimli_directory_get(), link_name) +
-                          1;
-
-  // Allocate a buffer to store link path.
-  self->link_path = malloc(link_path_size);
-  if (NULL == self->link_path) {
-    goto out_free_link_name;
+  // Read all of the property files at once.
+  // The files hold the properties themselves, so they are read directly into
+  // the layers' arena.
+  if (0 != io_read_files_at(layer_store_directory_fd, files.paths, files_size,
+                            arena, files.contents, files.sizes)) {
+    return 1;
   }
 
-  // Format the link path,.
-  snprintf(self->link_path, link_path_size, "%s/overlay2/l/%s",
-           gimli_directory_get(), link_name);
+  for (size_t layer_index = 0; layer_index < layers_size; ++layer_index) {
+    char **contents = &(files.contents[layer_index * LAYER_PROPERTY_COUNT]);
 
-  ret = 0;
+    layers[layer_index].chain_id =
+        arena_duplicate_string(arena, chain_ids[layer_index]);
+    if (NULL == layers[layer_index].chain_id) {
+      return 1;
+    }
 
-out_free_link_name:
-  free(link_name);
+    layers[layer_index].diff_id = contents[LAYER_PROPERTY_DIFF_ID];
+    layers[layer_index].cache_id = contents[LAYER_PROPERTY_CACHE_ID];
+  }
 
-out:
-  return ret;
+  return 0;
 }
 
-static int read_layer_property_file(const char *chain_id,
-                                    const char *layer_store_directory,
-                                    const char *property_file_name,
-                                    char **out_data) {
-  // Format the file's path.
-  char path[PATH_MAX];
-  snprintf(path, sizeof(path), "%s/%s/%s", layer_store_directory, chain_id,
-           property_file_name);
-
-  // Read the file.
-  if (0 != io_file_to_string(path, out_data)) {
+static int read_layer_link_paths(Layer *layers, size_t layers_size,
+                                 int overlay_directory_fd, Arena *arena,
+                                 Arena *scratch_arena) {
+  // Format the paths of all of the layers' link files, relative to the overlay
+  // directory.
+  LayerFiles files;
+  if (0 != allocate_layer_files(&files, layers_size, scratch_arena)) {
+    return 1;
+  }
+
+  for (size_t layer_index = 0; layer_index < layers_size; ++layer_index) {
+    files.paths[layer_index] = arena_format_string(
+        scratch_arena, "%s/link", layers[layer_index].cache_id);
+    if (NULL == files.paths[layer_index]) {
+      return 1;
+    }
+  }
+
+  // Read all of the link names at once.
+  if (0 != io_read_files_at(overlay_directory_fd, files.paths, layers_size,
+                            scratch_arena, files.contents, files.sizes)) {
     return 1;
   }
 
+  // Format the link paths.
+  for (size_t layer_index = 0; layer_index < layers_size; ++layer_index) {
+    layers[layer_index].link_path =
+        arena_format_string(arena, "%s/overlay2/l/%s", gimli_directory_get(),
+                            files.contents[layer_index]);
+    if (NULL == layers[layer_index].link_path) {
+      return 1;
+    }
+  }
+
   return 0;
 }
 
-int layer_init(Layer *self, const char *chain_id,
-               const char *layer_store_directory) {
+int layer_init_all(Layer *layers, char *const *chain_ids, size_t layers_size,
+                   int layer_store_directory_fd, int overlay_directory_fd,
+                   Arena *arena) {
   int ret = 1;
 
-  // Initialize the chain ID.
-  self->chain_id = strdup(chain_id);
-  if (NULL == self->chain_id) {
-    goto out;
-  }
-
-  // Read the diff ID.
-  if (0 != read_layer_property_file(chain_id, layer_store_directory, "diff",
-                                    &self->diff_id)) {
-    goto out_free_chain_id;
-  }
+  // The paths and the link names are only needed while the layers are read.
+  Arena scratch_arena;
+  arena_init(&scratch_arena);
 
-  // Read the cache ID.
-  if (0 != read_layer_property_file(chain_id, layer_store_directory, "cache-id",
-                                    &self->cache_id)) {
-    goto out_free_diff_id;
+  // Read the layers' diff IDs and cache IDs.
+  if (0 != read_layer_properties(layers, chain_ids, layers_size,
+                                 layer_store_directory_fd, arena,
+                                 &scratch_arena)) {
+    goto out_destroy_scratch_arena;
   }
 
-  // Initialize the layer's link path.
-  if (0 != init_link_path(self)) {
-    goto out_free_cache_id;
+  // The link files are named after the cache IDs, so they are read only once
+  // all of the cache IDs are known.
+  if (0 != read_layer_link_paths(layers, layers_size, overlay_directory_fd,
+                                 arena, &scratch_arena)) {
+    goto out_destroy_scratch_arena;
   }
 
   ret = 0;
-  goto out;
-
-out_free_cache_id:
-  free(self->cache_id);
 
-out_free_diff_id:
-  free(self->diff_id);
+out_destroy_scratch_arena:
+  arena_destroy(&scratch_arena);
 
-out_free_chain_id:
-  free(self->chain_id);
-
-out:
   return ret;
 }
 
-void layer_destroy(Layer *self) {
-  free(self->link_path);
-  free(self->cache_id);
-  free(self->diff_id);
-  free(self->chain_id);
+void layer_compute_chain_id(const char *parent_chain_id, const char *diff_id,
+                            char out_chain_id[DIGEST_STRING_SIZE]) {
+  // The chain ID of the bottom-most layer is its diff ID.
+  if (NULL == parent_chain_id) {
+    snprintf(out_chain_id, DIGEST_STRING_SIZE, "%s", diff_id);
+    return;
+  }
+
+  // The chain ID of every other layer is the digest of its parent's chain ID
+  // and its own diff ID, separated by a space.
+  Sha256 sha256;
+  sha256_init(&sha256);
+  sha256_update(&sha256, parent_chain_id, strlen(parent_chain_id));
+  sha256_update(&sha256, " ", 1);
+  sha256_update(&sha256, diff_id, strlen(diff_id));
+
+  Digest digest;
+  sha256_final(&sha256, digest.bytes);
+
+  digest_format(&digest, out_chain_id);
 }
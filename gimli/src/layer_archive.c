@@ -0,0 +1,866 @@
+#define _GNU_SOURCE
+
+#include "gimli/layer_archive.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/openat2.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "gimli/io.h"
+#include "gimli/sha256.h"
+#include "gimli/tar.h"
+#include "stb_ds/stb_ds.h"
+
+// The size of the chunks that layers are decompressed and hashed in.
+#define LAYER_ARCHIVE_CHUNK_SIZE (1024 * 1024)
+
+// The largest piece of input that is handed to zlib at once, whose sizes are
+// 32 bits wide.
+#define LAYER_ARCHIVE_INFLATE_INPUT_MAX_SIZE (1024 * 1024 * 1024)
+
+// Whiteouts that are stored as files prefixed with `.wh.`, and the file that
+// marks its directory as opaque.
+// They are converted to the overlay file system's own whiteouts, which are
+// character devices numbered 0/0, and an extended attribute.
+#define WHITEOUT_PREFIX ".wh."
+#define OPAQUE_WHITEOUT ".wh..wh..opq"
+#define OPAQUE_XATTR "trusted.overlay.opaque"
+
+static const unsigned char GZIP_MAGIC[] = {0x1f, 0x8b};
+
+// The decompressed stream of a layer, which is hashed as it is produced, so
+// that the layer's diff ID is verified in the same pass that extracts it.
+typedef struct LayerStream {
+  const uint8_t *input;
+  size_t input_size;
+  size_t input_offset;
+
+  int is_compressed;
+  z_stream inflater;
+  uint8_t *buffer;
+
+  // The data that has been produced but not consumed yet.
+  const uint8_t *cursor;
+  size_t available_size;
+  int is_finished;
+
+  Sha256 sha256;
+  uint64_t size;
+} LayerStream;
+
+// A directory whose modification time is set once the whole layer has been
+// extracted, as extracting its entries updates it.
+typedef struct DeferredDirectory {
+  char *path;
+  struct timespec modification_time;
+} DeferredDirectory;
+
+typedef struct Extractor {
+  LayerStream *stream;
+  int root_fd;
+
+  // The directory that the last entry was extracted to, which is kept open
+  // as consecutive entries usually share their directory.
+  char parent_path[PATH_MAX];
+  int parent_fd;
+
+  // Whether the directory is setgid, in which case the entries created in it
+  // are owned by its group instead of gimli's.
+  int is_parent_setgid;
+
+  DeferredDirectory *directories;
+
+  // The owner that entries are created with, which is only changed when an
+  // entry is owned by someone else.
+  uid_t uid;
+  gid_t gid;
+} Extractor;
+
+static int stream_init(LayerStream *self, const void *data, size_t size) {
+  self->input = data;
+  self->input_size = size;
+  self->input_offset = 0;
+  self->cursor = NULL;
+  self->available_size = 0;
+  self->is_finished = 0;
+  self->buffer = NULL;
+  self->size = 0;
+  sha256_init(&self->sha256);
+
+  self->is_compressed =
+      (sizeof(GZIP_MAGIC) <= size) &&
+      (0 == memcmp(data, GZIP_MAGIC, sizeof(GZIP_MAGIC)));
+  if (!self->is_compressed) {
+    return 0;
+  }
+
+  self->buffer = malloc(LAYER_ARCHIVE_CHUNK_SIZE);
+  if (NULL == self->buffer) {
+    return 1;
+  }
+
+  // Only gzip streams are inflated, as layers are never plain zlib streams.
+  memset(&self->inflater, 0, sizeof(self->inflater));
+  if (Z_OK != inflateInit2(&self->inflater, MAX_WBITS + 16)) {
+    free(self->buffer);
+    errno = ENOMEM;
+    return 1;
+  }
+
+  return 0;
+}
+
+static void stream_destroy(LayerStream *self) {
+  if (self->is_compressed) {
+    inflateEnd(&self->inflater);
+    free(self->buffer);
+  }
+}
+
+static void feed_inflater(LayerStream *self) {
+  if ((0 != self->inflater.avail_in) ||
+      (self->input_offset == self->input_size)) {
+    return;
+  }
+
+  size_t size = self->input_size - self->input_offset;
+  if (LAYER_ARCHIVE_INFLATE_INPUT_MAX_SIZE < size) {
+    size = LAYER_ARCHIVE_INFLATE_INPUT_MAX_SIZE;
+  }
+
+  self->inflater.next_in = (Bytef *)(self->input + self->input_offset);
+  self->inflater.avail_in = (uInt)size;
+  self->input_offset += size;
+}
+
+static int inflate_chunk(LayerStream *self, size_t *out_size) {
+  z_stream *inflater = &self->inflater;
+  inflater->next_out = self->buffer;
+  inflater->avail_out = LAYER_ARCHIVE_CHUNK_SIZE;
+
+  while (0 != inflater->avail_out) {
+    feed_inflater(self);
+
+    int result = inflate(inflater, Z_NO_FLUSH);
+    if (Z_STREAM_END == result) {
+      // A layer may be made of several gzip members, which are inflated one
+      // after the other.
+      feed_inflater(self);
+
+      if ((sizeof(GZIP_MAGIC) > inflater->avail_in) ||
+          (0 != memcmp(inflater->next_in, GZIP_MAGIC, sizeof(GZIP_MAGIC)))) {
+        self->is_finished = 1;
+        break;
+      }
+
+      inflateReset(inflater);
+      continue;
+    }
+
+    if (Z_OK != result) {
+      // The input ran out before the end of the stream.
+      errno = (Z_MEM_ERROR == result) ? ENOMEM : EBADMSG;
+      return 1;
+    }
+  }
+
+  *out_size = LAYER_ARCHIVE_CHUNK_SIZE - inflater->avail_out;
+
+  return 0;
+}
+
+static int stream_fill(LayerStream *self) {
+  size_t size;
+
+  if (self->is_compressed) {
+    if (0 != inflate_chunk(self, &size)) {
+      return 1;
+    }
+
+    self->cursor = self->buffer;
+  } else {
+    // Uncompressed layers are consumed from their mapping directly.
+    size = self->input_size - self->input_offset;
+    if (LAYER_ARCHIVE_CHUNK_SIZE < size) {
+      size = LAYER_ARCHIVE_CHUNK_SIZE;
+    }
+
+    self->cursor = self->input + self->input_offset;
+    self->input_offset += size;
+    self->is_finished = self->input_offset == self->input_size;
+  }
+
+  sha256_update(&self->sha256, self->cursor, size);
+  self->available_size = size;
+  self->size += size;
+
+  return 0;
+}
+
+static int stream_take(LayerStream *self, size_t size,
+                       const uint8_t **out_data, size_t *out_size) {
+  while (0 == self->available_size) {
+    // The stream ended in the middle of an entry.
+    if (self->is_finished) {
+      errno = EBADMSG;
+      return 1;
+    }
+
+    if (0 != stream_fill(self)) {
+      return 1;
+    }
+  }
+
+  if (size > self->available_size) {
+    size = self->available_size;
+  }
+
+  *out_data = self->cursor;
+  *out_size = size;
+  self->cursor += size;
+  self->available_size -= size;
+
+  return 0;
+}
+
+static int stream_read(void *context, void *buffer, size_t size) {
+  LayerStream *self = context;
+
+  for (uint8_t *cursor = buffer; 0 < size;) {
+    const uint8_t *data;
+    size_t data_size;
+    if (0 != stream_take(self, size, &data, &data_size)) {
+      return 1;
+    }
+
+    memcpy(cursor, data, data_size);
+    cursor += data_size;
+    size -= data_size;
+  }
+
+  return 0;
+}
+
+static int stream_skip(LayerStream *self, uint64_t size) {
+  while (0 < size) {
+    const uint8_t *data;
+    size_t data_size;
+    if (0 != stream_take(self, (SIZE_MAX < size) ? SIZE_MAX : (size_t)size,
+                         &data, &data_size)) {
+      return 1;
+    }
+
+    size -= data_size;
+  }
+
+  return 0;
+}
+
+static int stream_finish(LayerStream *self) {
+  // The diff ID covers the whole archive, including the blocks that follow
+  // its end.
+  self->available_size = 0;
+  while (!self->is_finished) {
+    if (0 != stream_fill(self)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int clean_path(const char *path, char out_path[PATH_MAX]) {
+  // Entries are extracted beneath the layer's directory, so leading slashes
+  // and "." components are dropped, and ".." components are refused.
+  size_t out_size = 0;
+
+  for (const char *component = path; '\0' != (*component);) {
+    size_t component_size = strcspn(component, "/");
+    const char *next = component + component_size;
+    if ('/' == (*next)) {
+      ++next;
+    }
+
+    if ((0 == component_size) ||
+        ((1 == component_size) && ('.' == component[0]))) {
+      component = next;
+      continue;
+    }
+
+    if ((2 == component_size) && (0 == strncmp(component, "..", 2))) {
+      errno = EPERM;
+      return 1;
+    }
+
+    if ((out_size + component_size + 2) > PATH_MAX) {
+      errno = ENAMETOOLONG;
+      return 1;
+    }
+
+    if (0 != out_size) {
+      out_path[out_size++] = '/';
+    }
+
+    memcpy(out_path + out_size, component, component_size);
+    out_size += component_size;
+
+    component = next;
+  }
+
+  out_path[out_size] = '\0';
+
+  return 0;
+}
+
+static int open_beneath(int root_fd, const char *path) {
+  // Symbolic links are resolved as if the layer's directory were the root,
+  // so that entries are never extracted outside of it.
+  struct open_how how = {
+      .flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC,
+      .mode = 0,
+      .resolve = RESOLVE_IN_ROOT | RESOLVE_NO_MAGICLINKS,
+  };
+
+  return (int)syscall(__NR_openat2, root_fd, ('\0' == path[0]) ? "." : path,
+                      &how, sizeof(how));
+}
+
+static int create_directories(int root_fd, char *path) {
+  // Create each missing directory of the path, which archives may omit.
+  for (char *separator = path;; ++separator) {
+    separator = strchrnul(separator, '/');
+    char saved = *separator;
+    *separator = '\0';
+
+    char *name = strrchr(path, '/');
+    name = (NULL == name) ? path : (name + 1);
+
+    int fd = open_beneath(root_fd, path);
+    if ((-1 == fd) && (ENOENT == errno)) {
+      // The directory is created in its parent, which has just been opened
+      // (or is the layer's directory).
+      char *name_separator = (name == path) ? NULL : (name - 1);
+      if (NULL != name_separator) {
+        *name_separator = '\0';
+      }
+
+      int parent_fd =
+          open_beneath(root_fd, (NULL == name_separator) ? "" : path);
+      if (NULL != name_separator) {
+        *name_separator = '/';
+      }
+
+      if (-1 == parent_fd) {
+        *separator = saved;
+        return 1;
+      }
+
+      int result = mkdirat(parent_fd, name, 0755);
+      close(parent_fd);
+      if ((0 != result) && (EEXIST != errno)) {
+        *separator = saved;
+        return 1;
+      }
+    } else if (-1 != fd) {
+      close(fd);
+    }
+
+    *separator = saved;
+    if ('\0' == saved) {
+      return 0;
+    }
+  }
+}
+
+static int open_parent(Extractor *self, char *parent_path) {
+  if ((-1 != self->parent_fd) &&
+      (0 == strcmp(parent_path, self->parent_path))) {
+    return self->parent_fd;
+  }
+
+  if (-1 != self->parent_fd) {
+    close(self->parent_fd);
+    self->parent_fd = -1;
+  }
+
+  int fd = open_beneath(self->root_fd, parent_path);
+  if ((-1 == fd) && (ENOENT == errno)) {
+    if (0 != create_directories(self->root_fd, parent_path)) {
+      return -1;
+    }
+
+    fd = open_beneath(self->root_fd, parent_path);
+  }
+
+  struct stat stat_buffer;
+  if ((-1 == fd) || (0 != fstat(fd, &stat_buffer))) {
+    if (-1 != fd) {
+      close(fd);
+    }
+
+    return -1;
+  }
+
+  snprintf(self->parent_path, sizeof(self->parent_path), "%s", parent_path);
+  self->parent_fd = fd;
+  self->is_parent_setgid = 0 != (stat_buffer.st_mode & S_ISGID);
+
+  return fd;
+}
+
+static char *split_path(char *path, char **out_parent_path,
+                        char **out_name) {
+  // The path is split in place, and the returned separator (if any) is
+  // restored to join it back.
+  char *separator = strrchr(path, '/');
+  if (NULL == separator) {
+    *out_parent_path = "";
+    *out_name = path;
+    return NULL;
+  }
+
+  *separator = '\0';
+  *out_parent_path = path;
+  *out_name = separator + 1;
+
+  return separator;
+}
+
+static int remove_existing(int parent_fd, const char *name,
+                           int is_directory_kept) {
+  // A later entry replaces an earlier one of the same path, except that
+  // directories are merged.
+  struct stat stat_buffer;
+  if (0 != fstatat(parent_fd, name, &stat_buffer, AT_SYMLINK_NOFOLLOW)) {
+    return (ENOENT == errno) ? 0 : 1;
+  }
+
+  if (is_directory_kept && S_ISDIR(stat_buffer.st_mode)) {
+    return 0;
+  }
+
+  return io_remove_tree_at(parent_fd, name);
+}
+
+static int is_owner_changed(const Extractor *self, const TarEntry *entry) {
+  return (entry->uid != self->uid) || (entry->gid != self->gid) ||
+         self->is_parent_setgid;
+}
+
+static int set_owner(Extractor *self, int parent_fd, const char *name,
+                     const TarEntry *entry, int *out_is_changed) {
+  *out_is_changed = is_owner_changed(self, entry);
+  if (!(*out_is_changed)) {
+    return 0;
+  }
+
+  return fchownat(parent_fd, name, entry->uid, entry->gid,
+                  AT_SYMLINK_NOFOLLOW);
+}
+
+static int set_xattrs(int fd, const TarEntry *entry) {
+  for (size_t xattr_index = 0; xattr_index < entry->xattrs_size;
+       ++xattr_index) {
+    const TarXattr *xattr = &(entry->xattrs[xattr_index]);
+    if (0 != fsetxattr(fd, xattr->name, xattr->value, xattr->value_size, 0)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int write_file_data(Extractor *self, int fd, uint64_t size) {
+  while (0 < size) {
+    const uint8_t *data;
+    size_t data_size;
+    if (0 != stream_take(self->stream,
+                         (SIZE_MAX < size) ? SIZE_MAX : (size_t)size, &data,
+                         &data_size)) {
+      return 1;
+    }
+
+    size -= data_size;
+
+    if (0 != io_write_all(fd, data, data_size)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int extract_file(Extractor *self, int parent_fd, const char *name,
+                        const TarEntry *entry) {
+  int ret = 1;
+
+  // The file is created with its mode directly, as the umask is cleared
+  // while layers are extracted.
+  int flags = O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC;
+  int fd = openat(parent_fd, name, flags, entry->mode);
+  if ((-1 == fd) && (EEXIST == errno)) {
+    if (0 != remove_existing(parent_fd, name, 0)) {
+      goto out;
+    }
+
+    fd = openat(parent_fd, name, flags, entry->mode);
+  }
+
+  if (-1 == fd) {
+    goto out;
+  }
+
+  if (0 != write_file_data(self, fd, entry->size)) {
+    goto out_close_fd;
+  }
+
+  // Changing the owner clears the setuid and setgid bits, and the file
+  // capabilities, so they are set after it.
+  if (is_owner_changed(self, entry)) {
+    if ((0 != fchown(fd, entry->uid, entry->gid)) ||
+        ((0 != (entry->mode & (S_ISUID | S_ISGID))) &&
+         (0 != fchmod(fd, entry->mode)))) {
+      goto out_close_fd;
+    }
+  }
+
+  if (0 != set_xattrs(fd, entry)) {
+    goto out_close_fd;
+  }
+
+  struct timespec times[2] = {entry->modification_time,
+                              entry->modification_time};
+  if (0 != futimens(fd, times)) {
+    goto out_close_fd;
+  }
+
+  ret = 0;
+
+out_close_fd:
+  close(fd);
+
+out:
+  return ret;
+}
+
+static int extract_directory(Extractor *self, int parent_fd, const char *name,
+                             const char *path, const TarEntry *entry) {
+  // An existing directory is merged with the entry, and takes its mode.
+  int is_existing = 0;
+  if (0 != mkdirat(parent_fd, name, entry->mode)) {
+    if ((EEXIST != errno) || (0 != remove_existing(parent_fd, name, 1))) {
+      return 1;
+    }
+
+    if (0 != mkdirat(parent_fd, name, entry->mode)) {
+      if (EEXIST != errno) {
+        return 1;
+      }
+
+      is_existing = 1;
+    }
+  }
+
+  int is_owner_changed;
+  if ((0 != set_owner(self, parent_fd, name, entry, &is_owner_changed)) ||
+      ((is_existing || is_owner_changed) &&
+       (0 != fchmodat(parent_fd, name, entry->mode, 0)))) {
+    return 1;
+  }
+
+  if (0 != entry->xattrs_size) {
+    int fd = openat(parent_fd, name,
+                    O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (-1 == fd) {
+      return 1;
+    }
+
+    int result = set_xattrs(fd, entry);
+    close(fd);
+    if (0 != result) {
+      return 1;
+    }
+  }
+
+  DeferredDirectory directory = {
+      .path = strdup(path),
+      .modification_time = entry->modification_time,
+  };
+  if (NULL == directory.path) {
+    return 1;
+  }
+
+  arrput(self->directories, directory);
+
+  return 0;
+}
+
+static int extract_link(Extractor *self, int parent_fd, const char *name,
+                        const TarEntry *entry) {
+  int result;
+
+  if (TAR_ENTRY_TYPE_SYMBOLIC_LINK == entry->type) {
+    result = symlinkat(entry->link_path, parent_fd, name);
+    if ((0 != result) && (EEXIST == errno)) {
+      if (0 != remove_existing(parent_fd, name, 0)) {
+        return 1;
+      }
+
+      result = symlinkat(entry->link_path, parent_fd, name);
+    }
+  } else {
+    // Hard links point at an entry that has already been extracted, whose
+    // path is relative to the layer as well.
+    char target_path[PATH_MAX];
+    if (0 != clean_path(entry->link_path, target_path)) {
+      return 1;
+    }
+
+    char *target_parent_path;
+    char *target_name;
+    (void)split_path(target_path, &target_parent_path, &target_name);
+
+    int target_parent_fd = open_beneath(self->root_fd, target_parent_path);
+    if (-1 == target_parent_fd) {
+      return 1;
+    }
+
+    result = linkat(target_parent_fd, target_name, parent_fd, name, 0);
+    if ((0 != result) && (EEXIST == errno)) {
+      result = remove_existing(parent_fd, name, 0);
+      if (0 == result) {
+        result = linkat(target_parent_fd, target_name, parent_fd, name, 0);
+      }
+    }
+
+    close(target_parent_fd);
+
+    // A hard link shares its target's owner and times.
+    return result;
+  }
+
+  if (0 != result) {
+    return 1;
+  }
+
+  int is_owner_changed;
+  if (0 != set_owner(self, parent_fd, name, entry, &is_owner_changed)) {
+    return 1;
+  }
+
+  struct timespec times[2] = {entry->modification_time,
+                              entry->modification_time};
+  return utimensat(parent_fd, name, times, AT_SYMLINK_NOFOLLOW);
+}
+
+static int extract_node(Extractor *self, int parent_fd, const char *name,
+                        const TarEntry *entry) {
+  mode_t type = S_IFIFO;
+  if (TAR_ENTRY_TYPE_CHARACTER_DEVICE == entry->type) {
+    type = S_IFCHR;
+  } else if (TAR_ENTRY_TYPE_BLOCK_DEVICE == entry->type) {
+    type = S_IFBLK;
+  }
+
+  dev_t device = makedev(entry->device_major, entry->device_minor);
+  if ((0 != mknodat(parent_fd, name, type | entry->mode, device)) &&
+      ((EEXIST != errno) || (0 != remove_existing(parent_fd, name, 0)) ||
+       (0 != mknodat(parent_fd, name, type | entry->mode, device)))) {
+    return 1;
+  }
+
+  int is_owner_changed;
+  if ((0 != set_owner(self, parent_fd, name, entry, &is_owner_changed)) ||
+      (is_owner_changed && (0 != fchmodat(parent_fd, name, entry->mode, 0)))) {
+    return 1;
+  }
+
+  struct timespec times[2] = {entry->modification_time,
+                              entry->modification_time};
+  return utimensat(parent_fd, name, times, AT_SYMLINK_NOFOLLOW);
+}
+
+static int extract_whiteout(Extractor *self, int parent_fd, const char *name,
+                            const TarEntry *entry) {
+  // An opaque whiteout hides all of the directory's entries in the layers
+  // below.
+  if (0 == strcmp(name, OPAQUE_WHITEOUT)) {
+    return fsetxattr(parent_fd, OPAQUE_XATTR, "y", 1, 0);
+  }
+
+  // Any other whiteout hides the entry that it is named after.
+  const char *hidden_name = name + strlen(WHITEOUT_PREFIX);
+  if ((0 != remove_existing(parent_fd, hidden_name, 0)) ||
+      (0 != mknodat(parent_fd, hidden_name, S_IFCHR, makedev(0, 0)))) {
+    return 1;
+  }
+
+  int is_owner_changed;
+  return set_owner(self, parent_fd, hidden_name, entry, &is_owner_changed);
+}
+
+static int extract_entry(Extractor *self, const TarEntry *entry) {
+  char path[PATH_MAX];
+  if (0 != clean_path(entry->path, path)) {
+    return 1;
+  }
+
+  // The layer's directory itself is left as it is.
+  if ('\0' == path[0]) {
+    return stream_skip(self->stream, tar_get_padded_size(entry->size));
+  }
+
+  char *parent_path;
+  char *name;
+  char *separator = split_path(path, &parent_path, &name);
+
+  int parent_fd = open_parent(self, parent_path);
+  if (-1 == parent_fd) {
+    return 1;
+  }
+
+  if (NULL != separator) {
+    *separator = '/';
+  }
+
+  // Only the data of files is consumed while they are extracted.
+  uint64_t consumed_size = 0;
+
+  int result = 1;
+  if (0 == strncmp(name, WHITEOUT_PREFIX, strlen(WHITEOUT_PREFIX))) {
+    result = extract_whiteout(self, parent_fd, name, entry);
+  } else {
+    switch (entry->type) {
+      case TAR_ENTRY_TYPE_REGULAR:
+        result = extract_file(self, parent_fd, name, entry);
+        consumed_size = entry->size;
+        break;
+
+      case TAR_ENTRY_TYPE_DIRECTORY:
+        result = extract_directory(self, parent_fd, name, path, entry);
+        break;
+
+      case TAR_ENTRY_TYPE_HARD_LINK:
+      case TAR_ENTRY_TYPE_SYMBOLIC_LINK:
+        result = extract_link(self, parent_fd, name, entry);
+        break;
+
+      case TAR_ENTRY_TYPE_CHARACTER_DEVICE:
+      case TAR_ENTRY_TYPE_BLOCK_DEVICE:
+      case TAR_ENTRY_TYPE_FIFO:
+        result = extract_node(self, parent_fd, name, entry);
+        break;
+    }
+  }
+
+  if (0 != result) {
+    return 1;
+  }
+
+  return stream_skip(self->stream,
+                     tar_get_padded_size(entry->size) - consumed_size);
+}
+
+static int set_directory_times(Extractor *self) {
+  // Directories are visited from the deepest one up, so that setting the
+  // times of a directory is not undone by its subdirectories.
+  for (size_t directory_index = arrlenu(self->directories);
+       0 < directory_index; --directory_index) {
+    const DeferredDirectory *directory =
+        &(self->directories[directory_index - 1]);
+
+    int fd = open_beneath(self->root_fd, directory->path);
+    if (-1 == fd) {
+      return 1;
+    }
+
+    struct timespec times[2] = {directory->modification_time,
+                                directory->modification_time};
+    int result = futimens(fd, times);
+    close(fd);
+    if (0 != result) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+int layer_archive_extract(const void *data, size_t size, int directory_fd,
+                          Digest *out_diff_id, uint64_t *out_size) {
+  int ret = 1;
+
+  LayerStream stream;
+  if (0 != stream_init(&stream, data, size)) {
+    goto out;
+  }
+
+  Extractor extractor = {
+      .stream = &stream,
+      .root_fd = directory_fd,
+      .parent_fd = -1,
+      .is_parent_setgid = 0,
+      .directories = NULL,
+      .uid = geteuid(),
+      .gid = getegid(),
+  };
+
+  TarReader reader;
+  tar_reader_init(&reader, stream_read, &stream);
+
+  // Extract the entries as they are decompressed.
+  for (;;) {
+    TarEntry *entry;
+    if (0 != tar_reader_next(&reader, &entry)) {
+      goto out_destroy_reader;
+    }
+
+    if (NULL == entry) {
+      break;
+    }
+
+    if (0 != extract_entry(&extractor, entry)) {
+      goto out_destroy_reader;
+    }
+  }
+
+  if ((0 != stream_finish(&stream)) ||
+      (0 != set_directory_times(&extractor))) {
+    goto out_destroy_reader;
+  }
+
+  sha256_final(&stream.sha256, out_diff_id->bytes);
+  *out_size = stream.size;
+
+  ret = 0;
+
+out_destroy_reader:
+  tar_reader_destroy(&reader);
+
+  for (size_t directory_index = 0;
+       directory_index < arrlenu(extractor.directories); ++directory_index) {
+    free(extractor.directories[directory_index].path);
+  }
+
+  arrfree(extractor.directories);
+
+  if (-1 != extractor.parent_fd) {
+    close(extractor.parent_fd);
+  }
+
+  stream_destroy(&stream);
+
+out:
+  return ret;
+}
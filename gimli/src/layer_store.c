@@ -1,93 +1,117 @@
 #include "gimli/layer_store.h"
 
 #include <dirent.h>
-#include <errno.h>
-#include <limits.h>
 #include <stddef.h>
-#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "gimli/digest.h"
 #include "gimli/gimli_directory.h"
+#include "gimli/io.h"
 #include "gimli/layer.h"
-#include "stb_ds/stb_ds.h"
+#include "gimli/sha256.h"
 
-static int read_layer_store(LayerStore *self, const char *path,
-                            DIR *directory) {
-  int ret = 1;
-
-  // Reset the diff ID to layer map (required to be initialized to NULL by
-  // stb_ds).
-  self->diff_id_to_layer = NULL;
+// The layer store directory, relative to the gimli directory.
+#define LAYER_STORE_DIRECTORY "image/overlay2/layerdb/sha256"
 
-  for (;;) {
-    // Set `errno` to 0 before reading the next directory entry.
-    errno = 0;
+static int add_layer(LayerStore *self, Layer *layer) {
+  Digest diff_id;
+  if (0 != digest_parse(&diff_id, layer->diff_id)) {
+    return 1;
+  }
 
-    // Read the next directory entry.
-    struct dirent *entry = readdir(directory);
-    if (NULL == entry) {
-      // Check if an error occurred while reading the directory entry.
-      if (0 != errno) {
-        goto out_free_diff_id_to_layer;
-      }
+  return digest_table_put(&self->diff_id_to_layer, &diff_id, layer);
+}
 
-      // Completed reading all directory entries.
-      break;
-    }
+static int read_layer_store(LayerStore *self, DIR *directory) {
+  int ret = 1;
 
-    // Skip non-directory entries.
-    if (DT_DIR != entry->d_type) {
-      continue;
-    }
+  // List the layer directories, which are named after the layers' chain IDs.
+  char **chain_ids;
+  size_t chain_ids_size;
+  if (0 != io_read_directory_names(directory, DT_DIR, &chain_ids,
+                                   &chain_ids_size)) {
+    goto out;
+  }
 
-    // Skip the "." and ".." directories.
-    if ((0 == strcmp(entry->d_name, ".")) ||
-        (0 == strcmp(entry->d_name, ".."))) {
-      continue;
-    }
+  // Read all of the layers at once.
+  Layer *layers = arena_allocate(&self->arena, chain_ids_size * sizeof(*layers));
+  if ((NULL == layers) ||
+      (0 != layer_init_all(layers, chain_ids, chain_ids_size,
+                           self->layer_store_directory_fd,
+                           self->overlay_directory_fd, &self->arena))) {
+    goto out_free_chain_ids;
+  }
 
-    // Read the layer information.
-    Layer layer;
-    if (0 != layer_init(&layer, entry->d_name, path)) {
-      goto out_free_diff_id_to_layer;
+  // Add the layers to the diff ID to layer map.
+  for (size_t layer_index = 0; layer_index < chain_ids_size; ++layer_index) {
+    if (0 != add_layer(self, &(layers[layer_index]))) {
+      goto out_free_chain_ids;
     }
-
-    // Add the layer to the diff ID to layer map.
-    shput(self->diff_id_to_layer, layer.diff_id, layer);
   }
 
   ret = 0;
-  goto out;
-
-out_free_diff_id_to_layer:
-  for (ptrdiff_t pair_index = 0; pair_index < shlen(self->diff_id_to_layer);
-       ++pair_index) {
-    layer_destroy(&(self->diff_id_to_layer[pair_index].value));
-  }
 
-  shfree(self->diff_id_to_layer);
+out_free_chain_ids:
+  io_free_directory_names(chain_ids, chain_ids_size);
 
 out:
   return ret;
 }
 
-int layer_store_init(LayerStore *self) {
+static int open_layer_directories(LayerStore *self) {
+  self->layer_store_directory_fd =
+      gimli_directory_open(LAYER_STORE_DIRECTORY);
+  if (-1 == self->layer_store_directory_fd) {
+    return 1;
+  }
+
+  self->overlay_directory_fd = gimli_directory_open("overlay2");
+  if (-1 == self->overlay_directory_fd) {
+    return 1;
+  }
+
+  return 0;
+}
+
+int layer_store_init(LayerStore *self, LayerStoreMode mode) {
   int ret = 1;
 
-  // Format the layer store directory path.
-  char layer_store_directory_path[PATH_MAX];
-  snprintf(layer_store_directory_path, sizeof(layer_store_directory_path),
-           "%s/image/overlay2/layerdb/sha256", gimli_directory_get());
+  self->mode = mode;
+  self->metadata_index = NULL;
+  self->layer_store_directory_fd = -1;
+  self->overlay_directory_fd = -1;
+  digest_table_init(&self->diff_id_to_layer);
+  arena_init(&self->arena);
+
+  // Open the directories that the layers are read from.
+  if (0 != open_layer_directories(self)) {
+    goto out;
+  }
+
+  // Layers are read on demand in lazy mode, so the layer store directory is
+  // not read during initialization.
+  if (LAYER_STORE_MODE_LAZY == self->mode) {
+    ret = 0;
+    goto out;
+  }
+
+  // List the layer store directory through a descriptor of its own, as the
+  // directory stream takes ownership of it.
+  int layer_store_directory_fd = dup(self->layer_store_directory_fd);
+  if (-1 == layer_store_directory_fd) {
+    goto out;
+  }
 
-  // Open the layer store directory.
-  DIR *layer_store_directory = opendir(layer_store_directory_path);
+  DIR *layer_store_directory = fdopendir(layer_store_directory_fd);
   if (NULL == layer_store_directory) {
+    close(layer_store_directory_fd);
     goto out;
   }
 
   // Read the layer store.
-  if (0 != read_layer_store(self, layer_store_directory_path,
-                            layer_store_directory)) {
+  if (0 != read_layer_store(self, layer_store_directory)) {
     goto out_close_layer_store_directory;
   }
 
@@ -97,24 +121,166 @@ out_close_layer_store_directory:
   closedir(layer_store_directory);
 
 out:
+  // Release whatever was read before the failure.
+  if (0 != ret) {
+    layer_store_destroy(self);
+  }
+
   return ret;
 }
 
+int layer_store_init_from_index(LayerStore *self,
+                                const MetadataIndex *metadata_index) {
+  self->mode = LAYER_STORE_MODE_INDEXED;
+  self->metadata_index = metadata_index;
+  self->layer_store_directory_fd = -1;
+  self->overlay_directory_fd = -1;
+  digest_table_init(&self->diff_id_to_layer);
+  arena_init(&self->arena);
+
+  return 0;
+}
+
 void layer_store_destroy(LayerStore *self) {
-  for (ptrdiff_t pair_index = 0; pair_index < shlen(self->diff_id_to_layer);
-       ++pair_index) {
-    layer_destroy(&(self->diff_id_to_layer[pair_index].value));
+  digest_table_destroy(&self->diff_id_to_layer);
+
+  // Release all of the layers at once.
+  arena_destroy(&self->arena);
+
+  if (-1 != self->overlay_directory_fd) {
+    close(self->overlay_directory_fd);
+  }
+
+  if (-1 != self->layer_store_directory_fd) {
+    close(self->layer_store_directory_fd);
+  }
+}
+
+static int load_indexed_image_layers(LayerStore *self, const Image *image) {
+  for (size_t layer_index = 0; layer_index < image->layers_size;
+       ++layer_index) {
+    const char *diff_id = image->layers[layer_index];
+
+    // Skip layers that have already been loaded.
+    if (NULL != layer_store_get_layer_by_diff_id(self, diff_id)) {
+      continue;
+    }
+
+    // Read the layer information from the index.
+    Layer *layer = arena_allocate(&self->arena, sizeof(*layer));
+    if ((NULL == layer) ||
+        (0 != metadata_index_get_layer(self->metadata_index, diff_id, layer))) {
+      return 1;
+    }
+
+    // Add the layer to the diff ID to layer map.
+    if (0 != add_layer(self, layer)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+int layer_store_load_image_layers(LayerStore *self, const Image *image) {
+  int ret = 1;
+
+  // Indexed layers are looked up by their diff IDs directly.
+  if (LAYER_STORE_MODE_INDEXED == self->mode) {
+    return load_indexed_image_layers(self, image);
+  }
+
+  // The layer store directories are named after the layers' chain IDs (without
+  // their digest algorithm prefix), which are derived from the image's ordered
+  // diff IDs.
+  // The chain IDs of the layers that have not been loaded yet are collected,
+  // so that all of them are read at once.
+  char(*chain_ids)[DIGEST_STRING_SIZE] =
+      malloc(image->layers_size * sizeof(*chain_ids));
+  char **missing_chain_ids = malloc(image->layers_size * sizeof(char *));
+  const char **missing_diff_ids =
+      malloc(image->layers_size * sizeof(*missing_diff_ids));
+  if ((0 < image->layers_size) &&
+      ((NULL == chain_ids) || (NULL == missing_chain_ids) ||
+       (NULL == missing_diff_ids))) {
+    goto out_free_chain_ids;
+  }
+
+  size_t missing_layers_size = 0;
+  size_t chain_id_prefix_size = strlen(SHA256_DIGEST_PREFIX);
+
+  for (size_t layer_index = 0; layer_index < image->layers_size;
+       ++layer_index) {
+    const char *diff_id = image->layers[layer_index];
+
+    // Compute the layer's chain ID.
+    layer_compute_chain_id(
+        (0 == layer_index) ? NULL : chain_ids[layer_index - 1], diff_id,
+        chain_ids[layer_index]);
+
+    // Skip layers that have already been loaded.
+    if (NULL != layer_store_get_layer_by_diff_id(self, diff_id)) {
+      continue;
+    }
+
+    // In eager mode all layers have already been read, so the layer does not
+    // exist.
+    if (LAYER_STORE_MODE_LAZY != self->mode) {
+      goto out_free_chain_ids;
+    }
+
+    if (0 != strncmp(chain_ids[layer_index], SHA256_DIGEST_PREFIX,
+                     chain_id_prefix_size)) {
+      goto out_free_chain_ids;
+    }
+
+    missing_chain_ids[missing_layers_size] =
+        chain_ids[layer_index] + chain_id_prefix_size;
+    missing_diff_ids[missing_layers_size] = diff_id;
+    ++missing_layers_size;
+  }
+
+  // Read the missing layers.
+  Layer *layers =
+      arena_allocate(&self->arena, missing_layers_size * sizeof(*layers));
+  if ((NULL == layers) ||
+      (0 != layer_init_all(layers, missing_chain_ids, missing_layers_size,
+                           self->layer_store_directory_fd,
+                           self->overlay_directory_fd, &self->arena))) {
+    goto out_free_chain_ids;
   }
 
-  shfree(self->diff_id_to_layer);
+  for (size_t layer_index = 0; layer_index < missing_layers_size;
+       ++layer_index) {
+    // Ensure that the layer found under the chain ID has the expected diff
+    // ID.
+    if (0 != strcmp(layers[layer_index].diff_id,
+                    missing_diff_ids[layer_index])) {
+      goto out_free_chain_ids;
+    }
+
+    // Add the layer to the diff ID to layer map.
+    if (0 != add_layer(self, &(layers[layer_index]))) {
+      goto out_free_chain_ids;
+    }
+  }
+
+  ret = 0;
+
+out_free_chain_ids:
+  free(missing_diff_ids);
+  free(missing_chain_ids);
+  free(chain_ids);
+
+  return ret;
 }
 
 Layer *layer_store_get_layer_by_diff_id(LayerStore *self, const char *diff_id) {
   // Find the layer by the diff ID.
-  ptrdiff_t id_pair_index = shgeti(self->diff_id_to_layer, diff_id);
-  if (-1 == id_pair_index) {
+  Digest diff_id_digest;
+  if (0 != digest_parse(&diff_id_digest, diff_id)) {
     return NULL;
   }
 
-  return &(self->diff_id_to_layer[id_pair_index].value);
+  return digest_table_get(&self->diff_id_to_layer, &diff_id_digest);
 }
@@ -0,0 +1,1401 @@
+#define _GNU_SOURCE
+
+#include "gimli/load.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "gimli/digest.h"
+#include "gimli/digest_table.h"
+#include "gimli/gimli_directory.h"
+#include "gimli/io.h"
+#include "gimli/layer.h"
+#include "gimli/layer_archive.h"
+#include "gimli/layer_store.h"
+#include "gimli/parallel.h"
+#include "gimli/sha256.h"
+#include "gimli/tar.h"
+#include "jansson.h"
+#include "stb_ds/stb_ds.h"
+
+// The store directories, relative to the gimli directory.
+#define LOAD_LAYERDB_DIRECTORY "image/overlay2/layerdb"
+#define LOAD_LAYER_STORE_DIRECTORY "image/overlay2/layerdb/sha256"
+#define LOAD_IMAGE_STORE_DIRECTORY "image/overlay2/imagedb/content/sha256"
+#define LOAD_REPOSITORIES_PATH "image/overlay2/repositories.json"
+
+// The file that loads lock while they merge their tags into the repositories,
+// which are replaced as a whole.
+#define LOAD_REPOSITORIES_LOCK_PATH "image/overlay2/repositories.json.lock"
+#define LOAD_OVERLAY_DIRECTORY "overlay2"
+
+// The directory that layer store entries are written in before they are
+// renamed into place, relative to the layerdb directory (as Docker does).
+#define LOAD_LAYERDB_TEMPORARY_DIRECTORY "tmp"
+
+// The prefix of the overlay directories that layers are extracted to, which
+// are renamed to their cache IDs once their diff IDs have been verified.
+#define LOAD_STAGING_PREFIX ".load-"
+
+// Docker names the links of the overlay layers with 26 characters.
+#define LOAD_LINK_NAME_SIZE 26
+
+// The archive's index of images, and the prefix of the blobs of archives in
+// the OCI layout, which are named after their digests.
+#define LOAD_MANIFEST_PATH "manifest.json"
+#define LOAD_BLOB_PREFIX "blobs/sha256/"
+
+// The largest metadata file that is kept in memory while the archive is
+// streamed.
+#define LOAD_METADATA_MAX_SIZE (16 * 1024 * 1024)
+
+// The size of the buffer that streamed input is copied through.
+#define LOAD_BUFFER_SIZE (1024 * 1024)
+
+typedef struct LoadBlob {
+  // The blob's path in the archive, and its data, which either points into
+  // the archive's mapping, a spooled copy, or a buffer.
+  char *name;
+  const uint8_t *data;
+  size_t size;
+  void *mapping;
+  char *buffer;
+
+  // The diff ID that the blob is known to have before it is extracted, which
+  // lets layers that are already in the store be skipped.
+  int has_expected_diff_id;
+  Digest expected_diff_id;
+
+  // The extraction, which is done by the workers once the blob is queued.
+  int is_queued;
+  int is_extracted;
+  int is_committed;
+  int error;
+  Digest diff_id;
+  uint64_t extracted_size;
+  char cache_id[SHA256_HEX_DIGEST_SIZE + 1];
+  struct LoadBlob *next;
+} LoadBlob;
+
+typedef struct NameToBlobPair {
+  char *key;
+  LoadBlob *value;
+} NameToBlobPair;
+
+typedef struct Loader {
+  // The archive, which is mapped when it is a regular file, and streamed
+  // otherwise.
+  int input_fd;
+  const uint8_t *input;
+  size_t input_size;
+  size_t input_offset;
+  uint8_t *buffer;
+
+  int overlay_directory_fd;
+  int layerdb_directory_fd;
+  int layer_store_directory_fd;
+
+  // The layers that are already in the store, and the ones that have been
+  // extracted by this load, by their diff IDs.
+  LayerStore layer_store;
+  DigestTable diff_id_to_blob;
+
+  NameToBlobPair *blobs;
+  LoadBlob **all_blobs;
+
+  // The blobs that are waiting to be extracted.
+  pthread_mutex_t mutex;
+  pthread_cond_t condition;
+  LoadBlob *queue_head;
+  LoadBlob *queue_tail;
+  int is_queue_closed;
+  int read_error;
+
+  LoadSummary *summary;
+} Loader;
+
+static int read_input(void *context, void *buffer, size_t size) {
+  Loader *self = context;
+
+  if (NULL != self->input) {
+    if (size > (self->input_size - self->input_offset)) {
+      errno = EBADMSG;
+      return 1;
+    }
+
+    memcpy(buffer, self->input + self->input_offset, size);
+    self->input_offset += size;
+
+    return 0;
+  }
+
+  for (uint8_t *cursor = buffer; 0 < size;) {
+    ssize_t read_size = read(self->input_fd, cursor, size);
+    if (-1 == read_size) {
+      if (EINTR == errno) {
+        continue;
+      }
+
+      return 1;
+    }
+
+    // The archive ended in the middle of an entry.
+    if (0 == read_size) {
+      errno = EBADMSG;
+      return 1;
+    }
+
+    cursor += read_size;
+    size -= (size_t)read_size;
+  }
+
+  return 0;
+}
+
+static int copy_input(Loader *self, int fd, uint64_t size) {
+  // Streamed input is spliced to the spool in the kernel when it is a pipe,
+  // and copied through the buffer otherwise (or when it is discarded).
+  while ((-1 != fd) && (0 < size)) {
+    ssize_t spliced_size =
+        splice(self->input_fd, NULL, fd, NULL,
+               (LOAD_BUFFER_SIZE < size) ? LOAD_BUFFER_SIZE : (size_t)size,
+               SPLICE_F_MOVE);
+    if (0 < spliced_size) {
+      size -= (uint64_t)spliced_size;
+      continue;
+    }
+
+    if ((-1 == spliced_size) && (EINTR == errno)) {
+      continue;
+    }
+
+    if ((-1 == spliced_size) && (EINVAL == errno)) {
+      break;
+    }
+
+    if (0 == spliced_size) {
+      errno = EBADMSG;
+    }
+
+    return 1;
+  }
+
+  while (0 < size) {
+    size_t chunk_size =
+        (LOAD_BUFFER_SIZE < size) ? LOAD_BUFFER_SIZE : (size_t)size;
+    if (0 != read_input(self, self->buffer, chunk_size)) {
+      return 1;
+    }
+
+    if ((-1 != fd) && (0 != io_write_all(fd, self->buffer, chunk_size))) {
+      return 1;
+    }
+
+    size -= chunk_size;
+  }
+
+  return 0;
+}
+
+static LoadBlob *get_blob(Loader *self, const char *name) {
+  return shget(self->blobs, name);
+}
+
+static LoadBlob *add_blob(Loader *self, const char *name) {
+  // Entries are named relative to the archive's root, which some archivers
+  // prefix with "./".
+  while (0 == strncmp(name, "./", 2)) {
+    name += 2;
+  }
+
+  LoadBlob *blob = calloc(1, sizeof(*blob));
+  if (NULL == blob) {
+    return NULL;
+  }
+
+  blob->name = strdup(name);
+  if (NULL == blob->name) {
+    free(blob);
+    return NULL;
+  }
+
+  // Archives in the OCI layout name blobs after their digests, which is the
+  // diff ID of an uncompressed layer.
+  size_t prefix_size = strlen(LOAD_BLOB_PREFIX);
+  blob->has_expected_diff_id =
+      (0 == strncmp(name, LOAD_BLOB_PREFIX, prefix_size)) &&
+      (0 == digest_parse_hex(&blob->expected_diff_id, name + prefix_size));
+
+  // A later entry of the same name replaces an earlier one, which is still
+  // freed with the rest.
+  arrput(self->all_blobs, blob);
+  shput(self->blobs, blob->name, blob);
+
+  return blob;
+}
+
+static void release_blob_data(LoadBlob *blob) {
+  if (NULL != blob->mapping) {
+    munmap(blob->mapping, blob->size);
+    blob->mapping = NULL;
+    blob->data = NULL;
+  }
+}
+
+static void free_blob(LoadBlob *blob) {
+  release_blob_data(blob);
+  free(blob->buffer);
+  free(blob->name);
+  free(blob);
+}
+
+static int is_layer_present(Loader *self, const Digest *diff_id) {
+  char diff_id_string[DIGEST_STRING_SIZE];
+  digest_format(diff_id, diff_id_string);
+
+  Layer *layer =
+      layer_store_get_layer_by_diff_id(&self->layer_store, diff_id_string);
+
+  return (NULL != layer) ||
+         (NULL != digest_table_get(&self->diff_id_to_blob, diff_id));
+}
+
+static void queue_blob(Loader *self, LoadBlob *blob) {
+  blob->is_queued = 1;
+
+  pthread_mutex_lock(&self->mutex);
+
+  if (NULL == self->queue_tail) {
+    self->queue_head = blob;
+  } else {
+    self->queue_tail->next = blob;
+  }
+
+  self->queue_tail = blob;
+
+  pthread_cond_signal(&self->condition);
+  pthread_mutex_unlock(&self->mutex);
+}
+
+static void close_queue(Loader *self, int is_dropped) {
+  pthread_mutex_lock(&self->mutex);
+
+  if (is_dropped) {
+    self->queue_head = NULL;
+    self->queue_tail = NULL;
+  }
+
+  self->is_queue_closed = 1;
+  pthread_cond_broadcast(&self->condition);
+  pthread_mutex_unlock(&self->mutex);
+}
+
+static LoadBlob *take_blob(Loader *self) {
+  pthread_mutex_lock(&self->mutex);
+
+  while ((NULL == self->queue_head) && !self->is_queue_closed) {
+    pthread_cond_wait(&self->condition, &self->mutex);
+  }
+
+  LoadBlob *blob = self->queue_head;
+  if (NULL != blob) {
+    self->queue_head = blob->next;
+    if (NULL == self->queue_head) {
+      self->queue_tail = NULL;
+    }
+  }
+
+  pthread_mutex_unlock(&self->mutex);
+
+  return blob;
+}
+
+static int generate_name(char *name, size_t size, int is_hex) {
+  uint8_t bytes[SHA256_DIGEST_SIZE];
+  if (sizeof(bytes) != getrandom(bytes, sizeof(bytes), 0)) {
+    return 1;
+  }
+
+  // Cache IDs are random hex digests, and links are random capital letters.
+  if (is_hex) {
+    sha256_to_hex(bytes, name);
+    return 0;
+  }
+
+  for (size_t character_index = 0; character_index < size; ++character_index) {
+    name[character_index] = (char)('A' + (bytes[character_index] % 26));
+  }
+
+  name[size] = '\0';
+
+  return 0;
+}
+
+static void extract_blob(Loader *self, LoadBlob *blob) {
+  char staging_name[sizeof(LOAD_STAGING_PREFIX) + SHA256_HEX_DIGEST_SIZE];
+  int diff_directory_fd = -1;
+
+  // Extract the layer to a staging directory, which only becomes the layer's
+  // overlay directory once the layer has been verified.
+  if (0 != generate_name(blob->cache_id, SHA256_HEX_DIGEST_SIZE, 1)) {
+    goto out_fail;
+  }
+
+  snprintf(staging_name, sizeof(staging_name), LOAD_STAGING_PREFIX "%s",
+           blob->cache_id);
+
+  if (0 != mkdirat(self->overlay_directory_fd, staging_name, 0755)) {
+    goto out_fail;
+  }
+
+  char diff_path[sizeof(staging_name) + sizeof("/diff")];
+  snprintf(diff_path, sizeof(diff_path), "%s/diff", staging_name);
+
+  if (0 != mkdirat(self->overlay_directory_fd, diff_path, 0755)) {
+    goto out_remove_staging_directory;
+  }
+
+  diff_directory_fd = openat(self->overlay_directory_fd, diff_path,
+                             O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (-1 == diff_directory_fd) {
+    goto out_remove_staging_directory;
+  }
+
+  if (0 != layer_archive_extract(blob->data, blob->size, diff_directory_fd,
+                                 &blob->diff_id, &blob->extracted_size)) {
+    goto out_remove_staging_directory;
+  }
+
+  close(diff_directory_fd);
+
+  blob->is_extracted = 1;
+  goto out;
+
+out_remove_staging_directory:
+  blob->error = errno;
+
+  if (-1 != diff_directory_fd) {
+    close(diff_directory_fd);
+  }
+
+  io_remove_tree_at(self->overlay_directory_fd, staging_name);
+  goto out;
+
+out_fail:
+  blob->error = errno;
+
+out:
+  // The spooled copy of a layer is only needed until it is extracted.
+  release_blob_data(blob);
+}
+
+static int spool_blob(Loader *self, LoadBlob *blob, const uint8_t *head,
+                      size_t head_size) {
+  int ret = 1;
+
+  // Spool the layer to an unnamed file on the store's file system, so that it
+  // is extracted while the rest of the archive is read, and is removed once
+  // it is unmapped.
+  int fd = openat(self->overlay_directory_fd, ".",
+                  O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+  if (-1 == fd) {
+    goto out;
+  }
+
+  if ((0 != io_write_all(fd, head, head_size)) ||
+      (0 != copy_input(self, fd, blob->size - head_size))) {
+    goto out_close_fd;
+  }
+
+  void *mapping = mmap(NULL, blob->size, PROT_READ, MAP_SHARED, fd, 0);
+  if (MAP_FAILED == mapping) {
+    goto out_close_fd;
+  }
+
+  blob->mapping = mapping;
+  blob->data = mapping;
+
+  ret = 0;
+
+out_close_fd:
+  close(fd);
+
+out:
+  return ret;
+}
+
+static int read_streamed_blob(Loader *self, LoadBlob *blob) {
+  // The first block tells metadata (which is JSON) from layers.
+  uint8_t head[TAR_BLOCK_SIZE];
+  size_t head_size = (sizeof(head) < blob->size) ? sizeof(head) : blob->size;
+  if (0 != read_input(self, head, head_size)) {
+    return 1;
+  }
+
+  int is_metadata =
+      (blob->size <= LOAD_METADATA_MAX_SIZE) &&
+      ((blob->size < (2 * TAR_BLOCK_SIZE)) || ('{' == head[0]) ||
+       ('[' == head[0]));
+  if (is_metadata) {
+    blob->buffer = malloc(blob->size + 1);
+    if (NULL == blob->buffer) {
+      return 1;
+    }
+
+    memcpy(blob->buffer, head, head_size);
+    if (0 != read_input(self, blob->buffer + head_size,
+                        blob->size - head_size)) {
+      return 1;
+    }
+
+    blob->buffer[blob->size] = '\0';
+    blob->data = (const uint8_t *)blob->buffer;
+
+    return 0;
+  }
+
+  // Layers that are already in the store are not even spooled.
+  if (blob->has_expected_diff_id &&
+      is_layer_present(self, &blob->expected_diff_id)) {
+    return copy_input(self, -1, blob->size - head_size);
+  }
+
+  if (0 != spool_blob(self, blob, head, head_size)) {
+    return 1;
+  }
+
+  queue_blob(self, blob);
+
+  return 0;
+}
+
+static int read_archive(Loader *self) {
+  int ret = 1;
+
+  TarReader reader;
+  tar_reader_init(&reader, read_input, self);
+
+  for (;;) {
+    TarEntry *entry;
+    if (0 != tar_reader_next(&reader, &entry)) {
+      goto out_destroy_reader;
+    }
+
+    if (NULL == entry) {
+      break;
+    }
+
+    // Only files are blobs, and the directories that hold them are skipped.
+    if (TAR_ENTRY_TYPE_REGULAR != entry->type) {
+      continue;
+    }
+
+    if (SIZE_MAX < entry->size) {
+      errno = EFBIG;
+      goto out_destroy_reader;
+    }
+
+    LoadBlob *blob = add_blob(self, entry->path);
+    if (NULL == blob) {
+      goto out_destroy_reader;
+    }
+
+    blob->size = (size_t)entry->size;
+
+    // A mapped archive is only scanned, and the blobs are read in place.
+    uint64_t padding_size = tar_get_padded_size(entry->size) - entry->size;
+    if (NULL != self->input) {
+      if (tar_get_padded_size(entry->size) >
+          (self->input_size - self->input_offset)) {
+        errno = EBADMSG;
+        goto out_destroy_reader;
+      }
+
+      blob->data = self->input + self->input_offset;
+      self->input_offset += blob->size + padding_size;
+      continue;
+    }
+
+    if ((0 != read_streamed_blob(self, blob)) ||
+        (0 != copy_input(self, -1, padding_size))) {
+      goto out_destroy_reader;
+    }
+  }
+
+  ret = 0;
+
+out_destroy_reader:
+  tar_reader_destroy(&reader);
+
+  return ret;
+}
+
+static json_t *load_json_blob(Loader *self, const char *name) {
+  LoadBlob *blob = get_blob(self, name);
+  if ((NULL == blob) || (NULL == blob->data)) {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  json_t *json = json_loadb((const char *)blob->data, blob->size, 0, NULL);
+  if (NULL == json) {
+    errno = EBADMSG;
+  }
+
+  return json;
+}
+
+static const char *get_string(const json_t *json) {
+  const char *string = json_string_value(json);
+  return (NULL == string) ? "" : string;
+}
+
+static json_t *get_config_diff_ids(json_t *config) {
+  json_t *diff_ids =
+      json_object_get(json_object_get(config, "rootfs"), "diff_ids");
+
+  return json_is_array(diff_ids) ? diff_ids : NULL;
+}
+
+static int queue_referenced_blobs(Loader *self) {
+  int ret = 1;
+
+  json_t *manifest = load_json_blob(self, LOAD_MANIFEST_PATH);
+  if (NULL == manifest) {
+    goto out;
+  }
+
+  // The manifest and the configs are at hand before any layer is extracted,
+  // so only the layers that are referenced and missing from the store are
+  // queued.
+  size_t image_index;
+  json_t *image;
+  json_array_foreach(manifest, image_index, image) {
+    json_t *config =
+        load_json_blob(self, get_string(json_object_get(image, "Config")));
+    if (NULL == config) {
+      goto out_decref_manifest;
+    }
+
+    json_t *diff_ids = get_config_diff_ids(config);
+    json_t *layers = json_object_get(image, "Layers");
+
+    size_t layer_index;
+    json_t *layer;
+    json_array_foreach(layers, layer_index, layer) {
+      LoadBlob *blob = get_blob(self, get_string(layer));
+      if ((NULL == blob) || blob->is_queued) {
+        continue;
+      }
+
+      blob->has_expected_diff_id =
+          0 == digest_parse(&blob->expected_diff_id,
+                            get_string(json_array_get(diff_ids, layer_index)));
+      if (blob->has_expected_diff_id &&
+          is_layer_present(self, &blob->expected_diff_id)) {
+        continue;
+      }
+
+      queue_blob(self, blob);
+    }
+
+    json_decref(config);
+  }
+
+  ret = 0;
+
+out_decref_manifest:
+  json_decref(manifest);
+
+out:
+  return ret;
+}
+
+static int run_task(void *context, size_t worker_index, size_t task_index) {
+  (void)worker_index;
+
+  Loader *self = context;
+
+  // The first task reads the archive and queues its layers, while the rest
+  // extract them as they are queued.
+  if (0 == task_index) {
+    int result = read_archive(self);
+    if ((0 == result) && (NULL != self->input)) {
+      result = queue_referenced_blobs(self);
+    }
+
+    // The error of a failed read is kept for the calling thread, and the
+    // layers that are still queued are dropped.
+    if (0 != result) {
+      self->read_error = errno;
+    }
+
+    close_queue(self, 0 != result);
+
+    return result;
+  }
+
+  for (LoadBlob *blob = take_blob(self); NULL != blob;
+       blob = take_blob(self)) {
+    extract_blob(self, blob);
+  }
+
+  return 0;
+}
+
+static int write_file_at(int directory_fd, const char *name,
+                         const char *string) {
+  int fd = openat(directory_fd, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+  if (-1 == fd) {
+    return 1;
+  }
+
+  int result = io_write_all(fd, string, strlen(string));
+  close(fd);
+
+  return result;
+}
+
+static int publish_overlay_directory(Loader *self, const char *cache_id) {
+  // Move the verified layer into place under its cache ID, and otherwise
+  // remove it.
+  char staging_name[sizeof(LOAD_STAGING_PREFIX) + SHA256_HEX_DIGEST_SIZE];
+  snprintf(staging_name, sizeof(staging_name), LOAD_STAGING_PREFIX "%s",
+           cache_id);
+
+  if (0 != renameat(self->overlay_directory_fd, staging_name,
+                    self->overlay_directory_fd, cache_id)) {
+    int remove_errno = errno;
+    io_remove_tree_at(self->overlay_directory_fd, staging_name);
+    errno = remove_errno;
+
+    return 1;
+  }
+
+  // Link the layer under a short name, which keeps the overlay mount options
+  // of deep images within a page.
+  char link_target[SHA256_HEX_DIGEST_SIZE + sizeof("../") + sizeof("/diff")];
+  snprintf(link_target, sizeof(link_target), "../%s/diff", cache_id);
+
+  char link_name[LOAD_LINK_NAME_SIZE + 1];
+  char link_path[sizeof("l/") + sizeof(link_name)];
+  for (;;) {
+    if (0 != generate_name(link_name, LOAD_LINK_NAME_SIZE, 0)) {
+      return 1;
+    }
+
+    snprintf(link_path, sizeof(link_path), "l/%s", link_name);
+    if (0 == symlinkat(link_target, self->overlay_directory_fd, link_path)) {
+      break;
+    }
+
+    if (EEXIST != errno) {
+      return 1;
+    }
+  }
+
+  char link_file_path[SHA256_HEX_DIGEST_SIZE + sizeof("/link")];
+  snprintf(link_file_path, sizeof(link_file_path), "%s/link", cache_id);
+
+  return write_file_at(self->overlay_directory_fd, link_file_path, link_name);
+}
+
+static int link_overlay_directory(Loader *self, const char *source_cache_id,
+                                  char *cache_id) {
+  char staging_name[sizeof(LOAD_STAGING_PREFIX) + SHA256_HEX_DIGEST_SIZE];
+
+  // The layer's files are linked into a staging directory of their own, as
+  // every chain owns its overlay directory and removes it along with itself.
+  if (0 != generate_name(cache_id, SHA256_HEX_DIGEST_SIZE, 1)) {
+    return 1;
+  }
+
+  snprintf(staging_name, sizeof(staging_name), LOAD_STAGING_PREFIX "%s",
+           cache_id);
+
+  if (0 != mkdirat(self->overlay_directory_fd, staging_name, 0755)) {
+    return 1;
+  }
+
+  char source_diff_path[SHA256_HEX_DIGEST_SIZE + sizeof("/diff")];
+  snprintf(source_diff_path, sizeof(source_diff_path), "%s/diff",
+           source_cache_id);
+
+  char diff_path[sizeof(staging_name) + sizeof("/diff")];
+  snprintf(diff_path, sizeof(diff_path), "%s/diff", staging_name);
+
+  if (0 != io_link_tree_at(self->overlay_directory_fd, source_diff_path,
+                           self->overlay_directory_fd, diff_path)) {
+    // Preserve the error while the staging directory is removed.
+    int remove_errno = errno;
+    io_remove_tree_at(self->overlay_directory_fd, staging_name);
+    errno = remove_errno;
+
+    return 1;
+  }
+
+  return publish_overlay_directory(self, cache_id);
+}
+
+static int write_layer_store_entry(Loader *self, const char *chain_id,
+                                   const char *diff_id, const char *cache_id,
+                                   const char *parent_chain_id) {
+  int ret = 1;
+
+  // The entry is written in a temporary directory, and renamed into place
+  // once it is complete.
+  const char *chain_id_hex = chain_id + strlen(SHA256_DIGEST_PREFIX);
+
+  char temporary_name[PATH_MAX];
+  snprintf(temporary_name, sizeof(temporary_name),
+           LOAD_LAYERDB_TEMPORARY_DIRECTORY "/write-set-%d-%s", (int)getpid(),
+           chain_id_hex);
+
+  if (0 != mkdirat(self->layerdb_directory_fd, temporary_name, 0755)) {
+    goto out;
+  }
+
+  int temporary_fd = openat(self->layerdb_directory_fd, temporary_name,
+                            O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (-1 == temporary_fd) {
+    goto out_remove_temporary_directory;
+  }
+
+  int result = (0 != write_file_at(temporary_fd, "diff", diff_id)) ||
+               (0 != write_file_at(temporary_fd, "cache-id", cache_id)) ||
+               ((NULL != parent_chain_id) &&
+                (0 != write_file_at(temporary_fd, "parent", parent_chain_id)));
+  close(temporary_fd);
+  if (0 != result) {
+    goto out_remove_temporary_directory;
+  }
+
+  if (0 != renameat(self->layerdb_directory_fd, temporary_name,
+                    self->layer_store_directory_fd, chain_id_hex)) {
+    // Another load has written the same layer first.
+    if ((EEXIST == errno) || (ENOTEMPTY == errno)) {
+      ret = 0;
+    }
+
+    goto out_remove_temporary_directory;
+  }
+
+  ret = 0;
+  goto out;
+
+out_remove_temporary_directory:
+  // Preserve the error while the temporary directory is removed.
+  {
+    int remove_errno = errno;
+    io_remove_tree_at(self->layerdb_directory_fd, temporary_name);
+    errno = remove_errno;
+  }
+
+out:
+  return ret;
+}
+
+static int commit_layer(Loader *self, const char *blob_name,
+                        const char *diff_id, const char *chain_id,
+                        const char *parent_chain_id) {
+  // The layer is already in the store under the same chain.
+  struct stat stat_buffer;
+  if (0 == fstatat(self->layer_store_directory_fd,
+                   chain_id + strlen(SHA256_DIGEST_PREFIX), &stat_buffer, 0)) {
+    ++self->summary->skipped_layers_size;
+    return 0;
+  }
+
+  Digest diff_id_digest;
+  if (0 != digest_parse(&diff_id_digest, diff_id)) {
+    errno = EBADMSG;
+    return 1;
+  }
+
+  // Layers whose contents are already in the store under another chain are
+  // linked from its overlay directory instead of being extracted again.
+  char linked_cache_id[SHA256_HEX_DIGEST_SIZE + 1];
+  const char *cache_id = NULL;
+  Layer *existing_layer =
+      layer_store_get_layer_by_diff_id(&self->layer_store, diff_id);
+  LoadBlob *existing_blob = digest_table_get(&self->diff_id_to_blob,
+                                             &diff_id_digest);
+  if ((NULL != existing_layer) || (NULL != existing_blob)) {
+    const char *source_cache_id = (NULL != existing_layer)
+                                      ? existing_layer->cache_id
+                                      : existing_blob->cache_id;
+    if (0 != link_overlay_directory(self, source_cache_id, linked_cache_id)) {
+      return 1;
+    }
+
+    cache_id = linked_cache_id;
+    ++self->summary->skipped_layers_size;
+  } else {
+    LoadBlob *blob = get_blob(self, blob_name);
+    if (NULL == blob) {
+      errno = ENOENT;
+      return 1;
+    }
+
+    // Layers small enough to have been taken for metadata are extracted
+    // here.
+    if (!blob->is_queued) {
+      blob->is_queued = 1;
+      extract_blob(self, blob);
+    }
+
+    if (!blob->is_extracted) {
+      errno = blob->error;
+      return 1;
+    }
+
+    // The layer must be the one that the image was built from.
+    if (!digest_equals(&blob->diff_id, &diff_id_digest)) {
+      errno = EBADMSG;
+      return 1;
+    }
+
+    // The staging directory is gone once the layer has been published, even
+    // if that failed.
+    blob->is_committed = 1;
+    if (0 != publish_overlay_directory(self, blob->cache_id)) {
+      return 1;
+    }
+
+    if (0 != digest_table_put(&self->diff_id_to_blob, &diff_id_digest, blob)) {
+      return 1;
+    }
+
+    cache_id = blob->cache_id;
+    ++self->summary->extracted_layers_size;
+    self->summary->extracted_size += blob->extracted_size;
+  }
+
+  return write_layer_store_entry(self, chain_id, diff_id, cache_id,
+                                 parent_chain_id);
+}
+
+static int verify_config(const LoadBlob *blob, const Digest *digest) {
+  // Configs are named after their digests, either as blobs or as
+  // "<hex>.json" files.
+  const char *name = strrchr(blob->name, '/');
+  name = (NULL == name) ? blob->name : (name + 1);
+
+  char hex[SHA256_HEX_DIGEST_SIZE + 1];
+  snprintf(hex, sizeof(hex), "%s", name);
+
+  Digest name_digest;
+  if (0 != digest_parse_hex(&name_digest, hex)) {
+    return 0;
+  }
+
+  if (!digest_equals(&name_digest, digest)) {
+    errno = EBADMSG;
+    return 1;
+  }
+
+  return 0;
+}
+
+static int commit_image(Loader *self, json_t *image, json_t *tags) {
+  int ret = 1;
+
+  LoadBlob *config_blob =
+      get_blob(self, get_string(json_object_get(image, "Config")));
+  if ((NULL == config_blob) || (NULL == config_blob->data)) {
+    errno = ENOENT;
+    goto out;
+  }
+
+  // The image ID is the digest of its config.
+  Sha256 sha256;
+  sha256_init(&sha256);
+  sha256_update(&sha256, config_blob->data, config_blob->size);
+
+  Digest image_digest;
+  sha256_final(&sha256, image_digest.bytes);
+  if (0 != verify_config(config_blob, &image_digest)) {
+    goto out;
+  }
+
+  char image_id[DIGEST_STRING_SIZE];
+  digest_format(&image_digest, image_id);
+
+  json_t *config = load_json_blob(self, config_blob->name);
+  if (NULL == config) {
+    goto out;
+  }
+
+  // Commit the image's layers, from the bottom-most layer up.
+  json_t *diff_ids = get_config_diff_ids(config);
+  json_t *layers = json_object_get(image, "Layers");
+  if ((NULL == diff_ids) || !json_is_array(layers) ||
+      (json_array_size(diff_ids) != json_array_size(layers))) {
+    errno = EBADMSG;
+    goto out_decref_config;
+  }
+
+  char chain_id[DIGEST_STRING_SIZE];
+  char parent_chain_id[DIGEST_STRING_SIZE];
+
+  size_t layer_index;
+  json_t *layer;
+  json_array_foreach(layers, layer_index, layer) {
+    const char *diff_id =
+        json_string_value(json_array_get(diff_ids, layer_index));
+    const char *blob_name = json_string_value(layer);
+    if ((NULL == diff_id) || (NULL == blob_name)) {
+      errno = EBADMSG;
+      goto out_decref_config;
+    }
+
+    layer_compute_chain_id((0 == layer_index) ? NULL : parent_chain_id,
+                           diff_id, chain_id);
+
+    if (0 != commit_layer(self, blob_name, diff_id, chain_id,
+                          (0 == layer_index) ? NULL : parent_chain_id)) {
+      goto out_decref_config;
+    }
+
+    memcpy(parent_chain_id, chain_id, sizeof(parent_chain_id));
+  }
+
+  // Write the image's config once all of its layers are in the store.
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/" LOAD_IMAGE_STORE_DIRECTORY "/%s",
+           gimli_directory_get(), image_id + strlen(SHA256_DIGEST_PREFIX));
+
+  struct stat stat_buffer;
+  if ((0 != stat(path, &stat_buffer)) &&
+      (0 != io_write_file_atomically(path, config_blob->data,
+                                     config_blob->size))) {
+    goto out_decref_config;
+  }
+
+  // Point the image's tags at it.
+  size_t tag_index;
+  json_t *tag;
+  json_array_foreach(json_object_get(image, "RepoTags"), tag_index, tag) {
+    if (json_is_string(tag)) {
+      json_object_set_new(tags, json_string_value(tag), json_string(image_id));
+    }
+  }
+
+  ++self->summary->images_size;
+  ret = 0;
+
+out_decref_config:
+  json_decref(config);
+
+out:
+  return ret;
+}
+
+static int write_repositories(Loader *self, json_t *tags) {
+  int ret = 1;
+
+  if (0 == json_object_size(tags)) {
+    return 0;
+  }
+
+  char lock_path[PATH_MAX];
+  snprintf(lock_path, sizeof(lock_path), "%s/" LOAD_REPOSITORIES_LOCK_PATH,
+           gimli_directory_get());
+
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/" LOAD_REPOSITORIES_PATH,
+           gimli_directory_get());
+
+  // Concurrent loads merge their tags one at a time, so that none of them are
+  // lost.
+  int lock_fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (-1 == lock_fd) {
+    goto out;
+  }
+
+  if (0 != flock(lock_fd, LOCK_EX)) {
+    goto out_close_lock_fd;
+  }
+
+  // Merge the tags into the existing repositories, if there are any.
+  json_t *root = NULL;
+  if (0 == access(path, F_OK)) {
+    root = json_load_file(path, 0, NULL);
+    if (!json_is_object(root)) {
+      errno = EBADMSG;
+      goto out_decref_root;
+    }
+  } else if (ENOENT == errno) {
+    root = json_object();
+  } else {
+    goto out_close_lock_fd;
+  }
+
+  json_t *repositories = json_object_get(root, "Repositories");
+  if (!json_is_object(repositories)) {
+    repositories = json_object();
+    json_object_set_new(root, "Repositories", repositories);
+  }
+
+  const char *reference;
+  json_t *image_id;
+  json_object_foreach(tags, reference, image_id) {
+    // The repository is the reference without its tag, whose separator
+    // follows the last slash (as a registry may have a port).
+    char name[PATH_MAX];
+    snprintf(name, sizeof(name), "%s", reference);
+
+    char *slash = strrchr(name, '/');
+    char *separator = strrchr((NULL == slash) ? name : slash, ':');
+    if (NULL != separator) {
+      *separator = '\0';
+    }
+
+    json_t *repository = json_object_get(repositories, name);
+    if (!json_is_object(repository)) {
+      repository = json_object();
+      json_object_set_new(repositories, name, repository);
+    }
+
+    json_object_set(repository, reference, image_id);
+    ++self->summary->tags_size;
+  }
+
+  char *data = json_dumps(root, JSON_COMPACT);
+  if (NULL == data) {
+    errno = ENOMEM;
+    goto out_decref_root;
+  }
+
+  if (0 != io_write_file_atomically(path, data, strlen(data))) {
+    goto out_free_data;
+  }
+
+  ret = 0;
+
+out_free_data:
+  free(data);
+
+out_decref_root:
+  json_decref(root);
+
+out_close_lock_fd:
+  // Preserve the error while the lock is released.
+  {
+    int close_errno = errno;
+    close(lock_fd);
+    errno = close_errno;
+  }
+
+out:
+  return ret;
+}
+
+static int commit_images(Loader *self) {
+  int ret = 1;
+
+  json_t *manifest = load_json_blob(self, LOAD_MANIFEST_PATH);
+  if (NULL == manifest) {
+    goto out;
+  }
+
+  if (!json_is_array(manifest)) {
+    errno = EBADMSG;
+    goto out_decref_manifest;
+  }
+
+  json_t *tags = json_object();
+  if (NULL == tags) {
+    errno = ENOMEM;
+    goto out_decref_manifest;
+  }
+
+  size_t image_index;
+  json_t *image;
+  json_array_foreach(manifest, image_index, image) {
+    if (0 != commit_image(self, image, tags)) {
+      goto out_decref_tags;
+    }
+  }
+
+  // The tags are written last, so that they only ever point at images that
+  // are complete.
+  if (0 != write_repositories(self, tags)) {
+    goto out_decref_tags;
+  }
+
+  ret = 0;
+
+out_decref_tags:
+  json_decref(tags);
+
+out_decref_manifest:
+  json_decref(manifest);
+
+out:
+  return ret;
+}
+
+static int create_store_directories(void) {
+  static const char *const DIRECTORIES[] = {
+      "container",
+      "image",
+      "image/overlay2",
+      "image/overlay2/imagedb",
+      "image/overlay2/imagedb/content",
+      LOAD_IMAGE_STORE_DIRECTORY,
+      LOAD_LAYERDB_DIRECTORY,
+      LOAD_LAYER_STORE_DIRECTORY,
+      LOAD_LAYERDB_DIRECTORY "/" LOAD_LAYERDB_TEMPORARY_DIRECTORY,
+      LOAD_OVERLAY_DIRECTORY,
+      LOAD_OVERLAY_DIRECTORY "/l",
+  };
+
+  // Images may be loaded into an empty gimli directory.
+  if ((0 != mkdir(gimli_directory_get(), 0755)) && (EEXIST != errno)) {
+    return 1;
+  }
+
+  for (size_t directory_index = 0;
+       directory_index < (sizeof(DIRECTORIES) / sizeof(*DIRECTORIES));
+       ++directory_index) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", gimli_directory_get(),
+             DIRECTORIES[directory_index]);
+
+    if ((0 != mkdir(path, 0755)) && (EEXIST != errno)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int reap_staging_directories(Loader *self) {
+  int ret = 1;
+
+  // Every load holds the overlay directory's lock shared while it runs, and a
+  // load that finds no other one running first removes the staging
+  // directories, which were then left behind by loads that crashed.
+  if (0 != flock(self->overlay_directory_fd, LOCK_EX | LOCK_NB)) {
+    if (EWOULDBLOCK != errno) {
+      goto out;
+    }
+
+    goto out_lock_shared;
+  }
+
+  // The directory is listed through a descriptor of its own, as the directory
+  // stream takes ownership of it.
+  int directory_fd = openat(self->overlay_directory_fd, ".",
+                            O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (-1 == directory_fd) {
+    goto out;
+  }
+
+  DIR *directory = fdopendir(directory_fd);
+  if (NULL == directory) {
+    close(directory_fd);
+    goto out;
+  }
+
+  char **names;
+  size_t names_size;
+  int result = io_read_directory_names(directory, DT_DIR, &names, &names_size);
+  closedir(directory);
+  if (0 != result) {
+    goto out;
+  }
+
+  for (size_t name_index = 0; name_index < names_size; ++name_index) {
+    if (0 == strncmp(names[name_index], LOAD_STAGING_PREFIX,
+                     strlen(LOAD_STAGING_PREFIX))) {
+      io_remove_tree_at(self->overlay_directory_fd, names[name_index]);
+    }
+  }
+
+  io_free_directory_names(names, names_size);
+
+out_lock_shared:
+  // Converting the lock may block while another load reaps.
+  if (0 != flock(self->overlay_directory_fd, LOCK_SH)) {
+    goto out;
+  }
+
+  ret = 0;
+
+out:
+  return ret;
+}
+
+static int open_store(Loader *self) {
+  if (0 != create_store_directories()) {
+    return 1;
+  }
+
+  self->overlay_directory_fd = gimli_directory_open(LOAD_OVERLAY_DIRECTORY);
+  self->layerdb_directory_fd = gimli_directory_open(LOAD_LAYERDB_DIRECTORY);
+  self->layer_store_directory_fd =
+      gimli_directory_open(LOAD_LAYER_STORE_DIRECTORY);
+  if ((-1 == self->overlay_directory_fd) ||
+      (-1 == self->layerdb_directory_fd) ||
+      (-1 == self->layer_store_directory_fd)) {
+    return 1;
+  }
+
+  if (0 != reap_staging_directories(self)) {
+    return 1;
+  }
+
+  // Read every layer, so that layers are found by their diff IDs whatever
+  // images they belong to.
+  return layer_store_init(&self->layer_store, LAYER_STORE_MODE_EAGER);
+}
+
+static void close_store(Loader *self) {
+  if (-1 != self->layer_store_directory_fd) {
+    close(self->layer_store_directory_fd);
+  }
+
+  if (-1 != self->layerdb_directory_fd) {
+    close(self->layerdb_directory_fd);
+  }
+
+  if (-1 != self->overlay_directory_fd) {
+    close(self->overlay_directory_fd);
+  }
+}
+
+static void free_blobs(Loader *self) {
+  for (size_t blob_index = 0; blob_index < arrlenu(self->all_blobs);
+       ++blob_index) {
+    LoadBlob *blob = self->all_blobs[blob_index];
+
+    // Remove the layers that were extracted but not committed (for example,
+    // layers that turned out to be in the store already).
+    if (blob->is_extracted && !blob->is_committed) {
+      char staging_name[sizeof(LOAD_STAGING_PREFIX) + SHA256_HEX_DIGEST_SIZE];
+      snprintf(staging_name, sizeof(staging_name), LOAD_STAGING_PREFIX "%s",
+               blob->cache_id);
+      io_remove_tree_at(self->overlay_directory_fd, staging_name);
+    }
+
+    free_blob(blob);
+  }
+
+  arrfree(self->all_blobs);
+  shfree(self->blobs);
+}
+
+int load_images(int input_fd, size_t threads_size, LoadSummary *out_summary) {
+  int ret = 1;
+
+  int load_errno = 0;
+  memset(out_summary, 0, sizeof(*out_summary));
+
+  Loader self = {
+      .input_fd = input_fd,
+      .input = NULL,
+      .input_size = 0,
+      .input_offset = 0,
+      .buffer = NULL,
+      .overlay_directory_fd = -1,
+      .layerdb_directory_fd = -1,
+      .layer_store_directory_fd = -1,
+      .blobs = NULL,
+      .all_blobs = NULL,
+      .queue_head = NULL,
+      .queue_tail = NULL,
+      .is_queue_closed = 0,
+      .read_error = 0,
+      .summary = out_summary,
+  };
+
+  digest_table_init(&self.diff_id_to_blob);
+  sh_new_arena(self.blobs);
+  pthread_mutex_init(&self.mutex, NULL);
+  pthread_cond_init(&self.condition, NULL);
+
+  if (0 != open_store(&self)) {
+    close_store(&self);
+    goto out;
+  }
+
+  // Map an archive that is a file, so that its layers are extracted from the
+  // page cache without being copied, and only the ones that are missing from
+  // the store are read.
+  struct stat stat_buffer;
+  if (0 != fstat(input_fd, &stat_buffer)) {
+    goto out_destroy_layer_store;
+  }
+
+  void *mapping = NULL;
+  if (S_ISREG(stat_buffer.st_mode) && (0 < stat_buffer.st_size)) {
+    self.input_size = (size_t)stat_buffer.st_size;
+    mapping = mmap(NULL, self.input_size, PROT_READ, MAP_SHARED, input_fd, 0);
+    if (MAP_FAILED == mapping) {
+      goto out_destroy_layer_store;
+    }
+
+    self.input = mapping;
+  } else {
+    self.buffer = malloc(LOAD_BUFFER_SIZE);
+    if (NULL == self.buffer) {
+      goto out_destroy_layer_store;
+    }
+  }
+
+  // Files are created with the modes of their entries.
+  mode_t umask_mode = umask(0);
+
+  // Read the archive on one thread while the layers are extracted on the
+  // others.
+  if (0 != parallel_run(threads_size + 1, threads_size + 1, run_task,
+                        &self)) {
+    errno = self.read_error;
+    goto out_restore_umask;
+  }
+
+  if (0 != commit_images(&self)) {
+    goto out_restore_umask;
+  }
+
+  ret = 0;
+
+out_restore_umask:
+  // Preserve the error while the load is cleaned up.
+  load_errno = errno;
+  umask(umask_mode);
+
+  free_blobs(&self);
+
+  if (NULL != mapping) {
+    munmap(mapping, self.input_size);
+  }
+
+  free(self.buffer);
+  errno = load_errno;
+
+out_destroy_layer_store:
+  layer_store_destroy(&self.layer_store);
+  close_store(&self);
+
+out:
+  pthread_cond_destroy(&self.condition);
+  pthread_mutex_destroy(&self.mutex);
+  digest_table_destroy(&self.diff_id_to_blob);
+
+  return ret;
+}
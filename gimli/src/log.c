@@ -0,0 +1,278 @@
+#define _GNU_SOURCE
+
+#include "gimli/log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_SUFFIX ".log"
+
+// The suffix of the previous log, which a log is renamed to when it is
+// rotated.
+#define LOG_ROTATED_SUFFIX ".1"
+
+// The size that a log's pipe is grown to, so that bursts of output are taken
+// in without waking gimli for every page.
+#define LOG_PIPE_SIZE (1024 * 1024)
+
+// The longest header of a timestamped frame, which is
+// "<seconds>.<nanoseconds> <size>\n".
+#define LOG_FRAME_HEADER_MAX_SIZE 48
+
+static int open_file(Log *self) {
+  self->file_size = 0;
+  self->file_fd =
+      open(self->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+  return (-1 == self->file_fd) ? 1 : 0;
+}
+
+static int rotate_file(Log *self) {
+  // The previous log is replaced, so that a log takes up at most twice its
+  // size.
+  char rotated_path[PATH_MAX + sizeof(LOG_ROTATED_SUFFIX)];
+  snprintf(rotated_path, sizeof(rotated_path), "%s" LOG_ROTATED_SUFFIX,
+           self->path);
+
+  close(self->file_fd);
+  self->file_fd = -1;
+
+  // The previous log is removed before it is replaced, as file systems such
+  // as ext4 flush a file that replaces another one on rename, which would
+  // stall the log on the disk.
+  if (((0 != unlink(rotated_path)) && (ENOENT != errno)) ||
+      (0 != rename(self->path, rotated_path))) {
+    return 1;
+  }
+
+  return open_file(self);
+}
+
+static int write_frame_header(Log *self, size_t size) {
+  struct timespec time;
+  clock_gettime(CLOCK_REALTIME, &time);
+
+  char header[LOG_FRAME_HEADER_MAX_SIZE];
+  int header_size = snprintf(header, sizeof(header), "%lld.%09ld %zu\n",
+                             (long long)time.tv_sec, time.tv_nsec, size);
+
+  if ((ssize_t)header_size !=
+      write(self->file_fd, header, (size_t)header_size)) {
+    return 1;
+  }
+
+  self->file_size += (size_t)header_size;
+
+  return 0;
+}
+
+static int move_to_file(Log *self, size_t size) {
+  // The output is moved from the pipe to the file in the kernel, without
+  // being copied through gimli.
+  while (0 < size) {
+    ssize_t moved_size = splice(self->pipe_fd, NULL, self->file_fd, NULL, size,
+                                SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (-1 == moved_size) {
+      if (EINTR == errno) {
+        continue;
+      }
+
+      return 1;
+    }
+
+    // The pipe holds the output, so nothing being moved means that the file
+    // cannot take it.
+    if (0 == moved_size) {
+      errno = EIO;
+      return 1;
+    }
+
+    size -= (size_t)moved_size;
+    self->file_size += (size_t)moved_size;
+  }
+
+  return 0;
+}
+
+static void drop(Log *self, size_t size) {
+  if (-1 == self->null_fd) {
+    self->null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  }
+
+  while (0 < size) {
+    ssize_t dropped_size =
+        (-1 == self->null_fd)
+            ? -1
+            : splice(self->pipe_fd, NULL, self->null_fd, NULL, size,
+                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+    // Read the output away if it cannot be moved.
+    if (0 >= dropped_size) {
+      char buffer[4096];
+      dropped_size = read(self->pipe_fd, buffer,
+                          (size < sizeof(buffer)) ? size : sizeof(buffer));
+      if (0 >= dropped_size) {
+        return;
+      }
+    }
+
+    size -= (size_t)dropped_size;
+    self->dropped_size += (size_t)dropped_size;
+  }
+}
+
+int log_open(Log *self, const LogConfiguration *configuration,
+             const char *name, int *out_write_fd) {
+  int ret = 1;
+
+  self->configuration = configuration;
+  self->null_fd = -1;
+  self->dropped_size = 0;
+  self->error = 0;
+  self->is_closed = 0;
+
+  if ((0 != mkdir(configuration->directory, 0755)) && (EEXIST != errno)) {
+    goto out;
+  }
+
+  snprintf(self->path, sizeof(self->path), "%s/%s" LOG_SUFFIX,
+           configuration->directory, name);
+
+  if (0 != open_file(self)) {
+    goto out;
+  }
+
+  int pipe_fds[2];
+  if (0 != pipe2(pipe_fds, O_CLOEXEC)) {
+    goto out_close_file;
+  }
+
+  // Growing the pipe fails past the system's limit for unprivileged users, in
+  // which case it is kept at its size.
+  fcntl(pipe_fds[0], F_SETPIPE_SZ, LOG_PIPE_SIZE);
+
+  int pipe_size = fcntl(pipe_fds[0], F_GETPIPE_SZ);
+  if (-1 == pipe_size) {
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    goto out_close_file;
+  }
+
+  self->pipe_fd = pipe_fds[0];
+  self->pipe_size = (size_t)pipe_size;
+  *out_write_fd = pipe_fds[1];
+
+  ret = 0;
+  goto out;
+
+out_close_file:
+  close(self->file_fd);
+
+out:
+  return ret;
+}
+
+void log_pump(Log *self) {
+  const LogConfiguration *configuration = self->configuration;
+
+  // Move at most a pipe's worth of output at a time, so that a container that
+  // keeps writing does not keep gimli from everything else.
+  for (size_t pumped_size = 0; pumped_size < self->pipe_size;) {
+    int available_size;
+    if (0 != ioctl(self->pipe_fd, FIONREAD, &available_size)) {
+      self->is_closed = 1;
+      return;
+    }
+
+    // The pipe is only ready with no output once it has been closed by every
+    // process that wrote to it.
+    if (0 == available_size) {
+      self->is_closed = 0 == pumped_size;
+      return;
+    }
+
+    size_t size = (size_t)available_size;
+
+    // Drop the output once the log has failed, or in non-blocking mode once
+    // the pipe is three quarters full, as the container is about to wait for
+    // the log to catch up.
+    if ((0 != self->error) || (configuration->is_non_blocking &&
+                               (size >= ((self->pipe_size / 4) * 3)))) {
+      drop(self, size);
+      pumped_size += size;
+      continue;
+    }
+
+    // Keep each file within its size, even when the size is smaller than the
+    // output at hand.
+    size_t frame_header_size =
+        configuration->is_timestamped ? LOG_FRAME_HEADER_MAX_SIZE : 0;
+    size_t frame_size_max = (configuration->size > frame_header_size)
+                                ? (configuration->size - frame_header_size)
+                                : 1;
+    if (size > frame_size_max) {
+      size = frame_size_max;
+    }
+
+    pumped_size += size;
+
+    size_t frame_size = frame_header_size + size;
+    if ((0 != self->file_size) &&
+        ((self->file_size + frame_size) > configuration->size) &&
+        (0 != rotate_file(self))) {
+      self->error = errno;
+      continue;
+    }
+
+    // Frame the output with the time it was logged at, once for all the
+    // output at hand instead of for every line.
+    if (configuration->is_timestamped &&
+        (0 != write_frame_header(self, size))) {
+      self->error = errno;
+      continue;
+    }
+
+    if (0 != move_to_file(self, size)) {
+      self->error = errno;
+    }
+  }
+}
+
+void log_drain(Log *self) {
+  // The output ends once every process that writes to it has exited, which
+  // they all have once the container's init has exited.
+  while (!self->is_closed) {
+    struct pollfd poll_fd = {.fd = self->pipe_fd, .events = POLLIN,
+                             .revents = 0};
+    if (-1 == poll(&poll_fd, 1, -1)) {
+      if (EINTR == errno) {
+        continue;
+      }
+
+      return;
+    }
+
+    log_pump(self);
+  }
+}
+
+void log_close(Log *self) {
+  close(self->pipe_fd);
+
+  if (-1 != self->file_fd) {
+    close(self->file_fd);
+  }
+
+  if (-1 != self->null_fd) {
+    close(self->null_fd);
+  }
+}
@@ -1,327 +1,272 @@
 #define _GNU_SOURCE
 
 #include <errno.h>
-#include <libgen.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <limits.h>
-#include <sched.h>
-#include <signal.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/mount.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
-#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "gimli/batch.h"
+#include "gimli/cgroup.h"
 #include "gimli/cli.h"
-#include "gimli/gimli_directory.h"
+#include "gimli/container.h"
+#include "gimli/dedupe.h"
 #include "gimli/image.h"
 #include "gimli/image_store.h"
-#include "gimli/io.h"
 #include "gimli/layer_store.h"
+#include "gimli/load.h"
+#include "gimli/log.h"
+#include "gimli/metadata_index.h"
+#include "gimli/metadata_index_builder.h"
+#include "gimli/netns.h"
+#include "gimli/parallel.h"
+#include "gimli/pool.h"
+#include "gimli/shared_root.h"
+#include "gimli/snapshot.h"
+#include "gimli/spawn.h"
+#include "gimli/stats.h"
+#include "gimli/trace.h"
 #include "gimli/uuid.h"
-#include "stb_ds/stb_ds.h"
-
-typedef struct ContainerConfiguration {
-  Image *image;
-  char *directory;
-  char *root_fs_directory;
-  char *hostname;
-  char **command;
-  LayerStore *layer_store;
-} ContainerConfiguration;
-
-static const size_t CLONE_STACK_SIZE = 1024 * 1024;
-
-static const char *LOWERDIR_MOUNT_DATA_PREFIX = "lowerdir=";
-static const char *UPPERDIR_MOUNT_DATA_PREFIX = "upperdir=";
-static const char *WORKDIR_MOUNT_DATA_PREFIX = "workdir=";
-
-static int setup_image_overlayfs(const Image *image, const char *directory,
-                                 const char *merged_directory,
-                                 LayerStore *layer_store) {
-  int ret = 1;
 
-  // Create the upperdir.
-  char upperdir[PATH_MAX];
-  snprintf(upperdir, sizeof(upperdir), "%s/diff", directory);
-  if (0 != mkdir(upperdir, 0755)) {
-    goto out;
+static int serve_pool(const Cli *cli, ImageStore *image_store,
+                      LayerStore *layer_store) {
+  char socket_path[PATH_MAX];
+  if (NULL == cli->pool_socket_path) {
+    pool_format_default_socket_path(socket_path, sizeof(socket_path));
+  } else {
+    snprintf(socket_path, sizeof(socket_path), "%s", cli->pool_socket_path);
   }
 
-  // Create the workdir.
-  char workdir[PATH_MAX];
-  snprintf(workdir, sizeof(workdir), "%s/work", directory);
-  if (0 != mkdir(workdir, 0755)) {
-    goto out;
-  }
-
-  // Prepare the mount data.
-  // The lowerdir data is formatted as follows:
-  // lowerdir=<directory-path>:<directory-path>:...
-  // `layers_size - 1` is the number of ':' characters that need to be
-  // appended.
-  size_t lowerdir_mount_data_prefix_size = strlen(LOWERDIR_MOUNT_DATA_PREFIX);
-  size_t lowerdir_mount_data_size =
-      lowerdir_mount_data_prefix_size + image->layers_size - 1;
-  for (size_t layer_index = 0; layer_index < image->layers_size;
-       ++layer_index) {
-    Layer *layer = layer_store_get_layer_by_diff_id(layer_store,
-                                                    image->layers[layer_index]);
-    if (NULL == layer) {
-      goto out;
-    }
+  printf("=> serving pool [%s]... \n", socket_path);
 
-    lowerdir_mount_data_size += strlen(layer->link_path);
+  if (0 != pool_serve(image_store, layer_store,
+                      (const char *const *)cli->images, cli->images_size,
+                      cli->pool_size, socket_path)) {
+    printf("=> pool failed, error(%d): [%s]\n", errno, strerror(errno));
+    return 1;
   }
 
-  // The upperdir data if formatted as follows:
-  // upperdir=<directory-path>
-  size_t upperdir_mount_data_prefix_size = strlen(UPPERDIR_MOUNT_DATA_PREFIX);
-  size_t upperdir_size = strlen(upperdir);
-  size_t upperdir_mount_data_size =
-      upperdir_mount_data_prefix_size + upperdir_size;
-
-  // The workdir data if formatted as follows:
-  // workdir=<directory-path>
-  size_t workdir_mount_data_prefix_size = strlen(WORKDIR_MOUNT_DATA_PREFIX);
-  size_t workdir_size = strlen(workdir);
-  size_t workdir_mount_data_size =
-      workdir_mount_data_prefix_size + workdir_size;
+  printf("=> pool stopped\n");
 
-  // Calculate the overall size of the mount data.
-  // Add 2 extra bytes for the commas between the mount data parts and an extra
-  // byte for the null terminator at the end of the mount data.
-  size_t mount_data_size = lowerdir_mount_data_size + upperdir_mount_data_size +
-                           workdir_mount_data_size + 3;
-
-  // Allocate the mount data string.
-  char *mount_data = malloc(mount_data_size);
-  if (NULL == mount_data) {
-    goto out;
-  }
+  return 0;
+}
 
-  // Format the lowerdir mount data.
-  char *cursor = mount_data;
+static uint64_t get_monotonic_time(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
 
-  memcpy(cursor, LOWERDIR_MOUNT_DATA_PREFIX, lowerdir_mount_data_prefix_size);
-  cursor += lowerdir_mount_data_prefix_size;
+  return ((uint64_t)time.tv_sec * 1000 * 1000 * 1000) + (uint64_t)time.tv_nsec;
+}
 
-  // Format the layers in reverse order at the left-most lowerdir in the overlay
-  // data is the top-most layer, and the right-most is the bottom-most.
-  for (size_t layer_index = image->layers_size; layer_index > 0;
-       --layer_index) {
-    Layer *layer = layer_store_get_layer_by_diff_id(
-        layer_store, image->layers[layer_index - 1]);
+static size_t get_processors_size(void) {
+  // A batch runs a job per processor by default, unlike the loads' threads,
+  // which are limited.
+  long processors_size = sysconf(_SC_NPROCESSORS_ONLN);
 
-    const char *link_path = layer->link_path;
-    size_t link_path_size = strlen(link_path);
+  return (1 > processors_size) ? 1 : (size_t)processors_size;
+}
 
-    memcpy(cursor, layer->link_path, link_path_size);
-    cursor += link_path_size;
+static int run_batch(const Cli *cli, ImageStore *image_store,
+                     LayerStore *layer_store, FILE *stats_file) {
+  int ret = 1;
 
-    if (0 != (layer_index - 1)) {
-      *cursor = ':';
-      ++cursor;
+  // Read the jobs from the standard input, unless a job file is given.
+  int input_fd = STDIN_FILENO;
+  if (NULL != cli->batch_path) {
+    input_fd = open(cli->batch_path, O_RDONLY | O_CLOEXEC);
+    if (-1 == input_fd) {
+      printf("=> failed opening jobs [%s], error(%d): [%s]\n", cli->batch_path,
+             errno, strerror(errno));
+      goto out;
     }
   }
 
-  *cursor = ',';
-  ++cursor;
-
-  // Format the upperdir mount data.
-  memcpy(cursor, UPPERDIR_MOUNT_DATA_PREFIX, upperdir_mount_data_prefix_size);
-  cursor += upperdir_mount_data_prefix_size;
-
-  memcpy(cursor, upperdir, upperdir_size);
-  cursor += upperdir_size;
-
-  *cursor = ',';
-  ++cursor;
-
-  // Format the workdir mount data.
-  memcpy(cursor, WORKDIR_MOUNT_DATA_PREFIX, workdir_mount_data_prefix_size);
-  cursor += workdir_mount_data_prefix_size;
-
-  memcpy(cursor, workdir, workdir_size);
-  cursor += workdir_size;
+  BatchConfiguration batch_configuration = {
+      .concurrency = (0 == cli->batch_jobs_size) ? get_processors_size()
+                                                 : cli->batch_jobs_size,
+      .timeout = cli->timeout,
+      .is_read_only = cli->is_read_only,
+      .ephemeral_size = cli->ephemeral_size,
+      .cgroup_limits = &cli->cgroup_limits,
+      .log_configuration = (NULL == cli->log_configuration.directory)
+                               ? NULL
+                               : &cli->log_configuration,
+      .stats_file = stats_file,
+  };
 
-  // Add a null terminator to the end of the mount data.
-  *cursor = '\0';
+  printf("=> running batch, (%zu) jobs at once\n",
+         batch_configuration.concurrency);
 
-  // Perform the overlayfs mount.
-  if (0 != mount("overlay", merged_directory, "overlay", 0, mount_data)) {
-    goto out_free_mount_data;
+  size_t failed_size;
+  if (0 != batch_run(image_store, layer_store, input_fd, &batch_configuration,
+                     &failed_size)) {
+    printf("=> batch failed, error(%d): [%s]\n", errno, strerror(errno));
+    goto out_close_input_fd;
   }
 
-  ret = 0;
+  ret = (0 == failed_size) ? 0 : 1;
 
-out_free_mount_data:
-  free(mount_data);
+out_close_input_fd:
+  if (STDIN_FILENO != input_fd) {
+    close(input_fd);
+  }
 
 out:
   return ret;
 }
 
-#if 0
-static int filter_syscalls() {
-  scmp_filter_ctx ctx = NULL;
-  fprintf(stderr, "=> filtering syscalls...");
-  if (!(ctx = seccomp_init(SCMP_ACT_ALLOW)) ||
-      seccomp_rule_add(ctx, SCMP_FAIL, SCMP_SYS(chmod), 1,
-                       SCMP_A1(SCMP_CMP_MASKED_EQ, S_ISUID, S_ISUID)) ||
-      seccomp_rule_add(ctx, SCMP_FAIL, SCMP_SYS(chmod), 1,
-                       SCMP_A1(SCMP_CMP_MASKED_EQ, S_ISGID, S_ISGID)) ||
-      seccomp_rule_add(ctx, SCMP_FAIL, SCMP_SYS(fchmod), 1,
-                       SCMP_A1(SCMP_CMP_MASKED_EQ, S_ISUID, S_ISUID)) ||
-      seccomp_rule_add(ctx, SCMP_FAIL, SCMP_SYS(fchmod), 1,
-                       SCMP_A1(SCMP_CMP_MASKED_EQ, S_ISGID, S_ISGID)) ||
-      seccomp_rule_add(ctx, SCMP_FAIL, SCMP_SYS(fchmodat), 1,
-                       SCMP_A2(SCMP_CMP_MASKED_EQ, S_ISUID, S_ISUID)) ||
-      seccomp_rule_add(ctx, SCMP_FAIL, SCMP_SYS(fchmodat), 1,
-                       SCMP_A2(SCMP_CMP_MASKED_EQ, S_ISGID, S_ISGID)) ||
-      seccomp_rule_add(
-          ctx, SCMP_FAIL, SCMP_SYS(unshare), 1,
-          SCMP_A0(SCMP_CMP_MASKED_EQ, CLONE_NEWUSER, CLONE_NEWUSER)) ||
-      seccomp_rule_add(
-          ctx, SCMP_FAIL, SCMP_SYS(clone), 1,
-          SCMP_A0(SCMP_CMP_MASKED_EQ, CLONE_NEWUSER, CLONE_NEWUSER)) ||
-      seccomp_rule_add(ctx, SCMP_FAIL, SCMP_SYS(ioctl), 1,
-                       SCMP_A1(SCMP_CMP_MASKED_EQ, TIOCSTI, TIOCSTI)) ||
-      seccomp_rule_add(ctx, SCMP_FAIL, SCMP_SYS(keyctl), 0) ||
-      seccomp_rule_add(ctx, SCMP_FAIL, SCMP_SYS(add_key), 0) ||
-      seccomp_rule_add(ctx, SCMP_FAIL, SCMP_SYS(request_key), 0) ||
-      seccomp_rule_add(ctx, SCMP_FAIL, SCMP_SYS(ptrace), 0) ||
-      seccomp_rule_add(ctx, SCMP_FAIL, SCMP_SYS(mbind), 0) ||
-      seccomp_rule_add(ctx, SCMP_FAIL, SCMP_SYS(migrate_pages), 0) ||
-      seccomp_rule_add(ctx, SCMP_FAIL, SCMP_SYS(move_pages), 0) ||
-      seccomp_rule_add(ctx, SCMP_FAIL, SCMP_SYS(set_mempolicy), 0) ||
-      seccomp_rule_add(ctx, SCMP_FAIL, SCMP_SYS(userfaultfd), 0) ||
-      seccomp_rule_add(ctx, SCMP_FAIL, SCMP_SYS(perf_event_open), 0) ||
-      seccomp_attr_set(ctx, SCMP_FLTATR_CTL_NNP, 0) || seccomp_load(ctx)) {
-    if (ctx) seccomp_release(ctx);
-    fprintf(stderr, "failed: %m\n");
-    return 1;
-  }
-  seccomp_release(ctx);
-  fprintf(stderr, "done.\n");
-  return 0;
-}
-#endif
+static int create_snapshots(const Cli *cli, ImageStore *image_store,
+                            LayerStore *layer_store) {
+  for (size_t image_index = 0; image_index < cli->images_size; ++image_index) {
+    const char *image_name = cli->images[image_index];
 
-static int mount_container_image(const Image *image, const char *directory,
-                                 const char *root_fs_directory,
-                                 LayerStore *layer_store) {
-  // Remount everything as private.
-  if (0 != mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL)) {
-    return 1;
-  }
+    printf("=> creating snapshot of image [%s]... ", image_name);
 
-  // Create the merged directory.
-  if (0 != mkdir(root_fs_directory, 0755)) {
-    return 1;
-  }
+    Image *image = image_store_get_image_by_name(image_store, image_name);
+    if (NULL == image) {
+      printf("failed, no such image\n");
+      return 1;
+    }
 
-  // Setup the image overlayfs.
-  if (0 !=
-      setup_image_overlayfs(image, directory, root_fs_directory, layer_store)) {
-    return 1;
-  }
+    if (0 != layer_store_load_image_layers(layer_store, image)) {
+      printf("failed, error(%d): [%s]\n", errno, strerror(errno));
+      return 1;
+    }
 
-  // Create a temporary directory to move the old root directory to.
-  char old_root_fs_directory[PATH_MAX];
-  snprintf(old_root_fs_directory, sizeof(old_root_fs_directory), "%s/old_root",
-           root_fs_directory);
+    uint64_t trace_start = trace_begin();
 
-  if (0 != mkdir(old_root_fs_directory, 0755)) {
-    return 1;
-  }
+    int is_created;
+    if (0 != snapshot_create(image, layer_store, &is_created)) {
+      printf("failed, error(%d): [%s]\n", errno, strerror(errno));
+      return 1;
+    }
 
-  // Pivot to the merged directory.
-  if (0 != syscall(SYS_pivot_root, root_fs_directory, old_root_fs_directory)) {
-    return 1;
-  }
+    trace_end("create snapshot", trace_start);
 
-  // Change directory to the newly pivoted root directory,
-  if (0 != chdir("/")) {
-    return 1;
+    printf("%s\n", is_created ? "done" : "exists");
   }
 
-  // Unmount the old root directory.
-  // The basename of the old root directory is retrieved here, as the root
-  // directory has been pivoted.
-  char *old_root_fs_directory_name = basename(old_root_fs_directory);
-  if (0 != umount2(old_root_fs_directory_name, MNT_DETACH)) {
-    return 1;
-  }
+  return 0;
+}
 
-  // Remove the old root directory.
-  if (0 != rmdir(old_root_fs_directory_name)) {
-    return 1;
-  }
+static int fill_netns_pool(const Cli *cli) {
+  printf("=> filling network namespace pool to (%zu)... ", cli->netns_size);
 
-  // Mount `/proc`.
-  if (0 != mount("proc", "/proc", "proc", 0, NULL)) {
+  uint64_t trace_start = trace_begin();
+
+  size_t created_size;
+  if (0 != netns_fill(cli->netns_size, &created_size)) {
+    printf("failed, error(%d): [%s]\n", errno, strerror(errno));
     return 1;
   }
 
+  trace_end("fill network namespace pool", trace_start);
+
+  printf("created (%zu)... done\n", created_size);
+
   return 0;
 }
 
-static int child(void *argument) {
-  ContainerConfiguration *container_configuration = argument;
+static int load(const Cli *cli) {
+  int ret = 1;
+
+  // Read the archive from the standard input, unless a file is given.
+  int input_fd = STDIN_FILENO;
+  if (NULL != cli->load_path) {
+    input_fd = open(cli->load_path, O_RDONLY | O_CLOEXEC);
+    if (-1 == input_fd) {
+      printf("=> failed opening archive [%s], error(%d): [%s]\n",
+             cli->load_path, errno, strerror(errno));
+      goto out;
+    }
+  }
+
+  printf("=> loading images from [%s]... ",
+         (NULL == cli->load_path) ? "stdin" : cli->load_path);
+  fflush(stdout);
 
-  // Set the container hostname.
-  printf("=> setting container hostname... ");
+  uint64_t trace_start = trace_begin();
 
-  if (-1 == sethostname(container_configuration->hostname,
-                        strlen(container_configuration->hostname))) {
+  LoadSummary summary;
+  if (0 != load_images(input_fd,
+                       (0 == cli->load_jobs_size) ? parallel_get_threads_size()
+                                                  : cli->load_jobs_size,
+                       &summary)) {
     printf("failed, error(%d): [%s]\n", errno, strerror(errno));
-    return 1;
+    goto out_close_input_fd;
   }
 
+  trace_end("load images", trace_start);
+
   printf("done\n");
+  printf("=> loaded (%zu) images, tagged (%zu), extracted (%zu) layers "
+         "(%" PRIu64 " bytes), skipped (%zu)\n",
+         summary.images_size, summary.tags_size,
+         summary.extracted_layers_size, summary.extracted_size,
+         summary.skipped_layers_size);
 
-  // Mount the image.
-  printf("=> mounting container image... ");
+  ret = 0;
 
-  if (0 != mount_container_image(container_configuration->image,
-                                 container_configuration->directory,
-                                 container_configuration->root_fs_directory,
-                                 container_configuration->layer_store)) {
-    printf("failed, error(%d): [%s]\n", errno, strerror(errno));
-    return 1;
+out_close_input_fd:
+  if (STDIN_FILENO != input_fd) {
+    close(input_fd);
   }
 
-  printf("done\n");
+out:
+  return ret;
+}
 
-  // Drop capabilities.
-  printf("=> filtering syscalls... ");
+static int dedupe(const Cli *cli) {
+  printf("=> deduplicating layer files... ");
+  fflush(stdout);
 
-#if 0
-  if (0 != filter_syscalls()) {
+  uint64_t trace_start = trace_begin();
+
+  DedupeSummary summary;
+  if (0 != dedupe_run((0 == cli->dedupe_jobs_size) ? parallel_get_threads_size()
+                                                   : cli->dedupe_jobs_size,
+                      &summary)) {
     printf("failed, error(%d): [%s]\n", errno, strerror(errno));
     return 1;
   }
-#endif
+
+  trace_end("dedupe layers", trace_start);
 
   printf("done\n");
+  printf("=> scanned (%zu) of (%zu) layers, hashed (%zu) of (%zu) files\n",
+         summary.scanned_layers_size, summary.layers_size,
+         summary.hashed_files_size, summary.files_size);
+  printf("=> linked (%zu) files, reflinked (%zu), failed (%zu), saved "
+         "(%" PRIu64 " bytes)\n",
+         summary.linked_files_size, summary.cloned_files_size,
+         summary.failed_files_size, summary.saved_size);
 
-  // Execute the user command.
-  execve(container_configuration->command[0], container_configuration->command,
-         NULL);
+  return 0;
+}
 
-  // If this line is reached, it means that `execve` failed.
-  // Exit with failure.
-  printf("failed executing user command, error(%d): [%s]\n", errno,
-         strerror(errno));
+static int open_metadata_index(MetadataIndex *metadata_index) {
+  // Use the existing index if it is up to date.
+  if (0 == metadata_index_open(metadata_index)) {
+    return 0;
+  }
 
-  return 1;
+  // The index is either missing or stale, so rebuild it from the image and
+  // layer stores.
+  if (0 != metadata_index_rebuild()) {
+    return 1;
+  }
+
+  return metadata_index_open(metadata_index);
 }
 
 int main(int argc, const char *const argv[]) {
@@ -337,38 +282,178 @@ int main(int argc, const char *const argv[]) {
     goto out;
   }
 
-  // Initialize the layer store.
-  printf("=> initializing layer store... ");
+  // Enable tracing if it is requested.
+  // The spans are also recorded for the stats, which include the duration of
+  // each launch phase.
+  if (0 != trace_init(cli.trace_path, cli.trace_format,
+                      NULL != cli.stats_path)) {
+    printf("failed enabling tracing, error(%d): [%s]\n", errno,
+           strerror(errno));
+    goto out_destroy_cli;
+  }
 
-  LayerStore layer_store;
-  if (0 != layer_store_init(&layer_store)) {
-    printf("failed, error(%d): [%s]\n", errno, strerror(errno));
+  // Open the file that the containers' resource usage is recorded to, if it
+  // is requested.
+  FILE *stats_file = NULL;
+  if ((NULL != cli.stats_path) &&
+      (NULL == (stats_file = stats_open(cli.stats_path)))) {
+    printf("failed opening stats [%s], error(%d): [%s]\n", cli.stats_path,
+           errno, strerror(errno));
     goto out_destroy_cli;
   }
 
-  printf("done\n");
+  uint64_t launch_trace_start = trace_begin();
+
+  // Fill the pool of network namespaces, which needs none of the stores.
+  if (CLI_SUBCOMMAND_NETNS == cli.subcommand) {
+    ret = fill_netns_pool(&cli);
+    goto out_write_trace;
+  }
+
+  // Load images into the stores, which are opened afterwards.
+  if (CLI_SUBCOMMAND_LOAD == cli.subcommand) {
+    ret = load(&cli);
+    goto out_write_trace;
+  }
+
+  // Deduplicate the layers' files, which needs none of the stores.
+  if (CLI_SUBCOMMAND_DEDUPE == cli.subcommand) {
+    ret = dedupe(&cli);
+    goto out_write_trace;
+  }
+
+  // Run the command in a container from a pool, if one is given.
+  // The container is launched here instead if the pool cannot take the
+  // command (for example, when it is not running or has no containers for
+  // the image).
+  if ((CLI_SUBCOMMAND_RUN == cli.subcommand) &&
+      (NULL != cli.pool_socket_path)) {
+    printf("=> running in pool [%s]\n", cli.pool_socket_path);
+
+    uint64_t pool_trace_start = trace_begin();
+
+    int exit_code;
+    int is_dispatched;
+    int pool_result = pool_run(cli.pool_socket_path, cli.image,
+                               (const char *const *)cli.command,
+                               cli.command_size, &exit_code, &is_dispatched);
+    trace_end("run in pool", pool_trace_start);
+
+    if (0 == pool_result) {
+      printf("=> container process exited with code (%d)\n", exit_code);
+      ret = exit_code;
+      goto out_write_trace;
+    }
+
+    if (is_dispatched) {
+      printf("=> failed waiting for the pool, error(%d): [%s]\n", errno,
+             strerror(errno));
+      goto out_write_trace;
+    }
+
+    printf("=> pool unavailable, error(%d): [%s]\n", errno, strerror(errno));
+  }
+
+  // Open the metadata index.
+  // The stores fall back to reading the image and layer stores directly when
+  // the index is unavailable (for example, when it cannot be written).
+  printf("=> opening metadata index... ");
+
+  uint64_t trace_start = trace_begin();
+
+  MetadataIndex metadata_index;
+  int has_metadata_index = 0 == open_metadata_index(&metadata_index);
+  trace_end("open metadata index", trace_start);
+  if (has_metadata_index) {
+    printf("done\n");
+  } else {
+    printf("unavailable, error(%d): [%s]\n", errno, strerror(errno));
+  }
 
   // Initialize the image store.
   printf("=> initializing image store... ");
 
+  trace_start = trace_begin();
+
   ImageStore image_store;
-  if (0 != image_store_init(&image_store)) {
+  int image_store_result =
+      has_metadata_index
+          ? image_store_init_from_index(&image_store, &metadata_index)
+          : image_store_init(&image_store, IMAGE_STORE_MODE_LAZY);
+  if (0 != image_store_result) {
     printf("failed, error(%d): [%s]\n", errno, strerror(errno));
-    goto out_destroy_layer_store;
+    goto out_close_metadata_index;
   }
 
+  trace_end("initialize image store", trace_start);
+
   printf("done\n");
 
-  // Locate the container image by its repository.
-  printf("=> locating image for repository [%s]... ", cli.image);
+  // Initialize the layer store.
+  printf("=> initializing layer store... ");
+
+  trace_start = trace_begin();
+
+  LayerStore layer_store;
+  int layer_store_result =
+      has_metadata_index
+          ? layer_store_init_from_index(&layer_store, &metadata_index)
+          : layer_store_init(&layer_store, LAYER_STORE_MODE_LAZY);
+  if (0 != layer_store_result) {
+    printf("failed, error(%d): [%s]\n", errno, strerror(errno));
+    goto out_destroy_image_store;
+  }
+
+  trace_end("initialize layer store", trace_start);
+
+  printf("done\n");
+
+  // Serve containers from a pool until the pool is stopped.
+  if (CLI_SUBCOMMAND_POOL == cli.subcommand) {
+    ret = serve_pool(&cli, &image_store, &layer_store);
+    goto out_destroy_layer_store;
+  }
+
+  // Run the jobs of a batch until they are done.
+  if (CLI_SUBCOMMAND_BATCH == cli.subcommand) {
+    ret = run_batch(&cli, &image_store, &layer_store, stats_file);
+    goto out_destroy_layer_store;
+  }
+
+  // Flatten the layers of the images into snapshots.
+  if (CLI_SUBCOMMAND_SNAPSHOT == cli.subcommand) {
+    ret = create_snapshots(&cli, &image_store, &layer_store);
+    goto out_destroy_layer_store;
+  }
+
+  // Locate the container image.
+  printf("=> locating image [%s]... ", cli.image);
+
+  trace_start = trace_begin();
 
   Image *container_image =
-      image_store_get_image_by_repository(&image_store, cli.image);
+      image_store_get_image_by_name(&image_store, cli.image);
   if (NULL == container_image) {
-    printf("failed, no such repository\n");
-    goto out_destroy_image_store;
+    printf("failed, no such image\n");
+    goto out_destroy_layer_store;
   }
 
+  trace_end("locate image", trace_start);
+
+  printf("done\n");
+
+  // Load the container image layers.
+  printf("=> loading image layers... ");
+
+  trace_start = trace_begin();
+
+  if (0 != layer_store_load_image_layers(&layer_store, container_image)) {
+    printf("failed, error(%d): [%s]\n", errno, strerror(errno));
+    goto out_destroy_layer_store;
+  }
+
+  trace_end("load image layers", trace_start);
+
   printf("done\n");
 
   // Generate the container hostname.
@@ -377,31 +462,94 @@ int main(int argc, const char *const argv[]) {
   char *container_hostname;
   if (0 != uuid_generate(&container_hostname)) {
     printf("failed, error(%d): [%s]\n", errno, strerror(errno));
-    goto out_destroy_image_store;
+    goto out_destroy_layer_store;
   }
 
   printf("%s... done\n", container_hostname);
 
-  // Create the container directory.
-  printf("=> creating container directory... ");
+  // The container's resource usage, which is recorded once it has been
+  // waited for.
+  int is_waited = 0;
+  StatsRecord stats_record = {
+      .container = container_hostname,
+      .image = cli.image,
+      .cgroup_usage = NULL,
+  };
 
-  // The directory is allocated on the heap as it is passed to the child
-  // process.
   char container_directory[PATH_MAX];
-  snprintf(container_directory, sizeof(container_directory), "%s/container/%s",
-           gimli_directory_get(), container_hostname);
+  char root_fs_directory[PATH_MAX];
+  container_format_directories(container_hostname, container_directory,
+                               root_fs_directory);
 
-  if (0 != mkdir(container_directory, 0755)) {
-    printf("failed, error(%d): [%s]", errno, strerror(errno));
-    goto out_free_container_hostname;
-  }
+  // Mount the image's shared read-only root, or else create the container
+  // directory that the container's own overlay is mounted in.
+  SharedRoot shared_root;
+  if (cli.is_read_only) {
+    printf("=> mounting shared read-only root... ");
 
-  char root_fs_directory[PATH_MAX];
-  snprintf(root_fs_directory, sizeof(root_fs_directory), "%s/merged",
-           container_directory);
+    trace_start = trace_begin();
+
+    if (0 != shared_root_acquire(&shared_root, container_image,
+                                 &layer_store)) {
+      printf("failed, error(%d): [%s]\n", errno, strerror(errno));
+      goto out_free_container_hostname;
+    }
+
+    trace_end("acquire shared root", trace_start);
+  } else {
+    printf("=> creating container directory... ");
+
+    trace_start = trace_begin();
+
+    if (0 != mkdir(container_directory, 0755)) {
+      printf("failed, error(%d): [%s]", errno, strerror(errno));
+      goto out_free_container_hostname;
+    }
+
+    trace_end("create container directory", trace_start);
+  }
 
   printf("done\n");
 
+  // Create the container's cgroup, which it is cloned into, if it is limited.
+  int is_limited = cgroup_limits_is_set(&cli.cgroup_limits);
+  Cgroup cgroup;
+  if (is_limited) {
+    printf("=> creating container cgroup... ");
+
+    trace_start = trace_begin();
+
+    if (0 != cgroup_create(&cgroup, container_hostname, &cli.cgroup_limits)) {
+      printf("failed, error(%d): [%s]\n", errno, strerror(errno));
+      goto out_remove_container_directory;
+    }
+
+    trace_end("create cgroup", trace_start);
+
+    printf("done\n");
+  }
+
+  // Open the container's log, which its output is moved to instead of
+  // gimli's output, if it is logged.
+  int is_logged = NULL != cli.log_configuration.directory;
+  Log log;
+  int log_write_fd = -1;
+  if (is_logged) {
+    printf("=> opening container log... ");
+
+    trace_start = trace_begin();
+
+    if (0 != log_open(&log, &cli.log_configuration, container_hostname,
+                      &log_write_fd)) {
+      printf("failed, error(%d): [%s]\n", errno, strerror(errno));
+      goto out_remove_cgroup;
+    }
+
+    trace_end("open log", trace_start);
+
+    printf("%s... done\n", log.path);
+  }
+
   // Setup the container configuration.
   printf("=> setting up the container configuration... ");
 
@@ -412,38 +560,87 @@ int main(int argc, const char *const argv[]) {
       .hostname = container_hostname,
       .command = cli.command,
       .layer_store = &layer_store,
+      .shared_root_directory =
+          cli.is_read_only ? shared_root.directory : NULL,
+      .ephemeral_size = cli.ephemeral_size,
+      .cgroup_fd = is_limited ? cgroup.fd : -1,
+      .log_fd = log_write_fd,
+      .control_fd = -1,
   };
 
   printf("done\n");
 
-  // Clone a child process in new namespaces.
-  uint8_t *clone_stack = malloc(CLONE_STACK_SIZE);
-  if (NULL == clone_stack) {
+  // Open the pipe that the child passes its trace spans back over.
+  if (0 != trace_open_child_pipe()) {
     printf("failed, error(%d): [%s]\n", errno, strerror(errno));
-    goto out_remove_container_directory;
+    goto out_close_log;
   }
 
-  int clone_flags =
-      CLONE_NEWNS | CLONE_NEWPID | CLONE_NEWIPC | CLONE_NEWNET | CLONE_NEWUTS;
+  // Clone a child process in new namespaces.
+  trace_start = trace_begin();
+
+  uint64_t container_start = get_monotonic_time();
+
+  int child_pidfd = -1;
+  pid_t child_pid = container_clone(&container_configuration, &child_pidfd);
+
+  // The child holds the log's pipe from now on, so that the log ends once the
+  // container has exited.
+  if (-1 != log_write_fd) {
+    close(log_write_fd);
+    log_write_fd = -1;
+  }
 
-  int child_pid = clone(child, clone_stack + CLONE_STACK_SIZE,
-                        clone_flags | SIGCHLD, &container_configuration);
   if (-1 == child_pid) {
     printf("failed, error(%d): [%s]\n", errno, strerror(errno));
-    goto out_free_clone_stack;
+    goto out_collect_child_trace;
   }
 
+  trace_end("clone", trace_start);
+
   // Wait for the child process to exit.
+  // Signals that are sent to gimli meanwhile are forwarded to the child, and
+  // the child is killed if it runs past the timeout.
+  trace_start = trace_begin();
+
   int waitpid_status;
-  if (-1 == waitpid(child_pid, &waitpid_status, 0)) {
+  int is_timed_out;
+  if (0 != spawn_wait(child_pid, child_pidfd, cli.timeout,
+                      is_logged ? &log : NULL, &waitpid_status,
+                      &stats_record.rusage, &is_timed_out)) {
     printf("failed waiting for child process (%d), error(%d): [%s]\n",
            child_pid, errno, strerror(errno));
-    goto out_free_clone_stack;
+    goto out_close_child_pidfd;
+  }
+
+  // Move the rest of the container's output to its log.
+  if (is_logged) {
+    log_drain(&log);
+  }
+
+  trace_end("wait container", trace_start);
+
+  is_waited = 1;
+  stats_record.status = waitpid_status;
+  stats_record.is_timed_out = is_timed_out;
+  stats_record.duration = get_monotonic_time() - container_start;
+
+  if (is_timed_out) {
+    printf("=> container timed out after (%zu) seconds\n", cli.timeout);
+  }
+
+  if (is_logged && (0 != log.error)) {
+    printf("=> failed logging container output, error(%d): [%s]\n",
+           log.error, strerror(log.error));
+  }
+
+  if (is_logged && (0 != log.dropped_size)) {
+    printf("=> dropped (%zu) bytes of container output\n", log.dropped_size);
   }
 
   if (!WIFEXITED(waitpid_status)) {
     printf("child process (%d) has not exited normally\n", child_pid);
-    goto out_free_clone_stack;
+    goto out_close_child_pidfd;
   }
 
   int child_exit_code = WEXITSTATUS(waitpid_status);
@@ -451,24 +648,86 @@ int main(int argc, const char *const argv[]) {
 
   ret = child_exit_code;
 
-out_free_clone_stack:
-  free(clone_stack);
+out_close_child_pidfd:
+  if (-1 != child_pidfd) {
+    close(child_pidfd);
+  }
 
-out_remove_container_directory:
-  // Try unmounting the root directory of the container's file system.
-  umount(root_fs_directory);
+out_collect_child_trace:
+  trace_collect_child(child_pid);
 
-  // Remove the container directory.
-  io_remove_directory_recursive(container_directory);
+out_close_log:
+  if (-1 != log_write_fd) {
+    close(log_write_fd);
+  }
+
+  if (is_logged) {
+    log_close(&log);
+  }
+
+out_remove_cgroup:
+  if (is_limited) {
+    // The cgroup's usage is gone once it is removed, so it is read first.
+    if (is_waited && (NULL != stats_file)) {
+      stats_read_cgroup_usage(cgroup.fd, &stats_record.cgroup_usage);
+    }
+
+    trace_start = trace_begin();
+    if (0 != cgroup_remove(&cgroup)) {
+      printf("=> failed removing cgroup [%s], error(%d): [%s]\n",
+             cgroup.directory, errno, strerror(errno));
+    }
+    trace_end("remove cgroup", trace_start);
+  }
+
+out_remove_container_directory:
+  trace_start = trace_begin();
+
+  if (cli.is_read_only) {
+    shared_root_release(&shared_root);
+    trace_end("release shared root", trace_start);
+  } else {
+    container_remove_directory(container_directory, root_fs_directory,
+                               container_hostname);
+    trace_end("remove container directory", trace_start);
+  }
 
 out_free_container_hostname:
+  // Record the container's usage, along with the phases of its launch.
+  if (is_waited && (NULL != stats_file)) {
+    if (0 != stats_write_record(stats_file, &stats_record, 1)) {
+      printf("failed writing stats, error(%d): [%s]\n", errno,
+             strerror(errno));
+    }
+
+    free(stats_record.cgroup_usage);
+  }
+
   free(container_hostname);
 
+out_destroy_layer_store:
+  layer_store_destroy(&layer_store);
+
 out_destroy_image_store:
   image_store_destroy(&image_store);
 
-out_destroy_layer_store:
-  layer_store_destroy(&layer_store);
+out_close_metadata_index:
+  if (has_metadata_index) {
+    metadata_index_close(&metadata_index);
+  }
+
+out_write_trace:
+  trace_end("launch", launch_trace_start);
+
+  // Write the trace, if tracing is enabled.
+  if (0 != trace_write()) {
+    printf("failed writing the trace, error(%d): [%s]\n", errno,
+           strerror(errno));
+  }
+
+  if (NULL != stats_file) {
+    stats_close(stats_file);
+  }
 
 out_destroy_cli:
   cli_destroy(&cli);
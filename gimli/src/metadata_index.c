@@ -0,0 +1,331 @@
+#include "gimli/metadata_index.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "gimli/gimli_directory.h"
+#include "gimli/io.h"
+
+#define EMPTY_BUCKET 0
+
+static const uint32_t FNV_OFFSET_BASIS = 2166136261u;
+static const uint32_t FNV_PRIME = 16777619u;
+
+static const void *get_section(const MetadataIndex *self, uint32_t offset) {
+  return (const uint8_t *)self->data + offset;
+}
+
+static const MetadataIndexHeader *get_header(const MetadataIndex *self) {
+  return self->data;
+}
+
+static const char *get_string(const MetadataIndex *self, uint32_t offset) {
+  const MetadataIndexHeader *header = get_header(self);
+
+  if (offset >= header->strings_size) {
+    return NULL;
+  }
+
+  return (const char *)get_section(self, header->strings_offset) + offset;
+}
+
+static int is_section_valid(const MetadataIndex *self, uint32_t offset,
+                            uint32_t size, size_t item_size) {
+  return (offset <= self->size) &&
+         (((size_t)size * item_size) <= (self->size - offset));
+}
+
+static int is_header_valid(const MetadataIndex *self) {
+  if (sizeof(MetadataIndexHeader) > self->size) {
+    return 0;
+  }
+
+  const MetadataIndexHeader *header = get_header(self);
+
+  if ((0 != memcmp(header->magic, METADATA_INDEX_MAGIC,
+                   sizeof(header->magic))) ||
+      (METADATA_INDEX_VERSION != header->version) ||
+      (header->file_size != self->size)) {
+    return 0;
+  }
+
+  // Ensure that all sections are within the file.
+  if (!is_section_valid(self, header->repositories_offset,
+                        header->repositories_size,
+                        sizeof(MetadataIndexRepository)) ||
+      !is_section_valid(self, header->repository_buckets_offset,
+                        header->repository_buckets_size, sizeof(uint32_t)) ||
+      !is_section_valid(self, header->images_offset, header->images_size,
+                        sizeof(MetadataIndexImage)) ||
+      !is_section_valid(self, header->image_buckets_offset,
+                        header->image_buckets_size, sizeof(uint32_t)) ||
+      !is_section_valid(self, header->image_layers_offset,
+                        header->image_layers_size, sizeof(uint32_t)) ||
+      !is_section_valid(self, header->layers_offset, header->layers_size,
+                        sizeof(MetadataIndexLayer)) ||
+      !is_section_valid(self, header->layer_buckets_offset,
+                        header->layer_buckets_size, sizeof(uint32_t)) ||
+      !is_section_valid(self, header->strings_offset, header->strings_size,
+                        sizeof(char))) {
+    return 0;
+  }
+
+  // Hash table bucket counts must be powers of 2.
+  if ((0 == header->repository_buckets_size) ||
+      (0 != (header->repository_buckets_size &
+             (header->repository_buckets_size - 1))) ||
+      (0 == header->image_buckets_size) ||
+      (0 != (header->image_buckets_size & (header->image_buckets_size - 1))) ||
+      (0 == header->layer_buckets_size) ||
+      (0 != (header->layer_buckets_size & (header->layer_buckets_size - 1)))) {
+    return 0;
+  }
+
+  // The strings section must be null terminated, so that no string can run
+  // past the end of the file.
+  if ((0 == header->strings_size) ||
+      ('\0' != *((const char *)get_section(self, header->strings_offset) +
+                 header->strings_size - 1))) {
+    return 0;
+  }
+
+  return 1;
+}
+
+static int is_fresh(const MetadataIndex *self) {
+  MetadataIndexSourceStamp stamps[METADATA_INDEX_SOURCE_COUNT];
+  if (0 != metadata_index_stamp_sources(stamps)) {
+    return 0;
+  }
+
+  return 0 == memcmp(get_header(self)->sources, stamps, sizeof(stamps));
+}
+
+// Finds the index of the entry whose key string is equal to `key`.
+static int64_t find_entry(const MetadataIndex *self, const uint32_t *buckets,
+                          uint32_t buckets_size, const void *entries,
+                          uint32_t entries_size, size_t entry_size,
+                          const char *key) {
+  uint32_t mask = buckets_size - 1;
+
+  // Probe linearly until the key or an empty bucket is found.
+  // Every probe sequence is bounded by the bucket count.
+  uint32_t bucket_index = metadata_index_hash(key) & mask;
+  for (uint32_t probe = 0; probe < buckets_size; ++probe) {
+    uint32_t bucket = buckets[bucket_index];
+    if (EMPTY_BUCKET == bucket) {
+      break;
+    }
+
+    uint32_t entry_index = bucket - 1;
+    if (entry_index < entries_size) {
+      // The key is always the first field of an entry.
+      const uint32_t *entry_key =
+          (const void *)((const uint8_t *)entries + (entry_index * entry_size));
+
+      const char *entry_key_string = get_string(self, *entry_key);
+      if ((NULL != entry_key_string) && (0 == strcmp(entry_key_string, key))) {
+        return entry_index;
+      }
+    }
+
+    bucket_index = (bucket_index + 1) & mask;
+  }
+
+  return -1;
+}
+
+static void stamp_source(const struct stat *stat_buffer,
+                         MetadataIndexSourceStamp *out_stamp) {
+  out_stamp->modification_seconds = (int64_t)stat_buffer->st_mtim.tv_sec;
+  out_stamp->modification_nanoseconds = (int64_t)stat_buffer->st_mtim.tv_nsec;
+  out_stamp->inode = (uint64_t)stat_buffer->st_ino;
+  out_stamp->size = (uint64_t)stat_buffer->st_size;
+}
+
+uint32_t metadata_index_hash(const char *key) {
+  // FNV-1a.
+  uint32_t hash = FNV_OFFSET_BASIS;
+
+  for (const char *cursor = key; '\0' != (*cursor); ++cursor) {
+    hash ^= (uint8_t)(*cursor);
+    hash *= FNV_PRIME;
+  }
+
+  return hash;
+}
+
+void metadata_index_format_path(char *path, size_t size) {
+  snprintf(path, size, "%s/metadata.index", gimli_directory_get());
+}
+
+int metadata_index_stamp_sources(
+    MetadataIndexSourceStamp out_stamps[METADATA_INDEX_SOURCE_COUNT]) {
+  static const char *const SOURCE_PATHS[METADATA_INDEX_SOURCE_COUNT] = {
+      [METADATA_INDEX_SOURCE_REPOSITORIES] =
+          "image/overlay2/repositories.json",
+      [METADATA_INDEX_SOURCE_IMAGE_STORE] =
+          "image/overlay2/imagedb/content/sha256",
+      [METADATA_INDEX_SOURCE_LAYER_STORE] = "image/overlay2/layerdb/sha256",
+  };
+
+  // Zero the stamps so that they can be compared as raw memory.
+  memset(out_stamps, 0, sizeof(*out_stamps) * METADATA_INDEX_SOURCE_COUNT);
+
+  for (size_t source_index = 0; source_index < METADATA_INDEX_SOURCE_COUNT;
+       ++source_index) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", gimli_directory_get(),
+             SOURCE_PATHS[source_index]);
+
+    // Adding or removing an image or a layer updates the modification time of
+    // its store directory.
+    struct stat stat_buffer;
+    if (0 != stat(path, &stat_buffer)) {
+      return 1;
+    }
+
+    stamp_source(&stat_buffer, &(out_stamps[source_index]));
+  }
+
+  return 0;
+}
+
+int metadata_index_open(MetadataIndex *self) {
+  // Format the index file path.
+  char path[PATH_MAX];
+  metadata_index_format_path(path, sizeof(path));
+
+  // Map the index file.
+  if (0 != io_map_file(path, &self->data, &self->size)) {
+    return 1;
+  }
+
+  // Ensure that the index is well formed and up to date with its sources.
+  if ((!is_header_valid(self)) || (!is_fresh(self))) {
+    io_unmap_file(self->data, self->size);
+    errno = ESTALE;
+    return 1;
+  }
+
+  return 0;
+}
+
+void metadata_index_close(MetadataIndex *self) {
+  io_unmap_file(self->data, self->size);
+}
+
+const char *metadata_index_get_image_id(const MetadataIndex *self,
+                                        const char *repository) {
+  const MetadataIndexHeader *header = get_header(self);
+  const MetadataIndexRepository *repositories =
+      get_section(self, header->repositories_offset);
+
+  // Find the repository.
+  int64_t repository_index = find_entry(
+      self, get_section(self, header->repository_buckets_offset),
+      header->repository_buckets_size, repositories, header->repositories_size,
+      sizeof(*repositories), repository);
+  if (-1 == repository_index) {
+    return NULL;
+  }
+
+  return get_string(self, repositories[repository_index].image_id);
+}
+
+size_t metadata_index_get_images_size(const MetadataIndex *self) {
+  return get_header(self)->images_size;
+}
+
+const char *metadata_index_get_image_id_at(const MetadataIndex *self,
+                                           size_t image_index) {
+  const MetadataIndexHeader *header = get_header(self);
+  const MetadataIndexImage *images = get_section(self, header->images_offset);
+
+  if (image_index >= header->images_size) {
+    return NULL;
+  }
+
+  return get_string(self, images[image_index].id);
+}
+
+int metadata_index_get_image(const MetadataIndex *self, const char *id,
+                             Arena *arena, Image *out_image) {
+  const MetadataIndexHeader *header = get_header(self);
+  const MetadataIndexImage *images = get_section(self, header->images_offset);
+
+  // Find the image.
+  int64_t image_index =
+      find_entry(self, get_section(self, header->image_buckets_offset),
+                 header->image_buckets_size, images, header->images_size,
+                 sizeof(*images), id);
+  if (-1 == image_index) {
+    return 1;
+  }
+
+  const MetadataIndexImage *image = &(images[image_index]);
+  if ((image->first_layer_index > header->image_layers_size) ||
+      (image->layers_size >
+       (header->image_layers_size - image->first_layer_index))) {
+    return 1;
+  }
+
+  // Allocate the layers array.
+  // The array is the only allocation, as the strings themselves point into the
+  // index.
+  out_image->layers =
+      arena_allocate(arena, image->layers_size * sizeof(*out_image->layers));
+  if (NULL == out_image->layers) {
+    return 1;
+  }
+
+  const uint32_t *image_layers = get_section(self, header->image_layers_offset);
+
+  for (size_t layer_index = 0; layer_index < image->layers_size;
+       ++layer_index) {
+    const char *diff_id =
+        get_string(self, image_layers[image->first_layer_index + layer_index]);
+    if (NULL == diff_id) {
+      return 1;
+    }
+
+    out_image->layers[layer_index] = (char *)diff_id;
+  }
+
+  out_image->id = (char *)get_string(self, image->id);
+  out_image->layers_size = image->layers_size;
+
+  return 0;
+}
+
+int metadata_index_get_layer(const MetadataIndex *self, const char *diff_id,
+                             Layer *out_layer) {
+  const MetadataIndexHeader *header = get_header(self);
+  const MetadataIndexLayer *layers = get_section(self, header->layers_offset);
+
+  // Find the layer.
+  int64_t layer_index =
+      find_entry(self, get_section(self, header->layer_buckets_offset),
+                 header->layer_buckets_size, layers, header->layers_size,
+                 sizeof(*layers), diff_id);
+  if (-1 == layer_index) {
+    return 1;
+  }
+
+  const MetadataIndexLayer *layer = &(layers[layer_index]);
+
+  out_layer->chain_id = (char *)get_string(self, layer->chain_id);
+  out_layer->diff_id = (char *)get_string(self, layer->diff_id);
+  out_layer->cache_id = (char *)get_string(self, layer->cache_id);
+  out_layer->link_path = (char *)get_string(self, layer->link_path);
+
+  if ((NULL == out_layer->chain_id) || (NULL == out_layer->diff_id) ||
+      (NULL == out_layer->cache_id) || (NULL == out_layer->link_path)) {
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,338 @@
+#include "gimli/metadata_index_builder.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gimli/io.h"
+#include "stb_ds/stb_ds.h"
+
+// Sections are aligned so that their entries can be read directly from the
+// mapped index.
+#define SECTION_ALIGNMENT 8
+
+typedef struct StringToOffsetPair {
+  char *key;
+  uint32_t value;
+} StringToOffsetPair;
+
+typedef struct Builder {
+  MetadataIndexRepository *repositories;
+  MetadataIndexImage *images;
+  uint32_t *image_layers;
+  MetadataIndexLayer *layers;
+  char *strings;
+  StringToOffsetPair *string_to_offset;
+} Builder;
+
+static uint32_t intern_string(Builder *self, const char *string) {
+  // Strings that are shared between entries (such as diff IDs) are stored
+  // once.
+  ptrdiff_t pair_index = shgeti(self->string_to_offset, string);
+  if (-1 != pair_index) {
+    return self->string_to_offset[pair_index].value;
+  }
+
+  uint32_t offset = (uint32_t)arrlenu(self->strings);
+
+  // Append the string along with its null terminator.
+  size_t string_size = strlen(string) + 1;
+  memcpy(arraddnptr(self->strings, string_size), string, string_size);
+
+  shput(self->string_to_offset, (char *)string, offset);
+
+  return offset;
+}
+
+static uint32_t get_buckets_size(size_t entries_size) {
+  // Keep the load factor at or below 1/2 so that probe sequences stay short.
+  uint32_t buckets_size = 2;
+  while (buckets_size < (entries_size * 2)) {
+    buckets_size *= 2;
+  }
+
+  return buckets_size;
+}
+
+static uint32_t *build_buckets(const Builder *self, const void *entries,
+                               size_t entries_size, size_t entry_size,
+                               uint32_t buckets_size) {
+  uint32_t *buckets = calloc(buckets_size, sizeof(*buckets));
+  if (NULL == buckets) {
+    return NULL;
+  }
+
+  uint32_t mask = buckets_size - 1;
+
+  for (size_t entry_index = 0; entry_index < entries_size; ++entry_index) {
+    // The key is always the first field of an entry.
+    const uint32_t *key =
+        (const void *)((const uint8_t *)entries + (entry_index * entry_size));
+
+    // Place the entry in the first empty bucket of its probe sequence.
+    uint32_t bucket_index = metadata_index_hash(self->strings + (*key)) & mask;
+    while (0 != buckets[bucket_index]) {
+      bucket_index = (bucket_index + 1) & mask;
+    }
+
+    buckets[bucket_index] = (uint32_t)entry_index + 1;
+  }
+
+  return buckets;
+}
+
+static size_t align_offset(size_t offset) {
+  return (offset + (SECTION_ALIGNMENT - 1)) & ~((size_t)SECTION_ALIGNMENT - 1);
+}
+
+static size_t place_section(size_t *cursor, size_t size) {
+  size_t offset = align_offset(*cursor);
+  *cursor = offset + size;
+  return offset;
+}
+
+static void add_images(Builder *self, const ImageStore *image_store) {
+  for (size_t slot_index = 0; slot_index < image_store->id_to_image.capacity;
+       ++slot_index) {
+    const Image *image = image_store->id_to_image.slots[slot_index].value;
+    if (NULL == image) {
+      continue;
+    }
+
+    MetadataIndexImage entry = {
+        .id = intern_string(self, image->id),
+        .first_layer_index = (uint32_t)arrlenu(self->image_layers),
+        .layers_size = (uint32_t)image->layers_size,
+    };
+
+    for (size_t layer_index = 0; layer_index < image->layers_size;
+         ++layer_index) {
+      arrput(self->image_layers,
+             intern_string(self, image->layers[layer_index]));
+    }
+
+    arrput(self->images, entry);
+  }
+
+  for (ptrdiff_t pair_index = 0;
+       pair_index < shlen(image_store->repository_to_id); ++pair_index) {
+    const RepositoryToIdPair *pair = &(image_store->repository_to_id[pair_index]);
+
+    MetadataIndexRepository entry = {
+        .name = intern_string(self, pair->key),
+        .image_id = intern_string(self, pair->value),
+    };
+
+    arrput(self->repositories, entry);
+  }
+}
+
+static void add_layers(Builder *self, const LayerStore *layer_store) {
+  for (size_t slot_index = 0;
+       slot_index < layer_store->diff_id_to_layer.capacity; ++slot_index) {
+    const Layer *layer = layer_store->diff_id_to_layer.slots[slot_index].value;
+    if (NULL == layer) {
+      continue;
+    }
+
+    MetadataIndexLayer entry = {
+        .diff_id = intern_string(self, layer->diff_id),
+        .chain_id = intern_string(self, layer->chain_id),
+        .cache_id = intern_string(self, layer->cache_id),
+        .link_path = intern_string(self, layer->link_path),
+    };
+
+    arrput(self->layers, entry);
+  }
+}
+
+static int write_index(
+    const Builder *self,
+    const MetadataIndexSourceStamp stamps[METADATA_INDEX_SOURCE_COUNT]) {
+  int ret = 1;
+
+  MetadataIndexHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, METADATA_INDEX_MAGIC, sizeof(header.magic));
+  header.version = METADATA_INDEX_VERSION;
+  memcpy(header.sources, stamps, sizeof(header.sources));
+
+  header.repositories_size = (uint32_t)arrlenu(self->repositories);
+  header.repository_buckets_size = get_buckets_size(arrlenu(self->repositories));
+  header.images_size = (uint32_t)arrlenu(self->images);
+  header.image_buckets_size = get_buckets_size(arrlenu(self->images));
+  header.image_layers_size = (uint32_t)arrlenu(self->image_layers);
+  header.layers_size = (uint32_t)arrlenu(self->layers);
+  header.layer_buckets_size = get_buckets_size(arrlenu(self->layers));
+  header.strings_size = (uint32_t)arrlenu(self->strings);
+
+  // Build the hash tables.
+  uint32_t *repository_buckets = build_buckets(
+      self, self->repositories, arrlenu(self->repositories),
+      sizeof(*self->repositories), header.repository_buckets_size);
+  uint32_t *image_buckets =
+      build_buckets(self, self->images, arrlenu(self->images),
+                    sizeof(*self->images), header.image_buckets_size);
+  uint32_t *layer_buckets =
+      build_buckets(self, self->layers, arrlenu(self->layers),
+                    sizeof(*self->layers), header.layer_buckets_size);
+  if ((NULL == repository_buckets) || (NULL == image_buckets) ||
+      (NULL == layer_buckets)) {
+    goto out_free_buckets;
+  }
+
+  // Lay out the sections after the header.
+  size_t cursor = sizeof(header);
+  size_t repositories_offset = place_section(
+      &cursor, header.repositories_size * sizeof(*self->repositories));
+  size_t repository_buckets_offset = place_section(
+      &cursor, header.repository_buckets_size * sizeof(*repository_buckets));
+  size_t images_offset =
+      place_section(&cursor, header.images_size * sizeof(*self->images));
+  size_t image_buckets_offset = place_section(
+      &cursor, header.image_buckets_size * sizeof(*image_buckets));
+  size_t image_layers_offset = place_section(
+      &cursor, header.image_layers_size * sizeof(*self->image_layers));
+  size_t layers_offset =
+      place_section(&cursor, header.layers_size * sizeof(*self->layers));
+  size_t layer_buckets_offset = place_section(
+      &cursor, header.layer_buckets_size * sizeof(*layer_buckets));
+  size_t strings_offset = place_section(&cursor, header.strings_size);
+  size_t file_size = cursor;
+
+  // All offsets are stored as 32 bit integers.
+  if (UINT32_MAX < file_size) {
+    errno = EFBIG;
+    goto out_free_buckets;
+  }
+
+  header.repositories_offset = (uint32_t)repositories_offset;
+  header.repository_buckets_offset = (uint32_t)repository_buckets_offset;
+  header.images_offset = (uint32_t)images_offset;
+  header.image_buckets_offset = (uint32_t)image_buckets_offset;
+  header.image_layers_offset = (uint32_t)image_layers_offset;
+  header.layers_offset = (uint32_t)layers_offset;
+  header.layer_buckets_offset = (uint32_t)layer_buckets_offset;
+  header.strings_offset = (uint32_t)strings_offset;
+  header.file_size = (uint32_t)file_size;
+
+  // Assemble the index file.
+  uint8_t *data = calloc(1, file_size);
+  if (NULL == data) {
+    goto out_free_buckets;
+  }
+
+  memcpy(data, &header, sizeof(header));
+  memcpy(data + repositories_offset, self->repositories,
+         header.repositories_size * sizeof(*self->repositories));
+  memcpy(data + repository_buckets_offset, repository_buckets,
+         header.repository_buckets_size * sizeof(*repository_buckets));
+  memcpy(data + images_offset, self->images,
+         header.images_size * sizeof(*self->images));
+  memcpy(data + image_buckets_offset, image_buckets,
+         header.image_buckets_size * sizeof(*image_buckets));
+  memcpy(data + image_layers_offset, self->image_layers,
+         header.image_layers_size * sizeof(*self->image_layers));
+  memcpy(data + layers_offset, self->layers,
+         header.layers_size * sizeof(*self->layers));
+  memcpy(data + layer_buckets_offset, layer_buckets,
+         header.layer_buckets_size * sizeof(*layer_buckets));
+  memcpy(data + strings_offset, self->strings, header.strings_size);
+
+  // Write the index file.
+  char path[PATH_MAX];
+  metadata_index_format_path(path, sizeof(path));
+
+  if (0 != io_write_file_atomically(path, data, file_size)) {
+    goto out_free_data;
+  }
+
+  ret = 0;
+
+out_free_data:
+  free(data);
+
+out_free_buckets:
+  free(layer_buckets);
+  free(image_buckets);
+  free(repository_buckets);
+
+  return ret;
+}
+
+int metadata_index_build(
+    const ImageStore *image_store, const LayerStore *layer_store,
+    const MetadataIndexSourceStamp stamps[METADATA_INDEX_SOURCE_COUNT]) {
+  int ret = 1;
+
+  // Reset the builder (the stb_ds arrays and maps are required to be
+  // initialized to NULL).
+  Builder builder;
+  memset(&builder, 0, sizeof(builder));
+
+  // Add the index entries.
+  add_images(&builder, image_store);
+  add_layers(&builder, layer_store);
+
+  // The strings section is never empty, so that it is always null terminated.
+  if (0 == arrlenu(builder.strings)) {
+    arrput(builder.strings, '\0');
+  }
+
+  // Write the index.
+  if (0 != write_index(&builder, stamps)) {
+    goto out_free_builder;
+  }
+
+  ret = 0;
+
+out_free_builder:
+  shfree(builder.string_to_offset);
+  arrfree(builder.strings);
+  arrfree(builder.layers);
+  arrfree(builder.image_layers);
+  arrfree(builder.images);
+  arrfree(builder.repositories);
+
+  return ret;
+}
+
+int metadata_index_rebuild(void) {
+  int ret = 1;
+
+  // Stamp the sources before reading them, so that changes made while the
+  // index is being built leave it stale rather than silently missing them.
+  MetadataIndexSourceStamp stamps[METADATA_INDEX_SOURCE_COUNT];
+  if (0 != metadata_index_stamp_sources(stamps)) {
+    goto out;
+  }
+
+  // Read the entire image and layer stores.
+  ImageStore image_store;
+  if (0 != image_store_init(&image_store, IMAGE_STORE_MODE_EAGER)) {
+    goto out;
+  }
+
+  LayerStore layer_store;
+  if (0 != layer_store_init(&layer_store, LAYER_STORE_MODE_EAGER)) {
+    goto out_destroy_image_store;
+  }
+
+  // Build the index.
+  if (0 != metadata_index_build(&image_store, &layer_store, stamps)) {
+    goto out_destroy_layer_store;
+  }
+
+  ret = 0;
+
+out_destroy_layer_store:
+  layer_store_destroy(&layer_store);
+
+out_destroy_image_store:
+  image_store_destroy(&image_store);
+
+out:
+  return ret;
+}
@@ -0,0 +1,378 @@
+#define _GNU_SOURCE
+
+#include "gimli/netns.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/nsfs.h>
+#include <net/if.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "gimli/gimli_directory.h"
+#include "gimli/spawn.h"
+
+// The directory of the pool's network namespaces, relative to the gimli
+// directory.
+// Each namespace is kept alive by bind mounting it on a file of its own, and
+// is taken by unmounting that file, which only a single taker succeeds in.
+#define NETNS_DIRECTORY "netns"
+
+// The lock that the pool is filled under, and the file that holds the number
+// of namespaces that it is filled to.
+// Both are hidden, as hidden files are never taken as namespaces.
+#define NETNS_LOCK_NAME ".lock"
+#define NETNS_SIZE_NAME ".size"
+
+// The largest pool size that is read back from its file.
+#define NETNS_SIZE_MAX_LENGTH 32
+
+#define NETNS_LOOPBACK_NAME "lo"
+
+// The number of namespaces created by this process, which tells the files of
+// its namespaces apart.
+static size_t namespaces_created_size = 0;
+
+static int open_netns_directory(void) {
+  // Create the directory the first time it is used.
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/" NETNS_DIRECTORY, gimli_directory_get());
+
+  if ((0 != mkdir(path, 0700)) && (EEXIST != errno)) {
+    return -1;
+  }
+
+  return open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+static int lock_netns_directory(int directory_fd, int operation) {
+  int fd = openat(directory_fd, NETNS_LOCK_NAME, O_RDWR | O_CREAT | O_CLOEXEC,
+                  0600);
+  if (-1 == fd) {
+    return -1;
+  }
+
+  if (0 != flock(fd, operation)) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+static int write_pool_size(int directory_fd, size_t size) {
+  int fd = openat(directory_fd, NETNS_SIZE_NAME,
+                  O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (-1 == fd) {
+    return 1;
+  }
+
+  int ret = (0 < dprintf(fd, "%zu\n", size)) ? 0 : 1;
+
+  close(fd);
+
+  return ret;
+}
+
+static size_t read_pool_size(int directory_fd) {
+  // The pool is left empty if its size is missing, as it was never filled.
+  int fd = openat(directory_fd, NETNS_SIZE_NAME, O_RDONLY | O_CLOEXEC);
+  if (-1 == fd) {
+    return 0;
+  }
+
+  char data[NETNS_SIZE_MAX_LENGTH + 1];
+  ssize_t data_size = read(fd, data, NETNS_SIZE_MAX_LENGTH);
+  close(fd);
+  if (0 >= data_size) {
+    return 0;
+  }
+
+  data[data_size] = '\0';
+
+  return (size_t)strtoull(data, NULL, 10);
+}
+
+static int is_network_namespace(int fd) {
+  return CLONE_NEWNET == ioctl(fd, NS_GET_NSTYPE);
+}
+
+int netns_set_loopback_up(void) {
+  int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (-1 == fd) {
+    return 1;
+  }
+
+  struct ifreq request;
+  memset(&request, 0, sizeof(request));
+  snprintf(request.ifr_name, sizeof(request.ifr_name), NETNS_LOOPBACK_NAME);
+
+  int ret = 1;
+  if (0 == ioctl(fd, SIOCGIFFLAGS, &request)) {
+    request.ifr_flags = (short)(request.ifr_flags | IFF_UP);
+    ret = (0 == ioctl(fd, SIOCSIFFLAGS, &request)) ? 0 : 1;
+  }
+
+  close(fd);
+
+  return ret;
+}
+
+static int create_namespace(int directory_fd) {
+  int ret = 1;
+
+  // Create the file that the namespace is bind mounted on.
+  char name[NAME_MAX];
+  snprintf(name, sizeof(name), "%d-%zu", (int)getpid(),
+           namespaces_created_size++);
+
+  int fd = openat(directory_fd, name, O_RDONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                  0600);
+  if (-1 == fd) {
+    goto out;
+  }
+
+  close(fd);
+
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/" NETNS_DIRECTORY "/%s",
+           gimli_directory_get(), name);
+
+  // Enter a new namespace, and return to the current one once the new one is
+  // mounted.
+  int original_fd = open("/proc/self/ns/net", O_RDONLY | O_CLOEXEC);
+  if (-1 == original_fd) {
+    goto out_remove_file;
+  }
+
+  if (0 != unshare(CLONE_NEWNET)) {
+    goto out_close_original_fd;
+  }
+
+  if ((0 == netns_set_loopback_up()) &&
+      (0 == mount("/proc/thread-self/ns/net", path, NULL, MS_BIND, NULL))) {
+    ret = 0;
+  }
+
+  // Preserve the error while returning to the original namespace.
+  {
+    int create_errno = errno;
+    if (0 != setns(original_fd, CLONE_NEWNET)) {
+      if (0 == ret) {
+        umount2(path, MNT_DETACH);
+        create_errno = errno;
+      }
+
+      ret = 1;
+    }
+
+    errno = create_errno;
+  }
+
+out_close_original_fd:
+  close(original_fd);
+
+out_remove_file:
+  if (0 != ret) {
+    unlinkat(directory_fd, name, 0);
+  }
+
+out:
+  return ret;
+}
+
+static int fill(int directory_fd, size_t size, size_t *out_created_size) {
+  *out_created_size = 0;
+
+  // Count the pool's namespaces, and remove the files that no namespace is
+  // mounted on (such as when their creator was killed).
+  int scan_fd = dup(directory_fd);
+  if (-1 == scan_fd) {
+    return 1;
+  }
+
+  DIR *directory = fdopendir(scan_fd);
+  if (NULL == directory) {
+    close(scan_fd);
+    return 1;
+  }
+
+  size_t pool_size = 0;
+  for (;;) {
+    struct dirent *entry = readdir(directory);
+    if (NULL == entry) {
+      break;
+    }
+
+    if ('.' == entry->d_name[0]) {
+      continue;
+    }
+
+    int fd = openat(directory_fd, entry->d_name, O_RDONLY | O_CLOEXEC);
+    if (-1 == fd) {
+      continue;
+    }
+
+    if (is_network_namespace(fd)) {
+      ++pool_size;
+    } else {
+      unlinkat(directory_fd, entry->d_name, 0);
+    }
+
+    close(fd);
+  }
+
+  closedir(directory);
+
+  // Create the missing namespaces.
+  for (; pool_size < size; ++pool_size) {
+    if (0 != create_namespace(directory_fd)) {
+      return 1;
+    }
+
+    ++(*out_created_size);
+  }
+
+  return 0;
+}
+
+int netns_fill(size_t size, size_t *out_created_size) {
+  int ret = 1;
+
+  *out_created_size = 0;
+
+  int directory_fd = open_netns_directory();
+  if (-1 == directory_fd) {
+    goto out;
+  }
+
+  // Fill the pool exclusively, so that the files of namespaces that are still
+  // being created are not mistaken for stale ones.
+  int lock_fd = lock_netns_directory(directory_fd, LOCK_EX);
+  if (-1 == lock_fd) {
+    goto out_close_directory_fd;
+  }
+
+  // Record the size, which the pool is refilled to as it is taken from.
+  if (0 != write_pool_size(directory_fd, size)) {
+    goto out_unlock;
+  }
+
+  ret = fill(directory_fd, size, out_created_size);
+
+out_unlock:
+  close(lock_fd);
+
+out_close_directory_fd:
+  close(directory_fd);
+
+out:
+  return ret;
+}
+
+int netns_take(int *out_is_low) {
+  *out_is_low = 0;
+
+  int directory_fd = gimli_directory_open(NETNS_DIRECTORY);
+  if (-1 == directory_fd) {
+    return -1;
+  }
+
+  DIR *directory = fdopendir(directory_fd);
+  if (NULL == directory) {
+    close(directory_fd);
+    return -1;
+  }
+
+  // Take the first namespace that can be taken, and count the files of the
+  // rest.
+  int namespace_fd = -1;
+  size_t remaining_size = 0;
+  for (;;) {
+    struct dirent *entry = readdir(directory);
+    if (NULL == entry) {
+      break;
+    }
+
+    if ('.' == entry->d_name[0]) {
+      continue;
+    }
+
+    if (-1 != namespace_fd) {
+      ++remaining_size;
+      continue;
+    }
+
+    int fd = openat(directory_fd, entry->d_name, O_RDONLY | O_CLOEXEC);
+    if (-1 == fd) {
+      continue;
+    }
+
+    // Take the namespace by unmounting it, which fails if another process has
+    // already taken it.
+    // The open file keeps the namespace alive until it is joined.
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/" NETNS_DIRECTORY "/%s",
+             gimli_directory_get(), entry->d_name);
+
+    if ((!is_network_namespace(fd)) || (0 != umount2(path, MNT_DETACH))) {
+      close(fd);
+      continue;
+    }
+
+    unlinkat(directory_fd, entry->d_name, 0);
+    namespace_fd = fd;
+  }
+
+  // The pool is refilled once less than half of it is left, so that a single
+  // refill replaces many namespaces.
+  *out_is_low = remaining_size < ((read_pool_size(directory_fd) + 1) / 2);
+
+  closedir(directory);
+
+  if (-1 == namespace_fd) {
+    errno = ENOENT;
+  }
+
+  return namespace_fd;
+}
+
+static int refill(void) {
+  int ret = 1;
+
+  int directory_fd = open_netns_directory();
+  if (-1 == directory_fd) {
+    goto out;
+  }
+
+  // Leave the pool to a refill that is already running.
+  int lock_fd = lock_netns_directory(directory_fd, LOCK_EX | LOCK_NB);
+  if (-1 == lock_fd) {
+    ret = (EWOULDBLOCK == errno) ? 0 : 1;
+    goto out_close_directory_fd;
+  }
+
+  size_t created_size;
+  ret = fill(directory_fd, read_pool_size(directory_fd), &created_size);
+
+  close(lock_fd);
+
+out_close_directory_fd:
+  close(directory_fd);
+
+out:
+  return ret;
+}
+
+int netns_spawn_refiller(void) { return spawn_detached(refill); }
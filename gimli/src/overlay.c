@@ -0,0 +1,415 @@
+#define _GNU_SOURCE
+
+#include "gimli/overlay.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "gimli/snapshot.h"
+
+// The new mount API is called through the raw system calls, and its constants
+// are defined here when the C library's headers predate it.
+#ifndef FSOPEN_CLOEXEC
+#define FSOPEN_CLOEXEC 0x00000001
+#endif
+
+#ifndef FSCONFIG_SET_STRING
+#define FSCONFIG_SET_STRING 1
+#endif
+
+#ifndef FSCONFIG_CMD_CREATE
+#define FSCONFIG_CMD_CREATE 6
+#endif
+
+#ifndef FSMOUNT_CLOEXEC
+#define FSMOUNT_CLOEXEC 0x00000001
+#endif
+
+#ifndef MOUNT_ATTR_RDONLY
+#define MOUNT_ATTR_RDONLY 0x00000001
+#endif
+
+#ifndef MOVE_MOUNT_F_EMPTY_PATH
+#define MOVE_MOUNT_F_EMPTY_PATH 0x00000004
+#endif
+
+static const char *LOWERDIR_MOUNT_DATA_PREFIX = "lowerdir=";
+static const char *UPPERDIR_MOUNT_DATA_PREFIX = "upperdir=";
+static const char *WORKDIR_MOUNT_DATA_PREFIX = "workdir=";
+
+// Whether overlayfs can be mounted through a file system context, which is
+// detected once by the parent (see `overlay_detect_fs_context_support`).
+typedef enum FsContextSupport {
+  FS_CONTEXT_SUPPORT_UNKNOWN = 0,
+  FS_CONTEXT_SUPPORT_SUPPORTED,
+  FS_CONTEXT_SUPPORT_UNSUPPORTED,
+} FsContextSupport;
+
+static FsContextSupport fs_context_support = FS_CONTEXT_SUPPORT_UNKNOWN;
+
+int overlay_format_mount_data(const Image *image, LayerStore *layer_store,
+                              const char *upperdir, const char *workdir,
+                              char **out_mount_data) {
+  // Prepare the mount data.
+  // The lowerdir data is formatted as follows:
+  // lowerdir=<directory-path>:<directory-path>:...
+  // `layers_size - 1` is the number of ':' characters that need to be
+  // appended.
+  size_t lowerdir_mount_data_prefix_size = strlen(LOWERDIR_MOUNT_DATA_PREFIX);
+  size_t lowerdir_mount_data_size =
+      lowerdir_mount_data_prefix_size + image->layers_size - 1;
+  for (size_t layer_index = 0; layer_index < image->layers_size;
+       ++layer_index) {
+    Layer *layer = layer_store_get_layer_by_diff_id(layer_store,
+                                                    image->layers[layer_index]);
+    if (NULL == layer) {
+      return 1;
+    }
+
+    lowerdir_mount_data_size += strlen(layer->link_path);
+  }
+
+  // The upperdir data if formatted as follows:
+  // upperdir=<directory-path>
+  // There is no upperdir (nor workdir) in a read-only mount.
+  size_t upperdir_mount_data_prefix_size = strlen(UPPERDIR_MOUNT_DATA_PREFIX);
+  size_t upperdir_size = (NULL == upperdir) ? 0 : strlen(upperdir);
+  size_t upperdir_mount_data_size =
+      (NULL == upperdir) ? 0
+                         : (upperdir_mount_data_prefix_size + upperdir_size);
+
+  // The workdir data if formatted as follows:
+  // workdir=<directory-path>
+  size_t workdir_mount_data_prefix_size = strlen(WORKDIR_MOUNT_DATA_PREFIX);
+  size_t workdir_size = (NULL == workdir) ? 0 : strlen(workdir);
+  size_t workdir_mount_data_size =
+      (NULL == workdir) ? 0 : (workdir_mount_data_prefix_size + workdir_size);
+
+  // Calculate the overall size of the mount data.
+  // Add 2 extra bytes for the commas between the mount data parts and an extra
+  // byte for the null terminator at the end of the mount data.
+  size_t mount_data_size = lowerdir_mount_data_size + upperdir_mount_data_size +
+                           workdir_mount_data_size + 3;
+
+  // Allocate the mount data string.
+  char *mount_data = malloc(mount_data_size);
+  if (NULL == mount_data) {
+    return 1;
+  }
+
+  // Format the lowerdir mount data.
+  char *cursor = mount_data;
+
+  memcpy(cursor, LOWERDIR_MOUNT_DATA_PREFIX, lowerdir_mount_data_prefix_size);
+  cursor += lowerdir_mount_data_prefix_size;
+
+  // Format the layers in reverse order at the left-most lowerdir in the overlay
+  // data is the top-most layer, and the right-most is the bottom-most.
+  for (size_t layer_index = image->layers_size; layer_index > 0;
+       --layer_index) {
+    Layer *layer = layer_store_get_layer_by_diff_id(
+        layer_store, image->layers[layer_index - 1]);
+
+    const char *link_path = layer->link_path;
+    size_t link_path_size = strlen(link_path);
+
+    memcpy(cursor, layer->link_path, link_path_size);
+    cursor += link_path_size;
+
+    if (0 != (layer_index - 1)) {
+      *cursor = ':';
+      ++cursor;
+    }
+  }
+
+  if (NULL != upperdir) {
+    *cursor = ',';
+    ++cursor;
+
+    // Format the upperdir mount data.
+    memcpy(cursor, UPPERDIR_MOUNT_DATA_PREFIX, upperdir_mount_data_prefix_size);
+    cursor += upperdir_mount_data_prefix_size;
+
+    memcpy(cursor, upperdir, upperdir_size);
+    cursor += upperdir_size;
+  }
+
+  if (NULL != workdir) {
+    *cursor = ',';
+    ++cursor;
+
+    // Format the workdir mount data.
+    memcpy(cursor, WORKDIR_MOUNT_DATA_PREFIX, workdir_mount_data_prefix_size);
+    cursor += workdir_mount_data_prefix_size;
+
+    memcpy(cursor, workdir, workdir_size);
+    cursor += workdir_size;
+  }
+
+  // Add a null terminator to the end of the mount data.
+  *cursor = '\0';
+
+  *out_mount_data = mount_data;
+
+  return 0;
+}
+
+static int open_fs_context(const char *fs_name) {
+  return (int)syscall(__NR_fsopen, fs_name, FSOPEN_CLOEXEC);
+}
+
+static int configure_fs_context(int fs_fd, unsigned int command,
+                                const char *key, const char *value) {
+  return (int)syscall(__NR_fsconfig, fs_fd, command, key, value, 0);
+}
+
+static int create_mount(int fs_fd, unsigned int mount_attributes) {
+  return (int)syscall(__NR_fsmount, fs_fd, FSMOUNT_CLOEXEC, mount_attributes);
+}
+
+static int attach_mount(int mount_fd, const char *directory) {
+  return (int)syscall(__NR_move_mount, mount_fd, "", AT_FDCWD, directory,
+                      MOVE_MOUNT_F_EMPTY_PATH);
+}
+
+static int is_fs_context_unsupported_error(int error) {
+  // The kernel either lacks the new mount API (or it is filtered), or its
+  // overlayfs does not support appending lower directories one at a time
+  // (before Linux 6.8).
+  return (ENOSYS == error) || (EPERM == error) || (EINVAL == error) ||
+         (EOPNOTSUPP == error);
+}
+
+static FsContextSupport probe_fs_context_support(void) {
+  int fs_fd = open_fs_context("overlay");
+  if (-1 == fs_fd) {
+    return is_fs_context_unsupported_error(errno)
+               ? FS_CONTEXT_SUPPORT_UNSUPPORTED
+               : FS_CONTEXT_SUPPORT_UNKNOWN;
+  }
+
+  // Appending a lower directory only looks it up, so the root directory
+  // stands in for a layer.
+  int result =
+      configure_fs_context(fs_fd, FSCONFIG_SET_STRING, "lowerdir+", "/");
+  int error = errno;
+
+  close(fs_fd);
+
+  if (0 == result) {
+    return FS_CONTEXT_SUPPORT_SUPPORTED;
+  }
+
+  return is_fs_context_unsupported_error(error)
+             ? FS_CONTEXT_SUPPORT_UNSUPPORTED
+             : FS_CONTEXT_SUPPORT_UNKNOWN;
+}
+
+void overlay_detect_fs_context_support(void) {
+  // Errors that say nothing about the kernel's support (such as running out of
+  // descriptors) leave it to be detected again.
+  if (FS_CONTEXT_SUPPORT_UNKNOWN == fs_context_support) {
+    fs_context_support = probe_fs_context_support();
+  }
+}
+
+static int mount_with_fs_context(const Image *image, LayerStore *layer_store,
+                                 const char *upperdir, const char *workdir,
+                                 const char *merged_directory) {
+  int ret = 1;
+
+  // Create an overlayfs context.
+  int fs_fd = open_fs_context("overlay");
+  if (-1 == fs_fd) {
+    goto out;
+  }
+
+  // Append the layers as lower directories, from the top-most layer to the
+  // bottom-most one.
+  // Each layer is passed separately, so the number of layers is not limited by
+  // the size of the mount data.
+  for (size_t layer_index = image->layers_size; layer_index > 0;
+       --layer_index) {
+    Layer *layer = layer_store_get_layer_by_diff_id(
+        layer_store, image->layers[layer_index - 1]);
+    if (NULL == layer) {
+      goto out_close_fs_fd;
+    }
+
+    if (0 != configure_fs_context(fs_fd, FSCONFIG_SET_STRING, "lowerdir+",
+                                  layer->link_path)) {
+      goto out_close_fs_fd;
+    }
+  }
+
+  // A read-only mount has neither an upperdir nor a workdir.
+  if ((NULL != upperdir) &&
+      ((0 != configure_fs_context(fs_fd, FSCONFIG_SET_STRING, "upperdir",
+                                  upperdir)) ||
+       (0 != configure_fs_context(fs_fd, FSCONFIG_SET_STRING, "workdir",
+                                  workdir)))) {
+    goto out_close_fs_fd;
+  }
+
+  if (0 != configure_fs_context(fs_fd, FSCONFIG_CMD_CREATE, NULL, NULL)) {
+    goto out_close_fs_fd;
+  }
+
+  // Create the mount, and attach it at the merged directory.
+  unsigned int mount_attributes = (NULL == upperdir) ? MOUNT_ATTR_RDONLY : 0;
+  int mount_fd = create_mount(fs_fd, mount_attributes);
+  if (-1 == mount_fd) {
+    goto out_close_fs_fd;
+  }
+
+  if (0 != attach_mount(mount_fd, merged_directory)) {
+    goto out_close_mount_fd;
+  }
+
+  ret = 0;
+
+out_close_mount_fd:
+  close(mount_fd);
+
+out_close_fs_fd:
+  close(fs_fd);
+
+out:
+  return ret;
+}
+
+static int mount_with_mount_data(const Image *image, LayerStore *layer_store,
+                                 const char *upperdir, const char *workdir,
+                                 const char *merged_directory) {
+  int ret = 1;
+
+  // Format the mount data.
+  char *mount_data;
+  if (0 != overlay_format_mount_data(image, layer_store, upperdir, workdir,
+                                     &mount_data)) {
+    goto out;
+  }
+
+  // Perform the overlayfs mount.
+  unsigned long mount_flags = (NULL == upperdir) ? MS_RDONLY : 0;
+  if (0 != mount("overlay", merged_directory, "overlay", mount_flags,
+                 mount_data)) {
+    goto out_free_mount_data;
+  }
+
+  ret = 0;
+
+out_free_mount_data:
+  free(mount_data);
+
+out:
+  return ret;
+}
+
+static int mount_snapshot(const char *snapshot_path, const char *upperdir,
+                          const char *workdir, const char *merged_directory) {
+  // A snapshot is a single lower directory, so its mount data always fits in
+  // a page.
+  char mount_data[3 * PATH_MAX];
+  int mount_data_size =
+      snprintf(mount_data, sizeof(mount_data), "%s%s,%s%s,%s%s",
+               LOWERDIR_MOUNT_DATA_PREFIX, snapshot_path,
+               UPPERDIR_MOUNT_DATA_PREFIX, upperdir, WORKDIR_MOUNT_DATA_PREFIX,
+               workdir);
+  if ((0 > mount_data_size) ||
+      (sizeof(mount_data) <= (size_t)mount_data_size)) {
+    errno = ENAMETOOLONG;
+    return 1;
+  }
+
+  return mount("overlay", merged_directory, "overlay", 0, mount_data);
+}
+
+static int mount_layers(const Image *image, LayerStore *layer_store,
+                        const char *upperdir, const char *workdir,
+                        const char *merged_directory) {
+  // Mount through a file system context when the kernel supports it, as the
+  // legacy mount data is limited to a single page, which limits the number of
+  // layers.
+  // Support is normally detected by the parent before the container is
+  // cloned, as a child's detection would be lost with it.
+  overlay_detect_fs_context_support();
+
+  if (FS_CONTEXT_SUPPORT_SUPPORTED == fs_context_support) {
+    return mount_with_fs_context(image, layer_store, upperdir, workdir,
+                                 merged_directory);
+  }
+
+  return mount_with_mount_data(image, layer_store, upperdir, workdir,
+                               merged_directory);
+}
+
+int overlay_mount_image(const Image *image, const char *directory,
+                        const char *merged_directory, LayerStore *layer_store) {
+  // Create the upperdir.
+  char upperdir[PATH_MAX];
+  snprintf(upperdir, sizeof(upperdir), "%s/diff", directory);
+  if (0 != mkdir(upperdir, 0755)) {
+    return 1;
+  }
+
+  // Create the workdir.
+  char workdir[PATH_MAX];
+  snprintf(workdir, sizeof(workdir), "%s/work", directory);
+  if (0 != mkdir(workdir, 0755)) {
+    return 1;
+  }
+
+  // Mount the image's flattened snapshot when it has one, so that lookups in
+  // the container go through a single lower directory instead of every
+  // layer.
+  char snapshot_path[PATH_MAX];
+  if (0 == snapshot_find(image, snapshot_path)) {
+    return mount_snapshot(snapshot_path, upperdir, workdir, merged_directory);
+  }
+
+  return mount_layers(image, layer_store, upperdir, workdir, merged_directory);
+}
+
+static int bind_mount_read_only(const char *source, const char *target) {
+  // The read-only flag only applies when a bind mount is remounted.
+  if (0 != mount(source, target, NULL, MS_BIND, NULL)) {
+    return 1;
+  }
+
+  return mount(NULL, target, NULL, MS_BIND | MS_REMOUNT | MS_RDONLY, NULL);
+}
+
+int overlay_mount_image_read_only(const Image *image,
+                                  const char *merged_directory,
+                                  LayerStore *layer_store) {
+  // overlayfs needs at least two lower directories without an upperdir, so a
+  // single directory (the image's snapshot, or its only layer) is bind
+  // mounted instead.
+  char snapshot_path[PATH_MAX];
+  if (0 == snapshot_find(image, snapshot_path)) {
+    return bind_mount_read_only(snapshot_path, merged_directory);
+  }
+
+  if (1 == image->layers_size) {
+    Layer *layer =
+        layer_store_get_layer_by_diff_id(layer_store, image->layers[0]);
+    if (NULL == layer) {
+      errno = ENOENT;
+      return 1;
+    }
+
+    return bind_mount_read_only(layer->link_path, merged_directory);
+  }
+
+  return mount_layers(image, layer_store, NULL, NULL, merged_directory);
+}
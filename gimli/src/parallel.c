@@ -0,0 +1,143 @@
+#include "gimli/parallel.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// The environment variable that overrides the number of worker threads.
+static const char *const THREADS_SIZE_ENVIRONMENT_VARIABLE =
+    "GIMLI_LOAD_THREADS";
+
+// Store loading is dominated by I/O latency rather than CPU time, so a small
+// pool is enough to keep several requests in flight.
+static const size_t DEFAULT_MAXIMUM_THREADS_SIZE = 8;
+
+typedef struct Pool {
+  ParallelTask task;
+  void *context;
+  size_t tasks_size;
+  size_t next_task_index;
+  int failed;
+} Pool;
+
+typedef struct Worker {
+  Pool *pool;
+  size_t index;
+  pthread_t thread;
+} Worker;
+
+static void *run_worker(void *argument) {
+  Worker *worker = argument;
+  Pool *pool = worker->pool;
+
+  for (;;) {
+    // Stop taking tasks once any task has failed.
+    if (__atomic_load_n(&pool->failed, __ATOMIC_RELAXED)) {
+      break;
+    }
+
+    // Take the next task.
+    size_t task_index =
+        __atomic_fetch_add(&pool->next_task_index, 1, __ATOMIC_RELAXED);
+    if (task_index >= pool->tasks_size) {
+      break;
+    }
+
+    if (0 != pool->task(pool->context, worker->index, task_index)) {
+      __atomic_store_n(&pool->failed, 1, __ATOMIC_RELAXED);
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+size_t parallel_get_threads_size(void) {
+  // Use the configured number of threads if there is one.
+  const char *threads_size_string = getenv(THREADS_SIZE_ENVIRONMENT_VARIABLE);
+  if (NULL != threads_size_string) {
+    char *end;
+    unsigned long threads_size = strtoul(threads_size_string, &end, 10);
+    if (('\0' == (*end)) && (0 < threads_size)) {
+      return (size_t)threads_size;
+    }
+  }
+
+  // Default to the number of online processors, up to a limit.
+  long processors_size = sysconf(_SC_NPROCESSORS_ONLN);
+  if (1 > processors_size) {
+    return 1;
+  }
+
+  if (DEFAULT_MAXIMUM_THREADS_SIZE < (size_t)processors_size) {
+    return DEFAULT_MAXIMUM_THREADS_SIZE;
+  }
+
+  return (size_t)processors_size;
+}
+
+int parallel_run(size_t tasks_size, size_t threads_size, ParallelTask task,
+                 void *context) {
+  int ret = 1;
+
+  Pool pool = {
+      .task = task,
+      .context = context,
+      .tasks_size = tasks_size,
+      .next_task_index = 0,
+      .failed = 0,
+  };
+
+  // Never start more threads than there are tasks.
+  if (threads_size > tasks_size) {
+    threads_size = tasks_size;
+  }
+
+  // Run the tasks on the calling thread when there is nothing to parallelize.
+  if (1 >= threads_size) {
+    Worker worker = {.pool = &pool, .index = 0};
+    run_worker(&worker);
+    return pool.failed;
+  }
+
+  // Allocate the workers.
+  // The calling thread is the first worker, so it does not get a thread of its
+  // own.
+  Worker *workers = malloc(threads_size * sizeof(*workers));
+  if (NULL == workers) {
+    goto out;
+  }
+
+  for (size_t worker_index = 0; worker_index < threads_size; ++worker_index) {
+    workers[worker_index].pool = &pool;
+    workers[worker_index].index = worker_index;
+  }
+
+  // Start the worker threads.
+  size_t started_threads_size = 1;
+  for (; started_threads_size < threads_size; ++started_threads_size) {
+    int error = pthread_create(&(workers[started_threads_size].thread), NULL,
+                               run_worker, &(workers[started_threads_size]));
+    if (0 != error) {
+      // Keep going with the threads that have already been started.
+      errno = error;
+      break;
+    }
+  }
+
+  run_worker(&(workers[0]));
+
+  // Wait for all worker threads to finish.
+  for (size_t worker_index = 1; worker_index < started_threads_size;
+       ++worker_index) {
+    pthread_join(workers[worker_index].thread, NULL);
+  }
+
+  ret = pool.failed;
+
+  free(workers);
+
+out:
+  return ret;
+}
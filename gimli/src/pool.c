@@ -0,0 +1,897 @@
+#define _GNU_SOURCE
+
+#include "gimli/pool.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gimli/container.h"
+#include "gimli/gimli_directory.h"
+#include "gimli/socket_message.h"
+#include "gimli/uuid.h"
+#include "stb_ds/stb_ds.h"
+
+// The pool's socket, relative to the gimli directory.
+#define POOL_SOCKET_NAME "pool.sock"
+
+#define POOL_LISTEN_BACKLOG 128
+
+static const uint64_t NANOSECONDS_PER_SECOND = 1000 * 1000 * 1000;
+static const uint64_t NANOSECONDS_PER_MILLISECOND = 1000 * 1000;
+
+// The delay (in milliseconds) before an image is refilled again after its
+// containers failed to park, which doubles with every failure in a row.
+static const uint64_t POOL_RETRY_MIN_DELAY = 100;
+static const uint64_t POOL_RETRY_MAX_DELAY = 30 * 1000;
+
+// The time (in milliseconds) that a client has to send its request once it
+// has connected, after which it is dropped.
+static const uint64_t POOL_REQUEST_TIMEOUT = 5 * 1000;
+
+// A request is a single message holding the image and the command, as null
+// terminated strings, along with the client's standard streams.
+// The pool answers it with a dispatched (or rejected) response once a
+// container has been handed the command, and with an exited response once the
+// command exits.
+typedef enum PoolResponseType {
+  POOL_RESPONSE_TYPE_DISPATCHED = 0,
+  POOL_RESPONSE_TYPE_REJECTED,
+  POOL_RESPONSE_TYPE_EXITED,
+} PoolResponseType;
+
+typedef struct PoolResponse {
+  int32_t type;
+
+  // The error number of a rejected request, or the exit code of the command.
+  int32_t value;
+} PoolResponse;
+
+typedef struct PoolContainer {
+  pid_t pid;
+  size_t image_index;
+
+  // The container's command socket, which is -1 once it has been handed a
+  // command.
+  int control_fd;
+
+  // The connection of the client whose command the container runs, which is
+  // -1 while the container is parked.
+  int client_fd;
+
+  char *hostname;
+  char directory[PATH_MAX];
+  char root_fs_directory[PATH_MAX];
+} PoolContainer;
+
+typedef struct PoolImage {
+  const char *name;
+  Image *image;
+  size_t parked_size;
+
+  // The containers of the image that failed to park in a row, and the time
+  // before which the image is not refilled again.
+  size_t failures_size;
+  uint64_t retry_time;
+} PoolImage;
+
+// A connection whose request has not been received yet.
+typedef struct PoolClient {
+  int fd;
+  uint64_t deadline;
+} PoolClient;
+
+typedef struct Pool {
+  ImageStore *image_store;
+  LayerStore *layer_store;
+  PoolImage *images;
+  size_t images_size;
+  size_t size;
+
+  // Every container of the pool, both parked and running.
+  PoolContainer **containers;
+
+  // The clients are received from along with the signals, so that a client
+  // that never sends its request does not hold the pool up.
+  PoolClient *clients;
+
+  int listen_fd;
+  int signal_fd;
+  int is_stopping;
+} Pool;
+
+void pool_format_default_socket_path(char *path, size_t size) {
+  snprintf(path, size, "%s/" POOL_SOCKET_NAME, gimli_directory_get());
+}
+
+static int format_socket_address(const char *socket_path,
+                                 struct sockaddr_un *out_address) {
+  memset(out_address, 0, sizeof(*out_address));
+  out_address->sun_family = AF_UNIX;
+
+  size_t socket_path_size = strlen(socket_path) + 1;
+  if (sizeof(out_address->sun_path) < socket_path_size) {
+    errno = ENAMETOOLONG;
+    return 1;
+  }
+
+  memcpy(out_address->sun_path, socket_path, socket_path_size);
+
+  return 0;
+}
+
+static int send_response(int client_fd, PoolResponseType type, int value) {
+  PoolResponse response = {
+      .type = type,
+      .value = value,
+  };
+
+  return socket_message_send(client_fd, &response, sizeof(response), NULL, 0);
+}
+
+static uint64_t get_monotonic_time(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+
+  return ((uint64_t)time.tv_sec * NANOSECONDS_PER_SECOND) +
+         (uint64_t)time.tv_nsec;
+}
+
+static int get_poll_timeout(uint64_t deadline) {
+  uint64_t now = get_monotonic_time();
+  if (now >= deadline) {
+    return 0;
+  }
+
+  // Round up, so that the deadline has passed when the poll times out.
+  uint64_t timeout = (deadline - now + NANOSECONDS_PER_MILLISECOND - 1) /
+                     NANOSECONDS_PER_MILLISECOND;
+
+  return (INT_MAX < timeout) ? INT_MAX : (int)timeout;
+}
+
+static void record_failure(Pool *self, size_t image_index) {
+  PoolImage *image = &self->images[image_index];
+
+  uint64_t delay = POOL_RETRY_MIN_DELAY;
+  for (size_t failure_index = 0;
+       (failure_index < image->failures_size) && (POOL_RETRY_MAX_DELAY > delay);
+       ++failure_index) {
+    delay *= 2;
+  }
+
+  if (POOL_RETRY_MAX_DELAY < delay) {
+    delay = POOL_RETRY_MAX_DELAY;
+  }
+
+  ++image->failures_size;
+  image->retry_time =
+      get_monotonic_time() + (delay * NANOSECONDS_PER_MILLISECOND);
+}
+
+static int park_container(Pool *self, size_t image_index) {
+  int ret = 1;
+
+  PoolContainer *container = malloc(sizeof(*container));
+  if (NULL == container) {
+    goto out;
+  }
+
+  container->image_index = image_index;
+  container->client_fd = -1;
+
+  // Create the container directory.
+  if (0 != uuid_generate(&container->hostname)) {
+    goto out_free_container;
+  }
+
+  container_format_directories(container->hostname, container->directory,
+                               container->root_fs_directory);
+
+  if (0 != mkdir(container->directory, 0755)) {
+    goto out_free_hostname;
+  }
+
+  // Create the socket that the container receives its command over.
+  int control_fds[2];
+  if (0 !=
+      socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, control_fds)) {
+    goto out_remove_directory;
+  }
+
+  // Clone the container, which sets itself up and parks until it is handed a
+  // command.
+  ContainerConfiguration container_configuration = {
+      .image = self->images[image_index].image,
+      .directory = container->directory,
+      .root_fs_directory = container->root_fs_directory,
+      .hostname = container->hostname,
+      .command = NULL,
+      .layer_store = self->layer_store,
+      .shared_root_directory = NULL,
+      .ephemeral_size = NULL,
+      .cgroup_fd = -1,
+      .log_fd = -1,
+      .control_fd = control_fds[1],
+  };
+
+  // The pool reaps its containers as they exit through `SIGCHLD`, so it does
+  // not need their pidfds.
+  container->pid = container_clone(&container_configuration, NULL);
+  if (-1 == container->pid) {
+    close(control_fds[0]);
+    close(control_fds[1]);
+    goto out_remove_directory;
+  }
+
+  close(control_fds[1]);
+  container->control_fd = control_fds[0];
+
+  arrput(self->containers, container);
+  ++self->images[image_index].parked_size;
+
+  ret = 0;
+  goto out;
+
+out_remove_directory:
+  container_remove_directory(container->directory,
+                             container->root_fs_directory, container->hostname);
+
+out_free_hostname:
+  free(container->hostname);
+
+out_free_container:
+  free(container);
+
+out:
+  return ret;
+}
+
+static void remove_container(Pool *self, size_t container_index) {
+  PoolContainer *container = self->containers[container_index];
+
+  if (-1 != container->control_fd) {
+    close(container->control_fd);
+    --self->images[container->image_index].parked_size;
+  }
+
+  if (-1 != container->client_fd) {
+    close(container->client_fd);
+  }
+
+  container_remove_directory(container->directory,
+                             container->root_fs_directory, container->hostname);
+
+  free(container->hostname);
+  free(container);
+
+  arrdelswap(self->containers, container_index);
+}
+
+static void discard_container(Pool *self, PoolContainer *container) {
+  // Kill the container and reap it right away, so that it is not taken
+  // again and its exit is not handled as a parked container's.
+  kill(container->pid, SIGKILL);
+  while ((-1 == waitpid(container->pid, NULL, 0)) && (EINTR == errno)) {
+  }
+
+  record_failure(self, container->image_index);
+
+  for (ptrdiff_t container_index = 0;
+       container_index < arrlen(self->containers); ++container_index) {
+    if (container == self->containers[container_index]) {
+      remove_container(self, (size_t)container_index);
+      return;
+    }
+  }
+}
+
+static PoolContainer *take_parked_container(Pool *self, size_t image_index) {
+  for (ptrdiff_t container_index = 0;
+       container_index < arrlen(self->containers); ++container_index) {
+    PoolContainer *container = self->containers[container_index];
+    if ((image_index == container->image_index) &&
+        (-1 != container->control_fd)) {
+      return container;
+    }
+  }
+
+  // There are no parked containers for the image, so park one right away.
+  if (0 != park_container(self, image_index)) {
+    return NULL;
+  }
+
+  return self->containers[arrlen(self->containers) - 1];
+}
+
+static int find_pool_image(Pool *self, const char *image, size_t *out_index) {
+  // Try the images by the names the pool was started with, and then by the
+  // images they resolve to.
+  for (size_t image_index = 0; image_index < self->images_size;
+       ++image_index) {
+    if (0 == strcmp(image, self->images[image_index].name)) {
+      *out_index = image_index;
+      return 0;
+    }
+  }
+
+  Image *found_image =
+      image_store_get_image_by_name(self->image_store, image);
+  for (size_t image_index = 0; image_index < self->images_size;
+       ++image_index) {
+    if ((NULL != found_image) &&
+        (found_image == self->images[image_index].image)) {
+      *out_index = image_index;
+      return 0;
+    }
+  }
+
+  errno = ENOENT;
+  return 1;
+}
+
+static void dispatch(Pool *self, int client_fd) {
+  // Receive the request.
+  char *data = malloc(SOCKET_MESSAGE_MAX_SIZE);
+  if (NULL == data) {
+    send_response(client_fd, POOL_RESPONSE_TYPE_REJECTED, errno);
+    goto out_close_client;
+  }
+
+  size_t data_size;
+  int streams[CONTAINER_STREAMS_SIZE];
+  if (0 != socket_message_receive(client_fd, data, SOCKET_MESSAGE_MAX_SIZE,
+                                  &data_size, streams,
+                                  CONTAINER_STREAMS_SIZE)) {
+    send_response(client_fd, POOL_RESPONSE_TYPE_REJECTED, errno);
+    goto out_free_data;
+  }
+
+  // The request holds the image, followed by at least a single command part.
+  char **strings;
+  size_t strings_size;
+  if (0 != socket_message_unpack_strings(data, data_size, &strings,
+                                         &strings_size)) {
+    send_response(client_fd, POOL_RESPONSE_TYPE_REJECTED, errno);
+    goto out_close_streams;
+  }
+
+  if (2 > strings_size) {
+    send_response(client_fd, POOL_RESPONSE_TYPE_REJECTED, EPROTO);
+    goto out_free_strings;
+  }
+
+  // Take a parked container for the image.
+  size_t image_index;
+  if (0 != find_pool_image(self, strings[0], &image_index)) {
+    send_response(client_fd, POOL_RESPONSE_TYPE_REJECTED, errno);
+    goto out_free_strings;
+  }
+
+  PoolContainer *container = take_parked_container(self, image_index);
+  if (NULL == container) {
+    send_response(client_fd, POOL_RESPONSE_TYPE_REJECTED, errno);
+    goto out_free_strings;
+  }
+
+  // Hand the container the command and the client's standard streams.
+  // A container that fails to take them is broken, and is discarded.
+  if (0 != container_send_command(container->control_fd,
+                                  (const char *const *)(strings + 1),
+                                  strings_size - 1, streams)) {
+    send_response(client_fd, POOL_RESPONSE_TYPE_REJECTED, errno);
+    discard_container(self, container);
+    goto out_free_strings;
+  }
+
+  close(container->control_fd);
+  container->control_fd = -1;
+  --self->images[image_index].parked_size;
+
+  // The container set itself up, so the image is refilled right away again.
+  self->images[image_index].failures_size = 0;
+  self->images[image_index].retry_time = 0;
+
+  // The client is answered again once the command exits.
+  if (0 == send_response(client_fd, POOL_RESPONSE_TYPE_DISPATCHED, 0)) {
+    container->client_fd = client_fd;
+    client_fd = -1;
+  }
+
+out_free_strings:
+  free(strings);
+
+out_close_streams:
+  for (size_t stream = 0; stream < CONTAINER_STREAMS_SIZE; ++stream) {
+    close(streams[stream]);
+  }
+
+out_free_data:
+  free(data);
+
+out_close_client:
+  if (-1 != client_fd) {
+    close(client_fd);
+  }
+}
+
+static void handle_exit(Pool *self, pid_t pid, int status) {
+  for (ptrdiff_t container_index = 0;
+       container_index < arrlen(self->containers); ++container_index) {
+    PoolContainer *container = self->containers[container_index];
+    if (pid != container->pid) {
+      continue;
+    }
+
+    // A container that exits while it is parked failed setting itself up,
+    // unless the pool released it.
+    if ((-1 != container->control_fd) && (!self->is_stopping)) {
+      printf("=> parked container (%d) exited, status (%d)\n", pid, status);
+      record_failure(self, container->image_index);
+    }
+
+    // Answer the client with the command's exit code.
+    if (-1 != container->client_fd) {
+      int exit_code = WIFEXITED(status) ? WEXITSTATUS(status)
+                                        : (128 + WTERMSIG(status));
+      send_response(container->client_fd, POOL_RESPONSE_TYPE_EXITED,
+                    exit_code);
+    }
+
+    remove_container(self, (size_t)container_index);
+    return;
+  }
+}
+
+static void reap_exited_containers(Pool *self) {
+  for (;;) {
+    int status;
+    pid_t pid = waitpid(-1, &status, WNOHANG);
+    if (0 >= pid) {
+      return;
+    }
+
+    handle_exit(self, pid, status);
+  }
+}
+
+static int handle_signals(Pool *self) {
+  for (;;) {
+    struct signalfd_siginfo signal_information;
+    ssize_t bytes_read = read(self->signal_fd, &signal_information,
+                              sizeof(signal_information));
+    if (-1 == bytes_read) {
+      return ((EAGAIN == errno) || (EINTR == errno)) ? 0 : 1;
+    }
+
+    if (SIGCHLD == signal_information.ssi_signo) {
+      reap_exited_containers(self);
+    } else {
+      self->is_stopping = 1;
+    }
+  }
+}
+
+// Returns the timeout of the next poll, which is -1 once the pool is full.
+static int refill(Pool *self) {
+  uint64_t now = get_monotonic_time();
+  uint64_t retry_time = 0;
+
+  // Park a single container at a time, so that requests are not held back by
+  // refilling the pool, and skip the images that are backing off.
+  for (size_t image_index = 0; image_index < self->images_size;
+       ++image_index) {
+    PoolImage *image = &self->images[image_index];
+    if (self->size <= image->parked_size) {
+      continue;
+    }
+
+    if (now < image->retry_time) {
+      if ((0 == retry_time) || (image->retry_time < retry_time)) {
+        retry_time = image->retry_time;
+      }
+
+      continue;
+    }
+
+    if (0 != park_container(self, image_index)) {
+      printf("=> parking container failed, error(%d): [%s]\n", errno,
+             strerror(errno));
+      record_failure(self, image_index);
+    }
+
+    return 0;
+  }
+
+  if (0 == retry_time) {
+    return -1;
+  }
+
+  return get_poll_timeout(retry_time);
+}
+
+static int open_listen_socket(const char *socket_path) {
+  struct sockaddr_un address;
+  if (0 != format_socket_address(socket_path, &address)) {
+    return -1;
+  }
+
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (-1 == fd) {
+    return -1;
+  }
+
+  // Remove the socket of a previous pool.
+  unlink(socket_path);
+
+  if ((0 != bind(fd, (const struct sockaddr *)&address, sizeof(address))) ||
+      (0 != listen(fd, POOL_LISTEN_BACKLOG))) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+static void accept_client(Pool *self) {
+  // The client is only received from once its request has arrived, so its
+  // socket never blocks the pool.
+  int client_fd =
+      accept4(self->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (-1 == client_fd) {
+    return;
+  }
+
+  PoolClient client = {
+      .fd = client_fd,
+      .deadline = get_monotonic_time() +
+                  (POOL_REQUEST_TIMEOUT * NANOSECONDS_PER_MILLISECOND),
+  };
+  arrput(self->clients, client);
+}
+
+// Returns the timeout of the next poll, which is the earlier of the refill's
+// timeout and the clients' deadlines.
+static int drop_expired_clients(Pool *self, int refill_timeout) {
+  uint64_t now = get_monotonic_time();
+  uint64_t deadline = 0;
+
+  for (ptrdiff_t client_index = arrlen(self->clients) - 1; client_index >= 0;
+       --client_index) {
+    PoolClient *client = &self->clients[client_index];
+    if (now >= client->deadline) {
+      send_response(client->fd, POOL_RESPONSE_TYPE_REJECTED, ETIMEDOUT);
+      close(client->fd);
+      arrdelswap(self->clients, client_index);
+      continue;
+    }
+
+    if ((0 == deadline) || (client->deadline < deadline)) {
+      deadline = client->deadline;
+    }
+  }
+
+  if (0 == deadline) {
+    return refill_timeout;
+  }
+
+  int timeout = get_poll_timeout(deadline);
+
+  return ((-1 == refill_timeout) || (timeout < refill_timeout))
+             ? timeout
+             : refill_timeout;
+}
+
+static void add_poll_fd(struct pollfd **poll_fds, int fd) {
+  struct pollfd poll_fd = {.fd = fd, .events = POLLIN, .revents = 0};
+  arrput(*poll_fds, poll_fd);
+}
+
+static int serve(Pool *self) {
+  int ret = 1;
+
+  struct pollfd *poll_fds = NULL;
+  int refill_timeout = 0;
+
+  while (!self->is_stopping) {
+    int timeout = drop_expired_clients(self, refill_timeout);
+
+    // The clients' sockets follow the listening socket and the signals.
+    arrsetlen(poll_fds, 0);
+    add_poll_fd(&poll_fds, self->listen_fd);
+    add_poll_fd(&poll_fds, self->signal_fd);
+    for (ptrdiff_t client_index = 0; client_index < arrlen(self->clients);
+         ++client_index) {
+      add_poll_fd(&poll_fds, self->clients[client_index].fd);
+    }
+
+    // Refill the pool whenever there is nothing else to do.
+    int ready = poll(poll_fds, (nfds_t)arrlen(poll_fds), timeout);
+    if (-1 == ready) {
+      if (EINTR == errno) {
+        continue;
+      }
+
+      goto out;
+    }
+
+    if (0 == ready) {
+      refill_timeout = refill(self);
+      continue;
+    }
+
+    // Either the containers have changed, or a request is about to take one,
+    // so check whether the pool needs refilling again.
+    refill_timeout = 0;
+
+    if (0 != (poll_fds[1].revents & POLLIN)) {
+      if (0 != handle_signals(self)) {
+        goto out;
+      }
+    }
+
+    // Dispatch the requests that have arrived (or the clients that hung up),
+    // from the last client, so that removing one keeps the rest in place.
+    for (ptrdiff_t client_index = arrlen(self->clients) - 1; client_index >= 0;
+         --client_index) {
+      if (0 == poll_fds[client_index + 2].revents) {
+        continue;
+      }
+
+      int client_fd = self->clients[client_index].fd;
+      arrdelswap(self->clients, client_index);
+      dispatch(self, client_fd);
+    }
+
+    if (0 != (poll_fds[0].revents & POLLIN)) {
+      accept_client(self);
+    }
+  }
+
+  ret = 0;
+
+out:
+  arrfree(poll_fds);
+
+  return ret;
+}
+
+static void stop(Pool *self) {
+  self->is_stopping = 1;
+
+  // Drop the clients whose requests have not arrived.
+  for (ptrdiff_t client_index = 0; client_index < arrlen(self->clients);
+       ++client_index) {
+    close(self->clients[client_index].fd);
+  }
+
+  arrfree(self->clients);
+
+  // Release the parked containers, which exit once their sockets are closed.
+  for (ptrdiff_t container_index = 0;
+       container_index < arrlen(self->containers); ++container_index) {
+    PoolContainer *container = self->containers[container_index];
+    if (-1 != container->control_fd) {
+      close(container->control_fd);
+      container->control_fd = -1;
+      --self->images[container->image_index].parked_size;
+    }
+  }
+
+  // Wait for every container, including the ones that still run commands.
+  while (0 < arrlen(self->containers)) {
+    int status;
+    pid_t pid = waitpid(-1, &status, 0);
+    if (-1 == pid) {
+      if (EINTR == errno) {
+        continue;
+      }
+
+      // There are no children left to wait for, so remove the remaining
+      // containers as they are.
+      while (0 < arrlen(self->containers)) {
+        remove_container(self, 0);
+      }
+
+      break;
+    }
+
+    handle_exit(self, pid, status);
+  }
+}
+
+int pool_serve(ImageStore *image_store, LayerStore *layer_store,
+               const char *const *images, size_t images_size, size_t size,
+               const char *socket_path) {
+  int ret = 1;
+
+  Pool pool = {
+      .image_store = image_store,
+      .layer_store = layer_store,
+      .images = NULL,
+      .images_size = images_size,
+      .size = size,
+      .containers = NULL,
+      .clients = NULL,
+      .listen_fd = -1,
+      .signal_fd = -1,
+      .is_stopping = 0,
+  };
+
+  // Locate the images and load their layers up front, so that containers are
+  // parked without touching the stores.
+  pool.images = calloc(images_size, sizeof(*pool.images));
+  if (NULL == pool.images) {
+    goto out;
+  }
+
+  for (size_t image_index = 0; image_index < images_size; ++image_index) {
+    PoolImage *pool_image = &pool.images[image_index];
+    pool_image->name = images[image_index];
+
+    pool_image->image =
+        image_store_get_image_by_name(image_store, images[image_index]);
+    if (NULL == pool_image->image) {
+      printf("=> no such image [%s]\n", images[image_index]);
+      errno = ENOENT;
+      goto out_free_images;
+    }
+
+    if (0 != layer_store_load_image_layers(layer_store, pool_image->image)) {
+      goto out_free_images;
+    }
+  }
+
+  // Handle exited containers and stop requests through a file descriptor, so
+  // that they are handled along with the requests.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGCHLD);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+
+  sigset_t previous_signals;
+  if (0 != sigprocmask(SIG_BLOCK, &signals, &previous_signals)) {
+    goto out_free_images;
+  }
+
+  pool.signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (-1 == pool.signal_fd) {
+    goto out_restore_signals;
+  }
+
+  pool.listen_fd = open_listen_socket(socket_path);
+  if (-1 == pool.listen_fd) {
+    goto out_close_signal_fd;
+  }
+
+  ret = serve(&pool);
+
+  // Preserve the error of the serving loop while the pool stops.
+  int serve_errno = errno;
+
+  stop(&pool);
+
+  close(pool.listen_fd);
+  unlink(socket_path);
+
+  errno = serve_errno;
+
+out_close_signal_fd:
+  close(pool.signal_fd);
+
+out_restore_signals:
+  sigprocmask(SIG_SETMASK, &previous_signals, NULL);
+
+out_free_images:
+  arrfree(pool.containers);
+  free(pool.images);
+
+out:
+  return ret;
+}
+
+int pool_run(const char *socket_path, const char *image,
+             const char *const *command, size_t command_size,
+             int *out_exit_code, int *out_is_dispatched) {
+  int ret = 1;
+
+  *out_is_dispatched = 0;
+
+  // Pack the request.
+  char *data = malloc(SOCKET_MESSAGE_MAX_SIZE);
+  if (NULL == data) {
+    goto out;
+  }
+
+  size_t image_size;
+  size_t command_data_size;
+  if ((0 != socket_message_pack_strings(&image, 1, data,
+                                        SOCKET_MESSAGE_MAX_SIZE,
+                                        &image_size)) ||
+      (0 != socket_message_pack_strings(
+                command, command_size, data + image_size,
+                SOCKET_MESSAGE_MAX_SIZE - image_size, &command_data_size))) {
+    goto out_free_data;
+  }
+
+  // Connect to the pool.
+  struct sockaddr_un address;
+  if (0 != format_socket_address(socket_path, &address)) {
+    goto out_free_data;
+  }
+
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (-1 == fd) {
+    goto out_free_data;
+  }
+
+  if (0 != connect(fd, (const struct sockaddr *)&address, sizeof(address))) {
+    goto out_close_fd;
+  }
+
+  // Flush any buffered output before the command writes to the same streams.
+  fflush(stdout);
+
+  // Send the request along with the standard streams.
+  const int streams[CONTAINER_STREAMS_SIZE] = {STDIN_FILENO, STDOUT_FILENO,
+                                               STDERR_FILENO};
+  if (0 != socket_message_send(fd, data, image_size + command_data_size,
+                               streams, CONTAINER_STREAMS_SIZE)) {
+    goto out_close_fd;
+  }
+
+  // Wait for the request to be dispatched, and then for the command to exit.
+  for (;;) {
+    PoolResponse response;
+    size_t response_size;
+    if (0 != socket_message_receive(fd, &response, sizeof(response),
+                                    &response_size, NULL, 0)) {
+      goto out_close_fd;
+    }
+
+    if ((sizeof(response) != response_size) ||
+        (POOL_RESPONSE_TYPE_EXITED < response.type) ||
+        (0 > response.type)) {
+      errno = EPROTO;
+      goto out_close_fd;
+    }
+
+    switch ((PoolResponseType)response.type) {
+      case POOL_RESPONSE_TYPE_DISPATCHED:
+        *out_is_dispatched = 1;
+        break;
+
+      case POOL_RESPONSE_TYPE_REJECTED:
+        errno = response.value;
+        goto out_close_fd;
+
+      case POOL_RESPONSE_TYPE_EXITED:
+        *out_exit_code = response.value;
+        ret = 0;
+        goto out_close_fd;
+    }
+  }
+
+out_close_fd:
+  close(fd);
+
+out_free_data:
+  free(data);
+
+out:
+  return ret;
+}
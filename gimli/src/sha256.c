@@ -0,0 +1,178 @@
+#include "gimli/sha256.h"
+
+#include <string.h>
+
+static const uint32_t ROUND_CONSTANTS[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t INITIAL_STATE[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+static uint32_t rotate_right(uint32_t value, unsigned int count) {
+  return (value >> count) | (value << (32 - count));
+}
+
+static void process_block(Sha256 *self, const uint8_t *block) {
+  // Expand the block into the message schedule.
+  uint32_t schedule[64];
+  for (size_t word_index = 0; word_index < 16; ++word_index) {
+    const uint8_t *word = block + (word_index * 4);
+    schedule[word_index] = ((uint32_t)word[0] << 24) |
+                           ((uint32_t)word[1] << 16) |
+                           ((uint32_t)word[2] << 8) | (uint32_t)word[3];
+  }
+
+  for (size_t word_index = 16; word_index < 64; ++word_index) {
+    uint32_t s0 = rotate_right(schedule[word_index - 15], 7) ^
+                  rotate_right(schedule[word_index - 15], 18) ^
+                  (schedule[word_index - 15] >> 3);
+    uint32_t s1 = rotate_right(schedule[word_index - 2], 17) ^
+                  rotate_right(schedule[word_index - 2], 19) ^
+                  (schedule[word_index - 2] >> 10);
+    schedule[word_index] =
+        schedule[word_index - 16] + s0 + schedule[word_index - 7] + s1;
+  }
+
+  // Run the compression rounds.
+  uint32_t a = self->state[0];
+  uint32_t b = self->state[1];
+  uint32_t c = self->state[2];
+  uint32_t d = self->state[3];
+  uint32_t e = self->state[4];
+  uint32_t f = self->state[5];
+  uint32_t g = self->state[6];
+  uint32_t h = self->state[7];
+
+  for (size_t round_index = 0; round_index < 64; ++round_index) {
+    uint32_t s1 = rotate_right(e, 6) ^ rotate_right(e, 11) ^ rotate_right(e, 25);
+    uint32_t choice = (e & f) ^ ((~e) & g);
+    uint32_t temp1 =
+        h + s1 + choice + ROUND_CONSTANTS[round_index] + schedule[round_index];
+    uint32_t s0 = rotate_right(a, 2) ^ rotate_right(a, 13) ^ rotate_right(a, 22);
+    uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+    uint32_t temp2 = s0 + majority;
+
+    h = g;
+    g = f;
+    f = e;
+    e = d + temp1;
+    d = c;
+    c = b;
+    b = a;
+    a = temp1 + temp2;
+  }
+
+  // Add the compressed block to the current state.
+  self->state[0] += a;
+  self->state[1] += b;
+  self->state[2] += c;
+  self->state[3] += d;
+  self->state[4] += e;
+  self->state[5] += f;
+  self->state[6] += g;
+  self->state[7] += h;
+}
+
+void sha256_init(Sha256 *self) {
+  memcpy(self->state, INITIAL_STATE, sizeof(self->state));
+  self->size = 0;
+  self->block_size = 0;
+}
+
+void sha256_update(Sha256 *self, const void *data, size_t size) {
+  const uint8_t *cursor = data;
+
+  self->size += size;
+
+  // Complete a partially filled block first.
+  if (0 < self->block_size) {
+    size_t copy_size = SHA256_BLOCK_SIZE - self->block_size;
+    if (copy_size > size) {
+      copy_size = size;
+    }
+
+    memcpy(self->block + self->block_size, cursor, copy_size);
+    self->block_size += copy_size;
+    cursor += copy_size;
+    size -= copy_size;
+
+    if (SHA256_BLOCK_SIZE != self->block_size) {
+      return;
+    }
+
+    process_block(self, self->block);
+    self->block_size = 0;
+  }
+
+  // Process full blocks directly from the input.
+  while (SHA256_BLOCK_SIZE <= size) {
+    process_block(self, cursor);
+    cursor += SHA256_BLOCK_SIZE;
+    size -= SHA256_BLOCK_SIZE;
+  }
+
+  // Keep the remaining bytes for the next update.
+  memcpy(self->block, cursor, size);
+  self->block_size = size;
+}
+
+void sha256_final(Sha256 *self, uint8_t out_digest[SHA256_DIGEST_SIZE]) {
+  uint64_t size_in_bits = self->size * 8;
+
+  // Append the terminating bit, and pad the block with zeros up to the message
+  // length field.
+  self->block[self->block_size] = 0x80;
+  ++self->block_size;
+
+  if ((SHA256_BLOCK_SIZE - sizeof(size_in_bits)) < self->block_size) {
+    memset(self->block + self->block_size, 0,
+           SHA256_BLOCK_SIZE - self->block_size);
+    process_block(self, self->block);
+    self->block_size = 0;
+  }
+
+  memset(self->block + self->block_size, 0,
+         SHA256_BLOCK_SIZE - sizeof(size_in_bits) - self->block_size);
+
+  // Append the message length in bits as a big endian integer.
+  for (size_t byte_index = 0; byte_index < sizeof(size_in_bits);
+       ++byte_index) {
+    self->block[SHA256_BLOCK_SIZE - 1 - byte_index] =
+        (uint8_t)(size_in_bits >> (byte_index * 8));
+  }
+
+  process_block(self, self->block);
+
+  // Serialize the state as big endian integers.
+  for (size_t word_index = 0; word_index < 8; ++word_index) {
+    out_digest[word_index * 4] = (uint8_t)(self->state[word_index] >> 24);
+    out_digest[(word_index * 4) + 1] = (uint8_t)(self->state[word_index] >> 16);
+    out_digest[(word_index * 4) + 2] = (uint8_t)(self->state[word_index] >> 8);
+    out_digest[(word_index * 4) + 3] = (uint8_t)self->state[word_index];
+  }
+}
+
+void sha256_to_hex(const uint8_t digest[SHA256_DIGEST_SIZE],
+                   char out_hex[SHA256_HEX_DIGEST_SIZE + 1]) {
+  for (size_t byte_index = 0; byte_index < SHA256_DIGEST_SIZE; ++byte_index) {
+    out_hex[byte_index * 2] = HEX_DIGITS[digest[byte_index] >> 4];
+    out_hex[(byte_index * 2) + 1] = HEX_DIGITS[digest[byte_index] & 0xF];
+  }
+
+  out_hex[SHA256_HEX_DIGEST_SIZE] = '\0';
+}
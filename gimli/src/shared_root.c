@@ -0,0 +1,179 @@
+#define _GNU_SOURCE
+
+#include "gimli/shared_root.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "gimli/digest.h"
+#include "gimli/gimli_directory.h"
+#include "gimli/overlay.h"
+
+// The directory that shared roots are mounted in, relative to the gimli
+// directory.
+// Each root is mounted on a directory named after the hex chain ID of its
+// image's top-most layer, next to its lock files.
+#define SHARED_ROOT_DIRECTORY "shared"
+
+// The lock that is held while the root is mounted or unmounted, which is only
+// held briefly, and the lock that the root's users hold shared.
+#define SHARED_ROOT_MOUNT_LOCK_SUFFIX ".lock"
+#define SHARED_ROOT_USERS_LOCK_SUFFIX ".users"
+
+static int is_mounted(const char *directory, const char *parent_directory) {
+  struct statx directory_statx;
+  if (0 != statx(AT_FDCWD, directory, AT_SYMLINK_NOFOLLOW, STATX_BASIC_STATS,
+                 &directory_statx)) {
+    return 0;
+  }
+
+  if (0 != (directory_statx.stx_attributes_mask & STATX_ATTR_MOUNT_ROOT)) {
+    return 0 != (directory_statx.stx_attributes & STATX_ATTR_MOUNT_ROOT);
+  }
+
+  // Before Linux 5.8, tell whether the directory is a mount by its device,
+  // which is enough for overlayfs, as it has a device of its own.
+  struct statx parent_statx;
+  if (0 != statx(AT_FDCWD, parent_directory, AT_SYMLINK_NOFOLLOW,
+                 STATX_BASIC_STATS, &parent_statx)) {
+    return 0;
+  }
+
+  return (directory_statx.stx_dev_major != parent_statx.stx_dev_major) ||
+         (directory_statx.stx_dev_minor != parent_statx.stx_dev_minor);
+}
+
+static int open_lock(const char *directory, const char *suffix) {
+  char lock_path[PATH_MAX];
+  int lock_path_size =
+      snprintf(lock_path, sizeof(lock_path), "%s%s", directory, suffix);
+  if ((0 > lock_path_size) || (sizeof(lock_path) <= (size_t)lock_path_size)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  return open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+}
+
+static int lock_mount(const char *directory) {
+  int fd = open_lock(directory, SHARED_ROOT_MOUNT_LOCK_SUFFIX);
+  if (-1 == fd) {
+    return -1;
+  }
+
+  if (0 != flock(fd, LOCK_EX)) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+int shared_root_acquire(SharedRoot *self, const Image *image,
+                        LayerStore *layer_store) {
+  int ret = 1;
+
+  // Roots are named after their images' chain IDs, which an image without
+  // layers does not have.
+  if (0 == image->layers_size) {
+    errno = EINVAL;
+    goto out;
+  }
+
+  // Create the shared roots directory the first time it is used.
+  char shared_roots_directory[PATH_MAX];
+  int shared_roots_directory_size =
+      snprintf(shared_roots_directory, sizeof(shared_roots_directory),
+               "%s/" SHARED_ROOT_DIRECTORY, gimli_directory_get());
+  if ((0 > shared_roots_directory_size) ||
+      (sizeof(shared_roots_directory) <= (size_t)shared_roots_directory_size)) {
+    errno = ENAMETOOLONG;
+    goto out;
+  }
+
+  if ((0 != mkdir(shared_roots_directory, 0700)) && (EEXIST != errno)) {
+    goto out;
+  }
+
+  char chain_id[DIGEST_STRING_SIZE];
+  image_compute_chain_id(image, chain_id);
+
+  int directory_size =
+      snprintf(self->directory, sizeof(self->directory), "%s/%s",
+               shared_roots_directory, chain_id + strlen(SHA256_DIGEST_PREFIX));
+  if ((0 > directory_size) ||
+      (sizeof(self->directory) <= (size_t)directory_size)) {
+    errno = ENAMETOOLONG;
+    goto out;
+  }
+
+  if ((0 != mkdir(self->directory, 0755)) && (EEXIST != errno)) {
+    goto out;
+  }
+
+  self->users_lock_fd =
+      open_lock(self->directory, SHARED_ROOT_USERS_LOCK_SUFFIX);
+  if (-1 == self->users_lock_fd) {
+    goto out;
+  }
+
+  int mount_lock_fd = lock_mount(self->directory);
+  if (-1 == mount_lock_fd) {
+    close(self->users_lock_fd);
+    goto out;
+  }
+
+  // Mount the root, unless another user already has.
+  if (!is_mounted(self->directory, shared_roots_directory)) {
+    if (0 !=
+        overlay_mount_image_read_only(image, self->directory, layer_store)) {
+      goto out_unlock_mount;
+    }
+  }
+
+  // Become a user of the root.
+  // This never blocks, as the users lock is only taken exclusively while the
+  // mount lock is held.
+  if (0 != flock(self->users_lock_fd, LOCK_SH)) {
+    goto out_unlock_mount;
+  }
+
+  ret = 0;
+
+out_unlock_mount:
+  // Closing a lock file releases its lock.
+  close(mount_lock_fd);
+
+  if (0 != ret) {
+    close(self->users_lock_fd);
+  }
+
+out:
+  return ret;
+}
+
+void shared_root_release(SharedRoot *self) {
+  int mount_lock_fd = lock_mount(self->directory);
+
+  // Unmount the root once its last user releases it, which is when no other
+  // user holds the users lock.
+  // The containers that used the root keep their own copies of its mount, so
+  // they are not affected.
+  if ((-1 != mount_lock_fd) && (0 == flock(self->users_lock_fd, LOCK_UN)) &&
+      (0 == flock(self->users_lock_fd, LOCK_EX | LOCK_NB))) {
+    umount2(self->directory, MNT_DETACH);
+  }
+
+  close(self->users_lock_fd);
+
+  if (-1 != mount_lock_fd) {
+    close(mount_lock_fd);
+  }
+}
@@ -0,0 +1,399 @@
+#define _GNU_SOURCE
+
+#include "gimli/snapshot.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include "gimli/digest.h"
+#include "gimli/gimli_directory.h"
+#include "gimli/io.h"
+
+// The directory that snapshots are kept in, relative to the gimli directory.
+// Each snapshot is a directory named after the hex chain ID of its image's
+// top-most layer, which identifies the whole layer stack.
+#define SNAPSHOT_DIRECTORY "snapshot"
+
+// Whiteouts that are stored as files prefixed with `.wh.`, and the file that
+// marks its directory as opaque.
+#define WHITEOUT_PREFIX ".wh."
+#define OPAQUE_WHITEOUT ".wh..wh..opq"
+
+// The extended attributes that mark a directory as opaque.
+static const char *const OPAQUE_XATTRS[] = {
+    "trusted.overlay.opaque",
+    "user.overlay.opaque",
+};
+
+static int apply_directory(int layer_directory_fd, int snapshot_directory_fd,
+                           const struct stat *layer_stat);
+
+static void format_snapshot_path(const Image *image, const char *prefix,
+                                 char out_path[PATH_MAX]) {
+  char chain_id[DIGEST_STRING_SIZE];
+  image_compute_chain_id(image, chain_id);
+
+  snprintf(out_path, PATH_MAX, "%s/" SNAPSHOT_DIRECTORY "/%s%s",
+           gimli_directory_get(), prefix,
+           chain_id + strlen(SHA256_DIGEST_PREFIX));
+}
+
+int snapshot_find(const Image *image, char out_path[PATH_MAX]) {
+  if (0 == image->layers_size) {
+    errno = ENOENT;
+    return 1;
+  }
+
+  format_snapshot_path(image, "", out_path);
+
+  // Snapshots are renamed into place once they are complete, so an existing
+  // snapshot is always complete.
+  struct stat stat_buffer;
+  if (0 != stat(out_path, &stat_buffer)) {
+    return 1;
+  }
+
+  if (!S_ISDIR(stat_buffer.st_mode)) {
+    errno = ENOTDIR;
+    return 1;
+  }
+
+  return 0;
+}
+
+static int remove_entry(int snapshot_directory_fd, const char *name) {
+  if (0 == io_remove_tree_at(snapshot_directory_fd, name)) {
+    return 0;
+  }
+
+  // A whiteout may hide an entry that is not in the snapshot.
+  return (ENOENT == errno) ? 0 : 1;
+}
+
+static int clear_directory(int snapshot_directory_fd) {
+  int ret = 1;
+
+  int fd = dup(snapshot_directory_fd);
+  if (-1 == fd) {
+    goto out;
+  }
+
+  DIR *directory = fdopendir(fd);
+  if (NULL == directory) {
+    close(fd);
+    goto out;
+  }
+
+  for (;;) {
+    // Set `errno` to 0 before reading the next directory entry.
+    errno = 0;
+
+    struct dirent *entry = readdir(directory);
+    if (NULL == entry) {
+      if (0 != errno) {
+        goto out_close_directory;
+      }
+
+      break;
+    }
+
+    // Skip the "." and ".." directories.
+    if ((0 == strcmp(entry->d_name, ".")) ||
+        (0 == strcmp(entry->d_name, ".."))) {
+      continue;
+    }
+
+    if (0 != io_remove_tree_at(snapshot_directory_fd, entry->d_name)) {
+      goto out_close_directory;
+    }
+  }
+
+  ret = 0;
+
+out_close_directory:
+  closedir(directory);
+
+out:
+  return ret;
+}
+
+static int is_opaque_directory(int layer_directory_fd) {
+  for (size_t xattr_index = 0;
+       xattr_index < (sizeof(OPAQUE_XATTRS) / sizeof(*OPAQUE_XATTRS));
+       ++xattr_index) {
+    char value[2];
+    if ((1 == fgetxattr(layer_directory_fd, OPAQUE_XATTRS[xattr_index], value,
+                        sizeof(value))) &&
+        ('y' == value[0])) {
+      return 1;
+    }
+  }
+
+  return 0 == faccessat(layer_directory_fd, OPAQUE_WHITEOUT, F_OK,
+                        AT_SYMLINK_NOFOLLOW);
+}
+
+static int apply_subdirectory(int layer_directory_fd, int snapshot_directory_fd,
+                              const char *name, const struct stat *layer_stat) {
+  // Replace whatever the lower layers have at the name, unless it is a
+  // directory, which is merged with this one.
+  struct stat snapshot_stat;
+  if (0 == fstatat(snapshot_directory_fd, name, &snapshot_stat,
+                   AT_SYMLINK_NOFOLLOW)) {
+    if (!S_ISDIR(snapshot_stat.st_mode)) {
+      if (0 != remove_entry(snapshot_directory_fd, name)) {
+        return 1;
+      }
+
+      if (0 != mkdirat(snapshot_directory_fd, name, 0700)) {
+        return 1;
+      }
+    }
+  } else if ((ENOENT != errno) ||
+             (0 != mkdirat(snapshot_directory_fd, name, 0700))) {
+    return 1;
+  }
+
+  int layer_fd = openat(layer_directory_fd, name,
+                        O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (-1 == layer_fd) {
+    return 1;
+  }
+
+  int snapshot_fd = openat(snapshot_directory_fd, name,
+                           O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (-1 == snapshot_fd) {
+    close(layer_fd);
+    return 1;
+  }
+
+  return apply_directory(layer_fd, snapshot_fd, layer_stat);
+}
+
+static int apply_entry(int layer_directory_fd, int snapshot_directory_fd,
+                       const struct dirent *entry) {
+  const char *name = entry->d_name;
+
+  // Apply file whiteouts, which hide the entry from the lower layers.
+  size_t whiteout_prefix_size = strlen(WHITEOUT_PREFIX);
+  if (0 == strncmp(name, WHITEOUT_PREFIX, whiteout_prefix_size)) {
+    // The opaque whiteout has already been applied to the whole directory.
+    if (0 == strcmp(name, OPAQUE_WHITEOUT)) {
+      return 0;
+    }
+
+    return remove_entry(snapshot_directory_fd, name + whiteout_prefix_size);
+  }
+
+  // Only directories and character devices (which may be overlayfs
+  // whiteouts) need to be examined further.
+  if ((DT_DIR == entry->d_type) || (DT_CHR == entry->d_type) ||
+      (DT_UNKNOWN == entry->d_type)) {
+    struct stat layer_stat;
+    if (0 != fstatat(layer_directory_fd, name, &layer_stat,
+                     AT_SYMLINK_NOFOLLOW)) {
+      return 1;
+    }
+
+    // Apply overlayfs whiteouts, which are 0/0 character devices.
+    if (S_ISCHR(layer_stat.st_mode) && (0 == layer_stat.st_rdev)) {
+      return remove_entry(snapshot_directory_fd, name);
+    }
+
+    if (S_ISDIR(layer_stat.st_mode)) {
+      return apply_subdirectory(layer_directory_fd, snapshot_directory_fd,
+                                name, &layer_stat);
+    }
+  }
+
+  // Replace whatever the lower layers have at the name with a hard link to
+  // the layer's entry, so that the snapshot shares the layer's page cache.
+  if (0 != remove_entry(snapshot_directory_fd, name)) {
+    return 1;
+  }
+
+  return (0 == linkat(layer_directory_fd, name, snapshot_directory_fd, name, 0))
+             ? 0
+             : 1;
+}
+
+static int apply_directory(int layer_directory_fd, int snapshot_directory_fd,
+                           const struct stat *layer_stat) {
+  int ret = 1;
+
+  DIR *directory = fdopendir(layer_directory_fd);
+  if (NULL == directory) {
+    close(layer_directory_fd);
+    goto out_close_snapshot_directory_fd;
+  }
+
+  // An opaque directory hides the lower layers' entries.
+  if (is_opaque_directory(layer_directory_fd)) {
+    if (0 != clear_directory(snapshot_directory_fd)) {
+      goto out_close_directory;
+    }
+  }
+
+  // The top-most layer that has the directory decides its ownership and mode.
+  // The mode is set after the owner, as changing the owner clears the set-ID
+  // bits.
+  if ((0 != fchown(snapshot_directory_fd, layer_stat->st_uid,
+                   layer_stat->st_gid)) ||
+      (0 != fchmod(snapshot_directory_fd, layer_stat->st_mode & 07777))) {
+    goto out_close_directory;
+  }
+
+  for (;;) {
+    // Set `errno` to 0 before reading the next directory entry.
+    errno = 0;
+
+    struct dirent *entry = readdir(directory);
+    if (NULL == entry) {
+      if (0 != errno) {
+        goto out_close_directory;
+      }
+
+      break;
+    }
+
+    // Skip the "." and ".." directories.
+    if ((0 == strcmp(entry->d_name, ".")) ||
+        (0 == strcmp(entry->d_name, ".."))) {
+      continue;
+    }
+
+    if (0 != apply_entry(layer_directory_fd, snapshot_directory_fd, entry)) {
+      goto out_close_directory;
+    }
+  }
+
+  // Set the directory's times last, as adding its entries changes them.
+  const struct timespec times[2] = {layer_stat->st_atim, layer_stat->st_mtim};
+  if (0 != futimens(snapshot_directory_fd, times)) {
+    goto out_close_directory;
+  }
+
+  ret = 0;
+
+out_close_directory:
+  closedir(directory);
+
+out_close_snapshot_directory_fd:
+  close(snapshot_directory_fd);
+
+  return ret;
+}
+
+static int apply_layer(const Layer *layer, const char *snapshot_path) {
+  // The link path points at the layer's diff directory.
+  int layer_fd = open(layer->link_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (-1 == layer_fd) {
+    return 1;
+  }
+
+  struct stat layer_stat;
+  if (0 != fstat(layer_fd, &layer_stat)) {
+    close(layer_fd);
+    return 1;
+  }
+
+  int snapshot_fd =
+      open(snapshot_path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (-1 == snapshot_fd) {
+    close(layer_fd);
+    return 1;
+  }
+
+  return apply_directory(layer_fd, snapshot_fd, &layer_stat);
+}
+
+int snapshot_create(const Image *image, LayerStore *layer_store,
+                    int *out_is_created) {
+  int ret = 1;
+
+  *out_is_created = 0;
+
+  // There is nothing to flatten in an image without layers, which has no
+  // chain ID to name its snapshot after either.
+  if (0 == image->layers_size) {
+    errno = EINVAL;
+    goto out;
+  }
+
+  char snapshot_path[PATH_MAX];
+  if (0 == snapshot_find(image, snapshot_path)) {
+    ret = 0;
+    goto out;
+  }
+
+  if (ENOENT != errno) {
+    goto out;
+  }
+
+  // Create the snapshots directory the first time it is used.
+  char snapshots_path[PATH_MAX];
+  snprintf(snapshots_path, sizeof(snapshots_path),
+           "%s/" SNAPSHOT_DIRECTORY, gimli_directory_get());
+
+  if ((0 != mkdir(snapshots_path, 0700)) && (EEXIST != errno)) {
+    goto out;
+  }
+
+  // Build the snapshot in a temporary directory, which is private to this
+  // process.
+  char temporary_path[PATH_MAX];
+  char temporary_prefix[32];
+  snprintf(temporary_prefix, sizeof(temporary_prefix), ".%d-", getpid());
+  format_snapshot_path(image, temporary_prefix, temporary_path);
+
+  if (0 != mkdir(temporary_path, 0755)) {
+    goto out;
+  }
+
+  // Apply the layers from the bottom-most one to the top-most one.
+  for (size_t layer_index = 0; layer_index < image->layers_size;
+       ++layer_index) {
+    Layer *layer = layer_store_get_layer_by_diff_id(layer_store,
+                                                    image->layers[layer_index]);
+    if (NULL == layer) {
+      errno = ENOENT;
+      goto out_remove_temporary_directory;
+    }
+
+    if (0 != apply_layer(layer, temporary_path)) {
+      goto out_remove_temporary_directory;
+    }
+  }
+
+  // Publish the snapshot.
+  if (0 != rename(temporary_path, snapshot_path)) {
+    // Another process has published the same snapshot first.
+    if ((EEXIST == errno) || (ENOTEMPTY == errno)) {
+      ret = 0;
+    }
+
+    goto out_remove_temporary_directory;
+  }
+
+  *out_is_created = 1;
+  ret = 0;
+  goto out;
+
+out_remove_temporary_directory:
+  // Preserve the error while the temporary directory is removed.
+  {
+    int remove_errno = errno;
+    io_remove_tree_at(AT_FDCWD, temporary_path);
+    errno = remove_errno;
+  }
+
+out:
+  return ret;
+}
@@ -0,0 +1,214 @@
+#define _GNU_SOURCE
+
+#include "gimli/socket_message.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// The maximal number of file descriptors that are passed with a message.
+#define SOCKET_MESSAGE_MAX_FDS 8
+
+// Messages are sent over sequenced packet sockets, so each one is sent and
+// received whole by a single call, along with the file descriptors passed
+// with it.
+int socket_message_send(int fd, const void *data, size_t size, const int *fds,
+                        size_t fds_size) {
+  if (SOCKET_MESSAGE_MAX_FDS < fds_size) {
+    errno = EINVAL;
+    return 1;
+  }
+
+  struct iovec iov = {
+      .iov_base = (void *)data,
+      .iov_len = size,
+  };
+
+  struct msghdr message = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+  };
+
+  // Attach the file descriptors.
+  union {
+    char buffer[CMSG_SPACE(SOCKET_MESSAGE_MAX_FDS * sizeof(int))];
+    struct cmsghdr align;
+  } control;
+
+  if (0 < fds_size) {
+    memset(&control, 0, sizeof(control));
+
+    message.msg_control = control.buffer;
+    message.msg_controllen = CMSG_SPACE(fds_size * sizeof(int));
+
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(fds_size * sizeof(int));
+    memcpy(CMSG_DATA(header), fds, fds_size * sizeof(int));
+  }
+
+  // The peer may have gone away, which is reported as an error rather than a
+  // signal.
+  ssize_t bytes_sent;
+  do {
+    bytes_sent = sendmsg(fd, &message, MSG_NOSIGNAL);
+  } while ((-1 == bytes_sent) && (EINTR == errno));
+
+  if (-1 == bytes_sent) {
+    return 1;
+  }
+
+  return 0;
+}
+
+static void close_fds(int *fds, size_t fds_size) {
+  for (size_t fd_index = 0; fd_index < fds_size; ++fd_index) {
+    close(fds[fd_index]);
+  }
+}
+
+int socket_message_receive(int fd, void *data, size_t size, size_t *out_size,
+                           int *out_fds, size_t fds_size) {
+  if (SOCKET_MESSAGE_MAX_FDS < fds_size) {
+    errno = EINVAL;
+    return 1;
+  }
+
+  struct iovec iov = {
+      .iov_base = data,
+      .iov_len = size,
+  };
+
+  union {
+    char buffer[CMSG_SPACE(SOCKET_MESSAGE_MAX_FDS * sizeof(int))];
+    struct cmsghdr align;
+  } control;
+
+  struct msghdr message = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+      .msg_control = control.buffer,
+      .msg_controllen = sizeof(control.buffer),
+  };
+
+  ssize_t bytes_received;
+  do {
+    bytes_received = recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+  } while ((-1 == bytes_received) && (EINTR == errno));
+
+  if (-1 == bytes_received) {
+    return 1;
+  }
+
+  // Collect the passed file descriptors.
+  int fds[SOCKET_MESSAGE_MAX_FDS];
+  size_t received_fds_size = 0;
+
+  for (struct cmsghdr *header = CMSG_FIRSTHDR(&message); NULL != header;
+       header = CMSG_NXTHDR(&message, header)) {
+    if ((SOL_SOCKET != header->cmsg_level) ||
+        (SCM_RIGHTS != header->cmsg_type)) {
+      continue;
+    }
+
+    size_t header_fds_size =
+        (header->cmsg_len - CMSG_LEN(0)) / sizeof(*fds);
+    if ((SOCKET_MESSAGE_MAX_FDS - received_fds_size) < header_fds_size) {
+      header_fds_size = SOCKET_MESSAGE_MAX_FDS - received_fds_size;
+    }
+
+    memcpy(fds + received_fds_size, CMSG_DATA(header),
+           header_fds_size * sizeof(*fds));
+    received_fds_size += header_fds_size;
+  }
+
+  // The peer closed the socket.
+  if (0 == bytes_received) {
+    close_fds(fds, received_fds_size);
+    errno = ECONNRESET;
+    return 1;
+  }
+
+  // The message must have been received whole, along with exactly the
+  // expected file descriptors.
+  if ((0 != (message.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) ||
+      (fds_size != received_fds_size)) {
+    close_fds(fds, received_fds_size);
+    errno = EPROTO;
+    return 1;
+  }
+
+  if (0 < fds_size) {
+    memcpy(out_fds, fds, fds_size * sizeof(*fds));
+  }
+
+  *out_size = (size_t)bytes_received;
+
+  return 0;
+}
+
+int socket_message_pack_strings(const char *const *strings,
+                                size_t strings_size, char *buffer, size_t size,
+                                size_t *out_size) {
+  size_t offset = 0;
+
+  // Pack the strings one after the other, each with its null terminator.
+  for (size_t string_index = 0; string_index < strings_size; ++string_index) {
+    size_t string_size = strlen(strings[string_index]) + 1;
+    if ((size - offset) < string_size) {
+      errno = E2BIG;
+      return 1;
+    }
+
+    memcpy(buffer + offset, strings[string_index], string_size);
+    offset += string_size;
+  }
+
+  *out_size = offset;
+
+  return 0;
+}
+
+int socket_message_unpack_strings(char *data, size_t size, char ***out_strings,
+                                  size_t *out_strings_size) {
+  // Every string must be null terminated.
+  if ((0 == size) || ('\0' != data[size - 1])) {
+    errno = EPROTO;
+    return 1;
+  }
+
+  // Count the strings.
+  size_t strings_size = 0;
+  for (size_t offset = 0; offset < size; ++offset) {
+    if ('\0' == data[offset]) {
+      ++strings_size;
+    }
+  }
+
+  // Allocate an extra item to place a NULL item at the end of the array, as
+  // `execve` expects.
+  char **strings = malloc((strings_size + 1) * sizeof(*strings));
+  if (NULL == strings) {
+    return 1;
+  }
+
+  // Point the strings into the data.
+  char *string = data;
+  for (size_t string_index = 0; string_index < strings_size; ++string_index) {
+    strings[string_index] = string;
+    string += strlen(string) + 1;
+  }
+
+  strings[strings_size] = NULL;
+
+  *out_strings = strings;
+  *out_strings_size = strings_size;
+
+  return 0;
+}
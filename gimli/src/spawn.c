@@ -0,0 +1,400 @@
+#define _GNU_SOURCE
+
+#include "gimli/spawn.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/sched.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gimli/io.h"
+
+// The size of the stack that a process is cloned onto when `clone3` is
+// unavailable.
+// The stack is mapped lazily, so only the pages that the child touches are
+// committed.
+static const size_t CLONE_STACK_SIZE = 1024 * 1024;
+
+// The signals that are forwarded to a process while it is waited for.
+static const int FORWARDED_SIGNALS[] = {SIGINT, SIGTERM, SIGHUP, SIGQUIT};
+
+static const uint64_t NANOSECONDS_PER_SECOND = 1000 * 1000 * 1000;
+static const uint64_t NANOSECONDS_PER_MILLISECOND = 1000 * 1000;
+
+// Whether `clone3` is unavailable, which is detected by the first spawn.
+// It is missing before Linux 5.3, and seccomp filters (such as those of
+// container runtimes) commonly fail it with `ENOSYS`.
+static int is_clone3_unsupported = 0;
+
+// Whether `clone3` cannot clone a process into a cgroup, which is only
+// supported since Linux 5.7.
+static int is_clone_into_cgroup_unsupported = 0;
+
+// A process that joins its cgroup itself before it runs, as it could not be
+// cloned into it.
+typedef struct SpawnedProcess {
+  int (*function)(void *);
+  void *argument;
+  int cgroup_fd;
+} SpawnedProcess;
+
+static int run_spawned_process(void *argument) {
+  const SpawnedProcess *spawned_process = argument;
+
+  // Writing 0 moves the writing process itself.
+  int fd = openat(spawned_process->cgroup_fd, "cgroup.procs",
+                  O_WRONLY | O_CLOEXEC);
+  if (-1 == fd) {
+    return 1;
+  }
+
+  ssize_t bytes_written = write(fd, "0", 1);
+  close(fd);
+  if (1 != bytes_written) {
+    return 1;
+  }
+
+  close(spawned_process->cgroup_fd);
+
+  return spawned_process->function(spawned_process->argument);
+}
+
+static pid_t spawn_with_clone3(int (*function)(void *), void *argument,
+                               int flags, int cgroup_fd, int *out_pidfd) {
+  int pidfd = -1;
+
+  struct clone_args clone_args;
+  memset(&clone_args, 0, sizeof(clone_args));
+  clone_args.flags = (uint64_t)(unsigned int)flags;
+  clone_args.exit_signal = SIGCHLD;
+
+  if (NULL != out_pidfd) {
+    clone_args.flags |= CLONE_PIDFD;
+    clone_args.pidfd = (uint64_t)(uintptr_t)&pidfd;
+  }
+
+  if (-1 != cgroup_fd) {
+    clone_args.flags |= CLONE_INTO_CGROUP;
+    clone_args.cgroup = (uint64_t)(unsigned int)cgroup_fd;
+  }
+
+  // Without a stack, the child runs on a copy of the parent's stack, as after
+  // `fork`, so no stack needs to be allocated.
+  long pid = syscall(__NR_clone3, &clone_args, sizeof(clone_args));
+  if (0 == pid) {
+    _exit(function(argument));
+  }
+
+  if (-1 == pid) {
+    return -1;
+  }
+
+  if (NULL != out_pidfd) {
+    *out_pidfd = pidfd;
+  }
+
+  return (pid_t)pid;
+}
+
+static pid_t spawn_with_clone(int (*function)(void *), void *argument,
+                              int flags, int *out_pidfd) {
+  // Map the stack with a guard page below it, so that a stack overflow faults
+  // instead of corrupting memory.
+  // The child runs on its own copy of the stack, so the parent's copy is
+  // unmapped right after the child is cloned.
+  size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+  size_t mapping_size = page_size + CLONE_STACK_SIZE;
+
+  uint8_t *mapping =
+      mmap(NULL, mapping_size, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK | MAP_NORESERVE, -1, 0);
+  if (MAP_FAILED == mapping) {
+    return -1;
+  }
+
+  pid_t pid = -1;
+  int pidfd = -1;
+  if (0 != mprotect(mapping, page_size, PROT_NONE)) {
+    goto out_unmap_stack;
+  }
+
+  // `clone` returns the pidfd through the parent TID argument.
+  int pidfd_flags = (NULL == out_pidfd) ? 0 : CLONE_PIDFD;
+
+  pid = clone(function, mapping + mapping_size, flags | pidfd_flags | SIGCHLD,
+              argument, &pidfd);
+
+  if ((-1 != pid) && (NULL != out_pidfd)) {
+    *out_pidfd = pidfd;
+  }
+
+out_unmap_stack:
+  // Preserve the error while the stack is unmapped.
+  {
+    int clone_errno = errno;
+    munmap(mapping, mapping_size);
+    errno = clone_errno;
+  }
+
+  return pid;
+}
+
+pid_t spawn_process(int (*function)(void *), void *argument, int flags,
+                    int cgroup_fd, int *out_pidfd) {
+  // Clone the process right into its cgroup, so that it never runs outside of
+  // it.
+  if ((!is_clone3_unsupported) &&
+      ((-1 == cgroup_fd) || (!is_clone_into_cgroup_unsupported))) {
+    pid_t pid =
+        spawn_with_clone3(function, argument, flags, cgroup_fd, out_pidfd);
+    if (-1 != pid) {
+      return pid;
+    }
+
+    // Before Linux 5.7, `clone3` does not know the cgroup argument.
+    if ((-1 != cgroup_fd) && (E2BIG == errno)) {
+      is_clone_into_cgroup_unsupported = 1;
+    } else if (ENOSYS == errno) {
+      is_clone3_unsupported = 1;
+    } else {
+      return -1;
+    }
+  }
+
+  // Otherwise, the process joins the cgroup as soon as it starts.
+  SpawnedProcess spawned_process = {
+      .function = function,
+      .argument = argument,
+      .cgroup_fd = cgroup_fd,
+  };
+
+  if (-1 != cgroup_fd) {
+    function = run_spawned_process;
+    argument = &spawned_process;
+  }
+
+  if (!is_clone3_unsupported) {
+    return spawn_with_clone3(function, argument, flags, -1, out_pidfd);
+  }
+
+  return spawn_with_clone(function, argument, flags, out_pidfd);
+}
+
+int spawn_signal(int pidfd, int signal) {
+  // The C library only wraps the system call since glibc 2.36.
+  return (int)syscall(__NR_pidfd_send_signal, pidfd, signal, NULL, 0);
+}
+
+static uint64_t get_monotonic_time(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+
+  return ((uint64_t)time.tv_sec * NANOSECONDS_PER_SECOND) +
+         (uint64_t)time.tv_nsec;
+}
+
+static int get_poll_timeout(uint64_t deadline) {
+  if (0 == deadline) {
+    return -1;
+  }
+
+  uint64_t now = get_monotonic_time();
+  if (now >= deadline) {
+    return 0;
+  }
+
+  // Round up, so that the deadline has passed when the poll times out.
+  uint64_t timeout =
+      (deadline - now + NANOSECONDS_PER_MILLISECOND - 1) /
+      NANOSECONDS_PER_MILLISECOND;
+
+  return (INT_MAX < timeout) ? INT_MAX : (int)timeout;
+}
+
+int spawn_wait(pid_t pid, int pidfd, size_t timeout, Log *log,
+               int *out_status, struct rusage *out_rusage,
+               int *out_is_timed_out) {
+  int ret = 1;
+
+  *out_is_timed_out = 0;
+
+  // Without a pidfd, the process can only be waited for until it exits, once
+  // its output has ended.
+  if (-1 == pidfd) {
+    if (NULL != log) {
+      log_drain(log);
+    }
+
+    return (-1 == wait4(pid, out_status, 0, out_rusage)) ? 1 : 0;
+  }
+
+  // Receive the forwarded signals through a file descriptor, so that they are
+  // handled in the same loop as the exit of the process.
+  sigset_t signals;
+  sigemptyset(&signals);
+  for (size_t signal_index = 0;
+       signal_index < (sizeof(FORWARDED_SIGNALS) / sizeof(*FORWARDED_SIGNALS));
+       ++signal_index) {
+    sigaddset(&signals, FORWARDED_SIGNALS[signal_index]);
+  }
+
+  sigset_t old_signals;
+  if (0 != sigprocmask(SIG_BLOCK, &signals, &old_signals)) {
+    goto out;
+  }
+
+  int signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (-1 == signal_fd) {
+    goto out_restore_signals;
+  }
+
+  uint64_t deadline =
+      (0 == timeout)
+          ? 0
+          : get_monotonic_time() + ((uint64_t)timeout * NANOSECONDS_PER_SECOND);
+
+  for (;;) {
+    struct pollfd poll_fds[] = {
+        {.fd = pidfd, .events = POLLIN, .revents = 0},
+        {.fd = signal_fd, .events = POLLIN, .revents = 0},
+        {.fd = ((NULL == log) || log->is_closed) ? -1 : log->pipe_fd,
+         .events = POLLIN,
+         .revents = 0},
+    };
+
+    int poll_result = poll(poll_fds, sizeof(poll_fds) / sizeof(*poll_fds),
+                           get_poll_timeout(deadline));
+    if (-1 == poll_result) {
+      if (EINTR == errno) {
+        continue;
+      }
+
+      goto out_close_signal_fd;
+    }
+
+    // Kill the process once it has run out of time, and keep waiting for it
+    // to exit.
+    if (0 == poll_result) {
+      if (0 != spawn_signal(pidfd, SIGKILL)) {
+        goto out_close_signal_fd;
+      }
+
+      *out_is_timed_out = 1;
+      deadline = 0;
+      continue;
+    }
+
+    // Move the process's output to its log, before the process is waited
+    // for.
+    if (0 != poll_fds[2].revents) {
+      log_pump(log);
+    }
+
+    // The pidfd becomes readable once the process has exited.
+    if (0 != (poll_fds[0].revents & POLLIN)) {
+      break;
+    }
+
+    // Forward the received signals to the process.
+    struct signalfd_siginfo signal_info;
+    while (sizeof(signal_info) ==
+           read(signal_fd, &signal_info, sizeof(signal_info))) {
+      spawn_signal(pidfd, (int)signal_info.ssi_signo);
+    }
+  }
+
+  // Reap the process, which has already exited, along with its resource
+  // usage.
+  if (-1 == wait4(pid, out_status, 0, out_rusage)) {
+    goto out_close_signal_fd;
+  }
+
+  ret = 0;
+
+out_close_signal_fd:
+  close(signal_fd);
+
+out_restore_signals:
+  // Preserve the error while the signal mask is restored.
+  {
+    int wait_errno = errno;
+    sigprocmask(SIG_SETMASK, &old_signals, NULL);
+    errno = wait_errno;
+  }
+
+out:
+  return ret;
+}
+
+int spawn_detached(int (*function)(void)) {
+  pid_t pid = fork();
+  if (-1 == pid) {
+    return 1;
+  }
+
+  if (0 == pid) {
+    // Detach the process from gimli's session, and fork it again so that it
+    // is reparented (instead of becoming a zombie of gimli), and so that gimli
+    // does not wait for it.
+    setsid();
+
+    pid_t detached_pid = fork();
+    if (0 != detached_pid) {
+      _exit((-1 == detached_pid) ? 1 : 0);
+    }
+
+    // Unblock any signals that gimli handles through a file descriptor, so
+    // that the process can be stopped.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigprocmask(SIG_SETMASK, &signals, NULL);
+
+    // Detach the process from gimli's standard streams, so that it does not
+    // hold a pipe that gimli's output is read from open.
+    int null_fd = open("/dev/null", O_RDWR);
+    if (-1 != null_fd) {
+      dup2(null_fd, STDIN_FILENO);
+      dup2(null_fd, STDOUT_FILENO);
+      dup2(null_fd, STDERR_FILENO);
+
+      if (STDERR_FILENO < null_fd) {
+        close(null_fd);
+      }
+    }
+
+    // Close the rest of gimli's files, such as the sockets and pipes that
+    // other processes wait for gimli to close.
+    io_close_range(STDERR_FILENO + 1, ~0U);
+
+    _exit((0 == function()) ? 0 : 1);
+  }
+
+  // Wait for the intermediate process, which exits right after forking the
+  // detached process.
+  int status;
+  while (-1 == waitpid(pid, &status, 0)) {
+    if (EINTR != errno) {
+      return 1;
+    }
+  }
+
+  if ((!WIFEXITED(status)) || (0 != WEXITSTATUS(status))) {
+    errno = ECHILD;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,259 @@
+#define _GNU_SOURCE
+
+#include "gimli/stats.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "gimli/trace.h"
+
+// The stats path that writes the records to the standard error.
+#define STATS_STANDARD_ERROR_PATH "-"
+
+// The largest cgroup interface file that is read.
+#define STATS_CGROUP_FILE_MAX_SIZE (16 * 1024)
+
+#define STATS_LINE_SEPARATORS "\n"
+#define STATS_TOKEN_SEPARATORS " \t"
+
+// The cgroup interface files that are reported.
+// Files that the kernel does not provide are skipped (such as memory.peak
+// before Linux 5.19, or the pressure files when PSI is disabled).
+static const char *const STATS_CGROUP_FILES[] = {
+    "cpu.stat",     "memory.peak",     "io.stat",
+    "cpu.pressure", "memory.pressure", "io.pressure",
+};
+
+FILE *stats_open(const char *path) {
+  if (0 == strcmp(path, STATS_STANDARD_ERROR_PATH)) {
+    return stderr;
+  }
+
+  // Records are appended a line at a time, so that a single file collects the
+  // records of many launches.
+  return fopen(path, "ae");
+}
+
+void stats_close(FILE *file) {
+  if (stderr != file) {
+    fclose(file);
+  }
+}
+
+static void write_string(FILE *file, const char *string) {
+  fputc('"', file);
+
+  for (const unsigned char *character = (const unsigned char *)string;
+       '\0' != (*character); ++character) {
+    if (('"' == (*character)) || ('\\' == (*character))) {
+      fprintf(file, "\\%c", *character);
+    } else if (0x20 > (*character)) {
+      fprintf(file, "\\u%04x", *character);
+    } else {
+      fputc(*character, file);
+    }
+  }
+
+  fputc('"', file);
+}
+
+static int is_number(const char *value) {
+  // A number is an integer, optionally followed by a fraction (such as the
+  // pressure averages).
+  size_t integer_size = strspn(value, "0123456789");
+  if (0 == integer_size) {
+    return 0;
+  }
+
+  const char *fraction = value + integer_size;
+  if ('\0' == fraction[0]) {
+    return 1;
+  }
+
+  size_t fraction_size = strspn(fraction + 1, "0123456789");
+  return ('.' == fraction[0]) && (0 != fraction_size) &&
+         ('\0' == fraction[1 + fraction_size]);
+}
+
+static void write_value(FILE *file, const char *value) {
+  // Values that are not numbers (such as "max") are written as strings.
+  if (is_number(value)) {
+    fputs(value, file);
+  } else {
+    write_string(file, value);
+  }
+}
+
+static void write_nested_keys(FILE *file, char *token, char **token_save) {
+  fputc('{', file);
+
+  for (int is_first = 1; NULL != token;
+       token = strtok_r(NULL, STATS_TOKEN_SEPARATORS, token_save)) {
+    char *separator = strchr(token, '=');
+    if (NULL == separator) {
+      continue;
+    }
+
+    *separator = '\0';
+
+    fputs(is_first ? "" : ",", file);
+    write_string(file, token);
+    fputc(':', file);
+    write_value(file, separator + 1);
+
+    is_first = 0;
+  }
+
+  fputc('}', file);
+}
+
+static void write_cgroup_file(FILE *file, char *data) {
+  // A file holds either a single value (such as memory.peak), or a line per
+  // key, with either a value (such as cpu.stat) or "key=value" pairs (such as
+  // io.stat and the pressure files).
+  size_t data_size = strlen(data);
+  while ((0 < data_size) && ('\n' == data[data_size - 1])) {
+    data[--data_size] = '\0';
+  }
+
+  if ((NULL == strpbrk(data, STATS_TOKEN_SEPARATORS)) &&
+      (NULL == strpbrk(data, STATS_LINE_SEPARATORS))) {
+    write_value(file, data);
+    return;
+  }
+
+  fputc('{', file);
+
+  char *line_save;
+  int is_first = 1;
+  for (char *line = strtok_r(data, STATS_LINE_SEPARATORS, &line_save);
+       NULL != line; line = strtok_r(NULL, STATS_LINE_SEPARATORS, &line_save)) {
+    char *token_save;
+    char *key = strtok_r(line, STATS_TOKEN_SEPARATORS, &token_save);
+    if (NULL == key) {
+      continue;
+    }
+
+    fputs(is_first ? "" : ",", file);
+    write_string(file, key);
+    fputc(':', file);
+
+    is_first = 0;
+
+    char *token = strtok_r(NULL, STATS_TOKEN_SEPARATORS, &token_save);
+    if (NULL == token) {
+      fputs("null", file);
+    } else if (NULL == strchr(token, '=')) {
+      write_value(file, token);
+    } else {
+      write_nested_keys(file, token, &token_save);
+    }
+  }
+
+  fputc('}', file);
+}
+
+int stats_read_cgroup_usage(int cgroup_fd, char **out_usage) {
+  size_t usage_size;
+  FILE *usage = open_memstream(out_usage, &usage_size);
+  if (NULL == usage) {
+    *out_usage = NULL;
+    return 1;
+  }
+
+  fputc('{', usage);
+
+  int is_first = 1;
+  for (size_t file_index = 0;
+       file_index < (sizeof(STATS_CGROUP_FILES) / sizeof(*STATS_CGROUP_FILES));
+       ++file_index) {
+    int fd = openat(cgroup_fd, STATS_CGROUP_FILES[file_index],
+                    O_RDONLY | O_CLOEXEC);
+    if (-1 == fd) {
+      continue;
+    }
+
+    char data[STATS_CGROUP_FILE_MAX_SIZE];
+    ssize_t data_size = read(fd, data, sizeof(data) - 1);
+    close(fd);
+    if (0 >= data_size) {
+      continue;
+    }
+
+    data[data_size] = '\0';
+
+    fputs(is_first ? "" : ",", usage);
+    write_string(usage, STATS_CGROUP_FILES[file_index]);
+    fputc(':', usage);
+    write_cgroup_file(usage, data);
+
+    is_first = 0;
+  }
+
+  fputc('}', usage);
+
+  if (0 != fclose(usage)) {
+    free(*out_usage);
+    *out_usage = NULL;
+    return 1;
+  }
+
+  return 0;
+}
+
+static double get_milliseconds(const struct timeval *time) {
+  return ((double)time->tv_sec * 1000.0) + ((double)time->tv_usec / 1000.0);
+}
+
+int stats_write_record(FILE *file, const StatsRecord *record,
+                       int is_with_phases) {
+  int status = record->status;
+  int exit_code =
+      WIFEXITED(status) ? WEXITSTATUS(status) : (128 + WTERMSIG(status));
+
+  fputs("{\"container\":", file);
+  write_string(file, record->container);
+  fputs(",\"image\":", file);
+  write_string(file, record->image);
+
+  fprintf(file,
+          ",\"exit_code\":%d,\"signal\":%d,\"timed_out\":%s,"
+          "\"duration_ms\":%.3f",
+          exit_code, WIFSIGNALED(status) ? WTERMSIG(status) : 0,
+          record->is_timed_out ? "true" : "false",
+          (double)record->duration / 1000000.0);
+
+  const struct rusage *rusage = &record->rusage;
+  fprintf(file,
+          ",\"rusage\":{\"user_ms\":%.3f,\"system_ms\":%.3f,"
+          "\"max_rss_kb\":%ld,\"minor_faults\":%ld,\"major_faults\":%ld,"
+          "\"voluntary_context_switches\":%ld,"
+          "\"involuntary_context_switches\":%ld,\"block_inputs\":%ld,"
+          "\"block_outputs\":%ld}",
+          get_milliseconds(&rusage->ru_utime),
+          get_milliseconds(&rusage->ru_stime), rusage->ru_maxrss,
+          rusage->ru_minflt, rusage->ru_majflt, rusage->ru_nvcsw,
+          rusage->ru_nivcsw, rusage->ru_inblock, rusage->ru_oublock);
+
+  if (NULL != record->cgroup_usage) {
+    fprintf(file, ",\"cgroup\":%s", record->cgroup_usage);
+  }
+
+  // The launch phases are the spans of the launch's trace.
+  if (is_with_phases) {
+    fputs(",\"phases\":", file);
+    trace_write_phases(file);
+  }
+
+  fputs("}\n", file);
+
+  // Flush each record, so that records are streamed as containers exit.
+  return ((0 != fflush(file)) || ferror(file)) ? 1 : 0;
+}
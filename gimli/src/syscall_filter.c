@@ -0,0 +1,145 @@
+#define _GNU_SOURCE
+
+#include "gimli/syscall_filter.h"
+
+#include <errno.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <sched.h>
+#include <stddef.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#define SYSCALL_FILTER_ARCHITECTURE AUDIT_ARCH_X86_64
+#elif defined(__aarch64__)
+#define SYSCALL_FILTER_ARCHITECTURE AUDIT_ARCH_AARCH64
+#else
+#error "The syscall filter does not support this architecture."
+#endif
+
+// The offset of the low 32 bits of a syscall argument, which are all that
+// the filter compares.
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define SYSCALL_FILTER_ARGUMENT(index) \
+  (offsetof(struct seccomp_data, args) + ((index) * sizeof(__u64)))
+#else
+#define SYSCALL_FILTER_ARGUMENT(index)                                   \
+  (offsetof(struct seccomp_data, args) + ((index) * sizeof(__u64)) + \
+   sizeof(__u32))
+#endif
+
+#define SYSCALL_FILTER_LOAD(offset) \
+  BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (offset))
+
+#define SYSCALL_FILTER_RETURN(action) BPF_STMT(BPF_RET | BPF_K, (action))
+
+#define SYSCALL_FILTER_ALLOW SYSCALL_FILTER_RETURN(SECCOMP_RET_ALLOW)
+
+#define SYSCALL_FILTER_FAIL(error) \
+  SYSCALL_FILTER_RETURN(SECCOMP_RET_ERRNO | ((error) & SECCOMP_RET_DATA))
+
+// Each rule is a block that is skipped as a whole unless it matches the
+// syscall number, which is left in the accumulator for the next rule.
+// Rules that compare an argument end by either failing or allowing the
+// syscall, as the argument has replaced the syscall number.
+
+// Fail a syscall.
+#define SYSCALL_FILTER_DENY(number, error) \
+  BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (number), 0, 1), \
+      SYSCALL_FILTER_FAIL(error)
+
+// Fail a syscall if an argument has any of the bits of a mask set.
+#define SYSCALL_FILTER_DENY_ANY_BITS(number, index, mask)  \
+  BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (number), 0, 4),     \
+      SYSCALL_FILTER_LOAD(SYSCALL_FILTER_ARGUMENT(index)), \
+      BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, (mask), 0, 1),  \
+      SYSCALL_FILTER_FAIL(EPERM), SYSCALL_FILTER_ALLOW
+
+// Fail a syscall if an argument is equal to a value.
+#define SYSCALL_FILTER_DENY_EQUAL(number, index, value)    \
+  BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (number), 0, 4),     \
+      SYSCALL_FILTER_LOAD(SYSCALL_FILTER_ARGUMENT(index)), \
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (value), 0, 1),  \
+      SYSCALL_FILTER_FAIL(EPERM), SYSCALL_FILTER_ALLOW
+
+// The container's syscall filter, which is compiled along with gimli instead
+// of being generated at every launch.
+// Syscalls are allowed unless a rule fails them, and the kernel caches the
+// syscalls that are allowed regardless of their arguments (since Linux 5.11),
+// so only the syscalls with argument rules run the filter.
+// The rules are therefore ordered by how often their syscalls are made, from
+// ioctl (which terminals make all the time) to the ones that are never
+// allowed.
+static const struct sock_filter SYSCALL_FILTER[] = {
+    // Kill processes of another architecture, whose syscall numbers differ.
+    SYSCALL_FILTER_LOAD(offsetof(struct seccomp_data, arch)),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYSCALL_FILTER_ARCHITECTURE, 1, 0),
+    SYSCALL_FILTER_RETURN(SECCOMP_RET_KILL_PROCESS),
+
+    SYSCALL_FILTER_LOAD(offsetof(struct seccomp_data, nr)),
+
+#ifdef __X32_SYSCALL_BIT
+    // Fail the x32 syscalls, which the rules do not cover.
+    BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, __X32_SYSCALL_BIT, 0, 1),
+    SYSCALL_FILTER_FAIL(ENOSYS),
+#endif
+
+    // Keep the container from faking terminal input.
+    // The kernel only reads the request's low 32 bits, which are all that is
+    // compared.
+    SYSCALL_FILTER_DENY_EQUAL(__NR_ioctl, 1, TIOCSTI),
+
+    // Keep the container from creating user namespaces, in which it would
+    // regain capabilities.
+    SYSCALL_FILTER_DENY_ANY_BITS(__NR_clone, 0, CLONE_NEWUSER),
+    SYSCALL_FILTER_DENY_ANY_BITS(__NR_unshare, 0, CLONE_NEWUSER),
+
+    // The flags of clone3 are out of the filter's reach, so it fails as if it
+    // were not supported, which makes the C library fall back to clone.
+    SYSCALL_FILTER_DENY(__NR_clone3, ENOSYS),
+
+    // Keep the container from creating setuid and setgid files.
+#ifdef __NR_chmod
+    SYSCALL_FILTER_DENY_ANY_BITS(__NR_chmod, 1, S_ISUID | S_ISGID),
+#endif
+    SYSCALL_FILTER_DENY_ANY_BITS(__NR_fchmod, 1, S_ISUID | S_ISGID),
+    SYSCALL_FILTER_DENY_ANY_BITS(__NR_fchmodat, 2, S_ISUID | S_ISGID),
+#ifdef __NR_fchmodat2
+    SYSCALL_FILTER_DENY_ANY_BITS(__NR_fchmodat2, 2, S_ISUID | S_ISGID),
+#endif
+
+    // Fail the syscalls that reach outside of the container, either through
+    // the kernel's keyring, other processes, the memory policy, or the
+    // performance counters.
+    SYSCALL_FILTER_DENY(__NR_keyctl, EPERM),
+    SYSCALL_FILTER_DENY(__NR_add_key, EPERM),
+    SYSCALL_FILTER_DENY(__NR_request_key, EPERM),
+    SYSCALL_FILTER_DENY(__NR_ptrace, EPERM),
+    SYSCALL_FILTER_DENY(__NR_mbind, EPERM),
+    SYSCALL_FILTER_DENY(__NR_migrate_pages, EPERM),
+    SYSCALL_FILTER_DENY(__NR_move_pages, EPERM),
+    SYSCALL_FILTER_DENY(__NR_set_mempolicy, EPERM),
+    SYSCALL_FILTER_DENY(__NR_userfaultfd, EPERM),
+    SYSCALL_FILTER_DENY(__NR_perf_event_open, EPERM),
+
+    SYSCALL_FILTER_ALLOW,
+};
+
+int syscall_filter_install(void) {
+  struct sock_fprog program = {
+      .len = (unsigned short)(sizeof(SYSCALL_FILTER) /
+                              sizeof(*SYSCALL_FILTER)),
+      .filter = (struct sock_filter *)SYSCALL_FILTER,
+  };
+
+  // The filter is installed without setting no_new_privs, so that setuid
+  // programs keep working in the container, which is allowed as the
+  // container's init still has all of its capabilities.
+  return (0 == syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER, 0, &program))
+             ? 0
+             : 1;
+}
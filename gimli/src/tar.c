@@ -0,0 +1,545 @@
+#include "gimli/tar.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stb_ds/stb_ds.h"
+
+// The largest extended header that is read, which bounds the memory that a
+// malformed archive can make the reader allocate.
+#define TAR_EXTENDED_HEADER_MAX_SIZE (1024 * 1024)
+
+// The PAX records that are applied to entries.
+#define TAR_PAX_PATH "path"
+#define TAR_PAX_LINK_PATH "linkpath"
+#define TAR_PAX_SIZE "size"
+#define TAR_PAX_UID "uid"
+#define TAR_PAX_GID "gid"
+#define TAR_PAX_MODIFICATION_TIME "mtime"
+#define TAR_PAX_XATTR_PREFIX "SCHILY.xattr."
+
+// The magic of POSIX ustar headers, which are the only ones with a prefix
+// field (GNU headers keep other fields at its offset).
+#define TAR_USTAR_MAGIC "ustar"
+
+// The fields of a tar header block.
+typedef struct TarHeader {
+  char name[100];
+  char mode[8];
+  char uid[8];
+  char gid[8];
+  char size[12];
+  char modification_time[12];
+  char checksum[8];
+  char type;
+  char link_name[100];
+  char magic[6];
+  char version[2];
+  char user_name[32];
+  char group_name[32];
+  char device_major[8];
+  char device_minor[8];
+  char prefix[155];
+  char padding[12];
+} TarHeader;
+
+// A tar header is a single block, which fails to compile otherwise.
+typedef char TarHeaderSizeCheck[(TAR_BLOCK_SIZE == sizeof(TarHeader)) ? 1 : -1];
+
+static void release_extended_headers(TarReader *self) {
+  free(self->extended_header);
+  self->extended_header = NULL;
+  self->extended_header_size = 0;
+
+  free(self->long_path);
+  self->long_path = NULL;
+
+  free(self->long_link_path);
+  self->long_link_path = NULL;
+}
+
+void tar_reader_init(TarReader *self, TarRead read, void *context) {
+  self->read = read;
+  self->context = context;
+  memset(&self->entry, 0, sizeof(self->entry));
+  self->extended_header = NULL;
+  self->extended_header_size = 0;
+  self->long_path = NULL;
+  self->long_link_path = NULL;
+}
+
+void tar_reader_destroy(TarReader *self) {
+  release_extended_headers(self);
+  arrfree(self->entry.xattrs);
+}
+
+uint64_t tar_get_padded_size(uint64_t size) {
+  return (size + (TAR_BLOCK_SIZE - 1)) & ~((uint64_t)TAR_BLOCK_SIZE - 1);
+}
+
+static int parse_number(const char *field, size_t field_size,
+                        uint64_t *out_number) {
+  const unsigned char *bytes = (const unsigned char *)field;
+
+  // Numbers that do not fit in octal are stored in base 256, which is marked
+  // by the high bit of the first byte (negative numbers are not supported).
+  if (0 != (bytes[0] & 0x80)) {
+    if (0 != (bytes[0] & 0x40)) {
+      errno = ERANGE;
+      return 1;
+    }
+
+    uint64_t number = bytes[0] & 0x3f;
+    for (size_t byte_index = 1; byte_index < field_size; ++byte_index) {
+      if (0 != (number >> 56)) {
+        errno = ERANGE;
+        return 1;
+      }
+
+      number = (number << 8) | bytes[byte_index];
+    }
+
+    *out_number = number;
+    return 0;
+  }
+
+  // Octal numbers may be padded with leading spaces, and end with a space or
+  // a null terminator.
+  size_t byte_index = 0;
+  while ((byte_index < field_size) && (' ' == field[byte_index])) {
+    ++byte_index;
+  }
+
+  uint64_t number = 0;
+  for (; (byte_index < field_size) && ('0' <= field[byte_index]) &&
+         ('7' >= field[byte_index]);
+       ++byte_index) {
+    number = (number << 3) | (uint64_t)(field[byte_index] - '0');
+  }
+
+  if ((byte_index < field_size) && (' ' != field[byte_index]) &&
+      ('\0' != field[byte_index])) {
+    errno = EBADMSG;
+    return 1;
+  }
+
+  *out_number = number;
+  return 0;
+}
+
+static int is_zero_block(const unsigned char *block) {
+  for (size_t byte_index = 0; byte_index < TAR_BLOCK_SIZE; ++byte_index) {
+    if (0 != block[byte_index]) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static int is_checksum_valid(const TarHeader *header) {
+  uint64_t checksum;
+  if (0 != parse_number(header->checksum, sizeof(header->checksum),
+                        &checksum)) {
+    return 0;
+  }
+
+  // The checksum is the sum of the header's bytes, with the checksum field
+  // taken as spaces.
+  // Some archivers sum the bytes as signed characters, which is accepted as
+  // well.
+  const unsigned char *bytes = (const unsigned char *)header;
+  size_t checksum_start = offsetof(TarHeader, checksum);
+  size_t checksum_end = checksum_start + sizeof(header->checksum);
+
+  uint64_t unsigned_sum = 0;
+  int64_t signed_sum = 0;
+  for (size_t byte_index = 0; byte_index < TAR_BLOCK_SIZE; ++byte_index) {
+    int is_checksum_byte =
+        (byte_index >= checksum_start) && (byte_index < checksum_end);
+    unsigned char byte = is_checksum_byte ? ' ' : bytes[byte_index];
+
+    unsigned_sum += byte;
+    signed_sum += (signed char)byte;
+  }
+
+  return (checksum == unsigned_sum) || ((int64_t)checksum == signed_sum);
+}
+
+static int read_extended_header(TarReader *self, uint64_t size,
+                                char **out_data) {
+  if (TAR_EXTENDED_HEADER_MAX_SIZE < size) {
+    errno = EFBIG;
+    return 1;
+  }
+
+  // The data is read along with its padding, and is null terminated so that
+  // it can be used as a string.
+  size_t padded_size = (size_t)tar_get_padded_size(size);
+  char *data = malloc(padded_size + 1);
+  if (NULL == data) {
+    return 1;
+  }
+
+  if (0 != self->read(self->context, data, padded_size)) {
+    free(data);
+    return 1;
+  }
+
+  data[size] = '\0';
+
+  free(*out_data);
+  *out_data = data;
+
+  return 0;
+}
+
+static void copy_field(char *destination, const char *field,
+                       size_t field_size) {
+  // Fields are null terminated unless they fill their whole size.
+  size_t size = strnlen(field, field_size);
+  memcpy(destination, field, size);
+  destination[size] = '\0';
+}
+
+static int parse_header(TarReader *self, const TarHeader *header) {
+  TarEntry *entry = &self->entry;
+
+  switch (header->type) {
+    case '0':
+    case '\0':
+    case '7':
+      entry->type = TAR_ENTRY_TYPE_REGULAR;
+      break;
+
+    case '1':
+      entry->type = TAR_ENTRY_TYPE_HARD_LINK;
+      break;
+
+    case '2':
+      entry->type = TAR_ENTRY_TYPE_SYMBOLIC_LINK;
+      break;
+
+    case '3':
+      entry->type = TAR_ENTRY_TYPE_CHARACTER_DEVICE;
+      break;
+
+    case '4':
+      entry->type = TAR_ENTRY_TYPE_BLOCK_DEVICE;
+      break;
+
+    case '5':
+      entry->type = TAR_ENTRY_TYPE_DIRECTORY;
+      break;
+
+    case '6':
+      entry->type = TAR_ENTRY_TYPE_FIFO;
+      break;
+
+    // Sparse files and multi-volume archives are not supported.
+    default:
+      errno = ENOTSUP;
+      return 1;
+  }
+
+  uint64_t mode;
+  uint64_t uid;
+  uint64_t gid;
+  uint64_t modification_time;
+  uint64_t device_major = 0;
+  uint64_t device_minor = 0;
+  if ((0 != parse_number(header->mode, sizeof(header->mode), &mode)) ||
+      (0 != parse_number(header->uid, sizeof(header->uid), &uid)) ||
+      (0 != parse_number(header->gid, sizeof(header->gid), &gid)) ||
+      (0 != parse_number(header->size, sizeof(header->size), &entry->size)) ||
+      (0 != parse_number(header->modification_time,
+                         sizeof(header->modification_time),
+                         &modification_time))) {
+    return 1;
+  }
+
+  // Only devices have their numbers set, which are left empty by some
+  // archivers for the other entries.
+  if (((TAR_ENTRY_TYPE_CHARACTER_DEVICE == entry->type) ||
+       (TAR_ENTRY_TYPE_BLOCK_DEVICE == entry->type)) &&
+      ((0 != parse_number(header->device_major, sizeof(header->device_major),
+                          &device_major)) ||
+       (0 != parse_number(header->device_minor, sizeof(header->device_minor),
+                          &device_minor)))) {
+    return 1;
+  }
+
+  entry->mode = (mode_t)(mode & 07777);
+  entry->uid = (uid_t)uid;
+  entry->gid = (gid_t)gid;
+  entry->modification_time.tv_sec = (time_t)modification_time;
+  entry->modification_time.tv_nsec = 0;
+  entry->device_major = (unsigned int)device_major;
+  entry->device_minor = (unsigned int)device_minor;
+
+  // Only links have data in their link field.
+  if ((TAR_ENTRY_TYPE_HARD_LINK == entry->type) ||
+      (TAR_ENTRY_TYPE_SYMBOLIC_LINK == entry->type)) {
+    copy_field(self->link_path, header->link_name, sizeof(header->link_name));
+  } else {
+    self->link_path[0] = '\0';
+  }
+
+  // The ustar prefix holds the directories of a long path.
+  size_t prefix_size = 0;
+  if (0 == memcmp(header->magic, TAR_USTAR_MAGIC, sizeof(TAR_USTAR_MAGIC))) {
+    prefix_size = strnlen(header->prefix, sizeof(header->prefix));
+  }
+
+  if (0 != prefix_size) {
+    memcpy(self->path, header->prefix, prefix_size);
+    self->path[prefix_size++] = '/';
+  }
+
+  copy_field(self->path + prefix_size, header->name, sizeof(header->name));
+
+  entry->path = self->path;
+  entry->link_path = self->link_path;
+
+  return 0;
+}
+
+static int parse_pax_number(const char *value, uint64_t *out_number) {
+  char *end;
+  errno = 0;
+  unsigned long long number = strtoull(value, &end, 10);
+  if ((0 != errno) || (end == value) || ('\0' != (*end))) {
+    errno = EBADMSG;
+    return 1;
+  }
+
+  *out_number = (uint64_t)number;
+  return 0;
+}
+
+static int parse_pax_time(const char *value, struct timespec *out_time) {
+  char *end;
+  errno = 0;
+  long long seconds = strtoll(value, &end, 10);
+  if ((0 != errno) || (end == value)) {
+    errno = EBADMSG;
+    return 1;
+  }
+
+  // The fraction is given in up to nanoseconds, and any digits past them are
+  // ignored.
+  long nanoseconds = 0;
+  if ('.' == (*end)) {
+    ++end;
+
+    long scale = 100000000;
+    for (; ('0' <= (*end)) && ('9' >= (*end)); ++end) {
+      nanoseconds += (long)((*end) - '0') * scale;
+      scale /= 10;
+    }
+  }
+
+  if ('\0' != (*end)) {
+    errno = EBADMSG;
+    return 1;
+  }
+
+  out_time->tv_sec = (time_t)seconds;
+  out_time->tv_nsec = nanoseconds;
+
+  return 0;
+}
+
+static int apply_pax_record(TarReader *self, char *key, char *value,
+                            size_t value_size) {
+  TarEntry *entry = &self->entry;
+
+  if (0 == strcmp(key, TAR_PAX_PATH)) {
+    entry->path = value;
+  } else if (0 == strcmp(key, TAR_PAX_LINK_PATH)) {
+    entry->link_path = value;
+  } else if (0 == strcmp(key, TAR_PAX_SIZE)) {
+    if (0 != parse_pax_number(value, &entry->size)) {
+      return 1;
+    }
+  } else if ((0 == strcmp(key, TAR_PAX_UID)) ||
+             (0 == strcmp(key, TAR_PAX_GID))) {
+    uint64_t id;
+    if (0 != parse_pax_number(value, &id)) {
+      return 1;
+    }
+
+    if ('u' == key[0]) {
+      entry->uid = (uid_t)id;
+    } else {
+      entry->gid = (gid_t)id;
+    }
+  } else if (0 == strcmp(key, TAR_PAX_MODIFICATION_TIME)) {
+    if (0 != parse_pax_time(value, &entry->modification_time)) {
+      return 1;
+    }
+  } else if (0 == strncmp(key, TAR_PAX_XATTR_PREFIX,
+                          strlen(TAR_PAX_XATTR_PREFIX))) {
+    TarXattr xattr = {
+        .name = key + strlen(TAR_PAX_XATTR_PREFIX),
+        .value = value,
+        .value_size = value_size,
+    };
+    arrput(entry->xattrs, xattr);
+  }
+
+  return 0;
+}
+
+static int apply_pax_header(TarReader *self) {
+  // Each record is "<length> <key>=<value>\n", where the length covers the
+  // whole record, so that values may hold any byte.
+  char *record = self->extended_header;
+  char *end = self->extended_header + self->extended_header_size;
+
+  while (record < end) {
+    // The length is plain digits (which `strtoull` alone does not ensure),
+    // and covers at least itself, the space and the newline.
+    if (('0' > (*record)) || ('9' < (*record))) {
+      errno = EBADMSG;
+      return 1;
+    }
+
+    char *length_end;
+    unsigned long long length = strtoull(record, &length_end, 10);
+    if ((' ' != (*length_end)) ||
+        (length <= (size_t)(length_end - record) + 1) ||
+        ((size_t)(end - record) < length) ||
+        ('\n' != record[length - 1])) {
+      errno = EBADMSG;
+      return 1;
+    }
+
+    char *key = length_end + 1;
+    char *record_end = record + length - 1;
+    char *separator = memchr(key, '=', (size_t)(record_end - key));
+    if (NULL == separator) {
+      errno = EBADMSG;
+      return 1;
+    }
+
+    // Terminate the key and the value in place, so that the entry can point
+    // at them.
+    *separator = '\0';
+    *record_end = '\0';
+
+    if (0 != apply_pax_record(self, key, separator + 1,
+                              (size_t)(record_end - (separator + 1)))) {
+      return 1;
+    }
+
+    record += length;
+  }
+
+  return 0;
+}
+
+int tar_reader_next(TarReader *self, TarEntry **out_entry) {
+  // The extended headers applied to the previous entry.
+  release_extended_headers(self);
+
+  for (;;) {
+    TarHeader header;
+    if (0 != self->read(self->context, &header, sizeof(header))) {
+      return 1;
+    }
+
+    // The archive ends with zero blocks.
+    if (is_zero_block((const unsigned char *)&header)) {
+      *out_entry = NULL;
+      return 0;
+    }
+
+    if (!is_checksum_valid(&header)) {
+      errno = EBADMSG;
+      return 1;
+    }
+
+    // Read the extended headers, which apply to the entry that follows them.
+    uint64_t size;
+    if (0 != parse_number(header.size, sizeof(header.size), &size)) {
+      return 1;
+    }
+
+    char **extended_header = NULL;
+    switch (header.type) {
+      // A PAX header.
+      case 'x':
+        extended_header = &self->extended_header;
+        break;
+
+      // A global PAX header, whose records are not used, so it is read aside
+      // and discarded, leaving the entry's own headers as they are.
+      case 'g': {
+        char *global_header = NULL;
+        if (0 != read_extended_header(self, size, &global_header)) {
+          return 1;
+        }
+
+        free(global_header);
+        continue;
+      }
+
+      // A GNU long path or link path.
+      case 'L':
+        extended_header = &self->long_path;
+        break;
+
+      case 'K':
+        extended_header = &self->long_link_path;
+        break;
+
+      default:
+        break;
+    }
+
+    if (NULL != extended_header) {
+      if (0 != read_extended_header(self, size, extended_header)) {
+        return 1;
+      }
+
+      if (&self->extended_header == extended_header) {
+        self->extended_header_size = (size_t)size;
+      }
+
+      continue;
+    }
+
+    arrsetlen(self->entry.xattrs, 0);
+
+    if (0 != parse_header(self, &header)) {
+      return 1;
+    }
+
+    // The extended headers take precedence over the header's own fields.
+    if (NULL != self->long_path) {
+      self->entry.path = self->long_path;
+    }
+
+    if (NULL != self->long_link_path) {
+      self->entry.link_path = self->long_link_path;
+    }
+
+    if ((NULL != self->extended_header) && (0 != apply_pax_header(self))) {
+      return 1;
+    }
+
+    // Only regular files have data, whatever the size of the other entries
+    // says.
+    if (TAR_ENTRY_TYPE_REGULAR != self->entry.type) {
+      self->entry.size = 0;
+    }
+
+    self->entry.xattrs_size = arrlenu(self->entry.xattrs);
+    *out_entry = &self->entry;
+
+    return 0;
+  }
+}
@@ -0,0 +1,295 @@
+#define _GNU_SOURCE
+
+#include "gimli/trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// The environment variables that enable tracing when no trace path or format
+// is given explicitly.
+#define TRACE_PATH_ENVIRONMENT_VARIABLE "GIMLI_TRACE"
+#define TRACE_FORMAT_ENVIRONMENT_VARIABLE "GIMLI_TRACE_FORMAT"
+
+// The trace path that writes the trace to the standard error.
+#define TRACE_STANDARD_ERROR_PATH "-"
+
+#define TRACE_SPAN_NAME_SIZE 32
+#define TRACE_SPANS_CAPACITY 128
+
+// Spans are fixed size, so that the child can pass each of them back to the
+// parent with a single (atomic) pipe write.
+typedef struct TraceSpan {
+  char name[TRACE_SPAN_NAME_SIZE];
+  uint64_t start;
+  uint64_t end;
+  pid_t pid;
+} TraceSpan;
+
+static const char *const TRACE_FORMAT_NAMES[] = {
+    [TRACE_FORMAT_CHROME] = "chrome",
+    [TRACE_FORMAT_LINES] = "lines",
+};
+
+// The trace is kept in static storage, so that recording a span never
+// allocates, and so that tracing costs a single branch when it is disabled.
+static int trace_enabled = 0;
+static const char *trace_path = NULL;
+static TraceFormat trace_format = TRACE_FORMAT_CHROME;
+static uint64_t trace_origin = 0;
+
+static TraceSpan trace_spans[TRACE_SPANS_CAPACITY];
+static size_t trace_spans_size = 0;
+
+// The pipe that the child passes its spans back over.
+static int trace_child_pipe[2] = {-1, -1};
+static int trace_is_child = 0;
+
+static uint64_t get_time_nanoseconds(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+
+  return ((uint64_t)time.tv_sec * 1000000000) + (uint64_t)time.tv_nsec;
+}
+
+static int parse_format(const char *format, TraceFormat *out_format) {
+  for (size_t format_index = 0;
+       format_index <
+       (sizeof(TRACE_FORMAT_NAMES) / sizeof(*TRACE_FORMAT_NAMES));
+       ++format_index) {
+    if (0 == strcmp(format, TRACE_FORMAT_NAMES[format_index])) {
+      *out_format = (TraceFormat)format_index;
+      return 0;
+    }
+  }
+
+  errno = EINVAL;
+  return 1;
+}
+
+int trace_init(const char *path, const char *format, int is_recording) {
+  // Fall back to the environment.
+  if (NULL == path) {
+    path = getenv(TRACE_PATH_ENVIRONMENT_VARIABLE);
+  }
+
+  if (NULL == format) {
+    format = getenv(TRACE_FORMAT_ENVIRONMENT_VARIABLE);
+  }
+
+  if ((NULL != format) && ('\0' != format[0])) {
+    if (0 != parse_format(format, &trace_format)) {
+      return 1;
+    }
+  }
+
+  // Tracing is disabled unless a trace path is given, or the spans are
+  // recorded for another report.
+  if ((NULL != path) && ('\0' != path[0])) {
+    trace_path = path;
+  } else if (!is_recording) {
+    return 0;
+  }
+
+  trace_origin = get_time_nanoseconds();
+  trace_enabled = 1;
+
+  return 0;
+}
+
+uint64_t trace_begin(void) {
+  if (!trace_enabled) {
+    return 0;
+  }
+
+  return get_time_nanoseconds();
+}
+
+void trace_end(const char *name, uint64_t start) {
+  if (!trace_enabled) {
+    return;
+  }
+
+  TraceSpan span = {
+      .start = start,
+      .end = get_time_nanoseconds(),
+      .pid = getpid(),
+  };
+
+  strncpy(span.name, name, sizeof(span.name) - 1);
+
+  // The child's spans are passed back to the parent as they end, as the child
+  // either executes the user command or exits.
+  if (trace_is_child) {
+    ssize_t bytes_written;
+    do {
+      bytes_written = write(trace_child_pipe[1], &span, sizeof(span));
+    } while ((-1 == bytes_written) && (EINTR == errno));
+
+    return;
+  }
+
+  // Spans beyond the capacity are dropped.
+  if (TRACE_SPANS_CAPACITY > trace_spans_size) {
+    trace_spans[trace_spans_size++] = span;
+  }
+}
+
+int trace_open_child_pipe(void) {
+  if (!trace_enabled) {
+    return 0;
+  }
+
+  // The pipe is closed on exec, so the child's end is closed once it executes
+  // the user command.
+  return (0 == pipe2(trace_child_pipe, O_CLOEXEC)) ? 0 : 1;
+}
+
+void trace_enter_child(void) {
+  if ((!trace_enabled) || (-1 == trace_child_pipe[1])) {
+    return;
+  }
+
+  close(trace_child_pipe[0]);
+  trace_child_pipe[0] = -1;
+
+  trace_is_child = 1;
+}
+
+void trace_collect_child(pid_t child_pid) {
+  if ((!trace_enabled) || (-1 == trace_child_pipe[0])) {
+    return;
+  }
+
+  // Close the parent's write end, so that reading stops once the child's end
+  // is closed.
+  close(trace_child_pipe[1]);
+  trace_child_pipe[1] = -1;
+
+  for (;;) {
+    TraceSpan span;
+    ssize_t bytes_read = read(trace_child_pipe[0], &span, sizeof(span));
+    if ((-1 == bytes_read) && (EINTR == errno)) {
+      continue;
+    }
+
+    if (sizeof(span) != (size_t)bytes_read) {
+      break;
+    }
+
+    // The child reports its PID in its own PID namespace, so replace it with
+    // the PID the parent knows it by.
+    span.name[sizeof(span.name) - 1] = '\0';
+    span.pid = child_pid;
+
+    if (TRACE_SPANS_CAPACITY > trace_spans_size) {
+      trace_spans[trace_spans_size++] = span;
+    }
+  }
+
+  close(trace_child_pipe[0]);
+  trace_child_pipe[0] = -1;
+}
+
+static int compare_spans(const void *first, const void *second) {
+  const TraceSpan *first_span = first;
+  const TraceSpan *second_span = second;
+
+  return (first_span->start > second_span->start) -
+         (first_span->start < second_span->start);
+}
+
+static void sort_spans(void) {
+  // Spans are recorded as they end, so order them by their start.
+  qsort(trace_spans, trace_spans_size, sizeof(*trace_spans), compare_spans);
+}
+
+static double get_span_offset_microseconds(uint64_t time) {
+  return (double)(time - trace_origin) / 1000.0;
+}
+
+static void write_chrome_trace(FILE *file) {
+  fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+  for (size_t span_index = 0; span_index < trace_spans_size; ++span_index) {
+    const TraceSpan *span = &trace_spans[span_index];
+
+    fprintf(file,
+            "%s\n{\"name\":\"%s\",\"cat\":\"gimli\",\"ph\":\"X\",\"ts\":%.3f,"
+            "\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+            (0 == span_index) ? "" : ",", span->name,
+            get_span_offset_microseconds(span->start),
+            (double)(span->end - span->start) / 1000.0, span->pid, span->pid);
+  }
+
+  fprintf(file, "\n]}\n");
+}
+
+static void write_lines_trace(FILE *file) {
+  for (size_t span_index = 0; span_index < trace_spans_size; ++span_index) {
+    const TraceSpan *span = &trace_spans[span_index];
+
+    fprintf(file, "%d %.3f %.3f %s\n", span->pid,
+            get_span_offset_microseconds(span->start),
+            (double)(span->end - span->start) / 1000.0, span->name);
+  }
+}
+
+void trace_write_phases(FILE *file) {
+  sort_spans();
+
+  fprintf(file, "[");
+
+  for (size_t span_index = 0; span_index < trace_spans_size; ++span_index) {
+    const TraceSpan *span = &trace_spans[span_index];
+
+    fprintf(file,
+            "%s{\"name\":\"%s\",\"pid\":%d,\"start_ms\":%.3f,"
+            "\"duration_ms\":%.3f}",
+            (0 == span_index) ? "" : ",", span->name, span->pid,
+            get_span_offset_microseconds(span->start) / 1000.0,
+            (double)(span->end - span->start) / 1000000.0);
+  }
+
+  fprintf(file, "]");
+}
+
+int trace_write(void) {
+  if ((!trace_enabled) || (NULL == trace_path)) {
+    return 0;
+  }
+
+  FILE *file = (0 == strcmp(trace_path, TRACE_STANDARD_ERROR_PATH))
+                   ? stderr
+                   : fopen(trace_path, "w");
+  if (NULL == file) {
+    return 1;
+  }
+
+  sort_spans();
+
+  switch (trace_format) {
+    case TRACE_FORMAT_CHROME:
+      write_chrome_trace(file);
+      break;
+
+    case TRACE_FORMAT_LINES:
+      write_lines_trace(file);
+      break;
+  }
+
+  int ret = ferror(file) ? 1 : 0;
+
+  if (stderr != file) {
+    if (0 != fclose(file)) {
+      ret = 1;
+    }
+  }
+
+  return ret;
+}
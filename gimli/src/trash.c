@@ -0,0 +1,269 @@
+#define _GNU_SOURCE
+
+#include "gimli/trash.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "gimli/gimli_directory.h"
+#include "gimli/io.h"
+#include "gimli/parallel.h"
+#include "gimli/spawn.h"
+#include "stb_ds/stb_ds.h"
+
+// The directory that container directories are moved to once the containers
+// exit, relative to the gimli directory.
+// It is on the same file system as the container directories, so that moving
+// a container directory to it is a single atomic rename.
+#define TRASH_DIRECTORY "trash"
+
+// The depth that the trash is split into removal tasks at (for example,
+// `<container>/diff/<entry>`), so that even a single large container is
+// removed in parallel.
+#define TRASH_TASKS_DEPTH 3
+
+typedef struct TrashScan {
+  int trash_directory_fd;
+
+  // The subtrees that are removed in parallel.
+  char **tasks;
+
+  // The directories above the subtrees, in the order they were found, which
+  // are removed (in reverse) once they are empty.
+  char **skeleton;
+} TrashScan;
+
+static int open_trash_directory(void) {
+  // Create the trash directory the first time it is used.
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/" TRASH_DIRECTORY, gimli_directory_get());
+
+  if ((0 != mkdir(path, 0700)) && (EEXIST != errno)) {
+    return -1;
+  }
+
+  return open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+int trash_move(const char *path, const char *name) {
+  char trash_path[PATH_MAX];
+  snprintf(trash_path, sizeof(trash_path), "%s/" TRASH_DIRECTORY "/%s",
+           gimli_directory_get(), name);
+
+  // Rename the directory into the trash.
+  if (0 == rename(path, trash_path)) {
+    return 0;
+  }
+
+  if (ENOENT != errno) {
+    return 1;
+  }
+
+  // The trash directory may not exist yet, so create it and try again.
+  int trash_directory_fd = open_trash_directory();
+  if (-1 == trash_directory_fd) {
+    return 1;
+  }
+
+  close(trash_directory_fd);
+
+  return (0 == rename(path, trash_path)) ? 0 : 1;
+}
+
+static int is_directory_entry(int directory_fd, const struct dirent *entry) {
+  if (DT_UNKNOWN != entry->d_type) {
+    return DT_DIR == entry->d_type;
+  }
+
+  // The file system does not report entry types, so stat the entry.
+  struct stat stat_buffer;
+  if (0 != fstatat(directory_fd, entry->d_name, &stat_buffer,
+                   AT_SYMLINK_NOFOLLOW)) {
+    return 0;
+  }
+
+  return S_ISDIR(stat_buffer.st_mode);
+}
+
+static int scan_trash(TrashScan *self, const char *path, size_t depth) {
+  int ret = 1;
+
+  // Open the directory relative to the trash directory.
+  int fd = openat(self->trash_directory_fd, path,
+                  O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (-1 == fd) {
+    goto out;
+  }
+
+  DIR *directory = fdopendir(fd);
+  if (NULL == directory) {
+    close(fd);
+    goto out;
+  }
+
+  for (;;) {
+    // Set `errno` to 0 before reading the next directory entry.
+    errno = 0;
+
+    struct dirent *entry = readdir(directory);
+    if (NULL == entry) {
+      if (0 != errno) {
+        goto out_close_directory;
+      }
+
+      break;
+    }
+
+    // Skip the "." and ".." directories.
+    if ((0 == strcmp(entry->d_name, ".")) ||
+        (0 == strcmp(entry->d_name, ".."))) {
+      continue;
+    }
+
+    // Format the entry's path relative to the trash directory.
+    char entry_path[PATH_MAX];
+    if (0 == depth) {
+      snprintf(entry_path, sizeof(entry_path), "%s", entry->d_name);
+    } else {
+      snprintf(entry_path, sizeof(entry_path), "%s/%s", path, entry->d_name);
+    }
+
+    char *entry_path_copy = strdup(entry_path);
+    if (NULL == entry_path_copy) {
+      goto out_close_directory;
+    }
+
+    // Directories above the tasks depth are split further, and everything
+    // else is removed by a single task.
+    if (((depth + 1) < TRASH_TASKS_DEPTH) &&
+        is_directory_entry(fd, entry)) {
+      arrput(self->skeleton, entry_path_copy);
+
+      if (0 != scan_trash(self, entry_path_copy, depth + 1)) {
+        goto out_close_directory;
+      }
+    } else {
+      arrput(self->tasks, entry_path_copy);
+    }
+  }
+
+  ret = 0;
+
+out_close_directory:
+  closedir(directory);
+
+out:
+  return ret;
+}
+
+static void free_paths(char **paths) {
+  for (ptrdiff_t path_index = 0; path_index < arrlen(paths); ++path_index) {
+    free(paths[path_index]);
+  }
+
+  arrfree(paths);
+}
+
+static int remove_task(void *context, size_t worker_index
+                       __attribute__((unused)),
+                       size_t task_index) {
+  TrashScan *scan = context;
+
+  return io_remove_tree_at(scan->trash_directory_fd, scan->tasks[task_index]);
+}
+
+static int reap_once(int trash_directory_fd, int *out_is_empty) {
+  int ret = 1;
+
+  TrashScan scan = {
+      .trash_directory_fd = trash_directory_fd,
+      .tasks = NULL,
+      .skeleton = NULL,
+  };
+
+  // Split the trash into subtrees.
+  if (0 != scan_trash(&scan, ".", 0)) {
+    goto out_free_scan;
+  }
+
+  *out_is_empty = (0 == arrlen(scan.tasks)) && (0 == arrlen(scan.skeleton));
+
+  // Remove the subtrees in parallel.
+  size_t tasks_size = (size_t)arrlen(scan.tasks);
+  if (0 < tasks_size) {
+    size_t threads_size = parallel_get_threads_size();
+    if (threads_size > tasks_size) {
+      threads_size = tasks_size;
+    }
+
+    if (0 != parallel_run(tasks_size, threads_size, remove_task, &scan)) {
+      goto out_free_scan;
+    }
+  }
+
+  // Remove the directories above the subtrees, deepest first.
+  for (ptrdiff_t path_index = arrlen(scan.skeleton) - 1; path_index >= 0;
+       --path_index) {
+    if (0 != unlinkat(trash_directory_fd, scan.skeleton[path_index],
+                      AT_REMOVEDIR)) {
+      goto out_free_scan;
+    }
+  }
+
+  ret = 0;
+
+out_free_scan:
+  free_paths(scan.skeleton);
+  free_paths(scan.tasks);
+
+  return ret;
+}
+
+int trash_reap(void) {
+  int ret = 1;
+
+  int trash_directory_fd = open_trash_directory();
+  if (-1 == trash_directory_fd) {
+    goto out;
+  }
+
+  // Only a single reaper empties the trash at a time.
+  // A reaper that finds another one running leaves the trash to it, as it
+  // keeps reaping until the trash is empty.
+  if (0 != flock(trash_directory_fd, LOCK_EX | LOCK_NB)) {
+    ret = (EWOULDBLOCK == errno) ? 0 : 1;
+    goto out_close_trash_directory;
+  }
+
+  for (;;) {
+    int is_empty;
+    if (0 != reap_once(trash_directory_fd, &is_empty)) {
+      goto out_close_trash_directory;
+    }
+
+    if (is_empty) {
+      break;
+    }
+  }
+
+  ret = 0;
+
+out_close_trash_directory:
+  // Closing the directory also releases the lock.
+  close(trash_directory_fd);
+
+out:
+  return ret;
+}
+
+int trash_spawn_reaper(void) { return spawn_detached(trash_reap); }
@@ -0,0 +1,600 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "gimli/digest.h"
+#include "gimli/io.h"
+#include "gimli/layer.h"
+#include "gimli/sha256.h"
+#include "jansson.h"
+
+// Docker names the links of the overlay layers with 26 characters.
+#define LINK_NAME_SIZE 26
+
+// The directories that every image's bottom-most layer provides, so that
+// containers can be started from the generated images.
+static const char *const ROOT_FS_DIRECTORIES[] = {
+    "bin", "dev", "etc", "proc", "tmp",
+};
+
+typedef struct GeneratorOptions {
+  const char *root;
+  size_t images_size;
+  size_t layers_per_image;
+  size_t shared_layers_size;
+  size_t repositories_size;
+  const char *payload;
+  unsigned long seed;
+} GeneratorOptions;
+
+static void print_usage(const char *program) {
+  printf("USAGE: %s --root <directory> [options]\n", program);
+  printf("\n");
+  printf("Generates a synthetic Docker overlay2 store for benchmarking.\n");
+  printf("\n");
+  printf("  --root <directory>         the store root (must not exist)\n");
+  printf("  --images <count>           the number of images (100)\n");
+  printf("  --layers-per-image <count> the number of layers per image (5)\n");
+  printf("  --shared-layers <count>    the number of bottom-most layers that "
+         "all images\n                             share (2)\n");
+  printf("  --repositories <count>     the number of tagged repositories "
+         "(the number\n                             of images)\n");
+  printf("  --payload <file>           an executable to install as "
+         "/bin/payload in every\n                             image\n");
+  printf("  --seed <number>            varies the generated identifiers "
+         "(0)\n");
+}
+
+static int parse_count(const char *argument, size_t *out_count) {
+  char *end;
+  errno = 0;
+  unsigned long long count = strtoull(argument, &end, 10);
+  if ((0 != errno) || (end == argument) || ('\0' != (*end))) {
+    return 1;
+  }
+
+  *out_count = (size_t)count;
+
+  return 0;
+}
+
+static int parse_options(GeneratorOptions *self, int argc, char *argv[]) {
+  enum Option {
+    OPTION_ROOT = 0,
+    OPTION_IMAGES,
+    OPTION_LAYERS_PER_IMAGE,
+    OPTION_SHARED_LAYERS,
+    OPTION_REPOSITORIES,
+    OPTION_PAYLOAD,
+    OPTION_SEED,
+  };
+
+  static const struct option OPTIONS[] = {
+      {"root", required_argument, NULL, OPTION_ROOT},
+      {"images", required_argument, NULL, OPTION_IMAGES},
+      {"layers-per-image", required_argument, NULL, OPTION_LAYERS_PER_IMAGE},
+      {"shared-layers", required_argument, NULL, OPTION_SHARED_LAYERS},
+      {"repositories", required_argument, NULL, OPTION_REPOSITORIES},
+      {"payload", required_argument, NULL, OPTION_PAYLOAD},
+      {"seed", required_argument, NULL, OPTION_SEED},
+      {NULL, 0, NULL, 0},
+  };
+
+  self->root = NULL;
+  self->images_size = 100;
+  self->layers_per_image = 5;
+  self->shared_layers_size = 2;
+  self->repositories_size = SIZE_MAX;
+  self->payload = NULL;
+  self->seed = 0;
+
+  for (;;) {
+    int option = getopt_long(argc, argv, "", OPTIONS, NULL);
+    if (-1 == option) {
+      break;
+    }
+
+    size_t seed;
+    int result = 0;
+
+    switch (option) {
+      case OPTION_ROOT:
+        self->root = optarg;
+        break;
+
+      case OPTION_IMAGES:
+        result = parse_count(optarg, &self->images_size);
+        break;
+
+      case OPTION_LAYERS_PER_IMAGE:
+        result = parse_count(optarg, &self->layers_per_image);
+        break;
+
+      case OPTION_SHARED_LAYERS:
+        result = parse_count(optarg, &self->shared_layers_size);
+        break;
+
+      case OPTION_REPOSITORIES:
+        result = parse_count(optarg, &self->repositories_size);
+        break;
+
+      case OPTION_PAYLOAD:
+        self->payload = optarg;
+        break;
+
+      case OPTION_SEED:
+        result = parse_count(optarg, &seed);
+        self->seed = seed;
+        break;
+
+      default:
+        return 1;
+    }
+
+    if (0 != result) {
+      return 1;
+    }
+  }
+
+  // Every image is tagged by default.
+  if (SIZE_MAX == self->repositories_size) {
+    self->repositories_size = self->images_size;
+  }
+
+  // Ensure that the options describe a valid store.
+  if ((NULL == self->root) || (optind != argc) || (0 == self->images_size) ||
+      (0 == self->layers_per_image) ||
+      (self->shared_layers_size > self->layers_per_image)) {
+    return 1;
+  }
+
+  return 0;
+}
+
+static void format_path(char *path, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void format_path(char *path, const char *format, ...) {
+  va_list arguments;
+  va_start(arguments, format);
+  vsnprintf(path, PATH_MAX, format, arguments);
+  va_end(arguments);
+}
+
+static int make_directory(const char *path) {
+  // Shared layers are visited once per image, so existing directories are
+  // expected.
+  if ((0 != mkdir(path, 0755)) && (EEXIST != errno)) {
+    return 1;
+  }
+
+  return 0;
+}
+
+static int write_string_file(const char *path, const char *string) {
+  return io_write_file_atomically(path, string, strlen(string));
+}
+
+static void compute_digest(const GeneratorOptions *self, const char *kind,
+                           size_t number, Digest *out_digest) {
+  // Identifiers are derived from their kind, their number and the seed, so
+  // that generating the same store twice yields the same identifiers.
+  char source[128];
+  int source_size = snprintf(source, sizeof(source), "gimli-%s %lu %zu", kind,
+                             self->seed, number);
+
+  Sha256 sha256;
+  sha256_init(&sha256);
+  sha256_update(&sha256, source, (size_t)source_size);
+  sha256_final(&sha256, out_digest->bytes);
+}
+
+static size_t get_layer_number(const GeneratorOptions *self,
+                               size_t image_index, size_t layer_index) {
+  // Shared layers are numbered first, and each image's own layers follow.
+  if (layer_index < self->shared_layers_size) {
+    return layer_index;
+  }
+
+  size_t own_layers_size = self->layers_per_image - self->shared_layers_size;
+
+  return self->shared_layers_size + (image_index * own_layers_size) +
+         (layer_index - self->shared_layers_size);
+}
+
+static int populate_root_fs(const GeneratorOptions *self,
+                            const char *diff_directory) {
+  char path[PATH_MAX];
+
+  for (size_t directory_index = 0;
+       directory_index <
+       (sizeof(ROOT_FS_DIRECTORIES) / sizeof(ROOT_FS_DIRECTORIES[0]));
+       ++directory_index) {
+    format_path(path, "%s/%s", diff_directory,
+                ROOT_FS_DIRECTORIES[directory_index]);
+    if (0 != make_directory(path)) {
+      return 1;
+    }
+  }
+
+  if (NULL == self->payload) {
+    return 0;
+  }
+
+  // The payload is hard linked from the copy at the root of the store, so
+  // that large stores do not hold a copy of it per image.
+  char payload_path[PATH_MAX];
+  format_path(payload_path, "%s/payload", self->root);
+  format_path(path, "%s/bin/payload", diff_directory);
+
+  if (0 != link(payload_path, path)) {
+    return 1;
+  }
+
+  return 0;
+}
+
+static int create_layer(const GeneratorOptions *self, size_t layer_number,
+                        const char *chain_id, const char *diff_id,
+                        int is_bottom_layer) {
+  char path[PATH_MAX];
+
+  // Derive the layer's cache ID and link name.
+  Digest cache_digest;
+  compute_digest(self, "cache", layer_number, &cache_digest);
+
+  char cache_id[SHA256_HEX_DIGEST_SIZE + 1];
+  sha256_to_hex(cache_digest.bytes, cache_id);
+
+  char link_name[LINK_NAME_SIZE + 1];
+  for (size_t character_index = 0; character_index < LINK_NAME_SIZE;
+       ++character_index) {
+    link_name[character_index] =
+        (char)('A' + (cache_digest.bytes[character_index] % 26));
+  }
+
+  link_name[LINK_NAME_SIZE] = '\0';
+
+  // Create the layer store entry, which is named after the chain ID without
+  // its digest algorithm prefix.
+  const char *chain_id_hex = chain_id + strlen(SHA256_DIGEST_PREFIX);
+
+  format_path(path, "%s/image/overlay2/layerdb/sha256/%s", self->root,
+              chain_id_hex);
+  if (0 != make_directory(path)) {
+    return 1;
+  }
+
+  format_path(path, "%s/image/overlay2/layerdb/sha256/%s/diff", self->root,
+              chain_id_hex);
+  if (0 != write_string_file(path, diff_id)) {
+    return 1;
+  }
+
+  format_path(path, "%s/image/overlay2/layerdb/sha256/%s/cache-id", self->root,
+              chain_id_hex);
+  if (0 != write_string_file(path, cache_id)) {
+    return 1;
+  }
+
+  // Create the layer's overlay directory and its link.
+  format_path(path, "%s/overlay2/%s", self->root, cache_id);
+  if (0 != make_directory(path)) {
+    return 1;
+  }
+
+  char diff_directory[PATH_MAX];
+  format_path(diff_directory, "%s/overlay2/%s/diff", self->root, cache_id);
+  if (0 != make_directory(diff_directory)) {
+    return 1;
+  }
+
+  format_path(path, "%s/overlay2/%s/link", self->root, cache_id);
+  if (0 != write_string_file(path, link_name)) {
+    return 1;
+  }
+
+  char link_target[PATH_MAX];
+  format_path(link_target, "../%s/diff", cache_id);
+  format_path(path, "%s/overlay2/l/%s", self->root, link_name);
+  if (0 != symlink(link_target, path)) {
+    return 1;
+  }
+
+  if (is_bottom_layer) {
+    return populate_root_fs(self, diff_directory);
+  }
+
+  return 0;
+}
+
+static char *format_image_config(const GeneratorOptions *self,
+                                 char (*diff_ids)[DIGEST_STRING_SIZE]) {
+  json_t *config = json_pack("{s:s, s:s, s:{s:[s]}, s:{s:s}}", "architecture",
+                             "amd64", "os", "linux", "config", "Cmd",
+                             "/bin/payload", "rootfs", "type", "layers");
+  if (NULL == config) {
+    return NULL;
+  }
+
+  json_t *diff_ids_json = json_array();
+  for (size_t layer_index = 0; layer_index < self->layers_per_image;
+       ++layer_index) {
+    json_array_append_new(diff_ids_json, json_string(diff_ids[layer_index]));
+  }
+
+  json_object_set_new(json_object_get(config, "rootfs"), "diff_ids",
+                      diff_ids_json);
+
+  char *config_string = json_dumps(config, JSON_COMPACT | JSON_SORT_KEYS);
+  json_decref(config);
+
+  return config_string;
+}
+
+static int create_image(const GeneratorOptions *self, size_t image_index,
+                        char out_image_id[DIGEST_STRING_SIZE]) {
+  int ret = 1;
+
+  char(*diff_ids)[DIGEST_STRING_SIZE] =
+      malloc(self->layers_per_image * sizeof(*diff_ids));
+  if (NULL == diff_ids) {
+    goto out;
+  }
+
+  // Create the image's layers, from the bottom-most layer up.
+  char chain_id[DIGEST_STRING_SIZE];
+  char parent_chain_id[DIGEST_STRING_SIZE];
+
+  for (size_t layer_index = 0; layer_index < self->layers_per_image;
+       ++layer_index) {
+    size_t layer_number = get_layer_number(self, image_index, layer_index);
+
+    Digest diff_digest;
+    compute_digest(self, "layer", layer_number, &diff_digest);
+    digest_format(&diff_digest, diff_ids[layer_index]);
+
+    layer_compute_chain_id((0 == layer_index) ? NULL : parent_chain_id,
+                           diff_ids[layer_index], chain_id);
+    memcpy(parent_chain_id, chain_id, sizeof(parent_chain_id));
+
+    // Shared layers are only created along with the first image.
+    int is_shared_layer = layer_index < self->shared_layers_size;
+    if ((is_shared_layer) && (0 != image_index)) {
+      continue;
+    }
+
+    if (0 != create_layer(self, layer_number, chain_id, diff_ids[layer_index],
+                          0 == layer_index)) {
+      goto out_free_diff_ids;
+    }
+  }
+
+  // Create the image's metadata file, which is named after its digest.
+  char *config = format_image_config(self, diff_ids);
+  if (NULL == config) {
+    goto out_free_diff_ids;
+  }
+
+  size_t config_size = strlen(config);
+
+  Sha256 sha256;
+  sha256_init(&sha256);
+  sha256_update(&sha256, config, config_size);
+
+  Digest image_digest;
+  sha256_final(&sha256, image_digest.bytes);
+  digest_format(&image_digest, out_image_id);
+
+  char path[PATH_MAX];
+  format_path(path, "%s/image/overlay2/imagedb/content/sha256/%s", self->root,
+              out_image_id + strlen(SHA256_DIGEST_PREFIX));
+  if (0 != io_write_file_atomically(path, config, config_size)) {
+    goto out_free_config;
+  }
+
+  ret = 0;
+
+out_free_config:
+  free(config);
+
+out_free_diff_ids:
+  free(diff_ids);
+
+out:
+  return ret;
+}
+
+static int write_repositories(const GeneratorOptions *self,
+                              char (*image_ids)[DIGEST_STRING_SIZE]) {
+  int ret = 1;
+
+  // Tag the images in a round robin, as "repository<n>:latest".
+  json_t *repositories = json_object();
+  for (size_t repository_index = 0;
+       repository_index < self->repositories_size; ++repository_index) {
+    char name[64];
+    snprintf(name, sizeof(name), "repository%zu", repository_index);
+
+    char reference[80];
+    snprintf(reference, sizeof(reference), "%s:latest", name);
+
+    json_object_set_new(
+        repositories, name,
+        json_pack("{s:s}", reference,
+                  image_ids[repository_index % self->images_size]));
+  }
+
+  json_t *root = json_pack("{s:o}", "Repositories", repositories);
+  if (NULL == root) {
+    goto out;
+  }
+
+  char *data = json_dumps(root, JSON_COMPACT);
+  if (NULL == data) {
+    goto out_decref_root;
+  }
+
+  char path[PATH_MAX];
+  format_path(path, "%s/image/overlay2/repositories.json", self->root);
+  if (0 != write_string_file(path, data)) {
+    goto out_free_data;
+  }
+
+  ret = 0;
+
+out_free_data:
+  free(data);
+
+out_decref_root:
+  json_decref(root);
+
+out:
+  return ret;
+}
+
+static int create_store_directories(const GeneratorOptions *self) {
+  static const char *const DIRECTORIES[] = {
+      "/container",
+      "/image",
+      "/image/overlay2",
+      "/image/overlay2/imagedb",
+      "/image/overlay2/imagedb/content",
+      "/image/overlay2/imagedb/content/sha256",
+      "/image/overlay2/layerdb",
+      "/image/overlay2/layerdb/sha256",
+      "/overlay2",
+      "/overlay2/l",
+  };
+
+  // The root must not exist, so that a store is never generated on top of
+  // another one.
+  char path[PATH_MAX];
+  format_path(path, "%s", self->root);
+  if (0 != mkdir(path, 0755)) {
+    return 1;
+  }
+
+  for (size_t directory_index = 0;
+       directory_index < (sizeof(DIRECTORIES) / sizeof(DIRECTORIES[0]));
+       ++directory_index) {
+    format_path(path, "%s%s", self->root, DIRECTORIES[directory_index]);
+    if (0 != mkdir(path, 0755)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int install_payload(const GeneratorOptions *self) {
+  int ret = 1;
+
+  void *payload;
+  size_t payload_size;
+  if (0 != io_map_file(self->payload, &payload, &payload_size)) {
+    goto out;
+  }
+
+  char path[PATH_MAX];
+  format_path(path, "%s/payload", self->root);
+  if (0 != io_write_file_atomically(path, payload, payload_size)) {
+    goto out_unmap_payload;
+  }
+
+  if (0 != chmod(path, 0755)) {
+    goto out_unmap_payload;
+  }
+
+  ret = 0;
+
+out_unmap_payload:
+  io_unmap_file(payload, payload_size);
+
+out:
+  return ret;
+}
+
+int main(int argc, char *argv[]) {
+  int ret = 1;
+
+  GeneratorOptions options;
+  if (0 != parse_options(&options, argc, argv)) {
+    print_usage(argv[0]);
+    goto out;
+  }
+
+  printf("=> creating store directories... ");
+
+  if (0 != create_store_directories(&options)) {
+    printf("failed, error(%d): [%s]\n", errno, strerror(errno));
+    goto out;
+  }
+
+  printf("done\n");
+
+  if (NULL != options.payload) {
+    printf("=> installing payload... ");
+
+    if (0 != install_payload(&options)) {
+      printf("failed, error(%d): [%s]\n", errno, strerror(errno));
+      goto out;
+    }
+
+    printf("done\n");
+  }
+
+  printf("=> generating %zu images... ", options.images_size);
+
+  char(*image_ids)[DIGEST_STRING_SIZE] =
+      malloc(options.images_size * sizeof(*image_ids));
+  if (NULL == image_ids) {
+    printf("failed, error(%d): [%s]\n", errno, strerror(errno));
+    goto out;
+  }
+
+  for (size_t image_index = 0; image_index < options.images_size;
+       ++image_index) {
+    if (0 != create_image(&options, image_index, image_ids[image_index])) {
+      printf("failed, error(%d): [%s]\n", errno, strerror(errno));
+      goto out_free_image_ids;
+    }
+  }
+
+  printf("done\n");
+
+  printf("=> writing %zu repositories... ", options.repositories_size);
+
+  if (0 != write_repositories(&options, image_ids)) {
+    printf("failed, error(%d): [%s]\n", errno, strerror(errno));
+    goto out_free_image_ids;
+  }
+
+  printf("done\n");
+
+  size_t layers_size =
+      options.shared_layers_size +
+      (options.images_size *
+       (options.layers_per_image - options.shared_layers_size));
+  printf("=> generated %zu images with %zu layers under [%s]\n",
+         options.images_size, layers_size, options.root);
+
+  ret = 0;
+
+out_free_image_ids:
+  free(image_ids);
+
+out:
+  return ret;
+}